@@ -0,0 +1,197 @@
+/*
+ * Shared helpers of the benchmark programs in this directory.
+ *
+ * Every benchmark prints CSV to stdout, one measurement per row, with the same columns:
+ *
+ *     bench,sched,backend,threads,producers,queue_max,metric,value
+ *
+ * so runs with different queue backends or scheduling modes can be concatenated and compared.
+ * Progress messages go to stderr. Common options:
+ *
+ *     --sched=shared|stealing     scheduling mode, default shared
+ *     --backend=list|ring         shared queue backend, default list
+ *     --threads=1,2,4             worker thread counts to sweep
+ *     --producers=1,2,4           producer thread counts to sweep
+ *     --queue-max=N[,N...]        work_num_max values to sweep, 0 for unbounded
+ *     --jobs=N                    jobs per measurement
+ *     --no-header                 do not print the CSV header
+ *
+ * 基准程序的公共部分。所有基准都以相同的列向标准输出写入CSV，每行一个测量值，
+ * 不同队列后端与调度模式的结果可以直接拼接比较。进度信息写入标准错误。
+ */
+
+#ifndef THPOOL_BENCH_COMMON_H
+#define THPOOL_BENCH_COMMON_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "threadpool.h"
+#include "utils/log.h"
+
+#define BENCH_MAX_SWEEP 16
+
+typedef struct bench_opts {
+    threadpool_sched_mode       sched_mode;
+    threadpool_queue_backend    queue_backend;
+    int     threads[BENCH_MAX_SWEEP];
+    int     num_threads;
+    int     producers[BENCH_MAX_SWEEP];
+    int     num_producers;
+    int     queue_max[BENCH_MAX_SWEEP];
+    int     num_queue_max;
+    long    jobs;
+    bool    header;
+} bench_opts;
+
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* 解析逗号分隔的整数列表，返回解析出的个数。    */
+static inline int bench_parse_list(const char *s, int *out)
+{
+    int n = 0;
+    while (*s != '\0' && n < BENCH_MAX_SWEEP) {
+        char *end;
+        long v = strtol(s, &end, 10);
+        if (end == s || v < 0) {
+            fprintf(stderr, "bad number list: %s\n", s);
+            exit(2);
+        }
+        out[n++] = (int)v;
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return n;
+}
+
+static inline bool bench_opt_value(const char *arg, const char *name, const char **value_out)
+{
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) == 0 && arg[len] == '=') {
+        *value_out = arg + len + 1;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * 解析公共选项。调用前由各基准在opts中填好默认值。
+ * 环形缓冲区后端要求有界队列，未给出上限时使用4096，否则线程池会退回链表后端，结果将被误标。
+ */
+static inline void bench_parse_args(int argc, char **argv, bench_opts *opts)
+{
+    opts->header = true;
+    for (int i = 1; i < argc; i++) {
+        const char *v;
+        if (bench_opt_value(argv[i], "--sched", &v)) {
+            if (strcmp(v, "shared") == 0) {
+                opts->sched_mode = THPOOL_SCHED_SHARED_QUEUE;
+            } else if (strcmp(v, "stealing") == 0) {
+                opts->sched_mode = THPOOL_SCHED_WORK_STEALING;
+            } else {
+                fprintf(stderr, "unknown sched mode: %s\n", v);
+                exit(2);
+            }
+        } else if (bench_opt_value(argv[i], "--backend", &v)) {
+            if (strcmp(v, "list") == 0) {
+                opts->queue_backend = THPOOL_QUEUE_LINKED_LIST;
+            } else if (strcmp(v, "ring") == 0) {
+                opts->queue_backend = THPOOL_QUEUE_RING;
+            } else {
+                fprintf(stderr, "unknown queue backend: %s\n", v);
+                exit(2);
+            }
+        } else if (bench_opt_value(argv[i], "--threads", &v)) {
+            opts->num_threads = bench_parse_list(v, opts->threads);
+        } else if (bench_opt_value(argv[i], "--producers", &v)) {
+            opts->num_producers = bench_parse_list(v, opts->producers);
+        } else if (bench_opt_value(argv[i], "--queue-max", &v)) {
+            opts->num_queue_max = bench_parse_list(v, opts->queue_max);
+        } else if (bench_opt_value(argv[i], "--jobs", &v)) {
+            opts->jobs = strtol(v, NULL, 10);
+        } else if (strcmp(argv[i], "--no-header") == 0) {
+            opts->header = false;
+        } else {
+            fprintf(stderr, "unknown option: %s\n", argv[i]);
+            exit(2);
+        }
+    }
+    if (opts->num_threads == 0 || opts->num_producers == 0 || opts->num_queue_max == 0 || opts->jobs <= 0) {
+        fprintf(stderr, "empty sweep\n");
+        exit(2);
+    }
+    if (opts->queue_backend == THPOOL_QUEUE_RING) {
+        for (int i = 0; i < opts->num_queue_max; i++) {
+            if (opts->queue_max[i] == 0) {
+                opts->queue_max[i] = 4096;
+            }
+        }
+    }
+    /* 调试日志会主导测量结果。  */
+    log_set_level(LOG_ERROR);
+    if (opts->header) {
+        printf("bench,sched,backend,threads,producers,queue_max,metric,value\n");
+    }
+}
+
+static inline threadpool bench_pool_init(const bench_opts *opts, int num_threads, int queue_max)
+{
+    threadpool_config conf = {
+        .thread_name_prefix = "bench",
+        .num_threads = num_threads,
+        .work_num_max = queue_max,
+        .sched_mode = opts->sched_mode,
+        .queue_backend = opts->queue_backend,
+    };
+    threadpool pool = thpool_init(&conf);
+    if (pool == NULL) {
+        perror("thpool_init");
+        exit(1);
+    }
+    return pool;
+}
+
+static inline void bench_pool_destroy(threadpool pool)
+{
+    thpool_shutdown(pool);
+    thpool_destroy(pool);
+}
+
+static inline void bench_row(const char *bench, const bench_opts *opts, int threads, int producers, int queue_max,
+                             const char *metric, double value)
+{
+    printf("%s,%s,%s,%d,%d,%d,%s,%.3f\n", bench,
+           opts->sched_mode == THPOOL_SCHED_WORK_STEALING ? "stealing" : "shared",
+           opts->queue_backend == THPOOL_QUEUE_RING ? "ring" : "list",
+           threads, producers, queue_max, metric, value);
+    fflush(stdout);
+}
+
+static int bench_cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* 对样本排序后取分位数，p取值0到1。    */
+static inline double bench_percentile(uint64_t *samples, size_t n, double p)
+{
+    size_t i = (size_t)(p * (double)(n - 1) + 0.5);
+    return (double)samples[i];
+}
+
+static inline void bench_sort(uint64_t *samples, size_t n)
+{
+    qsort(samples, n, sizeof(uint64_t), bench_cmp_u64);
+}
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * WHAT THIS BENCHMARK DOES
+ *
+ * Throughput of a bounded queue (`work_num_max`) under back-pressure. Producers submit
+ * short jobs faster than the workers run them, so they keep blocking on the full queue.
+ * Reports jobs per second and the share of producer time spent blocked, taken from
+ * `thpool_get_stats` with `stats_timing` enabled.
+ *
+ * 有界队列（`work_num_max`）在背压下的吞吐量，以及生产者阻塞时间占比。
+ * */
+
+#include "bench_common.h"
+
+typedef struct producer_arg {
+    threadpool  pool;
+    long        jobs;
+} producer_arg;
+
+static void short_job(void *arg, threadpool_thread _)
+{
+    /* 让任务比提交稍慢，队列才会保持满载。 */
+    volatile unsigned x = 0;
+    for (int i = 0; i < 200; i++) {
+        x += (unsigned)i;
+    }
+    (void)arg;
+}
+
+static void *producer(void *arg)
+{
+    producer_arg *p = arg;
+    for (long i = 0; i < p->jobs; i++) {
+        if (thpool_add_work(p->pool, short_job, NULL) != 0) {
+            perror("thpool_add_work");
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    bench_opts opts = {
+        .threads = {4}, .num_threads = 1,
+        .producers = {1, 4}, .num_producers = 2,
+        .queue_max = {1, 16, 256, 4096}, .num_queue_max = 4,
+        .jobs = 500000,
+    };
+    bench_parse_args(argc, argv, &opts);
+
+    for (int q = 0; q < opts.num_queue_max; q++) {
+        if (opts.queue_max[q] <= 0) {
+            fprintf(stderr, "backpressure: skipping unbounded queue\n");
+            continue;
+        }
+        for (int t = 0; t < opts.num_threads; t++) {
+            for (int p = 0; p < opts.num_producers; p++) {
+                int num_producers = opts.producers[p];
+                if (num_producers <= 0) {
+                    continue;
+                }
+                threadpool_config conf = {
+                    .thread_name_prefix = "bench",
+                    .num_threads = opts.threads[t],
+                    .work_num_max = opts.queue_max[q],
+                    .sched_mode = opts.sched_mode,
+                    .queue_backend = opts.queue_backend,
+                    .stats_timing = 1,
+                };
+                threadpool pool = thpool_init(&conf);
+                if (pool == NULL) {
+                    perror("thpool_init");
+                    return 1;
+                }
+                pthread_t threads[num_producers];
+                producer_arg arg = {.pool = pool, .jobs = opts.jobs / num_producers};
+
+                uint64_t start = bench_now_ns();
+                for (int i = 0; i < num_producers; i++) {
+                    pthread_create(&threads[i], NULL, producer, &arg);
+                }
+                for (int i = 0; i < num_producers; i++) {
+                    pthread_join(threads[i], NULL);
+                }
+                thpool_wait(pool);
+                uint64_t elapsed = bench_now_ns() - start;
+
+                threadpool_stats stats = {0};
+                thpool_get_stats(pool, &stats);
+                double jobs = (double)(arg.jobs * num_producers);
+                bench_row("backpressure", &opts, opts.threads[t], num_producers, opts.queue_max[q],
+                          "jobs_per_sec", jobs * 1e9 / (double)elapsed);
+                bench_row("backpressure", &opts, opts.threads[t], num_producers, opts.queue_max[q],
+                          "producer_blocked_ratio", (double)stats.producer_blocked_ns / ((double)elapsed * num_producers));
+                bench_row("backpressure", &opts, opts.threads[t], num_producers, opts.queue_max[q],
+                          "queue_len_peak", (double)stats.queue_len_peak);
+                bench_pool_destroy(pool);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * WHAT THIS BENCHMARK DOES
+ *
+ * Overhead of the debug-conc API against the plain API. The same producers submit the same
+ * empty jobs through `thpool_add_work` and through `thpool_add_work_debug_conc` with a passport,
+ * and the main thread also times a cheap query (`thpool_num_threads_working`) in both forms,
+ * which isolates the passport bookkeeping from queue costs.
+ * Must be built with THPOOL_ENABLE_DEBUG_CONC_API defined for the library and this file.
+ *
+ * 调试并发接口相对普通接口的开销。提交任务与廉价查询分别以两种形式计时，后者排除了队列本身的开销。
+ * */
+
+#include "bench_common.h"
+
+#ifndef THPOOL_ENABLE_DEBUG_CONC_API
+#error "thpool_bench_debug_conc requires THPOOL_ENABLE_DEBUG_CONC_API"
+#endif
+
+typedef struct producer_arg {
+    threadpool  pool;
+    thpool_debug_conc_passport  passport;   /* 为空时使用普通接口。   */
+    long        jobs;
+} producer_arg;
+
+static void empty_job(void *arg, threadpool_thread _)
+{
+    (void)arg;
+}
+
+static void *producer(void *arg)
+{
+    producer_arg *p = arg;
+    for (long i = 0; i < p->jobs; i++) {
+        int err = (p->passport != NULL) ? thpool_add_work_debug_conc(p->pool, p->passport, empty_job, NULL)
+                                        : thpool_add_work(p->pool, empty_job, NULL);
+        if (err != 0) {
+            perror("thpool_add_work");
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+static double time_submit(threadpool pool, thpool_debug_conc_passport passport, int num_producers, long jobs)
+{
+    pthread_t threads[num_producers];
+    producer_arg arg = {.pool = pool, .passport = passport, .jobs = jobs / num_producers};
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < num_producers; i++) {
+        pthread_create(&threads[i], NULL, producer, &arg);
+    }
+    for (int i = 0; i < num_producers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (passport != NULL) {
+        thpool_wait_debug_conc(pool, passport);
+        thpool_reactivate_debug_conc(pool, passport);
+    } else {
+        thpool_wait(pool);
+        thpool_reactivate(pool);
+    }
+    return (double)(bench_now_ns() - start) / (double)(arg.jobs * num_producers);
+}
+
+static double time_query(threadpool pool, thpool_debug_conc_passport passport, long calls)
+{
+    volatile int sink = 0;
+    uint64_t start = bench_now_ns();
+    for (long i = 0; i < calls; i++) {
+        sink += (passport != NULL) ? thpool_num_threads_working_debug_conc(pool, passport) : thpool_num_threads_working(pool);
+    }
+    (void)sink;
+    return (double)(bench_now_ns() - start) / (double)calls;
+}
+
+int main(int argc, char **argv)
+{
+    bench_opts opts = {
+        .threads = {4}, .num_threads = 1,
+        .producers = {1, 4}, .num_producers = 2,
+        .queue_max = {0}, .num_queue_max = 1,
+        .jobs = 1000000,
+    };
+    bench_parse_args(argc, argv, &opts);
+
+    for (int q = 0; q < opts.num_queue_max; q++) {
+        for (int t = 0; t < opts.num_threads; t++) {
+            thpool_debug_conc_passport passport = thpool_debug_conc_passport_init();
+            if (passport == NULL) {
+                perror("thpool_debug_conc_passport_init");
+                return 1;
+            }
+            threadpool_config conf = {
+                .thread_name_prefix = "bench",
+                .num_threads = opts.threads[t],
+                .work_num_max = opts.queue_max[q],
+                .sched_mode = opts.sched_mode,
+                .queue_backend = opts.queue_backend,
+                .passport = passport,
+            };
+            threadpool pool = thpool_init(&conf);
+            if (pool == NULL) {
+                perror("thpool_init");
+                return 1;
+            }
+            for (int p = 0; p < opts.num_producers; p++) {
+                int num_producers = opts.producers[p];
+                if (num_producers <= 0) {
+                    continue;
+                }
+                double plain = time_submit(pool, NULL, num_producers, opts.jobs);
+                double conc = time_submit(pool, passport, num_producers, opts.jobs);
+                bench_row("debug_conc", &opts, opts.threads[t], num_producers, opts.queue_max[q], "submit_ns_plain", plain);
+                bench_row("debug_conc", &opts, opts.threads[t], num_producers, opts.queue_max[q], "submit_ns_debug_conc", conc);
+                bench_row("debug_conc", &opts, opts.threads[t], num_producers, opts.queue_max[q], "submit_overhead_ratio", conc / plain);
+            }
+            double plain = time_query(pool, NULL, opts.jobs);
+            double conc = time_query(pool, passport, opts.jobs);
+            bench_row("debug_conc", &opts, opts.threads[t], 1, opts.queue_max[q], "query_ns_plain", plain);
+            bench_row("debug_conc", &opts, opts.threads[t], 1, opts.queue_max[q], "query_ns_debug_conc", conc);
+            thpool_shutdown_debug_conc(pool, passport);
+            thpool_destroy_debug_conc(pool, passport);
+            thpool_debug_conc_passport_destroy(passport);
+        }
+    }
+    return 0;
+}
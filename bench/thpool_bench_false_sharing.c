@@ -0,0 +1,93 @@
+/*
+ * WHAT THIS BENCHMARK DOES
+ *
+ * False-sharing check of the pool and thread struct layout. N producers submit empty jobs
+ * to N worker threads, so every job writes the slot counter, the queue and the worker's
+ * own busy flag while the other side reads its neighbours. Reports jobs per second.
+ *
+ * xmake builds this file twice: `thpool_bench_false_sharing` with the cache-line regions
+ * of `struct thpool` and `struct thread`, and `thpool_bench_false_sharing_packed` with
+ * `THPOOL_PACKED_LAYOUT`, where the regions sit next to each other. The bench column is
+ * `false_sharing_padded` or `false_sharing_packed`, so the two runs can be concatenated.
+ * The difference only shows with several cores; on a single core both layouts match.
+ *
+ *     --producers=0               as many producers as worker threads (default)
+ *
+ * 线程池与线程结构布局的伪共享检查。N个生产者向N个工作线程提交空任务，每个任务都写入名额计数、队列
+ * 与工作线程自身的busy标志，同时另一方读取相邻的成员。报告每秒任务数。
+ * xmake将本文件构建两次：按缓存行划分区域的`thpool_bench_false_sharing`，以及定义了`THPOOL_PACKED_LAYOUT`、
+ * 各区域紧挨排列的`thpool_bench_false_sharing_packed`。只有多核上才能看出差别，单核上两种布局结果一致。
+ * */
+
+#include "bench_common.h"
+
+#if defined(THPOOL_PACKED_LAYOUT)
+#define BENCH_NAME "false_sharing_packed"
+#else
+#define BENCH_NAME "false_sharing_padded"
+#endif
+
+typedef struct producer_arg {
+    threadpool  pool;
+    long        jobs;
+} producer_arg;
+
+static void empty_job(void *arg, threadpool_thread _)
+{
+    (void)arg;
+}
+
+static void *producer(void *arg)
+{
+    producer_arg *p = arg;
+    for (long i = 0; i < p->jobs; i++) {
+        if (thpool_add_work(p->pool, empty_job, NULL) != 0) {
+            perror("thpool_add_work");
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    bench_opts opts = {
+        .threads = {1, 2, 4, 8}, .num_threads = 4,
+        .producers = {0}, .num_producers = 1,
+        .queue_max = {0}, .num_queue_max = 1,
+        .jobs = 2000000,
+    };
+    bench_parse_args(argc, argv, &opts);
+
+    for (int q = 0; q < opts.num_queue_max; q++) {
+        for (int t = 0; t < opts.num_threads; t++) {
+            for (int p = 0; p < opts.num_producers; p++) {
+                int num_producers = (opts.producers[p] > 0) ? opts.producers[p] : opts.threads[t];
+                if (num_producers <= 0) {
+                    continue;
+                }
+                threadpool pool = bench_pool_init(&opts, opts.threads[t], opts.queue_max[q]);
+                pthread_t threads[num_producers];
+                producer_arg arg = {.pool = pool, .jobs = opts.jobs / num_producers};
+
+                uint64_t start = bench_now_ns();
+                for (int i = 0; i < num_producers; i++) {
+                    pthread_create(&threads[i], NULL, producer, &arg);
+                }
+                for (int i = 0; i < num_producers; i++) {
+                    pthread_join(threads[i], NULL);
+                }
+                thpool_wait(pool);
+                uint64_t elapsed = bench_now_ns() - start;
+
+                double jobs = (double)(arg.jobs * num_producers);
+                bench_row(BENCH_NAME, &opts, opts.threads[t], num_producers, opts.queue_max[q],
+                          "jobs_per_sec", jobs * 1e9 / (double)elapsed);
+                bench_row(BENCH_NAME, &opts, opts.threads[t], num_producers, opts.queue_max[q],
+                          "ns_per_job", (double)elapsed / jobs);
+                bench_pool_destroy(pool);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * WHAT THIS BENCHMARK DOES
+ *
+ * Submit-to-start latency percentiles. A single producer stamps each job with the time it
+ * is submitted, and the job records how long it took to start running. Two patterns are measured:
+ *
+ *   idle:  the producer waits until the previous job started, so every job wakes an idle worker.
+ *   burst: the producer submits all jobs back to back, so latency includes queueing.
+ *
+ * Reports p50, p90, p99, p99.9 and max in nanoseconds.
+ *
+ * 从提交到开始执行的延迟分位数。idle模式下每个任务都需要唤醒空闲线程，burst模式下延迟包含排队时间。
+ * */
+
+#include <sched.h>
+#include "bench_common.h"
+
+typedef struct latency_sample {
+    uint64_t    submit_ns;
+    uint64_t    latency_ns;
+} latency_sample;
+
+static atomic_long started;
+
+static void stamp_job(void *arg, threadpool_thread _)
+{
+    latency_sample *s = arg;
+    s->latency_ns = bench_now_ns() - s->submit_ns;
+    atomic_fetch_add_explicit(&started, 1, memory_order_release);
+}
+
+static void run_pattern(const bench_opts *opts, int num_threads, int queue_max, const char *pattern, long jobs)
+{
+    threadpool pool = bench_pool_init(opts, num_threads, queue_max);
+    latency_sample *samples = calloc((size_t)jobs, sizeof(latency_sample));
+    uint64_t *latencies = malloc((size_t)jobs * sizeof(uint64_t));
+    if (samples == NULL || latencies == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    bool idle = strcmp(pattern, "idle") == 0;
+    atomic_store(&started, 0);
+
+    for (long i = 0; i < jobs; i++) {
+        samples[i].submit_ns = bench_now_ns();
+        if (thpool_add_work(pool, stamp_job, &samples[i]) != 0) {
+            perror("thpool_add_work");
+            exit(1);
+        }
+        if (idle) {
+            /* 让出CPU，线程数多于CPU数时工作线程才能被调度。  */
+            while (atomic_load_explicit(&started, memory_order_acquire) <= i) {
+                sched_yield();
+            }
+        }
+    }
+    thpool_wait(pool);
+
+    for (long i = 0; i < jobs; i++) {
+        latencies[i] = samples[i].latency_ns;
+    }
+    bench_sort(latencies, (size_t)jobs);
+    char bench[32];
+    snprintf(bench, sizeof(bench), "latency_%s", pattern);
+    bench_row(bench, opts, num_threads, 1, queue_max, "p50_ns", bench_percentile(latencies, (size_t)jobs, 0.50));
+    bench_row(bench, opts, num_threads, 1, queue_max, "p90_ns", bench_percentile(latencies, (size_t)jobs, 0.90));
+    bench_row(bench, opts, num_threads, 1, queue_max, "p99_ns", bench_percentile(latencies, (size_t)jobs, 0.99));
+    bench_row(bench, opts, num_threads, 1, queue_max, "p999_ns", bench_percentile(latencies, (size_t)jobs, 0.999));
+    bench_row(bench, opts, num_threads, 1, queue_max, "max_ns", (double)latencies[jobs - 1]);
+
+    free(latencies);
+    free(samples);
+    bench_pool_destroy(pool);
+}
+
+int main(int argc, char **argv)
+{
+    bench_opts opts = {
+        .threads = {1, 4}, .num_threads = 2,
+        .producers = {1}, .num_producers = 1,
+        .queue_max = {0}, .num_queue_max = 1,
+        .jobs = 100000,
+    };
+    bench_parse_args(argc, argv, &opts);
+
+    for (int q = 0; q < opts.num_queue_max; q++) {
+        for (int t = 0; t < opts.num_threads; t++) {
+            run_pattern(&opts, opts.threads[t], opts.queue_max[q], "idle", opts.jobs);
+            run_pattern(&opts, opts.threads[t], opts.queue_max[q], "burst", opts.jobs);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * WHAT THIS BENCHMARK DOES
+ *
+ * Empty-job throughput against the number of worker threads and producer threads.
+ * For every combination, each producer submits its share of `--jobs` empty jobs and
+ * the main thread waits for the pool to drain. Reports jobs per second.
+ *
+ * 空任务吞吐量随工作线程数与生产者线程数的变化。
+ * */
+
+#include "bench_common.h"
+
+typedef struct producer_arg {
+    threadpool  pool;
+    long        jobs;
+} producer_arg;
+
+static void empty_job(void *arg, threadpool_thread _)
+{
+    (void)arg;
+}
+
+static void *producer(void *arg)
+{
+    producer_arg *p = arg;
+    for (long i = 0; i < p->jobs; i++) {
+        if (thpool_add_work(p->pool, empty_job, NULL) != 0) {
+            perror("thpool_add_work");
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    bench_opts opts = {
+        .threads = {1, 2, 4, 8}, .num_threads = 4,
+        .producers = {1, 2, 4}, .num_producers = 3,
+        .queue_max = {0}, .num_queue_max = 1,
+        .jobs = 1000000,
+    };
+    bench_parse_args(argc, argv, &opts);
+
+    for (int q = 0; q < opts.num_queue_max; q++) {
+        for (int t = 0; t < opts.num_threads; t++) {
+            for (int p = 0; p < opts.num_producers; p++) {
+                int num_producers = opts.producers[p];
+                if (num_producers <= 0) {
+                    continue;
+                }
+                threadpool pool = bench_pool_init(&opts, opts.threads[t], opts.queue_max[q]);
+                pthread_t threads[num_producers];
+                producer_arg arg = {.pool = pool, .jobs = opts.jobs / num_producers};
+
+                uint64_t start = bench_now_ns();
+                for (int i = 0; i < num_producers; i++) {
+                    pthread_create(&threads[i], NULL, producer, &arg);
+                }
+                for (int i = 0; i < num_producers; i++) {
+                    pthread_join(threads[i], NULL);
+                }
+                thpool_wait(pool);
+                uint64_t elapsed = bench_now_ns() - start;
+
+                double jobs = (double)(arg.jobs * num_producers);
+                bench_row("throughput", &opts, opts.threads[t], num_producers, opts.queue_max[q],
+                          "jobs_per_sec", jobs * 1e9 / (double)elapsed);
+                bench_row("throughput", &opts, opts.threads[t], num_producers, opts.queue_max[q],
+                          "ns_per_job", (double)elapsed / jobs);
+                bench_pool_destroy(pool);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * WHAT THIS BENCHMARK DOES
+ *
+ * Cost of one `thpool_wait`/`thpool_reactivate` cycle. Each cycle submits a small batch of
+ * empty jobs (none, one, or one per worker thread), waits for the pool to drain and reactivates it.
+ * `--jobs` is the number of cycles. Reports nanoseconds per cycle for each batch size.
+ *
+ * 一次`thpool_wait`/`thpool_reactivate`循环的开销，每次循环提交0个、1个或每线程1个空任务。
+ * */
+
+#include "bench_common.h"
+
+static void empty_job(void *arg, threadpool_thread _)
+{
+    (void)arg;
+}
+
+int main(int argc, char **argv)
+{
+    bench_opts opts = {
+        .threads = {1, 4}, .num_threads = 2,
+        .producers = {1}, .num_producers = 1,
+        .queue_max = {0}, .num_queue_max = 1,
+        .jobs = 20000,
+    };
+    bench_parse_args(argc, argv, &opts);
+
+    for (int q = 0; q < opts.num_queue_max; q++) {
+        for (int t = 0; t < opts.num_threads; t++) {
+            int batches[] = {0, 1, opts.threads[t]};
+            const char *metrics[] = {"ns_per_cycle_0_jobs", "ns_per_cycle_1_job", "ns_per_cycle_n_jobs"};
+            threadpool pool = bench_pool_init(&opts, opts.threads[t], opts.queue_max[q]);
+            for (int b = 0; b < 3; b++) {
+                uint64_t start = bench_now_ns();
+                for (long c = 0; c < opts.jobs; c++) {
+                    for (int i = 0; i < batches[b]; i++) {
+                        thpool_add_work(pool, empty_job, NULL);
+                    }
+                    thpool_wait(pool);
+                    thpool_reactivate(pool);
+                }
+                uint64_t elapsed = bench_now_ns() - start;
+                bench_row("wait_cycle", &opts, opts.threads[t], 1, opts.queue_max[q],
+                          metrics[b], (double)elapsed / (double)opts.jobs);
+            }
+            bench_pool_destroy(pool);
+        }
+    }
+    return 0;
+}
@@ -12,7 +12,7 @@
  * Extended and reduced features based on personal project requirements.
  * Added features:
  * 1. Global variables are encapsulated within a struct, allowing multiple thread pools to exist simultaneously.
- * 2. Added callbacks for thread start/end, and pre-task/post-task routines (though not fully implemented in this version's job execution loop).
+ * 2. Added callbacks for thread start/end, and pre-task/post-task routines (`pre_job_cb`, `post_job_cb`).
  * Allows tasks and threads to share metadata via a thread context slot, useful for scenarios like database connection reuse.
  * 3. Enhanced configuration, including a maximum job queue size and waiting/notification mechanisms when the queue is full to prevent excessive memory usage.
  * 4. Integrated with `rxi/log.c` library for logging.
@@ -35,13 +35,24 @@
  */
 
 #define _POSIX_C_SOURCE 200809L
+/**
+ * Linux下的CPU亲和性与NUMA内存绑定使用`syscall`直接调用，`syscall`与`MAP_ANONYMOUS`需要_DEFAULT_SOURCE。
+ * 这样仍然不必引入_GNU_SOURCE及其`cpu_set_t`系列宏。
+ */
+#if defined(__linux__)
+#define _DEFAULT_SOURCE
+#endif
 #include <stdlib.h>
+#include <stdio.h>
 #include <time.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <string.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <errno.h>
+#include <limits.h>
 
 /* Use `nullptr` for backward portability.  */
 #if !defined(nullptr) && (!defined(__STDC_VERSION__) || __STDC_VERSION__ <= 201710)
@@ -56,6 +67,25 @@
 #if defined(__linux__)
 #include <sys/prctl.h>
 #endif
+
+/* 下面的头文件仅用于Linux下的CPU亲和性与NUMA节点内存分配。    */
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#endif
+
+/* 完成句柄在Linux下使用futex休眠与唤醒。 */
+#if defined(__linux__)
+#include <linux/futex.h>
+#endif
+
+/* 协程任务使用glibc的ucontext切换栈，以epoll等待文件描述符，仅支持Linux下的glibc。    */
+#if defined(__linux__) && defined(__GLIBC__)
+#define THPOOL_HAS_FIBERS 1
+#include <ucontext.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 #if defined(__FreeBSD__) || defined(__OpenBSD__)
 #include <pthread_np.h>
 #endif
@@ -63,6 +93,11 @@
 #include "threadpool_log_config.h"
 #include "threadpool.h"
 
+/* 日志后端可选的刷新接口，`thpool_shutdown`在所有线程退出后调用。未提供时为空操作。  */
+#ifndef thpool_log_flush
+#define thpool_log_flush() ((void)0)
+#endif
+
 #if defined(__GNUC__) || defined(__clang__)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 #define likely(x) __builtin_expect(!!(x), 1)
@@ -71,6 +106,39 @@
 #define likely(x) (x)
 #endif
 
+/**
+ * USDT静态探针，供perf、bpftrace等在不重新编译的情况下挂载到运行中的线程池，provider为threadpool。
+ * 定义THPOOL_ENABLE_USDT时使用<sys/sdt.h>（systemtap的sdt头文件），每个探针是一条nop并登记在ELF的.note.stapsdt段中，
+ * 未挂载时只有准备参数的开销，因此参数只取已在手边的值或relaxed读取。未定义时展开为空语句，不求值参数。
+ * 例如统计排队深度：`bpftrace -e 'usdt:./prog:threadpool:job_enqueue { @depth = hist(arg2); }'`。
+ */
+#ifdef THPOOL_ENABLE_USDT
+#include <sys/sdt.h>
+#define THPOOL_PROBE1(name, a)          DTRACE_PROBE1(threadpool, name, a)
+#define THPOOL_PROBE2(name, a, b)       DTRACE_PROBE2(threadpool, name, a, b)
+#define THPOOL_PROBE3(name, a, b, c)    DTRACE_PROBE3(threadpool, name, a, b, c)
+#else
+#define THPOOL_PROBE1(name, a)          ((void)0)
+#define THPOOL_PROBE2(name, a, b)       ((void)0)
+#define THPOOL_PROBE3(name, a, b, c)    ((void)0)
+#endif
+
+/* 用于对齐频繁修改的共享数据，避免伪共享。 */
+#define THPOOL_CACHE_LINE_SIZE  64
+
+/**
+ * `struct thpool`与`struct thread`中各区域的起始成员以此对齐，使不同访问方写入的成员分属不同的缓存行。
+ * 定义THPOOL_PACKED_LAYOUT时各区域紧挨排列，仅供`bench/thpool_bench_false_sharing.c`与按缓存行划分的布局对比。
+ */
+#if defined(THPOOL_PACKED_LAYOUT)
+#define THPOOL_REGION_ALIGN
+#else
+#define THPOOL_REGION_ALIGN     _Alignas(THPOOL_CACHE_LINE_SIZE)
+#endif
+
+/* 自旋空闲策略在未指定`idle_spin_ns`时使用的自旋时长。   */
+#define THPOOL_DEFAULT_IDLE_SPIN_NS 50000L
+
 /* ========================== STRUCTURES ============================ */
 
 /**
@@ -143,14 +211,23 @@ static inline const char *thpool_state_to_string(enum thpool_state state)
  * 
  * 用户管理时叫做debug concurrency passport，并发通行证，用户并发使用debug conc API时出示。
  * 如果thpool已过生存期，这些API将执行失败，但只要用户管理的passport未过生存期，不会发生uaf。
+ *
+ * 使用计数按线程分片，每个分片独占一个缓存行。每次api调用只修改本线程分片的计数并读取state，
+ * 多个生产者并发调用时，不再争抢同一个缓存行；state只在生命周期切换时写入，平时在各核缓存中共享只读。
  */
+#define THPOOL_PASSPORT_SHARDS  32
+
+typedef struct conc_use_shard {
+    _Alignas(THPOOL_CACHE_LINE_SIZE) atomic_int num_api_use;   /* API calls currently using the passport on this shard. */
+} conc_use_shard;
+
 typedef struct conc_state_block {
 #ifdef THPOOL_ENABLE_DEBUG_CONC_API // Members included only if debug API is enabled
     struct thpool *bind_pool;  /* Pointer to the thread pool this passport is bound to, used for validation. 用于校验。    */
     char name_copy[7];  /* Copy of the thread pool name prefix, primarily for logging in debug messages. 仅仅用于打印错误日志。 */
 #endif
-    atomic_int  num_api_use;    /* Atomic counter for the number of API calls currently using this passport.    */
     _Atomic enum thpool_state state;    /* Atomic state of the thread pool lifecycle.   */
+    conc_use_shard  use[THPOOL_PASSPORT_SHARDS];    /* Sharded counters of API calls currently using this passport.    */
 } conc_state_block;
 
 /* 根据是否启用了调试并发API，决定日志是否包含相关信息。    */
@@ -164,7 +241,15 @@ typedef struct conc_state_block {
 
 /* Job */
 typedef struct job {
-    struct job *prev;                               /* pointer to previous job      */
+    /**
+     * 作为`thpool_submit`的完成句柄或`thpool_group_add_work`的载体时，节点既不在队列中也不在空闲链表中，
+     * prev的位置保存所属线程池或任务组。
+     */
+    union {
+        struct job *prev;                           /* pointer to previous job      */
+        struct thpool *owner;                       /* 完成句柄所属的线程池。 */
+        struct thpool_group *group;                 /* 任务组载体所属的任务组。 */
+    };
     /**
      * @brief Task function pointer.
      *
@@ -180,13 +265,160 @@ typedef struct job {
      */
     void (*function)(void *arg, threadpool_thread); /* function pointer    */
     void *arg;                                      /* function's argument          */
+    /**
+     * 完成句柄本身不入队，入队的是以它为参数的`thpool_handle_run`任务，因此句柄不需要入队时刻，
+     * 该位置保存句柄的状态与引用计数。
+     */
+    union {
+        uint64_t enqueue_ns;                        /* 入队时刻，仅在开启`stats_timing`或设置了任务钩子时记录。  */
+        struct {
+            atomic_uint state;                      /* 完成状态，参见`thpool_handle_state`。   */
+            atomic_uint refs;                       /* 用户与待执行任务各持有一个引用。    */
+        } handle;
+    };
 } job;
 
+/**
+ * @brief Bits of enqueue_ns that record the drain epoch and counter stripe of a queued job, see `thpool_drain`.
+ *
+ * 单调时钟的纳秒数用不到最高的4位（2^60纳秒约36年），因此enqueue_ns的最高位记录任务入队时的排空纪元，
+ * 其下3位记录入队时计数的条带，读取入队时刻时须屏蔽这些位。
+ */
+#define THPOOL_DRAIN_TAG            (1ull << 63)
+#define THPOOL_DRAIN_STRIPES        8
+#define THPOOL_DRAIN_STRIPE_SHIFT   60
+#define THPOOL_DRAIN_BITS           (THPOOL_DRAIN_TAG | ((uint64_t)(THPOOL_DRAIN_STRIPES - 1) << THPOOL_DRAIN_STRIPE_SHIFT))
+#define THPOOL_DRAIN_COUNT_MASK     0x7fffffffull
+
+/**
+ * 一个条带的排空计数，独占一个缓存行。最高位为当前的排空纪元，低31位与32至62位分别为纪元0与纪元1中
+ * 经本条带入队、尚未完成的任务数。
+ */
+typedef struct thpool_drain_stripe {
+    THPOOL_REGION_ALIGN atomic_ullong word;
+} thpool_drain_stripe;
+
+/**
+ * @brief Number of job nodes carved from one slab.
+ *
+ * 任务分配器每次向系统申请的任务节点数量。
+ */
+#define THPOOL_JOB_SLAB_SIZE    256
+
+/**
+ * @brief Maximum number of free job nodes cached by each worker thread.
+ *
+ * 每个工作线程本地缓存的空闲任务节点上限，超出部分归还到任务分配器的无锁归还栈中。
+ */
+#define THPOOL_JOB_CACHE_SIZE   32
+
+/* 一块连续分配的任务节点，所有slab串成链表，在线程池销毁时统一释放。   */
+typedef struct jobslab {
+    struct jobslab  *next;
+    job             nodes[];
+} jobslab;
+
+/**
+ * @brief Pool-owned allocator of job nodes.
+ *
+ * 线程池持有的任务节点分配器，替代每个任务一次的`malloc`与`free`。节点一经分配便在线程池内循环使用，
+ * 直到`thpool_destroy`才归还系统，因此num_nodes即为节点数量的历史峰值。
+ * 生产者在jobqueue_rwmutex内从free_list取节点；工作线程执行完任务后，把节点放入自身缓存，
+ * 缓存已满时以CAS压入returned归还栈。生产者取空free_list时，以原子交换一次取走整个归还栈。
+ * 归还栈只有压入与整体取走两种操作，不存在ABA问题。
+ */
+typedef struct jobpool {
+    _Atomic(job *)  returned;               /* lock-free stack of nodes freed by workers    */
+    job         *free_list;                 /* protected by jobqueue_rwmutex                */
+    jobslab     *slabs;                     /* protected by jobqueue_rwmutex                */
+    atomic_int  num_nodes;                  /* nodes carved from slabs so far, i.e. the high-water mark */
+    atomic_int  num_detached;               /* 作为完成句柄或任务组载体、不在队列中的节点数，不受max_nodes约束。 */
+    /**
+     * 节点数量上限，0表示无上限。有上限时，排队中的节点不超过`work_num_max`，执行中的节点每个线程至多一个，
+     * 缓存中的节点每个线程至多THPOOL_JOB_CACHE_SIZE个，因此该上限加上num_detached足以满足所有分配。
+     */
+    int         max_nodes;
+} jobpool;
+
+/**
+ * @brief Cell of the lock-free ring buffer, padded to a cache line.
+ *
+ * 环形缓冲区的槽位，直接保存任务函数与参数，并填充到一个缓存行，避免相邻槽位的生产者与消费者伪共享。
+ * seq为Vyukov算法的序号：seq == pos时槽位空闲可写入，seq == pos + 1时槽位已写入可读取。
+ */
+typedef struct jobring_cell {
+    _Alignas(THPOOL_CACHE_LINE_SIZE) atomic_size_t seq;
+    void (*function)(void *arg, threadpool_thread);
+    void *arg;
+    uint64_t enqueue_ns;
+} jobring_cell;
+
+/**
+ * @brief Preallocated bounded MPMC ring buffer (Vyukov style).
+ *
+ * 预分配的有界多生产者多消费者环形缓冲区，用作有上限线程池的无锁任务队列后端。
+ * 入队位置与出队位置分别位于不同的缓存行。
+ */
+typedef struct jobring {
+    _Alignas(THPOOL_CACHE_LINE_SIZE) atomic_size_t enqueue_pos;
+    _Alignas(THPOOL_CACHE_LINE_SIZE) atomic_size_t dequeue_pos;
+    _Alignas(THPOOL_CACHE_LINE_SIZE) size_t mask;   /* capacity - 1, capacity is a power of two */
+    jobring_cell    *cells;
+} jobring;
+
+/**
+ * @brief Arity of the deadline heap.
+ *
+ * 截止时间堆的叉数。4叉堆比二叉堆浅一半，下沉时比较的4个子节点位于相邻的缓存行内。
+ */
+#define THPOOL_DEADLINE_HEAP_ARITY  4
+
+/* 截止时间堆的元素。截止时间与过期回调保存在堆数组中，比较时不必访问任务节点。  */
+typedef struct jobheap_entry {
+    uint64_t    deadline_ns;
+    void        (*on_expire)(void *arg, threadpool_thread);
+    job         *job_p;
+} jobheap_entry;
+
 /* 将锁结构移出jobqueue，jobqueue结构体仅仅关心自己内部的任务，不关心与外部的同步。 */
 /* Job queue */
 typedef struct jobqueue {
-    job     *front;                         /* pointer to front of queue    */
-    job     *rear;                          /* pointer to rear  of queue    */
+    /**
+     * @brief Backend of this queue.
+     * 链表后端使用front/rear/len，受jobqueue_rwmutex保护；环形缓冲区后端使用ring，无需加锁。
+     */
+    threadpool_queue_backend backend;
+    jobring *ring;                          /* ring buffer, only for THPOOL_QUEUE_RING  */
+    /**
+     * @brief Per-priority sub-queues of the linked list backend.
+     * 每个优先级一条子链表，level_mask的第i位表示第i级非空，出队时取最低的置位即最高优先级，为O(1)操作。
+     */
+    job     *front[THPOOL_PRIO_LEVELS];     /* pointer to front of each level   */
+    job     *rear[THPOOL_PRIO_LEVELS];      /* pointer to rear  of each level   */
+    int     level_len[THPOOL_PRIO_LEVELS];  /* number of jobs in each level     */
+    unsigned    level_mask;                 /* bit i set if level i is not empty */
+    int     level_max[THPOOL_PRIO_LEVELS];  /* per-level limit, 0 means only the pool-wide limit applies */
+    bool    level_limited;                  /* true if any level has its own limit   */
+    /**
+     * 老化阈值，0表示关闭。非空的低优先级级别每被更高优先级跳过一次，计数加一，达到阈值后优先出队一次。
+     * 最后一项是截止时间堆的计数。
+     */
+    int     aging_threshold;
+    int     level_skipped[THPOOL_PRIO_LEVELS + 1];
+    /**
+     * @brief Earliest-deadline-first tier of `thpool_add_work_deadline`.
+     * 截止时间任务的最小堆，位于`THPOOL_PRIO_HIGH`与`THPOOL_PRIO_NORMAL`之间，首次使用时分配。
+     * 出队时已过期的任务改为执行其过期回调，num_expired记录这样的任务数。
+     */
+    jobheap_entry   *heap;
+    int     heap_len;
+    int     heap_cap;
+    atomic_ullong   num_expired;
+    /**
+     * @brief Number of jobs queued above THPOOL_PRIO_NORMAL.
+     * 在锁内修改，但不持锁的取任务路径（双端队列、环形缓冲区）会读取它，发现有紧急任务时先进入持锁路径。
+     */
+    atomic_int  len_urgent;
     /**
      * @brief Number of jobs currently in the queue.
      * Accessed under jobqueue_rwmutex protection.
@@ -207,8 +439,299 @@ typedef struct jobqueue {
     int     max_len;
 } jobqueue;
 
+/**
+ * @brief Capacity of each work-stealing deque. Must be a power of two.
+ *
+ * 工作窃取双端队列的容量，必须是2的幂。
+ * 为了避免Chase-Lev原论文中环形数组扩容带来的内存回收问题，这里使用固定容量，
+ * 当自身双端队列已满时，任务退回到共享队列（注入队列）中。
+ */
+#define THPOOL_DEQUE_CAPACITY   256
+
+/**
+ * @brief Chase-Lev work-stealing deque owned by a worker thread.
+ *
+ * Only the owner pushes and takes at the bottom; other threads steal from the top.
+ * Memory orderings follow "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al., PPoPP'13).
+ *
+ * 工作窃取模式下每个线程持有的双端队列。只有持有者在bottom端存取，其他线程在top端窃取。
+ * top与bottom分别放在不同的缓存行，避免持有者与窃取者之间的伪共享。
+ */
+typedef struct wsdeque {
+    _Alignas(THPOOL_CACHE_LINE_SIZE) atomic_long top;       /* steal end, modified by thieves   */
+    _Alignas(THPOOL_CACHE_LINE_SIZE) atomic_long bottom;    /* owner end, modified by owner     */
+    _Atomic(job *)  buffer[THPOOL_DEQUE_CAPACITY];
+} wsdeque;
+
+/**
+ * @brief Task group, see `thpool_group_create`.
+ *
+ * 任务组。state的低30位为尚未完成的任务数，另有两个标志位：
+ * WAITED表示有等待方在state上休眠，计数归零的一方据此决定是否唤醒；CANCELLED记录曾有任务被`thpool_shutdown`丢弃。
+ * DETACHED表示任务组已无人等待，计数归零的一方负责释放它，供`thpool_parallel_for`在等待被shutdown打断时使用。
+ * 计数、等待标志与取消标志位于同一个字，计数归零的一方在CAS之后除futex唤醒外不再访问任务组，
+ * 等待方返回后即可立即销毁任务组。
+ */
+#define THPOOL_GROUP_WAITED     (1u << 31)
+#define THPOOL_GROUP_CANCELLED  (1u << 30)
+#define THPOOL_GROUP_DETACHED   (1u << 29)
+#define THPOOL_GROUP_COUNT_MASK (THPOOL_GROUP_DETACHED - 1)
+
+typedef struct thpool_group {
+    struct thpool   *thpool_p;              /* 任务组所属的线程池。 */
+    atomic_uint     state;
+} thpool_group;
+
+/**
+ * @brief Hierarchical timing wheel geometry.
+ *
+ * 分层时间轮：每层64个槽，共4层，刻度为1毫秒，可直接容纳约4.6小时之内的到期时刻，更远的定时器先放在最高层，轮转到时再重新放置。
+ * 第l层的槽覆盖64^l个刻度，定时器放在剩余刻度数所对应的层，上层的槽在下层转完一圈时逐级下放（cascade）。
+ */
+#define THPOOL_TIMER_TICK_NS        1000000ull
+#define THPOOL_TIMER_LEVEL_BITS     6
+#define THPOOL_TIMER_SLOTS          (1 << THPOOL_TIMER_LEVEL_BITS)
+#define THPOOL_TIMER_LEVELS         4
+#define THPOOL_TIMER_BATCH          64      /* 定时器线程一次批量入队的到期任务数上限。 */
+
+enum thpool_timer_state {
+    THPOOL_TIMER_ARMED = 0,                 /* 在时间轮中等待到期。   */
+    THPOOL_TIMER_FIRING,                    /* 已到期，任务已入队或正在执行。    */
+    THPOOL_TIMER_CANCELLED,                 /* 周期定时器在入队后被取消。尚未执行的不再执行，正在执行的结束后不再放回时间轮。   */
+    THPOOL_TIMER_DONE,                      /* 不会再执行。   */
+};
+
+/**
+ * @brief Timer of a delayed or periodic job, see `thpool_add_work_at`.
+ *
+ * 定时器。所有成员都受时间轮的mutex保护。槽内链表以pprev双向链接，取消时无需查找即可摘除。
+ * 所有存活的定时器另串在all链表上，`thpool_shutdown`据此统一释放它们。
+ */
+typedef struct thpool_timer {
+    struct thpool   *thpool_p;
+    struct thpool_timer *next;
+    struct thpool_timer **pprev;
+    struct thpool_timer *all_next;
+    struct thpool_timer **all_pprev;
+    uint64_t        expire_tick;
+    uint64_t        period_ticks;           /* 0表示一次性定时器。  */
+    void            (*function)(void *arg, threadpool_thread current_thrd);
+    void            *arg;
+    enum thpool_timer_state state;
+    bool            user_ref;               /* 用户是否持有句柄。持有句柄时须以`thpool_timer_cancel`释放。    */
+    unsigned char   level;
+    unsigned char   slot;
+} thpool_timer;
+
+/**
+ * 时间轮。cur_tick为下一个待处理的刻度，第0层的定时器到期刻度总在[cur_tick, cur_tick + 63]之内。
+ * occupied按位记录各层非空的槽，用于计算下一次需要醒来的刻度，时间轮稀疏时定时器线程不必逐刻度醒来。
+ * 定时器线程在第一个定时器加入时才启动，不使用定时任务的线程池没有额外的线程。
+ */
+typedef struct thpool_timer_wheel {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;                   /* 以CLOCK_MONOTONIC计时。  */
+    pthread_t       thread;
+    bool            thread_started;
+    bool            stop;
+    uint64_t        cur_tick;
+    uint64_t        wake_tick;              /* 定时器线程计划醒来的刻度，运行中为0，加入更早的定时器时才需要唤醒它。 */
+    int             num_armed;
+    uint64_t        occupied[THPOOL_TIMER_LEVELS];
+    thpool_timer    *slots[THPOOL_TIMER_LEVELS][THPOOL_TIMER_SLOTS];
+    thpool_timer    *all;
+} thpool_timer_wheel;
+
+/**
+ * @brief Default stack size of a fiber job, see `thpool_add_work_fiber`.
+ *
+ * 协程任务的默认栈大小，不含栈底的保护页。
+ */
+#define THPOOL_FIBER_STACK_SIZE     (64 * 1024)
+#define THPOOL_FIBER_CACHE_SIZE     64      /* 每个线程池缓存的空闲协程数上限，超出的协程连同栈归还系统。  */
+#define THPOOL_FIBER_EVENTS         64      /* poller线程一次取出的事件数上限。   */
+
+#ifdef THPOOL_HAS_FIBERS
+/**
+ * @brief Stackful fiber of a job added by `thpool_add_work_fiber`.
+ *
+ * 协程。协程在`thpool_yield_until`中切出后，由恢复任务`thpool_fiber_resume`在任意工作线程上切回。
+ * 等待条件由协程自己填写，切出后由原工作线程登记到poller，因此poller唤醒时协程的上下文一定已经保存完毕。
+ * 协程返回后其上下文停在`thpool_fiber_entry`的循环中，复用时无需重新`makecontext`。
+ */
+typedef struct thpool_fiber {
+    ucontext_t      ctx;
+    ucontext_t      *worker_ctx;            /* 正在运行本协程的工作线程的上下文，切出时回到这里。 */
+    struct thpool   *thpool_p;
+    struct thread   *thread_p;              /* 最近一次恢复本协程的线程。    */
+    void            (*function)(void *arg, threadpool_thread current_thrd);
+    void            *arg;
+    void            *stack;                 /* 包括最低处的保护页。    */
+    size_t          stack_size;
+    bool            done;                   /* 任务函数已返回。 */
+    /* 以下等待状态在协程切出后受poller的mutex保护。    */
+    int             wait_fd;                /* 负数表示不等待文件描述符。    */
+    short           wait_events;
+    uint64_t        wait_deadline_ns;       /* 0表示不限时。 */
+    int             heap_index;             /* 在poller截止时间堆中的下标，-1表示不在堆中。    */
+    bool            registered;             /* 正在poller中等待。    */
+    int             result;                 /* `thpool_yield_until`的返回值。   */
+    int             err;                    /* result为-1时的errno。  */
+    struct thpool_fiber *next;              /* 空闲链表。   */
+    struct thpool_fiber *all_next;
+    struct thpool_fiber **all_pprev;
+} thpool_fiber;
+#endif
+
+/**
+ * 协程的poller。等待文件描述符或截止时刻的协程登记在这里，由单个poller线程以epoll等待，
+ * 条件满足后把恢复任务放回任务队列。poller线程在第一个协程等待时才启动，与定时器线程相同。
+ * 所有协程另串在all链表上，`thpool_shutdown`据此释放仍挂起的协程。
+ */
+typedef struct thpool_fiber_poller {
+    pthread_mutex_t mutex;
+    pthread_t       thread;
+    bool            thread_started;
+    bool            stop;
+    int             epoll_fd;
+    int             event_fd;               /* 唤醒poller线程，登记值为空指针。  */
+    size_t          stack_size;             /* 不含保护页，已向上取整到页。  */
+    struct thpool_fiber **heap;             /* 按wait_deadline_ns排列的最小堆。   */
+    int             heap_len;
+    int             heap_cap;
+    struct thpool_fiber *free_list;
+    int             num_free;
+    struct thpool_fiber *all;
+    atomic_int      num_live;               /* 已提交、尚未返回的协程任务数，`thpool_wait`据此等待挂起的协程。  */
+} thpool_fiber_poller;
+
+/**
+ * @brief Number of stripes of producer counters for threads outside the pool.
+ *
+ * 线程池外部的生产者无处保存私有计数器，因此按线程分配到若干条带中的一个，条带数须为2的幂。
+ */
+#define THPOOL_STATS_STRIPES    16
+
+/**
+ * @brief Counters recorded by producers, padded to a cache line.
+ *
+ * 生产者记录的计数器，填充到一个缓存行。每个工作线程持有一份，用于该线程内部提交的任务；
+ * 外部生产者按条带共享，同一条带的生产者之间才会有竞争。
+ */
+typedef struct producer_stats {
+    _Alignas(THPOOL_CACHE_LINE_SIZE) atomic_ullong jobs_submitted;
+    atomic_ullong   jobs_rejected;
+    atomic_ullong   blocked_ns;
+} producer_stats;
+
+/**
+ * @brief Geometry of the job argument arena, see `thpool_job_alloc`.
+ *
+ * 任务参数区按块分配，块的大小与对齐都是2 MiB，即x86-64与AArch64（4K页）下一个大页。
+ * 单次分配至多THPOOL_ARENA_MAX_ALLOC字节，按THPOOL_ARENA_ALIGN对齐，块尾因放不下而浪费的空间因此至多为其1/32。
+ * 块作为某个线程或条带的当前块期间，持有者预先计入THPOOL_ARENA_CHUNK_BIAS个引用，分配时只修改私有的计数，不做原子操作。
+ */
+#define THPOOL_ARENA_CHUNK_SIZE     ((size_t)2 << 20)
+#define THPOOL_ARENA_MAX_ALLOC      ((size_t)64 << 10)
+#define THPOOL_ARENA_ALIGN          16
+#define THPOOL_ARENA_CHUNK_BIAS     (1u << 30)
+
+/* 工作线程临时内存的默认大小，参见`thpool_thread_scratch`。    */
+#define THPOOL_SCRATCH_SIZE         (64 * 1024)
+
+/**
+ * 任务参数区的块头，位于块的起始处。live由释放分配的任意线程修改，与持有者修改的used分属不同的缓存行，第一个分配紧随块头之后。
+ * live为持有者的预计引用与已释放分配之差，持有者放弃该块时减去预计引用中未用掉的部分，归零的一方把块放回空闲链表。
+ */
+typedef struct thpool_arena_chunk {
+    _Alignas(THPOOL_CACHE_LINE_SIZE) atomic_uint live;
+    _Alignas(THPOOL_CACHE_LINE_SIZE) size_t used;   /* 已分配的字节数，包括块头，仅由持有者修改。 */
+    unsigned    num_allocs;                 /* 本轮已分配的次数，仅由持有者修改。  */
+    struct thpool_arena_chunk *next;        /* 空闲链表，受参数区的mutex保护。   */
+} thpool_arena_chunk;
+
+/* 外部线程分配参数区内存时使用的条带，与生产者计数器的条带编号相同。  */
+typedef struct thpool_arena_stripe {
+    _Alignas(THPOOL_CACHE_LINE_SIZE) pthread_mutex_t mutex;
+    thpool_arena_chunk  *chunk;
+} thpool_arena_stripe;
+
+/**
+ * @brief Preallocated arena of job arguments, see `thpool_job_alloc`.
+ *
+ * 任务参数区。初始化时一次保留`arena_size`字节的地址空间，按2 MiB对齐，块在首次取用时才提交物理内存，此后循环使用到`thpool_destroy`。
+ * 地址空间连续，判断任务参数是否来自参数区只需一次范围比较；未启用时base为空指针、size为0，比较总是不成立。
+ * 工作线程从自身的当前块分配，外部线程从所属条带的当前块分配；块内的分配全部释放后，块回到空闲链表。
+ */
+typedef struct thpool_arena {
+    char        *base;
+    size_t      size;
+    bool        huge_pages;                 /* 块以大页提交。    */
+    pthread_mutex_t mutex;                  /* 保护free_list，串行化num_committed的修改。 */
+    thpool_arena_chunk  *free_list;
+    /* 已提交的块数，块按地址顺序提交。在mutex内以release序增加，`thpool_arena_contains`不加锁以acquire序读取。   */
+    atomic_size_t   num_committed;
+    thpool_arena_stripe stripes[THPOOL_STATS_STRIPES];
+} thpool_arena;
+
+/**
+ * @brief Counters recorded by a worker thread, only written by that thread.
+ *
+ * 工作线程记录的计数器，仅由本线程写入，获取快照时由其他线程读取，因此仍使用原子变量，但只需relaxed序。
+ */
+typedef struct worker_stats {
+    producer_stats  produced;               /* 本线程内部提交的任务  */
+    _Alignas(THPOOL_CACHE_LINE_SIZE) atomic_ullong jobs_completed;
+    atomic_ullong   busy_ns;
+    atomic_ullong   idle_ns;
+    atomic_ullong   queue_wait_hist[THPOOL_STATS_HIST_BUCKETS];
+    atomic_ullong   run_time_hist[THPOOL_STATS_HIST_BUCKETS];
+} worker_stats;
+
+/**
+ * @brief Run states of a worker thread slot.
+ *
+ * 工作线程位置的运行状态。线程元数据一经创建便保留到`thpool_destroy`，退出的线程可以在原位置上重新启动，
+ * 因此不持锁的窃取者读取到的线程元数据与双端队列总是有效的。
+ * STARTING由启动方设置，线程开始运行后改为RUNNING。RUNNING与RETIRING之间由`thpool_resize`在resize_mutex内切换。
+ * 线程自身以CAS从RETIRING进入EXITING，之后不可撤回，执行`thread_end_cb`后设置为RETIRED，此后不再访问线程元数据。
+ */
+enum thread_run_state {
+    THREAD_STARTING = 0,
+    THREAD_RUNNING,
+    THREAD_RETIRING,    /* asked to retire, still running its current job   */
+    THREAD_EXITING,     /* left the job loop, running thread_end_cb         */
+    THREAD_RETIRED,     /* exited, may be restarted by thpool_resize        */
+};
+
+/**
+ * @brief CPU bit mask, in the layout the Linux affinity syscalls use.
+ *
+ * 与Linux亲和性系统调用布局一致的CPU位图。不使用`cpu_set_t`，以免引入_GNU_SOURCE。
+ * 大小与glibc的`CPU_SETSIZE`相同。NUMA节点列表也借用该结构保存。
+ */
+#define THPOOL_MAX_CPUS         1024
+#define THPOOL_CPUMASK_BITS     (8 * sizeof(unsigned long))
+typedef struct thpool_cpumask {
+    unsigned long   bits[THPOOL_MAX_CPUS / THPOOL_CPUMASK_BITS];
+} thpool_cpumask;
+
+/* 支持绑定内存的最大NUMA节点数，编号更大的节点上的线程只固定CPU，内存按默认策略分配。  */
+#define THPOOL_MAX_NUMA_NODES   64
+
+/* `THPOOL_AFFINITY_NUMA_SPREAD`下线程分布的一个NUMA节点。  */
+typedef struct thpool_numa_node {
+    int             id;                     /* 系统中的节点编号，拓扑无法读取时为-1。   */
+    thpool_cpumask  cpus;                   /* 该节点上位于允许集合内的CPU。  */
+} thpool_numa_node;
+
 /* Thread */
+/**
+ * 成员按访问方分为三个区域：创建后基本只读、会被其他线程读取的冷区；仅由本线程在每个任务上读写的热区；
+ * 以及统计计数器。后两者各自从新的缓存行开始，本线程每个任务的写入不会使其他线程读取的冷区缓存行失效。
+ */
 typedef struct thread {
+    /* ---- 冷区：创建后不变或极少修改，窃取者与控制接口会读取。 ---- */
     int         id;                         /* friendly id                  */
     pthread_t   pthread;                    /* pointer to actual thread     */
     struct thpool   *thpool_p;              /* access to thpool             */
@@ -225,40 +748,114 @@ typedef struct thread {
      */
     void        *thread_ctx_slot;
     char        thread_name[16];            /* Thread name for debugging/profiling. 线程名，原作者在thread_do中临时创建，这里在thread_init中先创建。    */
+    _Atomic enum thread_run_state   run_state;  /* 运行状态，参见`thread_run_state`。 */
     bool        callback_arg_ref_holding;   /* 如果用户提供了回调参数的析构函数，该布尔位指示是否本线程是否对回调参数持有引用。 */
+    wsdeque     *deque;                     /* 工作窃取模式下本线程持有的双端队列，其他模式下为空指针。  */
+    int         numa_node;                  /* 线程所在的NUMA节点，未按节点放置时为-1。初始化后不再改变。  */
+
+    /* ---- 热区：仅由本线程在每个任务上读写。 ---- */
+    /**
+     * @brief Whether this thread is executing a job.
+     *
+     * 本线程是否正在执行任务，取代原先全池共享的num_threads_working计数。
+     * 每个任务只写本线程的缓存行，`thpool_wait`与`thpool_num_threads_working`需要时再逐个求和。
+     */
+    THPOOL_REGION_ALIGN atomic_bool busy;
+    unsigned    steal_seed;                 /* 选择窃取目标的伪随机种子，仅由本线程读写。    */
+    unsigned    sched_tick;                 /* 取任务次数计数，用于周期性地优先检查共享队列。 */
+    long        spin_budget_ns;             /* 自适应空闲策略下本线程当前的自旋时长，仅由本线程读写。  */
+    job         *job_cache;                 /* 本线程缓存的空闲任务节点，仅由本线程读写。    */
+    int         job_cache_len;              /* 本线程缓存的空闲任务节点数量。    */
+    uint64_t    last_job_end_ns;            /* 上一个任务结束（或线程启动）的时刻，用于统计空闲时间。  */
+    /**
+     * 环形缓冲区后端不为任务分配节点，从环形缓冲区取出的任务函数与参数暂存于此。
+     * `thread_release_job`据此判断任务是否需要释放。
+     */
+    job         ring_job;
+    /**
+     * 延续槽位，仅由本线程读写。开启`nested_inline_depth`时，本线程执行的任务向所属线程池提交的后续任务保存于此，
+     * 当前任务返回后立即执行。cont_depth为连续执行的延续任务数，从队列取得任务时清零。
+     */
+    job         cont_job;
+    bool        cont_pending;
+    int         cont_depth;
+    /* 执行域的线程视图上，执行线程池的工作线程嵌套执行本执行域服务任务的层数，只有最外层设置与清除busy标志。  */
+    int         domain_depth;
+    struct thpool_fiber *fiber;             /* 本线程正在运行的协程，`thpool_yield_until`据此切出。   */
+    thpool_arena_chunk  *arena_chunk;       /* 本线程分配任务参数的当前块，参见`thpool_job_alloc`。   */
+    /* 本线程的临时内存，首次使用时分配，每个任务结束后回退到任务开始时的位置，参见`thpool_thread_scratch`。  */
+    char        *scratch;
+    size_t      scratch_used;
+
+    /* ---- 私有队列：受jobqueue_rwmutex保护，由`thpool_add_work_to`等接口的生产者写入。 ---- */
+    /**
+     * 指定本线程执行的任务，其他线程不会取走或窃取。结构与共享链表的一个级别相同，front最先出队，经prev链向队尾。
+     * 线程只在持锁确认私有队列为空后才进入THREAD_EXITING，因此退出的线程不会遗留私有任务。
+     */
+    THPOOL_REGION_ALIGN job *affine_front;
+    job         *affine_rear;
+    int         affine_len;
+
+    worker_stats    stats;                  /* 本线程的统计计数器，与上面的成员分属不同的缓存行。 */
 } thread;
 
 /* Threadpool */
 /* 相关的一些变量被我修改为atomic_int类型。 */
+/**
+ * 成员按访问方划分区域，各热区从新的缓存行开始：
+ * 冷区为配置与极少修改的状态，每个任务只读不写；队列区只在jobqueue_rwmutex内访问；
+ * 排队名额计数由生产者与工作线程共同修改，单独占据一行；生产者区与消费者区分别只由阻塞的生产者与休眠或退出的工作线程写入，
+ * 对方每个任务只读取；空闲等待区只在`thpool_wait`期间写入。空闲节点栈与统计计数器在各自结构中对齐。
+ * 这样每个任务上被写入的只有名额计数、队列区与本线程自身的缓存行，不会再使其他线程每次都要读取的缓存行失效。
+ */
 typedef struct thpool {
+    /* ---- 冷区：配置与极少修改的状态。 ---- */
     thread      **threads;                  /* pointer to threads           */
     /**
-     * Records the number of threads successfully created during initialization.
-     * 记录创建时的thread数量，这依然重要，以避免在num_threads_alive不准确时错误统计导致销毁失误。
+     * Records the number of thread slots ever created.
+     * 记录已创建的线程位置数，这依然重要，以避免在num_threads_alive不准确时错误统计导致销毁失误。
+     * 位置只增不减，已退出线程的元数据仍保留在原位置。新位置先写入threads数组，再以release序增加该值，
+     * 不持锁的读取方以acquire序读取该值后，即可安全读取其下标之内的threads数组。
      */
-    int         num_threads;
-    atomic_int  num_threads_alive;          /* threads currently alive      */
+    atomic_int  num_threads;
+    int         threads_capacity;           /* length of threads, i.e. max_threads  */
+    atomic_bool threads_keepalive;          /* 将全局变量改为移植入内部，允许多个线程池同时存在。     */
     /**
-     * @brief Atomic counter for threads currently executing a job.
-     * Updated outside of job queue lock. Used for signaling when all threads are idle.
+     * @brief Atomic flag: true while thpool_put_job and thpool_get_job are active.
+     * Set to false by thpool_wait, set to true by thpool_reactivate.
      * 
-     * 原作者把num_threads_working设置为volitile，此处是没有意义的，原代码中所有操作都在thcount_lock内部。
-     * 这里，将num_threads_working修改为atomic_int，并将相关代码修改为彻底与thcount_lock无关。
-     * 因此，thcount_lock更名为threads_all_idle_mutex。
-     * 在实际实现中，逻辑发生了轻微变化，例如在判断是否发送threads_all_idle时使用num_threads_working的缓存值而非最新值。
-     * 但新逻辑并不会造成不良后果，threads_all_idle的发送量不会变化，只是把原本无必要的阻塞判断部分去除了，加大吞吐。
+     * 添加一个量，设置thpool的等待目标。thpool_wait等待到队列空且无活动线程时，设置它为false，阻塞thpool_get_job与thpool_put_job。
      */
-    atomic_int  num_threads_working;        /* threads currently working    */
-    pthread_mutex_t threads_all_idle_mutex; /* used for threads_all_idle cond signal    */
-    pthread_cond_t  threads_all_idle;       /* signal to thpool_wait        */
-    jobqueue    jobqueue;                   /* job queue                    */
+    atomic_bool threads_active;
+    threadpool_sched_mode   sched_mode;     /* 任务调度模式。 */
+    threadpool_idle_policy  idle_policy;    /* 工作线程空闲策略。 */
+    long        idle_spin_ns;               /* 自旋时长，自适应策略下为上限。  */
+    int         min_threads;                /* 空闲自动缩减保留的最少线程数。    */
+    long        idle_timeout_ms;            /* 空闲自动缩减的超时时长，0表示关闭。 */
+    int         scale_up_queue_depth;       /* 触发自动扩大的排队任务数，0表示关闭。   */
+    bool        stats_timing;               /* 是否统计计时部分。  */
+    bool        job_timestamps;             /* 是否为任务记录入队与执行时刻，统计计时或任务钩子需要。  */
+    threadpool_reject_policy    reject_policy;  /* 非阻塞与限时提交的拒绝策略。 */
+    int         nested_inline_depth;        /* 连续执行的延续任务数上限，0表示关闭。 */
+    size_t      scratch_size;               /* 每个线程的临时内存大小，已向上取整到页。  */
+    void    (*pre_job_cb)(const threadpool_job_info *, threadpool_thread current_thrd);
+    void    (*post_job_cb)(const threadpool_job_info *, threadpool_thread current_thrd);
     /**
-     * Job queue synchronization primitives
-     * 把jobqueue的相关同步功能全部上移到thpool中，jobqueue仅关注它自身结构，不再关注信号量同步问题。
+     * 执行域。executor非空时本线程池不创建线程，threads中是为执行线程池每个工作线程位置准备的线程视图，
+     * 执行线程池的工作线程以服务任务轮流执行本线程池的任务，每轮至多domain_weight个。
+     * num_domains只在执行线程池上使用，为挂在它上面的执行域数量。
      */
-    pthread_mutex_t jobqueue_rwmutex;       /* used for queue r/w access    */
-    pthread_cond_t  get_job_unblock;        /* 删除原二元信号量has_jobs，变更为条件信号     */
-    pthread_cond_t  put_job_unblock;        /* 用于队列已满时的信号量等待功能。             */
+    struct thpool   *executor;
+    int         domain_weight;
+    atomic_int  num_domains;
+    /**
+     * CPU亲和性。affinity_mask为允许的CPU集合，`THPOOL_AFFINITY_NUMA_SPREAD`下numa_nodes为线程依次分布的节点。
+     * 线程的放置只由线程编号决定，因此重新启动的线程回到原来的CPU与节点上。
+     */
+    threadpool_affinity affinity;
+    thpool_cpumask  affinity_mask;
+    int         num_numa_nodes;
+    thpool_numa_node    *numa_nodes;
 
     /**
      * 启用TSD机制，检查当前线程是否属于此线程池。
@@ -266,14 +863,6 @@ typedef struct thpool {
      */
     pthread_key_t   key;
 
-    atomic_bool threads_keepalive;          /* 将全局变量改为移植入内部，允许多个线程池同时存在。     */
-    /**
-     * @brief Atomic flag: true while thpool_put_job and thpool_get_job are active.
-     * Set to false by thpool_wait, set to true by thpool_reactivate.
-     * 
-     * 添加一个量，设置thpool的等待目标。thpool_wait等待到队列空且无活动线程时，设置它为false，阻塞thpool_get_job与thpool_put_job。
-     */
-    atomic_bool threads_active;
     /**
      * @brief Prefix for naming worker threads (max 6 chars + null).
      * 
@@ -307,6 +896,104 @@ typedef struct thpool {
      */
     bool    passport_user_owned;
 #endif
+    /**
+     * 线程数量调整。resize_mutex串行化`thpool_resize`、自动扩大与空闲线程的自行退出，
+     * 并与`thpool_shutdown`关闭存活标记互斥，保证shutdown之后不会再有线程启动。
+     * 加锁顺序为先resize_mutex后jobqueue_rwmutex。
+     */
+    pthread_mutex_t resize_mutex;
+    pthread_mutex_t drain_mutex;            /* 串行化`thpool_drain`。   */
+    thpool_timer_wheel  timer_wheel;        /* 延时与周期任务。 */
+    thpool_fiber_poller fibers;             /* 协程任务。   */
+    thpool_arena    arena;                  /* 任务参数区。 */
+
+    /* ---- 队列区：只在jobqueue_rwmutex内访问。 ---- */
+    /**
+     * Job queue synchronization primitives
+     * 把jobqueue的相关同步功能全部上移到thpool中，jobqueue仅关注它自身结构，不再关注信号量同步问题。
+     */
+    THPOOL_REGION_ALIGN pthread_mutex_t jobqueue_rwmutex;  /* used for queue r/w access    */
+    pthread_cond_t  get_job_unblock;        /* 删除原二元信号量has_jobs，变更为条件信号     */
+    pthread_cond_t  put_job_unblock;        /* 用于队列已满时的信号量等待功能。             */
+    jobqueue    jobqueue;                   /* job queue                    */
+    /* 所有线程私有队列中的任务总数，已计入num_jobs_queued。休眠判定以num_jobs_queued减去该值为准，其他线程的私有任务不应阻止本线程休眠。  */
+    int         num_affine_queued;
+    /**
+     * 执行域在执行线程池中排队或执行中的服务任务数及其上限。只在本线程池的jobqueue_rwmutex内增减，
+     * 例外是执行线程池关闭时丢弃服务任务，此时不持本线程池的锁直接减少，因此为原子量。
+     */
+    atomic_int  domain_servers;
+    int         domain_max_servers;
+    /**
+     * 正在执行的`thpool_domain_serve`数。服务任务在锁内减少domain_servers后仍会访问执行域，
+     * 以减少该计数作为最后一次访问，`thpool_domain_stop`还须等待它归零。
+     */
+    atomic_int  domain_serving;
+    /* 空闲节点分配器。不持锁归还的节点栈位于其首个成员，单独从新的缓存行开始。  */
+    THPOOL_REGION_ALIGN jobpool jobpool;   /* job node allocator           */
+
+    /* ---- 排队名额计数：生产者与工作线程每个任务都会修改。 ---- */
+    /**
+     * @brief Total number of jobs queued in the shared queue and all work-stealing deques.
+     *
+     * 所有队列（共享队列与各线程的双端队列）中排队任务的总数。
+     * 工作窃取模式下，双端队列的存取不经过jobqueue_rwmutex，因此不能再只依赖jobqueue.len，
+     * `work_num_max`的上限、`thpool_wait`的判空以及工作线程的休眠判定都以该原子量为准。
+     * 入队前先以CAS预留名额，保证有上限时总数绝不超过`work_num_max`。
+     */
+    THPOOL_REGION_ALIGN atomic_int num_jobs_queued;
+
+    /* ---- 排空区：每个任务入队与完成时各修改一次。 ---- */
+    /**
+     * @brief Drain epoch and per-epoch counts of unfinished jobs, striped by producer, see `thpool_drain`.
+     *
+     * 任务入队时在生产者线程所属的条带上以一次CAS读取纪元并在其计数上加一，纪元与条带记录在任务的enqueue_ns中，
+     * 完成或被丢弃时在该条带、该纪元的计数上减一。各生产者分散在不同的缓存行上，只有`thpool_drain`汇总所有条带。
+     * 读取纪元与计数加一是同一次原子操作，因此`thpool_drain`翻转某一条带的纪元之后，该条带旧纪元的计数只减不增。
+     */
+    thpool_drain_stripe drain_stripes[THPOOL_DRAIN_STRIPES];
+    atomic_uint drain_seq;                  /* 旧纪元的计数归零时自增，`thpool_drain`在其上以futex等待。  */
+    atomic_int  num_drainers;               /* 正在等待的`thpool_drain`调用数，完成任务的一方据此决定是否唤醒。 */
+
+    /* ---- 生产者区：只由阻塞的生产者写入，释放名额的工作线程读取。 ---- */
+    /**
+     * @brief Number of producers blocked on put_job_unblock.
+     *
+     * 在put_job_unblock上阻塞的生产者数量。仅在jobqueue_rwmutex内修改，
+     * 释放名额的一方据此只在确有生产者阻塞时，唤醒其中一个。
+     */
+    THPOOL_REGION_ALIGN atomic_int num_producers_blocked;
+
+    /* ---- 消费者区：只由休眠、启动或退出的工作线程写入，不持锁入队的生产者读取。 ---- */
+    /**
+     * @brief Number of worker threads parked on get_job_unblock.
+     *
+     * 在get_job_unblock上休眠的工作线程数量。仅在jobqueue_rwmutex内修改，
+     * 但会被不持锁的双端队列入队方读取，以判断是否需要唤醒休眠线程。
+     */
+    THPOOL_REGION_ALIGN atomic_int num_threads_parked;
+    atomic_int  num_threads_running;        /* 未被要求退出的线程数，仅在resize_mutex内修改。   */
+    atomic_int  num_threads_alive;          /* threads currently alive      */
+
+    /* ---- 空闲等待区：只在`thpool_wait`期间写入。 ---- */
+    /**
+     * @brief Number of callers waiting in thpool_wait.
+     *
+     * 原作者用受thcount_lock保护的num_threads_working计数判断所有线程空闲，后来它被改为原子量，
+     * 但每个任务前后仍要修改这一全池共享的缓存行。现在工作状态记录在各线程的busy标志中，`thpool_wait`需要时逐个求和。
+     * 工作线程结束任务后读取该值，只有确有等待者且排队任务为空时才加锁发送threads_all_idle，因此thcount_lock更名为threads_all_idle_mutex。
+     */
+    THPOOL_REGION_ALIGN atomic_int num_idle_waiters;
+    pthread_mutex_t threads_all_idle_mutex; /* used for threads_all_idle cond signal    */
+    pthread_cond_t  threads_all_idle;       /* signal to thpool_wait        */
+
+    /**
+     * @brief Peak of num_jobs_queued.
+     *
+     * 排队任务总数的峰值。预留名额时只有超过峰值才写入，峰值稳定后该缓存行只读，不会引入竞争。
+     */
+    THPOOL_REGION_ALIGN atomic_int queue_len_peak;
+    producer_stats  producer_stats[THPOOL_STATS_STRIPES];   /* 外部生产者的计数器条带   */
 } thpool;
 
 /* ========================== PROTOTYPES ============================ */
@@ -314,31 +1001,185 @@ typedef struct thpool {
 // 删除了原作者的thread_hold，以及删除了所有二元信号量相关代码。
 // Helper function to initialize a single thread
 static int          thread_init(thpool *thpool_p, struct thread **thread_pout, int id);
+// Helper function to allocate thread metadata without starting the thread
+static int          thread_alloc(thpool *thpool_p, struct thread **thread_pout, int id);
+// Helper function to restart a retired thread in its slot
+static int          thread_revive(thpool *thpool_p, struct thread *thread_p);
 // The main function executed by each worker thread
 static void        *thread_do(void *thread_p_arg);
+// Runs one job taken from the queue and records its statistics
+static void         thread_run_job(struct thread *thread_p, struct job *job_p, bool nested);
 // Helper function to free thread resources
 static void         thread_destroy(struct thread* thread_p);
 
 // 把jobqueue的push和pull均改为无锁保护版本，jobqueue操作仅仅关心自己作为一个结构体该做的事，不去关心与信号同步有关的事。
 // Job queue internal helper functions (unsafe - require external synchronization)
-static int          jobqueue_init(jobqueue *jobqueue_p, int max_len);
+static int          jobqueue_init(jobqueue *jobqueue_p, int max_len, threadpool_queue_backend backend, int aging_threshold, const int *level_max);
 static void         jobqueue_clear_unsafe(jobqueue *jobqueue_p);
-static void         jobqueue_push_unsafe(jobqueue *jobqueue_p, struct job* newjob_p);
+static void         jobqueue_push_unsafe(jobqueue *jobqueue_p, struct job* newjob_p, threadpool_priority prio);
+static int          jobqueue_level_room_unsafe(jobqueue *jobqueue_p, int prio, int num);
 static struct job  *jobqueue_pull_unsafe(jobqueue *jobqueue_p);
+static struct job  *jobqueue_pull_level_unsafe(jobqueue *jobqueue_p, int level);
+static int          job_list_remove_unsafe(job **front_p, job **rear_p, void (*function_p)(void *, threadpool_thread), void *arg_p, job **removed_out);
+static int          jobqueue_push_deadline_unsafe(jobqueue *jobqueue_p, struct job *newjob, uint64_t deadline_ns, void (*on_expire)(void *, threadpool_thread));
+static struct job  *jobqueue_pull_deadline_unsafe(jobqueue *jobqueue_p);
 static void         jobqueue_destroy_unsafe(jobqueue *jobqueue_p);
 
+// 任务节点分配器。带unsafe后缀的函数需要在jobqueue_rwmutex保护下调用。
+// Job node allocator
+static void         jobpool_init(jobpool *jobpool_p, int max_nodes);
+static void         jobpool_destroy(jobpool *jobpool_p);
+static struct job  *jobpool_alloc_unsafe(jobpool *jobpool_p, bool grow);
+static void         jobpool_free_unsafe(jobpool *jobpool_p, struct job *job_p);
+static void         jobpool_return(jobpool *jobpool_p, struct job *job_p);
+static struct job  *thread_alloc_job(thpool *thpool_p, struct thread *thread_p);
+
+// 完成句柄。
+// Completion handles
+static void         thpool_handle_run(void *arg_p, threadpool_thread current_thrd);
+static void         thpool_handle_complete(struct job *handle_p, unsigned state);
+static void         thpool_handle_unref(struct job *handle_p);
+static inline void  thpool_job_discard(void (*function_p)(void *, threadpool_thread), void *arg_p);
+
+// 任务组。
+// Task groups
+static void         thpool_group_run(void *arg_p, threadpool_thread current_thrd);
+static void         thpool_group_done(struct thpool_group *group_p, bool cancelled);
+static struct job  *thpool_try_get_job(thpool *thpool_p, struct thread *thread_p);
+
+// CPU亲和性与NUMA节点放置。
+// Affinity helpers
+static int          thpool_affinity_init(thpool *thpool_p, threadpool_config *conf);
+static int          thpool_thread_placement(thpool *thpool_p, int id, thpool_cpumask *mask_out);
+static void         thread_apply_affinity(struct thread *thread_p);
+static void        *thpool_node_alloc(size_t size, int node);
+static void         thpool_node_free(void *ptr, size_t size, int node);
+
+// 统计。计数器以relaxed序累加，仅在获取快照时汇总。
+// Statistics helpers
+static inline uint64_t  thpool_now_ns(void);
+static int          thpool_cond_init_monotonic(pthread_cond_t *cond_p);
+static inline struct timespec thpool_cond_deadline(uint64_t deadline_ns);
+static inline uint64_t  thpool_stats_timestamp(thpool *thpool_p);
+static inline int   thpool_stats_bucket(uint64_t ns);
+static void         producer_stats_init(producer_stats *stats_p);
+static void         worker_stats_init(worker_stats *stats_p);
+static inline unsigned  thpool_producer_stripe_index(void);
+static inline producer_stats *thpool_producer_stats(thpool *thpool_p, struct thread *thread_p);
+static inline void  thpool_stats_record_submit(thpool *thpool_p, struct thread *thread_p, int submitted, int rejected);
+static inline void  thpool_stats_update_peak(thpool *thpool_p, int queued);
+
+// 环形缓冲区后端的入队与出队，均为无锁操作，可并发调用。
+// Lock-free ring buffer helpers
+static int          jobring_init(jobring *ring_p, int min_capacity);
+static void         jobring_destroy(jobring *ring_p);
+static bool         jobring_push(jobring *ring_p, void (*function_p)(void *, threadpool_thread), void *arg_p, uint64_t enqueue_ns);
+static bool         jobring_pop(jobring *ring_p, struct job *job_out);
+
+// 工作窃取双端队列。push与take仅可由持有者调用，steal可由任意线程调用。
+// Work-stealing deque helpers (lock-free)
+static wsdeque     *wsdeque_create(int node);
+static void         wsdeque_destroy(wsdeque *deque_p, int node);
+static inline bool  wsdeque_has_room(wsdeque *deque_p);
+static inline void  wsdeque_push(wsdeque *deque_p, struct job *newjob_p);
+static struct job  *wsdeque_take(wsdeque *deque_p);
+static struct job  *wsdeque_steal(wsdeque *deque_p);
+
 // 新增的非api函数，相当于原作者的jobqueue_push和jobqueue_pull，提供了更复杂的信号同步功能。
 // Thread pool internal job handling functions (with synchronization)
-static int          thpool_put_job(thpool *thpool_p, struct job *newjob_p);
-static struct job  *thpool_get_job(thpool *thpool_p);
+static struct job  *thpool_put_job_begin(thpool *thpool_p, struct thread *thread_p, int prio, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ns, const char *caller);
+static int          thpool_put_job(thpool *thpool_p, struct thread *thread_p, threadpool_priority prio, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ns);
+static struct job  *thpool_get_job(thpool *thpool_p, struct thread *thread_p);
+static bool         thpool_spin_for_job(thpool *thpool_p, struct thread *thread_p);
+static inline bool  thpool_reserve_job_slot(thpool *thpool_p);
+static int          thpool_reserve_job_slots(thpool *thpool_p, int num);
+static int          thpool_wait_job_slots_unsafe(thpool *thpool_p, int num, int prio, long timeout_ns);
+static void         thpool_release_job_slot(thpool *thpool_p, bool locked);
+static bool         thpool_recheck_active(thpool *thpool_p);
+static int          thpool_put_job_local(thpool *thpool_p, struct thread *thread_p, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ns);
+static struct job  *thpool_try_get_job_local(thpool *thpool_p, struct thread *thread_p);
+static int          thpool_put_job_ring(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ns);
+static int          thpool_drop_listed_job(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p, bool low_only, struct job *victim_out);
+static int          thpool_put_job_drop_oldest(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p);
+static inline void  thpool_notify_job_added(thpool *thpool_p);
+static void         thpool_domain_serve(void *arg_p, threadpool_thread current_thrd);
+static bool         thpool_domain_kick_unsafe(thpool *thpool_p, int num);
+static void         thpool_domain_post_failed(thpool *thpool_p, const char *caller);
+static void         thpool_domain_stop(thpool *thpool_p);
+static bool         thpool_domain_post_end(thpool *executor_p, int thread_id, struct thread *view_p);
+static int          thpool_domain_reclaim(thpool *thpool_p, struct thread *current_thrd);
+static int          thpool_fiber_poller_init(thpool_fiber_poller *poller_p, size_t stack_size);
+static void         thpool_fiber_poller_stop(thpool_fiber_poller *poller_p);
+static void         thpool_fiber_poller_release(thpool_fiber_poller *poller_p);
+static void         thpool_fiber_poller_destroy(thpool_fiber_poller *poller_p);
+#ifdef THPOOL_HAS_FIBERS
+static void         thpool_fiber_resume(void *arg_p, threadpool_thread current_thrd);
+#endif
+// 任务参数区。
+static int          thpool_arena_init(thpool_arena *arena_p, size_t size, bool huge_pages);
+static void         thpool_arena_destroy(thpool_arena *arena_p);
+static inline void *thpool_arena_job_arg(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p);
+static inline void  thpool_arena_put(thpool_arena *arena_p, void *ptr);
+static inline bool  thpool_put_job_cont(thpool *thpool_p, struct thread *thread_p, void (*function_p)(void *, threadpool_thread), void *arg_p);
+static inline void  thread_release_job(struct thread *thread_p, struct job *job_p);
+// 线程私有队列，需要在jobqueue_rwmutex保护下调用。
+static inline bool  thread_accepts_affine(struct thread *thread_p);
+static void         thread_affine_push_unsafe(thpool *thpool_p, struct thread *thread_p, struct job *newjob_p);
+static struct job  *thread_affine_pull_unsafe(thpool *thpool_p, struct thread *thread_p);
+static int          thpool_put_job_affine(thpool *thpool_p, struct thread *thread_p, struct thread *target_p, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ns);
+// 线程数量调整。带unsafe后缀的函数需要在resize_mutex保护下调用。
+static int          thpool_resize_unsafe(thpool *thpool_p, int num);
+static void         thpool_retire_idle_thread(thpool *thpool_p, struct thread *thread_p);
+static inline void  thpool_autoscale_grow(thpool *thpool_p);
 // 由部分API使用，判定调用的线程是否属于线程池内。以禁止一些不应由属于线程池的线程进行的操作。
 static inline bool  thpool_is_current_thread_owner(thpool *thpool_p);
+static inline struct thread *thpool_current_thread(thpool *thpool_p);
 // 原有api改名为inner。inner的api不涉及conc_state_block
 // Inner API functions (do not involve passport checks or use counting)
 static int          thpool_wait_inner(thpool *thpool_p);
+static int          thpool_drain_inner(thpool *thpool_p);
+static inline uint64_t  thpool_drain_enter(thpool *thpool_p);
+static inline void  thpool_drain_leave(thpool *thpool_p, uint64_t stamp);
+static inline uint64_t  thpool_job_stamp(thpool *thpool_p);
 static int          thpool_add_work_inner(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p);
+static int          thpool_add_work_timed_inner(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ns);
+static int          thpool_add_work_prio_inner(thpool *thpool_p, threadpool_priority prio, void (*function_p)(void *, threadpool_thread), void *arg_p);
+static int          thpool_add_work_fiber_inner(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p);
+static int          thpool_add_work_deadline_inner(thpool *thpool_p, unsigned long long deadline_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, void (*on_expire)(void *, threadpool_thread));
+static int          thpool_add_work_batch_inner(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void **args_p, int num);
+static int          thpool_add_work_to_inner(thpool *thpool_p, int thread_id, void (*function_p)(void *, threadpool_thread), void *arg_p);
+static int          thpool_add_work_keyed_inner(thpool *thpool_p, unsigned long long key, void (*function_p)(void *, threadpool_thread), void *arg_p);
+static int          thpool_submit_inner(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p, struct job **handle_out);
+static struct thpool_group *thpool_group_create_inner(thpool *thpool_p);
+static int          thpool_group_add_work_inner(struct thpool_group *group_p, void (*function_p)(void *, threadpool_thread), void *arg_p);
+static void         thpool_parallel_for_run(void *arg_p, threadpool_thread current_thrd);
+static int          thpool_parallel_for_inner(thpool *thpool_p, size_t begin, size_t end, size_t grain, void (*function_p)(size_t, size_t, void *, threadpool_thread), void *arg_p);
+static void         thpool_graph_node_run(void *arg_p, threadpool_thread current_thrd);
+static struct thpool_graph *thpool_graph_create_inner(thpool *thpool_p);
+static int          thpool_graph_run_inner(struct thpool_graph *graph_p);
+
+// 延时与周期任务。带unsafe后缀的函数需要在时间轮的mutex保护下调用。
+// Timer helpers
+static int          thpool_timer_wheel_init(thpool_timer_wheel *wheel_p);
+static void         thpool_timer_wheel_stop(thpool_timer_wheel *wheel_p);
+static void         thpool_timer_wheel_release(thpool_timer_wheel *wheel_p);
+static void         thpool_timer_wheel_destroy(thpool_timer_wheel *wheel_p);
+static void         thpool_timer_insert_unsafe(thpool_timer_wheel *wheel_p, thpool_timer *timer_p);
+static void         thpool_timer_unlink_unsafe(thpool_timer_wheel *wheel_p, thpool_timer *timer_p);
+static void         thpool_timer_free_unsafe(thpool_timer *timer_p);
+static void         thpool_timer_run(void *arg_p, threadpool_thread current_thrd);
+static void        *thpool_timer_thread_do(void *thpool_p_arg);
+static int          thpool_add_work_timer_inner(thpool *thpool_p, uint64_t deadline_ns, uint64_t period_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, thpool_timer **timer_out);
+static int          thpool_timer_cancel_inner(thpool *thpool_p, thpool_timer *timer_p);
 static int          thpool_reactivate_inner(thpool* thpool_p);
 static int          thpool_num_threads_working_inner(thpool *thpool_p);
+static int          thpool_count_busy_threads(thpool *thpool_p);
+static int          thpool_num_threads_inner(thpool *thpool_p);
+static int          thpool_resize_inner(thpool *thpool_p, int num);
+static int          thpool_job_slab_high_water_inner(thpool *thpool_p);
+static int          thpool_get_stats_inner(thpool *thpool_p, threadpool_stats *out);
+static void        *thpool_job_alloc_inner(thpool *thpool_p, size_t size);
+static int          thpool_job_free_inner(thpool *thpool_p, void *ptr);
 // 在inner api的基础上增加了涉及conc_state_block的操作。
 // 其他api直接在inner api基础上用宏扩充。shutdown和destroy比较特殊，因此从一开始就设计成safe inner api。
 /**
@@ -351,26 +1192,50 @@ static int          thpool_num_threads_working_inner(thpool *thpool_p);
 static int          thpool_shutdown_safe_inner(thpool *thpool_p, conc_state_block *passport);
 static int          thpool_destroy_safe_inner(thpool *thpool_p, conc_state_block *passport);
 static inline int   thpool_wait_safe_inner(thpool *thpool_p, conc_state_block *passport);
+static inline int   thpool_drain_safe_inner(thpool *thpool_p, conc_state_block *passport);
 static inline int   thpool_add_work_safe_inner(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p);
+static inline int   thpool_add_work_batch_safe_inner(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void **args_p, int num);
+static inline int   thpool_add_work_prio_safe_inner(thpool *thpool_p, conc_state_block *passport, threadpool_priority prio, void (*function_p)(void *, threadpool_thread), void *arg_p);
+static inline int   thpool_add_work_fiber_safe_inner(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p);
+static inline int   thpool_add_work_deadline_safe_inner(thpool *thpool_p, conc_state_block *passport, unsigned long long deadline_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, void (*on_expire)(void *, threadpool_thread));
+static inline int   thpool_add_work_timed_safe_inner(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ns);
+static inline int   thpool_add_work_to_safe_inner(thpool *thpool_p, conc_state_block *passport, int thread_id, void (*function_p)(void *, threadpool_thread), void *arg_p);
+static inline int   thpool_add_work_keyed_safe_inner(thpool *thpool_p, conc_state_block *passport, unsigned long long key, void (*function_p)(void *, threadpool_thread), void *arg_p);
+static inline int   thpool_submit_safe_inner(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p, struct job **handle_out);
+static inline struct thpool_group *thpool_group_create_safe_inner(thpool *thpool_p, conc_state_block *passport);
+static inline int   thpool_group_add_work_safe_inner(struct thpool_group *group_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p);
+static inline int   thpool_parallel_for_safe_inner(thpool *thpool_p, conc_state_block *passport, size_t begin, size_t end, size_t grain, void (*function_p)(size_t, size_t, void *, threadpool_thread), void *arg_p);
+static inline struct thpool_graph *thpool_graph_create_safe_inner(thpool *thpool_p, conc_state_block *passport);
+static inline int   thpool_graph_run_safe_inner(struct thpool_graph *graph_p, conc_state_block *passport);
+static inline int   thpool_add_work_timer_safe_inner(thpool *thpool_p, conc_state_block *passport, uint64_t deadline_ns, uint64_t period_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, thpool_timer **timer_out);
+static inline int   thpool_timer_cancel_safe_inner(thpool *thpool_p, conc_state_block *passport, thpool_timer *timer_p);
 static inline int   thpool_reactivate_safe_inner(thpool *thpool_p, conc_state_block *passport);
 static inline int   thpool_num_threads_working_safe_inner(thpool *thpool_p, conc_state_block *passport);
+static inline int   thpool_num_threads_safe_inner(thpool *thpool_p, conc_state_block *passport);
+static inline int   thpool_resize_safe_inner(thpool *thpool_p, conc_state_block *passport, int num);
+static inline int   thpool_job_slab_high_water_safe_inner(thpool *thpool_p, conc_state_block *passport);
+static inline int   thpool_get_stats_safe_inner(thpool *thpool_p, conc_state_block *passport, threadpool_stats *out);
+static inline void *thpool_job_alloc_safe_inner(thpool *thpool_p, conc_state_block *passport, size_t size);
+static inline int   thpool_job_free_safe_inner(thpool *thpool_p, conc_state_block *passport, void *ptr);
 
 static conc_state_block *thpool_debug_conc_passport_init_inner(enum thpool_state state);
+static inline atomic_int *thpool_passport_enter(conc_state_block *passport);
+static inline void  thpool_passport_leave(atomic_int *num_api_use);
+static bool         thpool_passport_in_use(conc_state_block *passport);
 
 /* ============================ THREAD ============================== */
 
 /**
- * Initialize a thread in the thread pool
- *
- * @param thread_pout   address to the pointer of the thread to be created
- * @param id            id to be given to the thread
- * @return 0 on success, -1 otherwise.
+ * 分配并初始化线程元数据，不创建线程。执行域的线程视图也由此创建，它们不对应实际的线程。
+ * 失败时解除该位置预先计入的`callback_arg`引用，返回-1。
  */
-static int thread_init(thpool *thpool_p, struct thread **thread_pout, int id)
+static int thread_alloc(thpool *thpool_p, struct thread **thread_pout, int id)
 {
-    *thread_pout = malloc(sizeof(struct thread));
+    /* 统计计数器按缓存行对齐，线程元数据需要对齐分配。按NUMA节点放置时分配在线程所在的节点上。  */
+    int numa_node = thpool_thread_placement(thpool_p, id, nullptr);
+    *thread_pout = thpool_node_alloc(sizeof(struct thread), numa_node);
     if (unlikely(*thread_pout == nullptr)) {
-        thpool_log_error("thread_init(): Could not allocate memory for thread");
+        thpool_log_error("thread_alloc(): Could not allocate memory for thread");
         if (thpool_p->callback_arg_destructor != nullptr) {
             /* 线程 */
             atomic_fetch_sub_explicit(&thpool_p->callback_arg_refcount, 1, memory_order_acq_rel);
@@ -395,16 +1260,38 @@ static int thread_init(thpool *thpool_p, struct thread **thread_pout, int id)
      */
     (*thread_pout)->thread_ctx_slot = nullptr;
 
-    int err = pthread_create(&(*thread_pout)->pthread, nullptr, thread_do, (*thread_pout));
-    if (unlikely(err != 0)) {
-        thpool_log_error("thread %d:pthread_create_failed, err=%d",id, err);
-        errno = err;
-        goto cleanup_thread;
+    /* 工作窃取模式下，为线程创建自身的双端队列。   */
+    (*thread_pout)->deque = nullptr;
+    (*thread_pout)->steal_seed = (unsigned)id * 2654435761u + 1u;
+    (*thread_pout)->sched_tick = 0;
+    (*thread_pout)->spin_budget_ns = thpool_p->idle_spin_ns;
+    (*thread_pout)->job_cache = nullptr;
+    (*thread_pout)->job_cache_len = 0;
+    (*thread_pout)->last_job_end_ns = 0;
+    (*thread_pout)->numa_node = numa_node;
+    worker_stats_init(&(*thread_pout)->stats);
+    atomic_init(&(*thread_pout)->busy, false);
+    (*thread_pout)->cont_pending = false;
+    (*thread_pout)->cont_depth = 0;
+    (*thread_pout)->domain_depth = 0;
+    (*thread_pout)->fiber = nullptr;
+    (*thread_pout)->arena_chunk = nullptr;
+    (*thread_pout)->scratch = nullptr;
+    (*thread_pout)->scratch_used = 0;
+    (*thread_pout)->affine_front = nullptr;
+    (*thread_pout)->affine_rear = nullptr;
+    (*thread_pout)->affine_len = 0;
+    atomic_init(&(*thread_pout)->run_state, THREAD_STARTING);
+    if (thpool_p->sched_mode == THPOOL_SCHED_WORK_STEALING) {
+        (*thread_pout)->deque = wsdeque_create(numa_node);
+        if (unlikely((*thread_pout)->deque == nullptr)) {
+            thpool_log_error("thread_alloc(): Could not allocate memory for work-stealing deque");
+            goto cleanup_thread;
+        }
     }
-    pthread_detach((*thread_pout)->pthread);
     return 0;
 cleanup_thread:
-    free(*thread_pout);
+    thpool_node_free(*thread_pout, sizeof(struct thread), numa_node);
     *thread_pout = nullptr;
 unref_callback_arg:
     if (thpool_p->callback_arg_destructor != nullptr) {
@@ -423,17 +1310,77 @@ unref_callback_arg:
 }
 
 /**
- * What each thread is doing
+ * Initialize a thread in the thread pool
  *
- * In principle this is an endless loop. The only time this loop gets interrupted is once
- * thpool_shutdown() is invoked or the program exits.
+ * 调用者须预先为新线程计入`callback_arg`的引用，创建失败时由本函数解除。
  *
- * @param  thread_p_arg thread that will run this function
- * @return nothing
+ * @param thread_pout   address to the pointer of the thread to be created
+ * @param id            id to be given to the thread
+ * @return 0 on success, -1 otherwise.
  */
-static void *thread_do(void *thread_p_arg)
+static int thread_init(thpool *thpool_p, struct thread **thread_pout, int id)
 {
-    struct thread *thread_p = thread_p_arg;
+    if (unlikely(thread_alloc(thpool_p, thread_pout, id) != 0)) {
+        return -1;
+    }
+    int err = pthread_create(&(*thread_pout)->pthread, nullptr, thread_do, (*thread_pout));
+    if (unlikely(err != 0)) {
+        thpool_log_error("thread %d:pthread_create_failed, err=%d",id, err);
+        wsdeque_destroy((*thread_pout)->deque, (*thread_pout)->numa_node);
+        thpool_node_free(*thread_pout, sizeof(struct thread), (*thread_pout)->numa_node);
+        *thread_pout = nullptr;
+        /* 与`thread_alloc`的失败路径相同，解除预先计入的引用。   */
+        if (thpool_p->callback_arg_destructor != nullptr) {
+            atomic_fetch_sub_explicit(&thpool_p->callback_arg_refcount, 1, memory_order_acq_rel);
+        }
+        errno = err;
+        return -1;
+    }
+    pthread_detach((*thread_pout)->pthread);
+    return 0;
+}
+
+/**
+ * 在已退出线程的位置上重新启动线程，沿用其线程元数据、双端队列、任务节点缓存与统计数据。
+ * 需要在resize_mutex保护下调用，且线程状态须为THREAD_RETIRED。
+ * 若旧线程未主动解除对`callback_arg`的引用，则继续持有，否则重新计入一个引用。
+ * @return 0 on success, -1 otherwise.
+ */
+static int thread_revive(thpool *thpool_p, struct thread *thread_p)
+{
+    if (thpool_p->callback_arg_destructor != nullptr && !thread_p->callback_arg_ref_holding) {
+        /* 线程池自身的引用保持到shutdown，此时引用计数必定大于0，`callback_arg`仍然存活。 */
+        atomic_fetch_add_explicit(&thpool_p->callback_arg_refcount, 1, memory_order_acq_rel);
+        thread_p->callback_arg_ref_holding = true;
+    }
+    thread_p->thread_ctx_slot = nullptr;
+    thread_p->spin_budget_ns = thpool_p->idle_spin_ns;
+    atomic_store(&thread_p->run_state, THREAD_STARTING);
+
+    int err = pthread_create(&thread_p->pthread, nullptr, thread_do, thread_p);
+    if (unlikely(err != 0)) {
+        thpool_log_error("thread %d:pthread_create_failed, err=%d", thread_p->id, err);
+        /* 引用继续由线程元数据持有，随`thread_destroy`或下一次重新启动处理。    */
+        atomic_store(&thread_p->run_state, THREAD_RETIRED);
+        errno = err;
+        return -1;
+    }
+    pthread_detach(thread_p->pthread);
+    return 0;
+}
+
+/**
+ * What each thread is doing
+ *
+ * In principle this is an endless loop. The only time this loop gets interrupted is once
+ * thpool_shutdown() is invoked or the program exits.
+ *
+ * @param  thread_p_arg thread that will run this function
+ * @return nothing
+ */
+static void *thread_do(void *thread_p_arg)
+{
+    struct thread *thread_p = thread_p_arg;
 
     /* Set thread name for profiling and debugging */
     /* 原作者在此处构造线程名，改为在init构造，仅需使用thread_p->thread_name的构造成品。 */
@@ -451,40 +1398,63 @@ static void *thread_do(void *thread_p_arg)
     /* Assure all threads have been created before starting serving */
     thpool *thpool_p = thread_p->thpool_p;
 
-    pthread_setspecific(thpool_p->key, thpool_p);
+    /* 先固定CPU，再执行开始回调，使回调中分配的线程上下文同样按首次访问落在本地节点上。   */
+    thread_apply_affinity(thread_p);
+
+    /* TSD中保存线程元数据本身，既可用于判定归属，也可用于在任务内部提交时找到本线程的双端队列。    */
+    pthread_setspecific(thpool_p->key, thread_p);
 
     /* Mark thread as alive (initialized) */
     atomic_fetch_add(&thpool_p->num_threads_alive, 1);
+    /* 启动方在THREAD_STARTING期间持有resize_mutex并等待，此时没有其他修改者。 */
+    atomic_store(&thread_p->run_state, THREAD_RUNNING);
 
     /* 执行开始任务回调，如果有的话。   */
     if (thpool_p->thread_start_cb) {
         thpool_p->thread_start_cb(thpool_p->callback_arg, thread_p);
     }
+    thread_p->last_job_end_ns = thpool_stats_timestamp(thpool_p);
 
-    while (atomic_load(&thpool_p->threads_keepalive)) {
+    /* 被`thpool_resize`或空闲超时要求退出的线程，由`thpool_get_job`将状态改为THREAD_EXITING后退出循环。   */
+    while (atomic_load(&thpool_p->threads_keepalive) && atomic_load_explicit(&thread_p->run_state, memory_order_relaxed) != THREAD_EXITING) {
 
-        job *job_p = thpool_get_job(thread_p->thpool_p);
+        /**
+         * `thpool_get_job`返回任务时，已经预先设置了本线程的busy标志。
+         * 原作者在取出任务并释放锁之后才对工作计数自增，这样`thpool_wait`可能在任务已出队、而计数尚未自增的窗口内，
+         * 误判为队列空且无活动线程。将标记提前到释放排队名额之前即可消除该窗口。
+         */
+        job *job_p;
+        if (thread_p->cont_pending) {
+            /* 延续任务不占用排队名额，放入槽位时已设置busy标志。其函数与参数在执行前读出，执行中槽位可以被再次填充。  */
+            thread_p->cont_pending = false;
+            thread_p->cont_depth++;
+            job_p = &thread_p->cont_job;
+        } else {
+            job_p = thpool_get_job(thpool_p, thread_p);
+            thread_p->cont_depth = 0;
+            if (job_p != nullptr) {
+                THPOOL_PROBE3(job_dequeue, thpool_p, thread_p->id, atomic_load_explicit(&thpool_p->num_jobs_queued, memory_order_relaxed));
+            }
+        }
 
         //如果job_p为空指针，这基本意味着进程池正在被摧毁。
         if (job_p != nullptr) {
 
-            atomic_fetch_add(&thpool_p->num_threads_working, 1);
-
-            /* Read job from queue and execute it */
-            /* 略作修改，增加了当前线程句柄参数。使用的时候，添加任务只需要输入函数和参数，而定义任务函数的时候除了arg还有线程句柄参数。    */
-            job_p->function(job_p->arg, thread_p);
-            free(job_p);
+            /* 完成计数先于busy标志清除，`thpool_wait`返回后，完成数一定等于提交数。  */
+            thread_run_job(thread_p, job_p, false);
+            /* 当前任务留下了延续任务，保持工作状态，下一轮直接执行。   */
+            if (thread_p->cont_pending) {
+                continue;
+            }
 
             /**
-             * 这里将thpool_p->num_threads_working设置为原子值以后，逻辑发生了些许变化。
-             * 原作者代码里整个threads_all_idle信号都与num_threads_working的变化同步阻塞。
-             * 这里修改为了使用num_threads_working的缓存值判断信号是否发送。
-             * ABA等情况这里当然可能出现，但是我们的需求可以容忍，不会造成错误的影响。
-             * 当有一个num_threads_working被修改至0时，一定会有一个信号被发送，且不会有两个信号被同时发送。
-             * 使用旧值-1的方式获取获取原子变量的自减更新值缓存。`__atomic_sub_fetch`需求的参数是普通`int`指针而非`atomic_int`指针，不应使用。
+             * 原作者代码里整个threads_all_idle信号都与工作计数的变化同步阻塞，后来改为在全池共享的原子计数减到0时发送。
+             * 现在只清除本线程的busy标志，再读取等待者数量，与`thpool_wait`先登记等待者、再读取各线程busy标志的顺序构成一对，
+             * 两者都使用seq_cst序，因此要么等待者看到本线程已空闲，要么本线程看到等待者而发送信号。
+             * 排队任务不为空时不必发送，剩余的任务被取出时会重新设置busy标志，由最后执行完的线程发送。
              */
-            int num_threads_working = atomic_fetch_sub(&thpool_p->num_threads_working, 1) - 1;
-            if (!num_threads_working) {
+            atomic_store(&thread_p->busy, false);
+            if (unlikely(atomic_load(&thpool_p->num_idle_waiters) > 0) && atomic_load(&thpool_p->num_jobs_queued) == 0) {
                 pthread_mutex_lock(&thpool_p->threads_all_idle_mutex);
                 /* 这里的signal修改为broadcast，允许支持多个线程都在等待任务队列与工作线程皆空的情形。  */
                 pthread_cond_broadcast(&thpool_p->threads_all_idle);
@@ -492,15 +1462,111 @@ static void *thread_do(void *thread_p_arg)
             }
         }
     }
+    /* 线程池关闭时未执行的延续任务与队列中的任务一样丢弃。    */
+    if (thread_p->cont_pending) {
+        thread_p->cont_pending = false;
+        thpool_job_discard(thread_p->cont_job.function, thread_p->cont_job.arg);
+        atomic_store(&thread_p->busy, false);
+    }
     /* 如果存在任务执行回调，执行任务结束回调。 */
     if (thpool_p->thread_end_cb) {
         thpool_p->thread_end_cb(thread_p);
     }
+    /* 退出的线程此后不再访问线程元数据，设置为THREAD_RETIRED后，该位置即可被重新启动。    */
+    if (atomic_load(&thread_p->run_state) == THREAD_EXITING) {
+        atomic_store(&thread_p->run_state, THREAD_RETIRED);
+    }
     atomic_fetch_sub(&thpool_p->num_threads_alive, 1);
 
     return nullptr;
 }
 
+/**
+ * 执行一个已取出的任务并记录统计，随后回收任务节点。
+ * nested为真表示在任务内部（`thpool_group_wait`协助执行时）嵌套执行，
+ * 此时外层任务仍在计时，不应把两个任务之间的时间计为空闲。
+ */
+static void thread_run_job(struct thread *thread_p, struct job *job_p, bool nested)
+{
+    thpool *thpool_p = thread_p->thpool_p;
+    worker_stats *stats_p = &thread_p->stats;
+    uint64_t start_ns = 0;
+    if (thpool_p->job_timestamps) {
+        start_ns = thpool_now_ns();
+    }
+    if (thpool_p->stats_timing) {
+        if (!nested) {
+            atomic_fetch_add_explicit(&stats_p->idle_ns, start_ns - thread_p->last_job_end_ns, memory_order_relaxed);
+        }
+        atomic_fetch_add_explicit(&stats_p->queue_wait_hist[thpool_stats_bucket(start_ns - (job_p->enqueue_ns & ~THPOOL_DRAIN_BITS))], 1, memory_order_relaxed);
+    }
+
+    /**
+     * 任务钩子看到的是用户的任务函数与参数，而不是句柄与任务组的内部包装函数。
+     * 包装函数执行时会归还载体或句柄节点，因此在执行前读出。
+     */
+    threadpool_job_info info;
+    bool hooked = thpool_p->pre_job_cb != nullptr || thpool_p->post_job_cb != nullptr;
+    if (unlikely(hooked)) {
+        if (job_p->function == thpool_handle_run || job_p->function == thpool_group_run) {
+            struct job *inner_p = job_p->arg;
+            info.function = inner_p->function;
+            info.arg = inner_p->arg;
+#ifdef THPOOL_HAS_FIBERS
+        } else if (job_p->function == thpool_fiber_resume) {
+            thpool_fiber *fiber_p = job_p->arg;
+            info.function = fiber_p->function;
+            info.arg = fiber_p->arg;
+#endif
+        } else {
+            info.function = job_p->function;
+            info.arg = job_p->arg;
+        }
+        info.enqueue_ns = job_p->enqueue_ns & ~THPOOL_DRAIN_BITS;
+        info.start_ns = start_ns;
+        info.end_ns = 0;
+        if (thpool_p->pre_job_cb) {
+            thpool_p->pre_job_cb(&info, thread_p);
+        }
+    }
+
+    /* Read job from queue and execute it */
+    /* 略作修改，增加了当前线程句柄参数。使用的时候，添加任务只需要输入函数和参数，而定义任务函数的时候除了arg还有线程句柄参数。    */
+    /**
+     * 延续任务的槽位在执行中可能被再次填充，节点也随即回收，因此先读出纪元与参数区中的参数。
+     * 临时内存在任务结束后回退到开始时的位置，嵌套执行的任务按栈的次序使用它。
+     */
+    uint64_t stamp = job_p->enqueue_ns;
+    void *arena_arg = thpool_arena_job_arg(thpool_p, job_p->function, job_p->arg);
+    size_t scratch_mark = thread_p->scratch_used;
+    THPOOL_PROBE3(job_start, thpool_p, thread_p->id, job_p->function);
+    job_p->function(job_p->arg, thread_p);
+    thread_release_job(thread_p, job_p);
+    thread_p->scratch_used = scratch_mark;
+    if (arena_arg != nullptr) {
+        thpool_arena_put(&thpool_p->arena, arena_arg);
+    }
+    THPOOL_PROBE2(job_finish, thpool_p, thread_p->id);
+
+    if (thpool_p->job_timestamps) {
+        uint64_t end_ns = thpool_now_ns();
+        if (unlikely(hooked) && thpool_p->post_job_cb) {
+            info.end_ns = end_ns;
+            thpool_p->post_job_cb(&info, thread_p);
+        }
+        if (thpool_p->stats_timing) {
+            uint64_t run_ns = end_ns - start_ns;
+            if (!nested) {
+                thread_p->last_job_end_ns = end_ns;
+            }
+            atomic_fetch_add_explicit(&stats_p->busy_ns, run_ns, memory_order_relaxed);
+            atomic_fetch_add_explicit(&stats_p->run_time_hist[thpool_stats_bucket(run_ns)], 1, memory_order_relaxed);
+        }
+    }
+    atomic_fetch_add_explicit(&stats_p->jobs_completed, 1, memory_order_relaxed);
+    thpool_drain_leave(thpool_p, stamp);
+}
+
 /* Frees a thread  */
 static void thread_destroy(thread *thread_p)
 {
@@ -521,7 +1587,9 @@ static void thread_destroy(thread *thread_p)
     if (thread_p->callback_arg_ref_holding) {
         thpool_thread_unref_callback_arg(thread_p);
     }
-    free(thread_p);
+    thpool_node_free(thread_p->scratch, thread_p->thpool_p->scratch_size, thread_p->numa_node);
+    wsdeque_destroy(thread_p->deque, thread_p->numa_node);
+    thpool_node_free(thread_p, sizeof(struct thread), thread_p->numa_node);
 }
 
 /* ====================== THREAD WORKER API ========================= */
@@ -562,696 +1630,6218 @@ void thpool_thread_unref_callback_arg(threadpool_thread current_thrd)
     }
 }
 
-/* ============================ JOB QUEUE =========================== */
-
-/* 新增参数最大任务数man_len。如果不是正整数，视为未设置上限。  */
-/* Initialize queue */
-static int jobqueue_init(jobqueue *jobqueue_p, int max_len)
+/* 临时内存按线程首次使用时分配在线程所在的NUMA节点上，由本线程独占，因此只需移动偏移。  */
+void *thpool_thread_scratch(threadpool_thread current_thrd, size_t size)
 {
-    jobqueue_p->len = 0;
-    jobqueue_p->front = nullptr;
-    jobqueue_p->rear  = nullptr;
-    jobqueue_p->max_len = (max_len > 0)?max_len:0;
-
-    return 0;
+    if (unlikely(current_thrd == nullptr) || unlikely(size == 0)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    struct thread *thread_p = current_thrd;
+    size_t capacity = thread_p->thpool_p->scratch_size;
+    size = (size + THPOOL_ARENA_ALIGN - 1) & ~(size_t)(THPOOL_ARENA_ALIGN - 1);
+    if (unlikely(size > capacity - thread_p->scratch_used) || unlikely(size == 0)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    if (unlikely(thread_p->scratch == nullptr)) {
+        thread_p->scratch = thpool_node_alloc(capacity, thread_p->numa_node);
+        if (unlikely(thread_p->scratch == nullptr)) {
+            errno = ENOMEM;
+            return nullptr;
+        }
+    }
+    void *ptr = thread_p->scratch + thread_p->scratch_used;
+    thread_p->scratch_used += size;
+    return ptr;
 }
 
-/* Clear the queue */
-static void jobqueue_clear_unsafe(jobqueue *jobqueue_p)
+/**
+ * 协程切出，等待条件由工作线程在切出后登记。切回时可能已在另一个工作线程上，
+ * errno只在切回后才访问，避免编译器沿用切出前所在线程的errno地址。
+ */
+int thpool_yield_until(threadpool_thread *current_thrd, int fd, short events, unsigned long long deadline_ns)
 {
-    while (jobqueue_p->len) {
-        free(jobqueue_pull_unsafe(jobqueue_p));
+#ifdef THPOOL_HAS_FIBERS
+    if (unlikely(current_thrd == nullptr) || unlikely(*current_thrd == nullptr) || unlikely((*current_thrd)->fiber == nullptr)) {
+        errno = EINVAL;
+        return -1;
     }
-
-    jobqueue_p->front = nullptr;
-    jobqueue_p->rear  = nullptr;
-    jobqueue_p->len = 0;
+    thpool_fiber *fiber_p = (*current_thrd)->fiber;
+    if (unlikely(!atomic_load(&fiber_p->thpool_p->threads_keepalive))) {
+        errno = ECANCELED;
+        return -1;
+    }
+    fiber_p->wait_fd = (fd >= 0 && events != 0) ? fd : -1;
+    fiber_p->wait_events = events;
+    fiber_p->wait_deadline_ns = deadline_ns;
+    swapcontext(&fiber_p->ctx, fiber_p->worker_ctx);
+    *current_thrd = fiber_p->thread_p;
+    if (unlikely(fiber_p->result < 0)) {
+        errno = fiber_p->err;
+    }
+    return fiber_p->result;
+#else
+    (void)current_thrd;
+    (void)fd;
+    (void)events;
+    (void)deadline_ns;
+    errno = ENOTSUP;
+    return -1;
+#endif
 }
 
-/* Free all queue resources back to the system */
-static void jobqueue_destroy_unsafe(jobqueue *jobqueue_p)
+/* ============================ AFFINITY ============================ */
+
+static inline void thpool_cpumask_set(thpool_cpumask *mask, int cpu)
 {
-    jobqueue_clear_unsafe(jobqueue_p);
+    mask->bits[cpu / THPOOL_CPUMASK_BITS] |= 1UL << (cpu % THPOOL_CPUMASK_BITS);
 }
 
-
-/* 修改为不加锁的版本，最简化push逻辑。使用该函数应在读写锁保护下。有保护的版本为thpool_put_job。 */
-/* Add (allocated) job to queue
-*/
-static void jobqueue_push_unsafe(jobqueue *jobqueue_p, struct job *newjob)
+static inline bool thpool_cpumask_test(const thpool_cpumask *mask, int cpu)
 {
-    newjob->prev = nullptr;
-
-    switch (jobqueue_p->len) {
-    case 0:  /* if no jobs in queue */
-            jobqueue_p->front = newjob;
-            jobqueue_p->rear  = newjob;
-            break;
+    return (mask->bits[cpu / THPOOL_CPUMASK_BITS] >> (cpu % THPOOL_CPUMASK_BITS)) & 1UL;
+}
 
-    default: /* if jobs in queue */
-            jobqueue_p->rear->prev = newjob;
-            jobqueue_p->rear = newjob;
+static int thpool_cpumask_count(const thpool_cpumask *mask)
+{
+    int count = 0;
+    for (size_t i = 0; i < sizeof(mask->bits) / sizeof(mask->bits[0]); i++) {
+        for (unsigned long word = mask->bits[i]; word != 0; word &= word - 1) {
+            count++;
+        }
     }
-
-    jobqueue_p->len++;
+    return count;
 }
 
-/* Get first job from queue(removes it from queue)
-* Notice: Caller MUST hold a mutex
-*/
-static struct job *jobqueue_pull_unsafe(jobqueue *jobqueue_p)
+/* 求交集，返回交集中的CPU数。   */
+static int thpool_cpumask_and(thpool_cpumask *dst, const thpool_cpumask *src)
 {
-    job *job_p = jobqueue_p->front;
-
-    switch (jobqueue_p->len) {
-    case 0:  /* if no jobs in queue */
-            break;
+    for (size_t i = 0; i < sizeof(dst->bits) / sizeof(dst->bits[0]); i++) {
+        dst->bits[i] &= src->bits[i];
+    }
+    return thpool_cpumask_count(dst);
+}
 
-    case 1:  /* if one job in queue */
-            jobqueue_p->front = nullptr;
-            jobqueue_p->rear  = nullptr;
-            jobqueue_p->len = 0;
-            break;
+/* 返回第n个（从0开始）置位的CPU编号，不存在时返回-1。  */
+static int thpool_cpumask_nth(const thpool_cpumask *mask, int n)
+{
+    for (int cpu = 0; cpu < THPOOL_MAX_CPUS; cpu++) {
+        if (thpool_cpumask_test(mask, cpu) && n-- == 0) {
+            return cpu;
+        }
+    }
+    return -1;
+}
 
-    default: /* if >1 jobs in queue */
-            jobqueue_p->front = job_p->prev;
-            jobqueue_p->len--;
+/**
+ * 读取sysfs中"0-3,8-11"格式的列表文件。文件不存在或格式错误时返回-1。
+ * 没有CPU的节点，其cpulist为空行，得到空位图。
+ */
+static int thpool_cpumask_read_list(thpool_cpumask *mask, const char *path)
+{
+    char buf[4096];
+    FILE *file = fopen(path, "r");
+    if (file == nullptr) {
+        return -1;
+    }
+    char *line = fgets(buf, sizeof(buf), file);
+    fclose(file);
+    if (line == nullptr) {
+        return -1;
     }
 
-    return job_p;
+    memset(mask, 0, sizeof(*mask));
+    char *cur = buf;
+    while (*cur != '\0' && *cur != '\n') {
+        char *end;
+        long first = strtol(cur, &end, 10);
+        long last = first;
+        if (end == cur) {
+            return -1;
+        }
+        if (*end == '-') {
+            cur = end + 1;
+            last = strtol(cur, &end, 10);
+            if (end == cur) {
+                return -1;
+            }
+        }
+        for (long cpu = (first > 0) ? first : 0; cpu <= last && cpu < THPOOL_MAX_CPUS; cpu++) {
+            thpool_cpumask_set(mask, (int)cpu);
+        }
+        cur = (*end == ',') ? end + 1 : end;
+    }
+    return 0;
 }
 
-/* ========================== THREADPOOL ============================ */
-
 /**
- * @brief Initializes a thread pool.
- *
- * Creates and initializes a thread pool with the specified configuration.
- * This function blocks until all worker threads have been successfully created and are ready.
- * It also handles the creation or binding of the concurrency passport based on the config.
- *
- * @param conf Pointer to a threadpool_config structure containing initialization options.
- * Must not be null pointer. The memory pointed to by @p conf is only needed during the call to thpool_init.
- * @return threadpool A handle to the created thread pool on success, or null pointer on error.
- * Returns null pointer if memory allocation fails, thread creation fails, or passport binding/initialization fails.
+ * 根据配置计算允许的CPU集合，`THPOOL_AFFINITY_NUMA_SPREAD`下再读取NUMA拓扑。
+ * 只有配置错误返回-1，拓扑读取失败时退化为不按节点放置。
+ * @return 0 on success, -1 with errno set otherwise.
  */
-struct thpool *thpool_init(threadpool_config *conf)
+static int thpool_affinity_init(thpool *thpool_p, threadpool_config *conf)
 {
-    if (unlikely(conf == nullptr)) {
-        errno = EINVAL;
-        return nullptr;
+    /* 执行域不创建线程，放置由执行线程池决定。   */
+    thpool_p->affinity = (thpool_p->executor != nullptr) ? THPOOL_AFFINITY_NONE : conf->affinity;
+    thpool_p->num_numa_nodes = 0;
+    thpool_p->numa_nodes = nullptr;
+    memset(&thpool_p->affinity_mask, 0, sizeof(thpool_p->affinity_mask));
+    if (thpool_p->affinity == THPOOL_AFFINITY_NONE) {
+        return 0;
     }
 
-    int num_threads = (conf->num_threads < 0)?0:conf->num_threads;
-
-    /* Make new thread pool */
-    thpool *thpool_p;
-    thpool_p = malloc(sizeof(struct thpool));
-    if (unlikely(thpool_p == nullptr)) {
-        thpool_log_error("thpool_init(): Could not allocate memory for thread pool");
-        return nullptr;
+#if defined(__linux__)
+    /* 进程当前允许的CPU集合，已经包含taskset与cgroup cpuset的限制。 */
+    thpool_cpumask allowed = {0};
+    if (syscall(SYS_sched_getaffinity, 0, sizeof(allowed.bits), allowed.bits) < 0) {
+        thpool_log_error("thpool_init(): sched_getaffinity failed, errno=%d", errno);
+        return -1;
     }
 
-    /* 创建或使用用户提供的同步控制块。 */
-    /* Create or use user-provided concurrency control block (passport). */
-#ifdef THPOOL_ENABLE_DEBUG_CONC_API
-    if (conf->passport == nullptr){
-        thpool_p->passport_user_owned = false;
-        thpool_p->debug_conc_passport = thpool_debug_conc_passport_init();
+    if (conf->affinity_cpus != nullptr && conf->affinity_num_cpus > 0) {
+        for (int i = 0; i < conf->affinity_num_cpus; i++) {
+            int cpu = conf->affinity_cpus[i];
+            if (cpu < 0 || cpu >= THPOOL_MAX_CPUS) {
+                thpool_log_error("thpool_init(): invalid cpu %d in affinity_cpus", cpu);
+                errno = EINVAL;
+                return -1;
+            }
+            thpool_cpumask_set(&thpool_p->affinity_mask, cpu);
+        }
     } else {
-        thpool_p->passport_user_owned = true;
-        thpool_p->debug_conc_passport = conf->passport;
+        thpool_p->affinity_mask = allowed;
+    }
+    if (thpool_cpumask_and(&thpool_p->affinity_mask, &allowed) == 0) {
+        thpool_log_error("thpool_init(): none of affinity_cpus is allowed for this process");
+        errno = EINVAL;
+        return -1;
     }
 
-    if (thpool_p->debug_conc_passport == nullptr) {
-        thpool_log_error("thpool_init(): Could not allocate memory for conc state block");
-        goto cleanup_pool;
+    if (thpool_p->affinity != THPOOL_AFFINITY_NUMA_SPREAD) {
+        return 0;
     }
 
-    /* 同步控制块绑定。 */
-    /* Bind passport to this thread pool. */
-    bool bind_success = false;
-    enum thpool_state expected = THPOOL_UNBIND;
-    while (!atomic_compare_exchange_weak(&thpool_p->debug_conc_passport->state, &expected, THPOOL_ALIVE)) {
-        if (likely(expected == THPOOL_UNBIND)) {
-            /* 应该是弱交换造成的伪错误，继续循环。 */
-            continue;
-        } else {
-            /* 其他情况理应是将一个已经被绑定过的passport重复绑定了，因此报告上一个绑定的线程池信息。   */
-            thpool_log_error("passport rebind! The old "THPOOL_PASSPORT_STATUS_REPORTER(thpool_p->debug_conc_passport, expected));
-            errno = EINVAL;
-            goto cleanup_passport;
+    /* 只保留与允许集合有交集的节点。节点列表同样是位图格式。    */
+    thpool_cpumask online;
+    if (thpool_cpumask_read_list(&online, "/sys/devices/system/node/online") == 0) {
+        thpool_p->numa_nodes = malloc(sizeof(thpool_numa_node) * (size_t)thpool_cpumask_count(&online));
+        if (unlikely(thpool_p->numa_nodes == nullptr)) {
+            thpool_log_error("thpool_init(): Could not allocate memory for NUMA nodes");
+            return -1;
+        }
+        for (int node = 0; node < THPOOL_MAX_CPUS; node++) {
+            if (!thpool_cpumask_test(&online, node)) {
+                continue;
+            }
+            char path[64];
+            thpool_numa_node *node_p = &thpool_p->numa_nodes[thpool_p->num_numa_nodes];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            if (thpool_cpumask_read_list(&node_p->cpus, path) == 0 && thpool_cpumask_and(&node_p->cpus, &thpool_p->affinity_mask) > 0) {
+                node_p->id = node;
+                thpool_p->num_numa_nodes++;
+            }
         }
     }
-    thpool_p->debug_conc_passport->bind_pool = thpool_p;
-    snprintf(thpool_p->debug_conc_passport->name_copy, sizeof(thpool_p->debug_conc_passport->name_copy), "%s", conf->thread_name_prefix);
-    bind_success = true;
-#else
-    thpool_p->debug_conc_passport = thpool_debug_conc_passport_init_inner(THPOOL_ALIVE);
-    if (thpool_p->debug_conc_passport == nullptr) {
-        thpool_log_error("thpool_init(): Could not allocate memory for conc state block");
-        goto cleanup_pool;
+    if (thpool_p->num_numa_nodes == 0) {
+        /* 没有sysfs（或节点信息不可读）时，视为允许集合组成的一个不绑定内存的节点。    */
+        thpool_log_warn("thpool_init(): could not read NUMA topology, falling back to THPOOL_AFFINITY_CPUSET");
+        free(thpool_p->numa_nodes);
+        thpool_p->numa_nodes = nullptr;
+        thpool_p->affinity = THPOOL_AFFINITY_CPUSET;
     }
+    return 0;
+#else
+    thpool_log_warn("thpool_init(): CPU affinity is not supported on this system, ignored");
+    thpool_p->affinity = THPOOL_AFFINITY_NONE;
+    return 0;
 #endif
+}
 
-    /* 配置继承。   */
-    /* Inherit configuration.   */
-    snprintf(thpool_p->thread_name_prefix, sizeof(thpool_p->thread_name_prefix), "%s", conf->thread_name_prefix);
-    thpool_p->thread_start_cb = conf->thread_start_cb;
-    thpool_p->thread_end_cb = conf->thread_end_cb;
-    thpool_p->callback_arg = conf->callback_arg;
-    thpool_p->callback_arg_destructor = conf->callback_arg_destructor;
-    thpool_p->num_threads = num_threads;
-
-    /* 原子量初始化。   */
-    /* Initialize atomics.      */
-    atomic_init(&thpool_p->threads_keepalive, true);
-    atomic_init(&thpool_p->threads_active, true);
-    atomic_init(&thpool_p->num_threads_alive, 0);
-    atomic_init(&thpool_p->num_threads_working, 0);
-    /**
-     * 如果用户对callback_arg传入了析构函数，则各线程默认均持有引用。此外`thpool_init`自己也视为持有引用。
-     * `thpool_init`的引用持续到所有线程的创建函数执行完成。
-     */
-    if (thpool_p->callback_arg_destructor != nullptr) {
-        atomic_init(&thpool_p->callback_arg_refcount, num_threads + 1);
-    } else {
-        atomic_init(&thpool_p->callback_arg_refcount, 0);
+/**
+ * 计算编号为id的线程应当运行的CPU集合与所在节点。线程的放置只取决于编号，
+ * 因此`thread_init`分配内存时与线程自身设置亲和性时得到相同的结果。
+ * @param mask_out  可以为空指针，此时只计算节点。
+ * @return 线程所在的NUMA节点，未按节点放置时为-1。
+ */
+static int thpool_thread_placement(thpool *thpool_p, int id, thpool_cpumask *mask_out)
+{
+    switch (thpool_p->affinity) {
+    case THPOOL_AFFINITY_CPUSET:
+        if (mask_out != nullptr) {
+            *mask_out = thpool_p->affinity_mask;
+        }
+        return -1;
+    case THPOOL_AFFINITY_PER_CPU:
+        if (mask_out != nullptr) {
+            int cpu = thpool_cpumask_nth(&thpool_p->affinity_mask, id % thpool_cpumask_count(&thpool_p->affinity_mask));
+            memset(mask_out, 0, sizeof(*mask_out));
+            thpool_cpumask_set(mask_out, cpu);
+        }
+        return -1;
+    case THPOOL_AFFINITY_NUMA_SPREAD: {
+        thpool_numa_node *node_p = &thpool_p->numa_nodes[id % thpool_p->num_numa_nodes];
+        if (mask_out != nullptr) {
+            *mask_out = node_p->cpus;
+        }
+        return node_p->id;
+    }
+    default:
+        return -1;
     }
+}
 
-    /* 在任务队列创建前，先创建相关锁。 */
-    /* Job queue related locks and condition variables initialization. */
-    int err = pthread_mutex_init(&(thpool_p->jobqueue_rwmutex), nullptr);
-    if (unlikely(err != 0)) { // Check init result
-        thpool_log_error("thpool_init(): Could not initialize jobqueue_rwmutex");
-        errno = err;
-        goto cleanup_passport;
-    }
-    /* 创建任务队列。   */
-    /* Initialise the job queue */
-    if (unlikely(jobqueue_init(&thpool_p->jobqueue, conf->work_num_max) == -1)) {
-        thpool_log_error("thpool_init(): Could not allocate memory for job queue");
-        goto cleanup_jobqueue_rwmutex;
-    }
-
-    /* 任务队列条件量初始化。   */
-    err = pthread_cond_init(&thpool_p->get_job_unblock, nullptr);
-    if (unlikely(err != 0)) { // Check init result
-        thpool_log_error("thpool_init(): Could not initialize get_job_unblock");
-        errno = err;
-        goto cleanup_jobqueue;
+/* 由工作线程在`thread_do`开始时为自身调用，失败时仅记录警告，线程照常运行。  */
+static void thread_apply_affinity(struct thread *thread_p)
+{
+#if defined(__linux__)
+    thpool_cpumask mask;
+    if (thread_p->thpool_p->affinity == THPOOL_AFFINITY_NONE) {
+        return;
     }
-    err = pthread_cond_init(&thpool_p->put_job_unblock, nullptr);
-    if (unlikely(err != 0)) { // Check init result
-        thpool_log_error("thpool_init(): Could not initialize put_job_unblock");
-        errno = err;
-        goto cleanup_get_job_unblock;
+    thpool_thread_placement(thread_p->thpool_p, thread_p->id, &mask);
+    if (syscall(SYS_sched_setaffinity, 0, sizeof(mask.bits), mask.bits) != 0) {
+        thpool_log_warn("thread %d: sched_setaffinity failed, errno=%d", thread_p->id, errno);
     }
+#else
+    (void)thread_p;
+#endif
+}
 
-    /* TSD key 初始化。         */
-    err = pthread_key_create(&thpool_p->key, nullptr);
-    if (unlikely(err != 0)) {
-        thpool_log_error("thpool_init(): Could not initialize TSD key");
-        errno = err;
-        goto cleanup_put_job_unblock;
-    }
+/* Linux内核的NUMA内存策略，未引入<numaif.h>，这里只用到首选节点。 */
+#define THPOOL_MPOL_PREFERRED   1
 
-    /* Make threads in pool */
-    thpool_p->threads = malloc(num_threads * sizeof(struct thread *));
-    if (unlikely(thpool_p->threads == nullptr)) {
-        thpool_log_error("thpool_init(): Could not allocate memory for threads");
-        goto cleanup_TSD_key;
+/**
+ * 在指定NUMA节点上分配线程私有的结构，node为-1时按缓存行对齐普通分配。
+ * 按节点分配时直接映射独占的页面，在首次访问前以首选策略绑定，使页面在该节点上产生；
+ * 绑定失败（如容器中禁止mbind）时仍可使用，只是退化为默认策略。
+ * 释放时须以相同的size与node调用`thpool_node_free`。
+ */
+static void *thpool_node_alloc(size_t size, int node)
+{
+#if defined(__linux__)
+    if (node >= 0) {
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            return nullptr;
+        }
+#if defined(SYS_mbind)
+        if (node < THPOOL_MAX_NUMA_NODES) {
+            unsigned long nodemask[THPOOL_MAX_NUMA_NODES / THPOOL_CPUMASK_BITS] = {0};
+            nodemask[node / THPOOL_CPUMASK_BITS] = 1UL << (node % THPOOL_CPUMASK_BITS);
+            /* 内核会将maxnode减一后使用，因此传入位数加一。 */
+            if (syscall(SYS_mbind, ptr, size, THPOOL_MPOL_PREFERRED, nodemask, THPOOL_MAX_NUMA_NODES + 1, 0) != 0) {
+                thpool_log_debug("mbind to node %d failed, errno=%d", node, errno);
+            }
+        }
+#endif
+        return ptr;
     }
+#else
+    (void)node;
+#endif
+    return aligned_alloc(THPOOL_CACHE_LINE_SIZE, size);
+}
 
-    /* 线程空闲锁与条件量初始化。 */
-    /* Thread idle lock and condition variable initialization. */
-    err = pthread_mutex_init(&(thpool_p->threads_all_idle_mutex), nullptr);
-    if (unlikely(err != 0)) { // Check init result
-        thpool_log_error("thpool_init(): Could not initialize threads_all_idle_mutex");
-        errno = err;
-        goto cleanup_threads_array;
+static void thpool_node_free(void *ptr, size_t size, int node)
+{
+    if (ptr == nullptr) {
+        return;
     }
-    err = pthread_cond_init(&thpool_p->threads_all_idle, nullptr);
-    if (unlikely(err != 0)) { // Check init result
-        thpool_log_error("thpool_init(): Could not initialize threads_all_idle");
-        errno = err;
-        goto cleanup_threads_all_idle_mutex;
+#if defined(__linux__)
+    if (node >= 0) {
+        munmap(ptr, size);
+        return;
     }
+#else
+    (void)size;
+    (void)node;
+#endif
+    free(ptr);
+}
 
-    /* Thread init */
-    int n;
-    for (n=0; n<num_threads; n++) {
-        int thread_init_err = thread_init(thpool_p, &thpool_p->threads[n], n);
-        thpool_log_debug("THPOOL_DEBUG: Created thread %d in pool", n);
-        if (unlikely(thread_init_err != 0)) {
-            thpool_log_error("init thread %d fail", n);
-            num_threads -= 1;
-        }
+/* ============================== STATS ============================= */
+
+static inline uint64_t thpool_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * 初始化限时等待所用的条件变量。Linux下以CLOCK_MONOTONIC计时，不受系统时间调整影响；
+ * 其他系统（如macOS）没有`pthread_condattr_setclock`，退回默认的CLOCK_REALTIME，由`thpool_cond_deadline`换算超时时刻。
+ */
+static int thpool_cond_init_monotonic(pthread_cond_t *cond_p)
+{
+#if defined(__linux__)
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    int err = pthread_cond_init(cond_p, &attr);
+    pthread_condattr_destroy(&attr);
+    return err;
+#else
+    return pthread_cond_init(cond_p, nullptr);
+#endif
+}
+
+/* 将以`thpool_now_ns`表示的时刻换算为`thpool_cond_init_monotonic`所初始化条件变量的超时时刻。   */
+static inline struct timespec thpool_cond_deadline(uint64_t deadline_ns)
+{
+#if defined(__linux__)
+    return (struct timespec) {(time_t)(deadline_ns / 1000000000u), (long)(deadline_ns % 1000000000u)};
+#else
+    uint64_t now_ns = thpool_now_ns();
+    uint64_t remain_ns = (deadline_ns > now_ns) ? deadline_ns - now_ns : 0;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)(remain_ns / 1000000000u);
+    deadline.tv_nsec += (long)(remain_ns % 1000000000u);
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
     }
-    if (unlikely(num_threads <= 0)) {
-        goto cleanup_threads_all_idle_cond; 
+    return deadline;
+#endif
+}
+
+/* 未开启`stats_timing`且没有任务钩子时不读取时钟，返回0。  */
+static inline uint64_t thpool_stats_timestamp(thpool *thpool_p)
+{
+    return thpool_p->job_timestamps ? thpool_now_ns() : 0;
+}
+
+/* 直方图每个2的幂区间的子桶数，为2的幂。    */
+#define THPOOL_STATS_HIST_SUB_BITS  2
+#define THPOOL_STATS_HIST_SUB       (1 << THPOOL_STATS_HIST_SUB_BITS)
+
+/**
+ * 对数线性分桶：小于THPOOL_STATS_HIST_SUB的值各占一个桶，此后每个[2^e, 2^(e+1))区间按次高位均分为THPOOL_STATS_HIST_SUB个子桶。
+ * 超出范围的值计入最后一个桶。
+ */
+static inline int thpool_stats_bucket(uint64_t ns)
+{
+    if (ns < THPOOL_STATS_HIST_SUB) {
+        return (int)ns;
     }
-    /**
-     * 如果线程没有全部创建失败，就视为线程池创建成功。此时解除`thpool_init`自身的引用计数。
-     * 因为此刻可以保证不会再发生线程池创建失败的可能性，因此如果引用计数降至0，可以放心地执行析构。
-     */
-    if (thpool_p->callback_arg_destructor != nullptr) {
-        if (atomic_fetch_sub_explicit(&thpool_p->callback_arg_refcount, 1, memory_order_acq_rel) == 1) {
-            thpool_p->callback_arg_destructor(thpool_p->callback_arg);
-            thpool_log_debug("callback_arg destructed by thpool_init.");
-        }
+#if defined(__GNUC__) || defined(__clang__)
+    int e = 63 - __builtin_clzll(ns);
+#else
+    int e = 0;
+    for (uint64_t v = ns; v > 1; v >>= 1) {
+        e++;
     }
+#endif
+    int bucket = (e - THPOOL_STATS_HIST_SUB_BITS + 1) * THPOOL_STATS_HIST_SUB + (int)((ns >> (e - THPOOL_STATS_HIST_SUB_BITS)) & (THPOOL_STATS_HIST_SUB - 1));
+    return (bucket < THPOOL_STATS_HIST_BUCKETS) ? bucket : THPOOL_STATS_HIST_BUCKETS - 1;
+}
 
-    /* Wait for threads to initialize */
-    while (atomic_load(&thpool_p->num_threads_alive) != num_threads) {
-        /**
-         * 在创建与销毁等性能不那么敏感的地方，没有再添加条件变量。
-         * 如果为此添加一个条件变量和一个锁，仅仅为了创建和销毁的这一点小小的需求就要消耗88字节常驻内存，我有些无法接受。
-         * 其他地方的条件变量的检查都是需要多次使用的，唯独此处几乎仅需要检查一次，我实在不想为此实现cond和mutex的通知机制。
-         * 而相比原作者的自旋忙等待，采取了`nanosleep`等待的折中方案。
-         */
-        nanosleep(&(struct timespec) {0, 10000}, nullptr);
+static void producer_stats_init(producer_stats *stats_p)
+{
+    atomic_init(&stats_p->jobs_submitted, 0);
+    atomic_init(&stats_p->jobs_rejected, 0);
+    atomic_init(&stats_p->blocked_ns, 0);
+}
+
+static void worker_stats_init(worker_stats *stats_p)
+{
+    producer_stats_init(&stats_p->produced);
+    atomic_init(&stats_p->jobs_completed, 0);
+    atomic_init(&stats_p->busy_ns, 0);
+    atomic_init(&stats_p->idle_ns, 0);
+    for (int i = 0; i < THPOOL_STATS_HIST_BUCKETS; i++) {
+        atomic_init(&stats_p->queue_wait_hist[i], 0);
+        atomic_init(&stats_p->run_time_hist[i], 0);
     }
+}
 
-    return thpool_p;
+/**
+ * 外部生产者线程首次提交任务时，轮流分配一个条带，此后固定使用。条带编号与线程池无关，因此是进程全局的。
+ * 0表示尚未分配，其余值为条带编号加一。
+ */
+static _Thread_local unsigned thpool_producer_stripe;
+static atomic_uint thpool_producer_stripe_next;
 
-cleanup_threads_all_idle_cond:
-    pthread_cond_destroy(&thpool_p->threads_all_idle);
-cleanup_threads_all_idle_mutex:
-    pthread_mutex_destroy(&thpool_p->threads_all_idle_mutex);
-cleanup_threads_array:
-    free(thpool_p->threads);
-cleanup_TSD_key:
-    pthread_key_delete(thpool_p->key);
-cleanup_put_job_unblock:
-    pthread_cond_destroy(&thpool_p->put_job_unblock);
-cleanup_get_job_unblock:
-    pthread_cond_destroy(&thpool_p->get_job_unblock);
-cleanup_jobqueue:
-    /* 此处的锁逻辑上是无意义的，仅仅是为了遵循自己设计的API调用约定。    */
-    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
-    jobqueue_destroy_unsafe(&thpool_p->jobqueue);
-    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
-cleanup_jobqueue_rwmutex:
-    pthread_mutex_destroy(&(thpool_p->jobqueue_rwmutex));
-cleanup_passport:
-#ifdef THPOOL_ENABLE_DEBUG_CONC_API
-    if (bind_success) {
-        /* 如果最初绑定成功，passport状态块回退回THPOOL_UNBIND。    */
-        expected = THPOOL_ALIVE;
-        while (!atomic_compare_exchange_weak(&thpool_p->debug_conc_passport->state, &expected, THPOOL_UNBIND)) {
-            if (expected == THPOOL_ALIVE) {
-                /* 应该是弱交换造成的伪错误，继续循环。 */
-                continue;
-            } else {
-                /* 不明原因解绑失败，那没办法了，反正都要错误退出了。   */
-                thpool_log_error("passport unbind failed! The "THPOOL_PASSPORT_STATUS_REPORTER(thpool_p->debug_conc_passport, expected));
-                // Unbind failed from ALIVE state. What should happen? Passport is likely still bound.
-                // This indicates a serious error during initialization cleanup.
-                // Maybe just log and continue cleanup, leaving passport in potentially bad state?
-                // Or attempt to force the state? Forcing might hide errors. Log and continue is safer.
-                break;
-            }
-        }
-        thpool_p->debug_conc_passport->bind_pool = nullptr;
+/* 返回调用线程所属的条带，任务参数区也按该条带为外部线程分配。   */
+static inline unsigned thpool_producer_stripe_index(void)
+{
+    if (unlikely(thpool_producer_stripe == 0)) {
+        thpool_producer_stripe = (atomic_fetch_add_explicit(&thpool_producer_stripe_next, 1, memory_order_relaxed) & (THPOOL_STATS_STRIPES - 1)) + 1;
     }
-    if (!thpool_p->passport_user_owned) {
-        /* 若passport非用户持有，无警告地简单清理掉passport对象。   */
-        free(thpool_p->debug_conc_passport);
+    return thpool_producer_stripe - 1;
+}
+
+/* 返回调用者应使用的生产者计数器：工作线程使用自身的，外部线程使用所属条带的。  */
+static inline producer_stats *thpool_producer_stats(thpool *thpool_p, struct thread *thread_p)
+{
+    if (thread_p != nullptr) {
+        return &thread_p->stats.produced;
     }
-#else
-    free(thpool_p->debug_conc_passport);
-#endif
-cleanup_pool:
-    free(thpool_p);
-    return nullptr;
+    return &thpool_p->producer_stats[thpool_producer_stripe_index()];
 }
 
-/* 将thpool的threads_keepalive设置为false，并等待所有线程与正在执行中的thpool_add_work执行完毕。    */
-static int thpool_shutdown_safe_inner(thpool *thpool_p, conc_state_block *passport)
+static inline void thpool_stats_record_submit(thpool *thpool_p, struct thread *thread_p, int submitted, int rejected)
 {
-    /* 禁止线程池内的线程本身执行`thpool_shutdown`。    */
-    if (thpool_is_current_thread_owner(thpool_p)) {
-        errno = EINVAL;
-        return -1;
+    producer_stats *stats_p = thpool_producer_stats(thpool_p, thread_p);
+    if (submitted > 0) {
+        atomic_fetch_add_explicit(&stats_p->jobs_submitted, (unsigned long long)submitted, memory_order_relaxed);
+        THPOOL_PROBE3(job_enqueue, thpool_p, submitted, atomic_load_explicit(&thpool_p->num_jobs_queued, memory_order_relaxed));
     }
-    enum thpool_state expected = THPOOL_ALIVE;
-    /* 若交换失败，则发生了重复调用，错误退出。 */
-    if (!atomic_compare_exchange_strong(&passport->state, &expected, THPOOL_SHUTTING_DOWN)) {
-        thpool_log_error("cannot shutdown! The "THPOOL_PASSPORT_STATUS_REPORTER(passport, expected));
-        errno = EINVAL;
-        return -1;
+    if (rejected > 0) {
+        atomic_fetch_add_explicit(&stats_p->jobs_rejected, (unsigned long long)rejected, memory_order_relaxed);
+        THPOOL_PROBE2(job_reject, thpool_p, rejected);
     }
+}
 
-    /* End each thread 's infinite loop */
-    atomic_store(&thpool_p->threads_keepalive, false);
-    atomic_store(&thpool_p->threads_active, false);
+static inline void thpool_stats_update_peak(thpool *thpool_p, int queued)
+{
+    int peak = atomic_load_explicit(&thpool_p->queue_len_peak, memory_order_relaxed);
+    while (queued > peak && !atomic_compare_exchange_weak_explicit(&thpool_p->queue_len_peak, &peak, queued, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
 
-    /* 大幅修正原作者基于二元信号做的不优雅摧毁逻辑，一次广播即可保证所有jobqueue的阻塞取消。   */
-    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
-    pthread_cond_broadcast(&thpool_p->get_job_unblock);
-    pthread_cond_broadcast(&thpool_p->put_job_unblock);
-    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+/* ============================ JOB QUEUE =========================== */
 
-    /* Poll remaining threads */
-    while (atomic_load(&thpool_p->num_threads_alive) != 0) {
-        sleep(1);
+/* 新增参数最大任务数man_len。如果不是正整数，视为未设置上限。  */
+/* 环形缓冲区后端仅适用于有上限的队列，无上限时退回链表后端。  */
+/* Initialize queue */
+static int jobqueue_init(jobqueue *jobqueue_p, int max_len, threadpool_queue_backend backend, int aging_threshold, const int *level_max)
+{
+    jobqueue_p->len = 0;
+    jobqueue_p->level_mask = 0;
+    jobqueue_p->level_limited = false;
+    for (int i = 0; i < THPOOL_PRIO_LEVELS; i++) {
+        jobqueue_p->front[i] = nullptr;
+        jobqueue_p->rear[i]  = nullptr;
+        jobqueue_p->level_len[i] = 0;
+        jobqueue_p->level_skipped[i] = 0;
+        jobqueue_p->level_max[i] = (level_max[i] > 0) ? level_max[i] : 0;
+        if (jobqueue_p->level_max[i]) {
+            jobqueue_p->level_limited = true;
+        }
     }
+    jobqueue_p->level_skipped[THPOOL_PRIO_LEVELS] = 0;
+    jobqueue_p->aging_threshold = (aging_threshold > 0) ? aging_threshold : 0;
+    jobqueue_p->heap = nullptr;
+    jobqueue_p->heap_len = 0;
+    jobqueue_p->heap_cap = 0;
+    atomic_init(&jobqueue_p->num_expired, 0);
+    atomic_init(&jobqueue_p->len_urgent, 0);
+    jobqueue_p->max_len = (max_len > 0)?max_len:0;
+    jobqueue_p->backend = THPOOL_QUEUE_LINKED_LIST;
+    jobqueue_p->ring = nullptr;
 
-    /* 等待所有正在使用中的api退出。 */
-    while (atomic_load(&passport->num_api_use) != 0) {
-        sleep(1);
+    if (backend == THPOOL_QUEUE_RING) {
+        if (jobqueue_p->max_len == 0) {
+            thpool_log_warn("jobqueue_init(): ring buffer backend requires work_num_max > 0, fall back to linked list");
+            return 0;
+        }
+        jobqueue_p->ring = aligned_alloc(THPOOL_CACHE_LINE_SIZE, sizeof(jobring));
+        if (unlikely(jobqueue_p->ring == nullptr)) {
+            return -1;
+        }
+        if (unlikely(jobring_init(jobqueue_p->ring, jobqueue_p->max_len) == -1)) {
+            free(jobqueue_p->ring);
+            jobqueue_p->ring = nullptr;
+            return -1;
+        }
+        jobqueue_p->backend = THPOOL_QUEUE_RING;
     }
 
-    /* Job queue cleanup */
-    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
-    jobqueue_destroy_unsafe(&thpool_p->jobqueue);
-    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    return 0;
+}
 
-    expected = THPOOL_SHUTTING_DOWN;
-    /* 若交换失败，不明原因，可能是弱交换的固有问题，继续等待   */
-    while (!atomic_compare_exchange_weak(&passport->state, &expected, THPOOL_SHUTDOWN)) {
-        if (expected == THPOOL_SHUTTING_DOWN) {
-            /* 应该是弱交换造成的伪错误，继续循环。 */
-            continue;
-        } else {
-            /* 其他情况理论不可达，abort。  */
-            thpool_log_fatal("shutdown but status panic! The "THPOOL_PASSPORT_STATUS_REPORTER(passport, expected));
-            abort();
+/* Clear the queue */
+static void jobqueue_clear_unsafe(jobqueue *jobqueue_p)
+{
+    /* 任务节点属于任务分配器，随`thpool_destroy`统一释放，这里只需摘除。被丢弃的完成句柄任务以取消状态完成。  */
+    while (jobqueue_p->len) {
+        job *job_p = jobqueue_pull_unsafe(jobqueue_p);
+        thpool_job_discard(job_p->function, job_p->arg);
+    }
+
+    for (int i = 0; i < THPOOL_PRIO_LEVELS; i++) {
+        jobqueue_p->front[i] = nullptr;
+        jobqueue_p->rear[i]  = nullptr;
+        jobqueue_p->level_len[i] = 0;
+        jobqueue_p->level_skipped[i] = 0;
+    }
+    jobqueue_p->level_skipped[THPOOL_PRIO_LEVELS] = 0;
+    jobqueue_p->level_mask = 0;
+    jobqueue_p->heap_len = 0;
+    jobqueue_p->len = 0;
+    atomic_store(&jobqueue_p->len_urgent, 0);
+
+    if (jobqueue_p->ring != nullptr) {
+        job discard;
+        while (jobring_pop(jobqueue_p->ring, &discard)) {
+            thpool_job_discard(discard.function, discard.arg);
         }
     }
-    return 0;
 }
 
-/* Destroy the threadpool */
-static int thpool_destroy_safe_inner(thpool *thpool_p, conc_state_block *passport)
+/* Free all queue resources back to the system */
+static void jobqueue_destroy_unsafe(jobqueue *jobqueue_p)
 {
-    /* 禁止线程池内的线程本身执行`thpool_destroy`。    */
-    if (thpool_is_current_thread_owner(thpool_p)) {
-        errno = EINVAL;
-        return -1;
+    jobqueue_clear_unsafe(jobqueue_p);
+    free(jobqueue_p->heap);
+    jobqueue_p->heap = nullptr;
+    jobqueue_p->heap_cap = 0;
+    if (jobqueue_p->ring != nullptr) {
+        jobring_destroy(jobqueue_p->ring);
+        free(jobqueue_p->ring);
+        jobqueue_p->ring = nullptr;
     }
+}
 
-    enum thpool_state expected = THPOOL_SHUTDOWN;
-    /* 若交换失败，情况可能有多种，分别讨论。   */
-    while (!atomic_compare_exchange_weak(&passport->state, &expected, THPOOL_DESTROYING)) {
-        /* 根据不同情形决定不同应对 */
-        switch (expected) {
-        case THPOOL_ALIVE:
-            //还没有开始shutdown，尝试运行shutdown，并警告用户尽量先shutdown。
-#ifdef THPOOL_ENABLE_DEBUG_CONC_API
-            thpool_log_warn("threadpool %p:%s has not shutdown yet, `thpool_shutdown` first is recommanded. Try auto shutdown...", passport->bind_pool, passport->name_copy);
+
+/* 修改为不加锁的版本，最简化push逻辑。使用该函数应在读写锁保护下。有保护的版本为thpool_put_job。 */
+/* Add (allocated) job to the sub-queue of its priority
+*/
+static void jobqueue_push_unsafe(jobqueue *jobqueue_p, struct job *newjob, threadpool_priority prio)
+{
+    newjob->prev = nullptr;
+
+    switch (jobqueue_p->level_len[prio]) {
+    case 0:  /* if no jobs in this level */
+            jobqueue_p->front[prio] = newjob;
+            jobqueue_p->rear[prio]  = newjob;
+            jobqueue_p->level_mask |= 1u << prio;
+            break;
+
+    default: /* if jobs in this level */
+            jobqueue_p->rear[prio]->prev = newjob;
+            jobqueue_p->rear[prio] = newjob;
+    }
+
+    jobqueue_p->level_len[prio]++;
+    jobqueue_p->len++;
+    if (prio < THPOOL_PRIO_NORMAL) {
+        atomic_fetch_add_explicit(&jobqueue_p->len_urgent, 1, memory_order_relaxed);
+    }
+}
+
+/* 返回非空级别中优先级最高（编号最小）的级别。调用者须保证mask非零。  */
+static inline int jobqueue_highest_level(unsigned mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
 #else
-            thpool_log_warn("threadpool has not shutdown yet, `thpool_shutdown` first is recommanded. Try auto shutdown...");
+    int level = 0;
+    while (!(mask & 1u)) {
+        mask >>= 1;
+        level++;
+    }
+    return level;
 #endif
-            thpool_shutdown_safe_inner(thpool_p, passport);
-            /* 不论结果如何，先continue根据新的expected再看。*/
-            break;
-        case THPOOL_SHUTTING_DOWN:
-#ifdef THPOOL_ENABLE_DEBUG_CONC_API
-            thpool_log_warn("threadpool %p:%s is shutting down, waiting ...", passport->bind_pool, passport->name_copy);
+}
+
+/* 返回非空级别中优先级最低（编号最大）的级别。调用者须保证mask非零。  */
+static inline int jobqueue_lowest_level(unsigned mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return 31 - __builtin_clz(mask);
 #else
-            thpool_log_warn("threadpool is shutting down, waiting ...");
+    int level = THPOOL_PRIO_LEVELS - 1;
+    while (!(mask & (1u << level))) {
+        level--;
+    }
+    return level;
 #endif
-            sleep(1);
-            break;
-        case THPOOL_SHUTDOWN:
-            /* 假失败，重试。   */
+}
+
+/* Get first job of the highest non-empty level from queue(removes it from queue)
+* Notice: Caller MUST hold a mutex
+*/
+static struct job *jobqueue_pull_unsafe(jobqueue *jobqueue_p)
+{
+    if (jobqueue_p->len == 0) {
+        return nullptr;
+    }
+
+    /* 截止时间堆相当于`THPOOL_PRIO_HIGH`与`THPOOL_PRIO_NORMAL`之间的一个级别，以THPOOL_PRIO_LEVELS表示。   */
+    int level = (jobqueue_p->level_mask != 0) ? jobqueue_highest_level(jobqueue_p->level_mask) : THPOOL_PRIO_LEVELS;
+    int first = (jobqueue_p->heap_len > 0 && level >= THPOOL_PRIO_NORMAL) ? THPOOL_PRIO_LEVELS : level;
+    int pick = first;
+    if (jobqueue_p->aging_threshold) {
+        /* 被跳过的非空低优先级级别计数加一，其中优先级最高的已到期级别本次出队。截止时间堆按其位置参与老化，
+         * 持续的高优先级任务因此也不会让它饿死。级别数固定，仍为O(1)。  */
+        bool passed = false;
+        for (int rank = 0; rank <= THPOOL_PRIO_LEVELS; rank++) {
+            int i = (rank < THPOOL_PRIO_NORMAL) ? rank : (rank == THPOOL_PRIO_NORMAL) ? THPOOL_PRIO_LEVELS : rank - 1;
+            if (!passed) {
+                passed = (i == first);
+                continue;
+            }
+            if ((i == THPOOL_PRIO_LEVELS) ? jobqueue_p->heap_len == 0 : jobqueue_p->level_len[i] == 0) {
+                continue;
+            }
+            if (++jobqueue_p->level_skipped[i] >= jobqueue_p->aging_threshold && pick == first) {
+                pick = i;
+            }
+        }
+        jobqueue_p->level_skipped[pick] = 0;
+    }
+
+    if (pick == THPOOL_PRIO_LEVELS) {
+        return jobqueue_pull_deadline_unsafe(jobqueue_p);
+    }
+    return jobqueue_pull_level_unsafe(jobqueue_p, pick);
+}
+
+/* 取出指定非空级别的最早任务。调用者须持锁。   */
+static struct job *jobqueue_pull_level_unsafe(jobqueue *jobqueue_p, int level)
+{
+    job *job_p = jobqueue_p->front[level];
+
+    switch (jobqueue_p->level_len[level]) {
+    case 1:  /* if one job in this level */
+            jobqueue_p->front[level] = nullptr;
+            jobqueue_p->rear[level]  = nullptr;
+            jobqueue_p->level_mask &= ~(1u << level);
             break;
-        default:
-            thpool_log_error("cannot destroy! The "THPOOL_PASSPORT_STATUS_REPORTER(passport, expected));
-            errno = EINVAL;
+
+    default: /* if >1 jobs in this level */
+            jobqueue_p->front[level] = job_p->prev;
+    }
+
+    jobqueue_p->level_len[level]--;
+    jobqueue_p->len--;
+    if (level < THPOOL_PRIO_NORMAL) {
+        atomic_fetch_sub_explicit(&jobqueue_p->len_urgent, 1, memory_order_relaxed);
+    }
+    return job_p;
+}
+
+/**
+ * 从front经prev链向rear的任务链表中摘除任务函数与参数都匹配的任务，摘下的节点经prev串成链表交给removed_out，
+ * 返回摘除的数量。链表可以是共享链表的一个级别，也可以是线程的私有队列，长度等计数由调用者修正。调用者须持锁。
+ */
+static int job_list_remove_unsafe(job **front_p, job **rear_p, void (*function_p)(void *, threadpool_thread), void *arg_p, job **removed_out)
+{
+    int removed = 0;
+    job *kept_p = nullptr;
+    job *job_p = *front_p;
+    *removed_out = nullptr;
+    while (job_p != nullptr) {
+        job *next_p = job_p->prev;
+        if (job_p->function == function_p && job_p->arg == arg_p) {
+            if (kept_p != nullptr) {
+                kept_p->prev = next_p;
+            } else {
+                *front_p = next_p;
+            }
+            if (*rear_p == job_p) {
+                *rear_p = kept_p;
+            }
+            job_p->prev = *removed_out;
+            *removed_out = job_p;
+            removed++;
+        } else {
+            kept_p = job_p;
+        }
+        job_p = next_p;
+    }
+    return removed;
+}
+
+/* 过期回调为空指针的截止时间任务过期后改为执行本函数，即直接丢弃。  */
+static void thpool_deadline_drop(void *arg_p, threadpool_thread current_thrd)
+{
+    (void)arg_p;
+    (void)current_thrd;
+}
+
+/**
+ * 放入截止时间堆。堆数组按需倍增，扩容失败时返回-1，任务未入队。调用者须持锁。
+ * 截止时间任务与高于普通优先级的任务一样计入len_urgent，不持锁的取任务路径因此先进入持锁路径。
+ */
+static int jobqueue_push_deadline_unsafe(jobqueue *jobqueue_p, struct job *newjob, uint64_t deadline_ns, void (*on_expire)(void *, threadpool_thread))
+{
+    if (unlikely(jobqueue_p->heap_len == jobqueue_p->heap_cap)) {
+        int cap = (jobqueue_p->heap_cap > 0) ? jobqueue_p->heap_cap * 2 : 64;
+        jobheap_entry *heap = realloc(jobqueue_p->heap, (size_t)cap * sizeof(jobheap_entry));
+        if (unlikely(heap == nullptr)) {
             return -1;
         }
-        continue;
+        jobqueue_p->heap = heap;
+        jobqueue_p->heap_cap = cap;
     }
-#ifdef THPOOL_ENABLE_DEBUG_CONC_API
-    bool passport_user_owned = thpool_p->passport_user_owned;
+
+    /* 上浮。截止时间相同的任务之间不保证先后。    */
+    jobheap_entry *heap = jobqueue_p->heap;
+    int i = jobqueue_p->heap_len++;
+    while (i > 0) {
+        int parent = (i - 1) / THPOOL_DEADLINE_HEAP_ARITY;
+        if (heap[parent].deadline_ns <= deadline_ns) {
+            break;
+        }
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = (jobheap_entry) {deadline_ns, on_expire, newjob};
+
+    jobqueue_p->len++;
+    atomic_fetch_add_explicit(&jobqueue_p->len_urgent, 1, memory_order_relaxed);
+    return 0;
+}
+
+/**
+ * 取出截止时间最早的任务。调用者须持锁，并保证堆非空。
+ * 任务已过期时改写节点的任务函数为过期回调，工作线程照常执行它，回收节点与统计的路径与普通任务相同。
+ */
+static struct job *jobqueue_pull_deadline_unsafe(jobqueue *jobqueue_p)
+{
+    jobheap_entry *heap = jobqueue_p->heap;
+    jobheap_entry top = heap[0];
+    jobheap_entry last = heap[--jobqueue_p->heap_len];
+    int len = jobqueue_p->heap_len;
+
+    /* 下沉。   */
+    int i = 0;
+    for (;;) {
+        int child = i * THPOOL_DEADLINE_HEAP_ARITY + 1;
+        if (child >= len) {
+            break;
+        }
+        int end = (child + THPOOL_DEADLINE_HEAP_ARITY < len) ? child + THPOOL_DEADLINE_HEAP_ARITY : len;
+        int min = child;
+        for (int c = child + 1; c < end; c++) {
+            if (heap[c].deadline_ns < heap[min].deadline_ns) {
+                min = c;
+            }
+        }
+        if (last.deadline_ns <= heap[min].deadline_ns) {
+            break;
+        }
+        heap[i] = heap[min];
+        i = min;
+    }
+    if (len > 0) {
+        heap[i] = last;
+    }
+
+    jobqueue_p->len--;
+    atomic_fetch_sub_explicit(&jobqueue_p->len_urgent, 1, memory_order_relaxed);
+    if (top.deadline_ns <= thpool_now_ns()) {
+        top.job_p->function = (top.on_expire != nullptr) ? top.on_expire : thpool_deadline_drop;
+        atomic_fetch_add_explicit(&jobqueue_p->num_expired, 1, memory_order_relaxed);
+    }
+    return top.job_p;
+}
+
+/**
+ * 返回指定级别还能容纳的任务数，至多为num。prio为负数或该级别没有单独上限时，返回num。
+ * 级别的单独上限只约束链表后端中的任务，线程池整体的上限由名额保证。
+ */
+static int jobqueue_level_room_unsafe(jobqueue *jobqueue_p, int prio, int num)
+{
+    if (prio < 0 || jobqueue_p->level_max[prio] == 0) {
+        return num;
+    }
+    int room = jobqueue_p->level_max[prio] - jobqueue_p->level_len[prio];
+    return (room < num) ? room : num;
+}
+
+/* ============================ JOB POOL ============================ */
+
+static void jobpool_init(jobpool *jobpool_p, int max_nodes)
+{
+    atomic_init(&jobpool_p->returned, nullptr);
+    jobpool_p->free_list = nullptr;
+    jobpool_p->slabs = nullptr;
+    atomic_init(&jobpool_p->num_nodes, 0);
+    atomic_init(&jobpool_p->num_detached, 0);
+    jobpool_p->max_nodes = max_nodes;
+}
+
+/* 释放所有slab。调用者须保证已没有任何线程持有或访问任务节点。  */
+static void jobpool_destroy(jobpool *jobpool_p)
+{
+    jobslab *slab_p = jobpool_p->slabs;
+    while (slab_p != nullptr) {
+        jobslab *next = slab_p->next;
+        free(slab_p);
+        slab_p = next;
+    }
+    jobpool_p->slabs = nullptr;
+    jobpool_p->free_list = nullptr;
+    atomic_store(&jobpool_p->returned, nullptr);
+}
+
+/**
+ * 取一个空闲节点。free_list为空时先取走整个归还栈，仍为空且grow为真时申请新的slab。
+ * 有上限时，slab的总节点数不超过max_nodes。
+ * 返回空指针表示没有空闲节点（grow为假）或内存不足。调用者持有jobqueue_rwmutex，这里不写日志，由调用者解锁后报告。
+ */
+static struct job *jobpool_alloc_unsafe(jobpool *jobpool_p, bool grow)
+{
+    if (jobpool_p->free_list == nullptr) {
+        jobpool_p->free_list = atomic_exchange_explicit(&jobpool_p->returned, nullptr, memory_order_acquire);
+    }
+    if (jobpool_p->free_list == nullptr && grow) {
+        int num_nodes = atomic_load_explicit(&jobpool_p->num_nodes, memory_order_relaxed);
+        int count = THPOOL_JOB_SLAB_SIZE;
+        if (jobpool_p->max_nodes) {
+            int max_nodes = jobpool_p->max_nodes + atomic_load_explicit(&jobpool_p->num_detached, memory_order_relaxed);
+            /* 按上限的推导不应出现节点已达上限的情形，若出现，宁可超出上限也不令入队失败。 */
+            if (num_nodes < max_nodes) {
+                count = (max_nodes - num_nodes < count) ? max_nodes - num_nodes : count;
+            }
+        }
+        jobslab *slab_p = malloc(sizeof(jobslab) + sizeof(job) * count);
+        if (unlikely(slab_p == nullptr)) {
+            return nullptr;
+        }
+        slab_p->next = jobpool_p->slabs;
+        jobpool_p->slabs = slab_p;
+        for (int i = 0; i < count; i++) {
+            slab_p->nodes[i].prev = (i + 1 < count) ? &slab_p->nodes[i + 1] : nullptr;
+        }
+        jobpool_p->free_list = &slab_p->nodes[0];
+        atomic_store_explicit(&jobpool_p->num_nodes, num_nodes + count, memory_order_relaxed);
+    }
+
+    job *job_p = jobpool_p->free_list;
+    if (job_p != nullptr) {
+        jobpool_p->free_list = job_p->prev;
+    }
+    return job_p;
+}
+
+/* 把未使用的节点放回free_list。   */
+static void jobpool_free_unsafe(jobpool *jobpool_p, struct job *job_p)
+{
+    job_p->prev = jobpool_p->free_list;
+    jobpool_p->free_list = job_p;
+}
+
+/* 不持锁地把节点压入归还栈，供任意线程调用。  */
+static void jobpool_return(jobpool *jobpool_p, struct job *job_p)
+{
+    job *head = atomic_load_explicit(&jobpool_p->returned, memory_order_relaxed);
+    do {
+        job_p->prev = head;
+    } while (!atomic_compare_exchange_weak_explicit(&jobpool_p->returned, &head, job_p, memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * 工作线程分配任务节点，优先使用自身缓存。缓存为空时，加锁一次从分配器取回至多半个缓存的节点，摊薄加锁开销。
+ */
+static struct job *thread_alloc_job(thpool *thpool_p, struct thread *thread_p)
+{
+    if (thread_p->job_cache == nullptr) {
+        pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+        job *job_p = jobpool_alloc_unsafe(&thpool_p->jobpool, true);
+        for (int i = 0; job_p != nullptr && i < THPOOL_JOB_CACHE_SIZE / 2; i++) {
+            job_p->prev = thread_p->job_cache;
+            thread_p->job_cache = job_p;
+            thread_p->job_cache_len++;
+            job_p = jobpool_alloc_unsafe(&thpool_p->jobpool, false);
+        }
+        if (job_p != nullptr) {
+            jobpool_free_unsafe(&thpool_p->jobpool, job_p);
+        }
+        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+        if (thread_p->job_cache == nullptr) {
+            thpool_log_error("thread_alloc_job(): Could not allocate memory for job slab");
+            return nullptr;
+        }
+    }
+    job *job_p = thread_p->job_cache;
+    thread_p->job_cache = job_p->prev;
+    thread_p->job_cache_len--;
+    return job_p;
+}
+
+/* ======================== COMPLETION HANDLE ======================= */
+
+/**
+ * 完成句柄的状态。等待方把PENDING改为WAITED后才休眠，完成方交换得到WAITED时才需要唤醒。
+ */
+enum thpool_handle_state {
+    THPOOL_HANDLE_PENDING = 0,              /* 任务尚未完成，无人等待。   */
+    THPOOL_HANDLE_WAITED,                   /* 任务尚未完成，有人在等待。 */
+    THPOOL_HANDLE_DONE,                     /* 任务已执行。  */
+    THPOOL_HANDLE_CANCELLED,                /* 任务被`thpool_shutdown`丢弃。  */
+};
+
+/**
+ * `thpool_handle_wait_any`无法同时在多个地址上休眠，因此在全局的纪元计数上休眠。
+ * 只有存在wait_any等待方时，完成方才更新并唤醒纪元计数。
+ */
+static atomic_uint thpool_handle_epoch;
+static atomic_int thpool_handle_any_waiters;
+
+/**
+ * 在地址上的值仍等于val时休眠，至多timeout_ns纳秒（不大于0表示不限时），返回后调用者须重新检查。
+ * Linux下直接使用futex；其他系统退回到一对全局的互斥锁与条件变量，仅在有人等待时使用。
+ * 完成句柄与任务组共用这一对原语。
+ */
+#if defined(__linux__)
+static inline void thpool_futex_wait(atomic_uint *addr, unsigned val, long timeout_ns)
+{
+    struct timespec timeout = {timeout_ns / 1000000000L, timeout_ns % 1000000000L};
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, (timeout_ns > 0) ? &timeout : nullptr, nullptr, 0);
+}
+
+/* 唤醒方在此之后不再访问该地址所在的对象，即使对象随即被释放，futex也只会产生无害的虚假唤醒或EFAULT。  */
+static inline void thpool_futex_wake(atomic_uint *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+#else
+static pthread_mutex_t thpool_futex_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t thpool_futex_cond = PTHREAD_COND_INITIALIZER;
+
+static inline void thpool_futex_wait(atomic_uint *addr, unsigned val, long timeout_ns)
+{
+    struct timespec deadline;
+    if (timeout_ns > 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ns / 1000000000L;
+        deadline.tv_nsec += timeout_ns % 1000000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    pthread_mutex_lock(&thpool_futex_mutex);
+    while (atomic_load(addr) == val) {
+        if (timeout_ns > 0) {
+            if (pthread_cond_timedwait(&thpool_futex_cond, &thpool_futex_mutex, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        } else {
+            pthread_cond_wait(&thpool_futex_cond, &thpool_futex_mutex);
+        }
+    }
+    pthread_mutex_unlock(&thpool_futex_mutex);
+}
+
+/* 值已在锁外修改，加锁一次保证等待方要么尚未检查，要么已在条件变量上休眠。 */
+static inline void thpool_futex_wake(atomic_uint *addr)
+{
+    (void)addr;
+    pthread_mutex_lock(&thpool_futex_mutex);
+    pthread_mutex_unlock(&thpool_futex_mutex);
+    pthread_cond_broadcast(&thpool_futex_cond);
+}
 #endif
 
-    /* Deallocs */
-    int n;
-    for (n=0; n < thpool_p->num_threads; n++) {
-        thread_destroy(thpool_p->threads[n]);
+/* 实际入队的任务：执行用户的任务函数后完成句柄，并解除待执行任务持有的引用。 */
+static void thpool_handle_run(void *arg_p, threadpool_thread current_thrd)
+{
+    struct job *handle_p = arg_p;
+    handle_p->function(handle_p->arg, current_thrd);
+    thpool_handle_complete(handle_p, THPOOL_HANDLE_DONE);
+    thpool_handle_unref(handle_p);
+}
+
+/**
+ * 以一次原子交换完成句柄，只有交换出WAITED时才进行唤醒的系统调用。
+ * 交换使用acq_rel序：release令等待方看到任务函数的全部写入；acquire令完成方看到wait_any等待方先于标记WAITED的登记。
+ */
+static void thpool_handle_complete(struct job *handle_p, unsigned state)
+{
+    if (atomic_exchange_explicit(&handle_p->handle.state, state, memory_order_acq_rel) != THPOOL_HANDLE_WAITED) {
+        return;
     }
-    free(thpool_p->threads);
+    thpool_futex_wake(&handle_p->handle.state);
+    if (atomic_load(&thpool_handle_any_waiters) > 0) {
+        atomic_fetch_add_explicit(&thpool_handle_epoch, 1, memory_order_acq_rel);
+        thpool_futex_wake(&thpool_handle_epoch);
+    }
+}
 
-    pthread_mutex_destroy(&thpool_p->threads_all_idle_mutex);
-    pthread_cond_destroy(&thpool_p->threads_all_idle);
-    pthread_mutex_destroy(&(thpool_p->jobqueue_rwmutex));
-    pthread_cond_destroy(&thpool_p->get_job_unblock);
-    pthread_cond_destroy(&thpool_p->put_job_unblock);
-    pthread_key_delete(thpool_p->key);
+/* 最后一个引用解除时，把节点归还给所属线程池的任务分配器。   */
+static void thpool_handle_unref(struct job *handle_p)
+{
+    if (atomic_fetch_sub_explicit(&handle_p->handle.refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    thpool *thpool_p = handle_p->owner;
+    atomic_fetch_sub_explicit(&thpool_p->jobpool.num_detached, 1, memory_order_relaxed);
+    jobpool_return(&thpool_p->jobpool, handle_p);
+}
 
-    free(thpool_p);
-    expected = THPOOL_DESTROYING;
-    /* 若交换失败，不明原因，可能是弱交换的固有问题，继续等待   */
-    while (!atomic_compare_exchange_weak(&passport->state, &expected, THPOOL_DESTROYED)) {
-        if (expected == THPOOL_DESTROYING) {
-            /* 应该是弱交换造成的伪错误，继续循环。 */
+/**
+ * `thpool_shutdown`丢弃排队任务时调用。若被丢弃的是完成句柄的任务，以取消状态完成句柄；
+ * 若是任务组的任务，回收载体并以取消状态计入任务组；若是执行域的服务任务，减少执行域的服务任务数；
+ * 若是协程的恢复任务，协程不再恢复，其栈随`thpool_shutdown`释放。
+ */
+static inline void thpool_job_discard(void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (function_p == thpool_handle_run) {
+        thpool_handle_complete(arg_p, THPOOL_HANDLE_CANCELLED);
+        thpool_handle_unref(arg_p);
+    } else if (function_p == thpool_group_run) {
+        struct job *carrier_p = arg_p;
+        struct thpool_group *group_p = carrier_p->group;
+        atomic_fetch_sub_explicit(&group_p->thpool_p->jobpool.num_detached, 1, memory_order_relaxed);
+        jobpool_return(&group_p->thpool_p->jobpool, carrier_p);
+        thpool_group_done(group_p, true);
+    } else if (function_p == thpool_domain_serve) {
+        atomic_fetch_sub(&((thpool *)arg_p)->domain_servers, 1);
+#ifdef THPOOL_HAS_FIBERS
+    } else if (function_p == thpool_fiber_resume) {
+        atomic_fetch_sub(&((thpool_fiber *)arg_p)->thpool_p->fibers.num_live, 1);
+#endif
+    }
+}
+
+/**
+ * 标记为WAITED后休眠，直到句柄完成。
+ * @return 句柄的最终状态。
+ */
+static unsigned thpool_handle_wait_state(struct job *handle_p)
+{
+    unsigned state = atomic_load_explicit(&handle_p->handle.state, memory_order_acquire);
+    while (state < THPOOL_HANDLE_DONE) {
+        if (state == THPOOL_HANDLE_PENDING &&
+            !atomic_compare_exchange_weak_explicit(&handle_p->handle.state, &state, THPOOL_HANDLE_WAITED, memory_order_acquire, memory_order_acquire)) {
             continue;
-        } else {
-            /* 理论不可达的情况，abort  */
-            thpool_log_fatal("destroyed but status panic! The "THPOOL_PASSPORT_STATUS_REPORTER(passport, expected));
-            abort();
         }
+        thpool_futex_wait(&handle_p->handle.state, THPOOL_HANDLE_WAITED, 0);
+        state = atomic_load_explicit(&handle_p->handle.state, memory_order_acquire);
     }
-#ifdef THPOOL_ENABLE_DEBUG_CONC_API
-    /* 若passport非用户持有，无警告地简单清理掉passport对象。   */
-    if (!passport_user_owned) {
-        free(passport);
+    return state;
+}
+
+int thpool_handle_try(threadpool_handle handle)
+{
+    if (unlikely(handle == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    switch (atomic_load_explicit(&handle->handle.state, memory_order_acquire)) {
+    case THPOOL_HANDLE_DONE:
+        return 1;
+    case THPOOL_HANDLE_CANCELLED:
+        errno = ECANCELED;
+        return -1;
+    default:
+        return 0;
+    }
+}
+
+int thpool_handle_wait(threadpool_handle handle)
+{
+    if (unlikely(handle == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (thpool_handle_wait_state(handle) == THPOOL_HANDLE_CANCELLED) {
+        errno = ECANCELED;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 先登记为wait_any等待方并读取纪元，再把各句柄标记为WAITED。
+ * 此后完成的句柄必然交换出WAITED并看到登记，从而推进纪元，纪元变化时休眠立即返回，不会错过唤醒。
+ */
+int thpool_handle_wait_any(threadpool_handle *handles, int num)
+{
+    if (unlikely(handles == nullptr) || unlikely(num <= 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < num; i++) {
+        if (unlikely(handles[i] == nullptr)) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    atomic_fetch_add(&thpool_handle_any_waiters, 1);
+    int found = -1;
+    while (found < 0) {
+        unsigned epoch = atomic_load_explicit(&thpool_handle_epoch, memory_order_acquire);
+        for (int i = 0; i < num && found < 0; i++) {
+            unsigned state = atomic_load_explicit(&handles[i]->handle.state, memory_order_acquire);
+            while (state == THPOOL_HANDLE_PENDING &&
+                   !atomic_compare_exchange_weak_explicit(&handles[i]->handle.state, &state, THPOOL_HANDLE_WAITED, memory_order_acq_rel, memory_order_acquire)) {
+                ;
+            }
+            if (state >= THPOOL_HANDLE_DONE) {
+                found = i;
+            }
+        }
+        if (found < 0) {
+            thpool_futex_wait(&thpool_handle_epoch, epoch, 0);
+        }
+    }
+    atomic_fetch_sub(&thpool_handle_any_waiters, 1);
+    return found;
+}
+
+int thpool_handle_wait_all(threadpool_handle *handles, int num)
+{
+    if (unlikely(num < 0) || unlikely(num > 0 && handles == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < num; i++) {
+        if (unlikely(handles[i] == nullptr)) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    bool cancelled = false;
+    for (int i = 0; i < num; i++) {
+        cancelled |= (thpool_handle_wait_state(handles[i]) == THPOOL_HANDLE_CANCELLED);
+    }
+    if (cancelled) {
+        errno = ECANCELED;
+        return -1;
+    }
+    return 0;
+}
+
+void thpool_handle_release(threadpool_handle handle)
+{
+    if (handle != nullptr) {
+        thpool_handle_unref(handle);
+    }
+}
+
+/* =========================== TASK GROUP =========================== */
+
+/**
+ * @brief Polling interval of a worker waiting on a group while no job can be taken.
+ *
+ * 工作线程在任务组上等待且暂时取不到任务时的休眠上限。休眠期间新入队的任务不会唤醒它，
+ * 限时休眠保证它能回来协助执行。外部线程不协助执行，不限时休眠。
+ */
+#define THPOOL_GROUP_HELP_POLL_NS   1000000L
+
+/* 实际入队的任务：先把载体归还到本线程的缓存，再执行用户的任务函数并计入任务组。    */
+static void thpool_group_run(void *arg_p, threadpool_thread current_thrd)
+{
+    struct job *carrier_p = arg_p;
+    struct thpool_group *group_p = carrier_p->group;
+    void (*function_p)(void *, threadpool_thread) = carrier_p->function;
+    void *user_arg_p = carrier_p->arg;
+
+    atomic_fetch_sub_explicit(&group_p->thpool_p->jobpool.num_detached, 1, memory_order_relaxed);
+    thread_release_job(current_thrd, carrier_p);
+    function_p(user_arg_p, current_thrd);
+    thpool_group_done(group_p, false);
+}
+
+/**
+ * 计数减一。以CAS一次同时更新计数与标志：归零时清除等待标志，旧值带有等待标志时才唤醒，已分离的任务组则直接释放。
+ * CAS使用acq_rel序，令等待方看到任务函数的全部写入。
+ */
+static void thpool_group_done(struct thpool_group *group_p, bool cancelled)
+{
+    unsigned old = atomic_load_explicit(&group_p->state, memory_order_relaxed);
+    unsigned new;
+    do {
+        new = old - 1;
+        if ((new & THPOOL_GROUP_COUNT_MASK) == 0) {
+            new &= ~THPOOL_GROUP_WAITED;
+        }
+        if (cancelled) {
+            new |= THPOOL_GROUP_CANCELLED;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&group_p->state, &old, new, memory_order_acq_rel, memory_order_relaxed));
+
+    if ((new & THPOOL_GROUP_COUNT_MASK) == 0) {
+        if (new & THPOOL_GROUP_DETACHED) {
+            free(group_p);
+        } else if (old & THPOOL_GROUP_WAITED) {
+            thpool_futex_wake(&group_p->state);
+        }
+    }
+}
+
+static struct thpool_group *thpool_group_create_inner(thpool *thpool_p)
+{
+    struct thpool_group *group_p = malloc(sizeof(struct thpool_group));
+    if (unlikely(group_p == nullptr)) {
+        thpool_log_error("thpool_group_create(): Could not allocate memory for task group");
+        return nullptr;
+    }
+    group_p->thpool_p = thpool_p;
+    atomic_init(&group_p->state, 0);
+    return group_p;
+}
+
+/**
+ * 计数先于入队增加，任务执行完毕前计数不会归零。载体从任务分配器取得，
+ * 以`thpool_group_run`为任务函数、载体为参数，按`thpool_add_work`的路径提交。
+ */
+static int thpool_group_add_work_inner(struct thpool_group *group_p, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    thpool *thpool_p = group_p->thpool_p;
+    struct thread *current_thrd = thpool_current_thread(thpool_p);
+    job *carrier_p;
+    if (current_thrd != nullptr) {
+        carrier_p = thread_alloc_job(thpool_p, current_thrd);
+    } else {
+        pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+        carrier_p = jobpool_alloc_unsafe(&thpool_p->jobpool, true);
+        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+        if (unlikely(carrier_p == nullptr)) {
+            thpool_log_error("thpool_group_add_work(): Could not allocate memory for job slab");
+        }
+    }
+    if (unlikely(carrier_p == nullptr)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    atomic_fetch_add_explicit(&thpool_p->jobpool.num_detached, 1, memory_order_relaxed);
+    carrier_p->group = group_p;
+    carrier_p->function = function_p;
+    carrier_p->arg = arg_p;
+
+    atomic_fetch_add_explicit(&group_p->state, 1, memory_order_relaxed);
+    if (unlikely(thpool_add_work_inner(thpool_p, thpool_group_run, carrier_p) != 0)) {
+        int err = errno;
+        atomic_fetch_sub_explicit(&thpool_p->jobpool.num_detached, 1, memory_order_relaxed);
+        jobpool_return(&thpool_p->jobpool, carrier_p);
+        thpool_group_done(group_p, false);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 在线程池的工作线程内调用时，等待期间协助执行排队的任务（不限于本组），
+ * 因此即使所有工作线程都在等待任务组，组内的任务也能得到执行。
+ * 外部线程没有可以传给任务函数的线程句柄，只休眠等待。
+ */
+int thpool_group_wait(threadpool_group group)
+{
+    if (unlikely(group == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    thpool *thpool_p = group->thpool_p;
+    struct thread *current_thrd = thpool_current_thread(thpool_p);
+
+    unsigned state = atomic_load_explicit(&group->state, memory_order_acquire);
+    while (state & THPOOL_GROUP_COUNT_MASK) {
+        if (current_thrd != nullptr) {
+            /* 线程池关闭时不再取任务，剩余的任务将被`thpool_shutdown`取消。   */
+            if (unlikely(!atomic_load(&thpool_p->threads_keepalive))) {
+                errno = ECANCELED;
+                return -1;
+            }
+            job *job_p = thpool_try_get_job(thpool_p, current_thrd);
+            if (job_p != nullptr) {
+                thread_run_job(current_thrd, job_p, true);
+                state = atomic_load_explicit(&group->state, memory_order_acquire);
+                continue;
+            }
+        }
+        if (!(state & THPOOL_GROUP_WAITED) &&
+            !atomic_compare_exchange_weak_explicit(&group->state, &state, state | THPOOL_GROUP_WAITED, memory_order_acquire, memory_order_acquire)) {
+            continue;
+        }
+        thpool_futex_wait(&group->state, state | THPOOL_GROUP_WAITED, (current_thrd != nullptr) ? THPOOL_GROUP_HELP_POLL_NS : 0);
+        state = atomic_load_explicit(&group->state, memory_order_acquire);
+    }
+
+    if (state & THPOOL_GROUP_CANCELLED) {
+        errno = ECANCELED;
+        return -1;
+    }
+    return 0;
+}
+
+int thpool_group_destroy(threadpool_group group)
+{
+    if (unlikely(group == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(atomic_load(&group->state) & THPOOL_GROUP_COUNT_MASK)) {
+        errno = EBUSY;
+        return -1;
+    }
+    free(group);
+    return 0;
+}
+
+/* ========================== PARALLEL FOR ========================== */
+
+/* 自动分块时每个工作线程平均分到的块数。多于一块，先完成的线程可以继续领取，抵消各块耗时的差异。  */
+#define THPOOL_PARALLEL_FOR_CHUNKS_PER_THREAD   8
+
+/**
+ * 一次`thpool_parallel_for`调用的共享状态。任务组是第一个成员，分离后由任务组的最后一个完成方一并释放。
+ * 各执行者以fetch_add领取块号，第i块为[begin + i * grain, min(begin + (i + 1) * grain, end))。
+ * 领取的是块号而不是下标，越界的领取至多为执行者个数，不会回绕。
+ */
+typedef struct thpool_parallel_for_ctx {
+    struct thpool_group group;
+    atomic_size_t   next_chunk;
+    size_t          num_chunks;
+    size_t          begin;
+    size_t          end;
+    size_t          grain;
+    void            (*function)(size_t range_begin, size_t range_end, void *arg, threadpool_thread current_thrd);
+    void            *arg;
+} thpool_parallel_for_ctx;
+
+/* 执行者：不断领取下一块直到领完，整个调用只提交与线程数相当的任务，不随分块数分配节点。 */
+static void thpool_parallel_for_run(void *arg_p, threadpool_thread current_thrd)
+{
+    thpool_parallel_for_ctx *ctx_p = arg_p;
+    size_t chunk;
+    while ((chunk = atomic_fetch_add_explicit(&ctx_p->next_chunk, 1, memory_order_relaxed)) < ctx_p->num_chunks) {
+        size_t range_begin = ctx_p->begin + chunk * ctx_p->grain;
+        size_t range_end = (ctx_p->end - range_begin > ctx_p->grain) ? range_begin + ctx_p->grain : ctx_p->end;
+        ctx_p->function(range_begin, range_end, ctx_p->arg, current_thrd);
+    }
+}
+
+/**
+ * 分配一次状态（不随分块数增长），以其中的任务组提交执行者并等待。部分执行者提交失败时，
+ * 已提交的执行者仍会领完所有块，只有一个也未能提交时才返回错误。在工作线程内调用时，`thpool_group_wait`会协助执行这些执行者。
+ * 工作线程的等待可能被shutdown打断而提前返回，此时仍有排队的执行者引用该状态，它们要到所有线程退出后才被丢弃，
+ * 因此不能在这里释放，而是分离任务组，交给计数归零的一方释放。
+ */
+static int thpool_parallel_for_inner(thpool *thpool_p, size_t begin, size_t end, size_t grain, void (*function_p)(size_t, size_t, void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely(function_p == nullptr)) {
+        thpool_log_error("thpool_parallel_for(): function_p is null pointer");
+        errno = EINVAL;
+        return -1;
+    }
+    if (begin >= end) {
+        return 0;
+    }
+
+    size_t num = end - begin;
+    size_t num_workers = (size_t)atomic_load(&thpool_p->num_threads_running);
+    if (num_workers == 0) {
+        num_workers = 1;
+    }
+    if (grain == 0) {
+        size_t target = num_workers * THPOOL_PARALLEL_FOR_CHUNKS_PER_THREAD;
+        grain = num / target + (num % target != 0);
+    }
+
+    thpool_parallel_for_ctx *ctx_p = malloc(sizeof(thpool_parallel_for_ctx));
+    if (unlikely(ctx_p == nullptr)) {
+        thpool_log_error("thpool_parallel_for(): Could not allocate memory for parallel for");
+        errno = ENOMEM;
+        return -1;
+    }
+    ctx_p->group.thpool_p = thpool_p;
+    atomic_init(&ctx_p->group.state, 0);
+    atomic_init(&ctx_p->next_chunk, 0);
+    ctx_p->num_chunks = num / grain + (num % grain != 0);
+    ctx_p->begin = begin;
+    ctx_p->end = end;
+    ctx_p->grain = grain;
+    ctx_p->function = function_p;
+    ctx_p->arg = arg_p;
+
+    size_t num_runners = (ctx_p->num_chunks < num_workers) ? ctx_p->num_chunks : num_workers;
+    size_t submitted = 0;
+    int err = 0;
+    for (; submitted < num_runners; submitted++) {
+        if (unlikely(thpool_group_add_work_inner(&ctx_p->group, thpool_parallel_for_run, ctx_p) != 0)) {
+            err = errno;
+            break;
+        }
+    }
+    if (unlikely(submitted == 0)) {
+        free(ctx_p);
+        errno = err;
+        return -1;
+    }
+
+    int ret = thpool_group_wait(&ctx_p->group);
+    err = errno;
+    unsigned state = atomic_load_explicit(&ctx_p->group.state, memory_order_acquire);
+    while (state & THPOOL_GROUP_COUNT_MASK) {
+        if (atomic_compare_exchange_weak_explicit(&ctx_p->group.state, &state, state | THPOOL_GROUP_DETACHED, memory_order_acq_rel, memory_order_acquire)) {
+            errno = err;
+            return ret;
+        }
+    }
+    free(ctx_p);
+    errno = err;
+    return ret;
+}
+
+/* =========================== TASK GRAPH =========================== */
+
+/**
+ * 任务图的节点。后继以下标保存，节点数组扩容时无需修正。
+ * in_degree为静态的前驱数（重复的边重复计数），pending是本次执行中尚未完成的前驱数，每次执行前重置。
+ */
+typedef struct thpool_graph_node {
+    void            (*function)(void *arg, threadpool_thread current_thrd);
+    void            *arg;
+    struct thpool_graph *graph_p;           /* 节点所属的任务图，供节点任务找回图。  */
+    int             *succ;
+    int             num_succ;
+    int             cap_succ;
+    int             in_degree;
+    atomic_int      pending;
+    struct thpool_graph_node *next;         /* 提交失败、留在本线程执行的就绪节点链表。节点每次执行只就绪一次，同一时刻至多在一个链表中。 */
+} thpool_graph_node;
+
+/**
+ * @brief Task graph, see `thpool_graph_create`.
+ *
+ * 任务图。执行时以内嵌的任务组计数已提交的节点任务：就绪的后继在其前驱的任务结束之前提交，
+ * 因此计数只有在全部节点完成（或被shutdown丢弃）后才会归零。
+ */
+typedef struct thpool_graph {
+    struct thpool_group group;
+    thpool_graph_node *nodes;
+    int             num_nodes;
+    int             cap_nodes;
+    bool            acyclic;                /* 自上次修改以来已确认无环。    */
+    atomic_bool     running;
+} thpool_graph;
+
+/**
+ * 执行节点，然后递减各后继的pending。第一个就绪的后继留在本线程接着执行，数据仍在缓存中；
+ * 其余就绪的后继先提交到线程池，交给其他线程。提交失败的后继（例如shutdown之后）同样留在本线程执行，不会丢失：
+ * 它们串入本地的待执行链表，由外层循环依次取出，而不是递归执行，因此栈深度与图的深度无关。
+ */
+static void thpool_graph_node_run(void *arg_p, threadpool_thread current_thrd)
+{
+    thpool_graph_node *node_p = arg_p;
+    thpool_graph *graph_p = node_p->graph_p;
+    thpool_graph_node *local_p = nullptr;
+    while (node_p != nullptr) {
+        node_p->function(node_p->arg, current_thrd);
+
+        thpool_graph_node *next_p = nullptr;
+        for (int i = 0; i < node_p->num_succ; i++) {
+            thpool_graph_node *succ_p = &graph_p->nodes[node_p->succ[i]];
+            if (atomic_fetch_sub_explicit(&succ_p->pending, 1, memory_order_acq_rel) != 1) {
+                continue;
+            }
+            if (next_p == nullptr) {
+                next_p = succ_p;
+            } else if (unlikely(thpool_group_add_work_inner(&graph_p->group, thpool_graph_node_run, succ_p) != 0)) {
+                succ_p->next = local_p;
+                local_p = succ_p;
+            }
+        }
+        if (next_p == nullptr && local_p != nullptr) {
+            next_p = local_p;
+            local_p = local_p->next;
+        }
+        node_p = next_p;
+    }
+}
+
+static struct thpool_graph *thpool_graph_create_inner(thpool *thpool_p)
+{
+    struct thpool_graph *graph_p = malloc(sizeof(struct thpool_graph));
+    if (unlikely(graph_p == nullptr)) {
+        thpool_log_error("thpool_graph_create(): Could not allocate memory for task graph");
+        return nullptr;
+    }
+    graph_p->group.thpool_p = thpool_p;
+    atomic_init(&graph_p->group.state, 0);
+    graph_p->nodes = nullptr;
+    graph_p->num_nodes = 0;
+    graph_p->cap_nodes = 0;
+    graph_p->acyclic = true;
+    atomic_init(&graph_p->running, false);
+    return graph_p;
+}
+
+int thpool_graph_add_node(threadpool_graph graph, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely(graph == nullptr) || unlikely(function_p == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(atomic_load(&graph->running))) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (graph->num_nodes == graph->cap_nodes) {
+        int cap = (graph->cap_nodes > 0) ? graph->cap_nodes * 2 : 16;
+        thpool_graph_node *nodes = realloc(graph->nodes, (size_t)cap * sizeof(thpool_graph_node));
+        if (unlikely(nodes == nullptr)) {
+            thpool_log_error("thpool_graph_add_node(): Could not allocate memory for graph nodes");
+            errno = ENOMEM;
+            return -1;
+        }
+        graph->nodes = nodes;
+        graph->cap_nodes = cap;
+    }
+    thpool_graph_node *node_p = &graph->nodes[graph->num_nodes];
+    node_p->function = function_p;
+    node_p->arg = arg_p;
+    node_p->graph_p = graph;
+    node_p->succ = nullptr;
+    node_p->num_succ = 0;
+    node_p->cap_succ = 0;
+    node_p->in_degree = 0;
+    atomic_init(&node_p->pending, 0);
+    return graph->num_nodes++;
+}
+
+int thpool_graph_add_edge(threadpool_graph graph, int from, int to)
+{
+    if (unlikely(graph == nullptr) || unlikely(from < 0) || unlikely(from >= graph->num_nodes) ||
+        unlikely(to < 0) || unlikely(to >= graph->num_nodes) || unlikely(from == to)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(atomic_load(&graph->running))) {
+        errno = EBUSY;
+        return -1;
+    }
+    thpool_graph_node *node_p = &graph->nodes[from];
+    if (node_p->num_succ == node_p->cap_succ) {
+        int cap = (node_p->cap_succ > 0) ? node_p->cap_succ * 2 : 4;
+        int *succ = realloc(node_p->succ, (size_t)cap * sizeof(int));
+        if (unlikely(succ == nullptr)) {
+            thpool_log_error("thpool_graph_add_edge(): Could not allocate memory for graph edges");
+            errno = ENOMEM;
+            return -1;
+        }
+        node_p->succ = succ;
+        node_p->cap_succ = cap;
+    }
+    node_p->succ[node_p->num_succ++] = to;
+    graph->nodes[to].in_degree++;
+    graph->acyclic = false;
+    return 0;
+}
+
+/* 以Kahn算法确认无环，结果缓存到下次修改为止。 */
+static int thpool_graph_check_acyclic(thpool_graph *graph_p)
+{
+    if (graph_p->acyclic) {
+        return 0;
+    }
+    int num = graph_p->num_nodes;
+    int *degree = malloc((size_t)num * 2 * sizeof(int));
+    if (unlikely(degree == nullptr)) {
+        thpool_log_error("thpool_graph_run(): Could not allocate memory for cycle check");
+        errno = ENOMEM;
+        return -1;
+    }
+    int *ready = degree + num;
+    int num_ready = 0;
+    for (int i = 0; i < num; i++) {
+        degree[i] = graph_p->nodes[i].in_degree;
+        if (degree[i] == 0) {
+            ready[num_ready++] = i;
+        }
+    }
+    int visited = 0;
+    while (num_ready > 0) {
+        thpool_graph_node *node_p = &graph_p->nodes[ready[--num_ready]];
+        visited++;
+        for (int i = 0; i < node_p->num_succ; i++) {
+            if (--degree[node_p->succ[i]] == 0) {
+                ready[num_ready++] = node_p->succ[i];
+            }
+        }
+    }
+    free(degree);
+    if (unlikely(visited != num)) {
+        thpool_log_error("thpool_graph_run(): task graph has a cycle");
+        errno = EINVAL;
+        return -1;
+    }
+    graph_p->acyclic = true;
+    return 0;
+}
+
+/**
+ * 重置各节点的pending并提交所有入度为零的节点，然后在内嵌的任务组上等待。
+ * 与`thpool_group_wait`一样，在工作线程内调用时等待期间协助执行。
+ * 根节点全部提交失败时返回错误；部分失败时已提交的节点照常执行，未能提交的根节点在本线程执行。
+ */
+static int thpool_graph_run_inner(struct thpool_graph *graph_p)
+{
+    bool expected = false;
+    if (unlikely(!atomic_compare_exchange_strong(&graph_p->running, &expected, true))) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (unlikely(atomic_load(&graph_p->group.state) & THPOOL_GROUP_COUNT_MASK)) {
+        /* 上次执行被shutdown打断，仍有节点任务未被丢弃。  */
+        atomic_store(&graph_p->running, false);
+        errno = EBUSY;
+        return -1;
+    }
+    if (unlikely(thpool_graph_check_acyclic(graph_p) != 0)) {
+        atomic_store(&graph_p->running, false);
+        return -1;
+    }
+    atomic_store_explicit(&graph_p->group.state, 0, memory_order_relaxed);
+    for (int i = 0; i < graph_p->num_nodes; i++) {
+        atomic_store_explicit(&graph_p->nodes[i].pending, graph_p->nodes[i].in_degree, memory_order_relaxed);
+    }
+
+    struct thread *current_thrd = thpool_current_thread(graph_p->group.thpool_p);
+    int ret = 0;
+    for (int i = 0; i < graph_p->num_nodes; i++) {
+        if (graph_p->nodes[i].in_degree != 0) {
+            continue;
+        }
+        if (unlikely(thpool_group_add_work_inner(&graph_p->group, thpool_graph_node_run, &graph_p->nodes[i]) != 0)) {
+            if (current_thrd == nullptr) {
+                /* 外部线程没有线程句柄可以传给任务函数，放弃剩余的根节点，等待已提交的节点后报错。  */
+                ret = -1;
+                break;
+            }
+            thpool_graph_node_run(&graph_p->nodes[i], current_thrd);
+        }
+    }
+
+    int err = errno;
+    if (thpool_group_wait(&graph_p->group) != 0) {
+        ret = -1;
+        err = errno;
+    }
+    atomic_store(&graph_p->running, false);
+    errno = err;
+    return ret;
+}
+
+int thpool_graph_destroy(threadpool_graph graph)
+{
+    if (unlikely(graph == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(atomic_load(&graph->running)) || unlikely(atomic_load(&graph->group.state) & THPOOL_GROUP_COUNT_MASK)) {
+        errno = EBUSY;
+        return -1;
+    }
+    for (int i = 0; i < graph->num_nodes; i++) {
+        free(graph->nodes[i].succ);
+    }
+    free(graph->nodes);
+    free(graph);
+    return 0;
+}
+
+/* ============================= TIMER ============================== */
+
+static inline uint64_t thpool_timer_now_tick(void)
+{
+    return thpool_now_ns() / THPOOL_TIMER_TICK_NS;
+}
+
+static int thpool_timer_wheel_init(thpool_timer_wheel *wheel_p)
+{
+    int err = pthread_mutex_init(&wheel_p->mutex, nullptr);
+    if (unlikely(err != 0)) {
+        errno = err;
+        return -1;
+    }
+    err = thpool_cond_init_monotonic(&wheel_p->cond);
+    if (unlikely(err != 0)) {
+        pthread_mutex_destroy(&wheel_p->mutex);
+        errno = err;
+        return -1;
+    }
+    wheel_p->thread_started = false;
+    wheel_p->stop = false;
+    wheel_p->cur_tick = thpool_timer_now_tick();
+    wheel_p->wake_tick = 0;
+    wheel_p->num_armed = 0;
+    memset(wheel_p->occupied, 0, sizeof(wheel_p->occupied));
+    memset(wheel_p->slots, 0, sizeof(wheel_p->slots));
+    wheel_p->all = nullptr;
+    return 0;
+}
+
+/* 停止定时器线程。须在关闭存活标记并唤醒阻塞的生产者之后调用，定时器线程可能正阻塞在批量入队中。    */
+static void thpool_timer_wheel_stop(thpool_timer_wheel *wheel_p)
+{
+    pthread_mutex_lock(&wheel_p->mutex);
+    wheel_p->stop = true;
+    bool started = wheel_p->thread_started;
+    pthread_cond_signal(&wheel_p->cond);
+    pthread_mutex_unlock(&wheel_p->mutex);
+    if (started) {
+        pthread_join(wheel_p->thread, nullptr);
+    }
+}
+
+/**
+ * 所有线程与api调用都已退出后，释放仍然存活的定时器，包括用户尚未以`thpool_timer_cancel`释放的句柄。
+ * 此后对这些句柄调用`thpool_timer_cancel`会因线程池不在ALIVE状态而被拒绝，不会访问已释放的定时器。
+ */
+static void thpool_timer_wheel_release(thpool_timer_wheel *wheel_p)
+{
+    pthread_mutex_lock(&wheel_p->mutex);
+    thpool_timer *timer_p = wheel_p->all;
+    while (timer_p != nullptr) {
+        thpool_timer *next_p = timer_p->all_next;
+        free(timer_p);
+        timer_p = next_p;
+    }
+    wheel_p->all = nullptr;
+    wheel_p->num_armed = 0;
+    memset(wheel_p->occupied, 0, sizeof(wheel_p->occupied));
+    memset(wheel_p->slots, 0, sizeof(wheel_p->slots));
+    pthread_mutex_unlock(&wheel_p->mutex);
+}
+
+static void thpool_timer_wheel_destroy(thpool_timer_wheel *wheel_p)
+{
+    pthread_mutex_destroy(&wheel_p->mutex);
+    pthread_cond_destroy(&wheel_p->cond);
+}
+
+/**
+ * 按剩余刻度数选择层与槽。已过期的定时器放在下一个待处理的刻度上。
+ * 超出时间轮范围的定时器按范围内最远的刻度放置，下放时以真实的到期刻度重新放置。
+ */
+static void thpool_timer_insert_unsafe(thpool_timer_wheel *wheel_p, thpool_timer *timer_p)
+{
+    if (timer_p->expire_tick < wheel_p->cur_tick) {
+        timer_p->expire_tick = wheel_p->cur_tick;
+    }
+    uint64_t delta = timer_p->expire_tick - wheel_p->cur_tick;
+    uint64_t place = timer_p->expire_tick;
+    if (delta >= (1ull << (THPOOL_TIMER_LEVEL_BITS * THPOOL_TIMER_LEVELS))) {
+        place = wheel_p->cur_tick + (1ull << (THPOOL_TIMER_LEVEL_BITS * THPOOL_TIMER_LEVELS)) - 1;
+    }
+    int level = 0;
+    while (level < THPOOL_TIMER_LEVELS - 1 && delta >= (1ull << (THPOOL_TIMER_LEVEL_BITS * (level + 1)))) {
+        level++;
+    }
+    int slot = (int)((place >> (THPOOL_TIMER_LEVEL_BITS * level)) & (THPOOL_TIMER_SLOTS - 1));
+
+    thpool_timer **head_p = &wheel_p->slots[level][slot];
+    timer_p->next = *head_p;
+    if (*head_p != nullptr) {
+        (*head_p)->pprev = &timer_p->next;
+    }
+    *head_p = timer_p;
+    timer_p->pprev = head_p;
+    timer_p->level = (unsigned char)level;
+    timer_p->slot = (unsigned char)slot;
+    wheel_p->occupied[level] |= 1ull << slot;
+    wheel_p->num_armed++;
+}
+
+static void thpool_timer_unlink_unsafe(thpool_timer_wheel *wheel_p, thpool_timer *timer_p)
+{
+    *timer_p->pprev = timer_p->next;
+    if (timer_p->next != nullptr) {
+        timer_p->next->pprev = timer_p->pprev;
+    }
+    if (wheel_p->slots[timer_p->level][timer_p->slot] == nullptr) {
+        wheel_p->occupied[timer_p->level] &= ~(1ull << timer_p->slot);
+    }
+    wheel_p->num_armed--;
+}
+
+static void thpool_timer_free_unsafe(thpool_timer *timer_p)
+{
+    *timer_p->all_pprev = timer_p->all_next;
+    if (timer_p->all_next != nullptr) {
+        timer_p->all_next->all_pprev = timer_p->all_pprev;
+    }
+    free(timer_p);
+}
+
+/* 将上层的一个槽整体取下，按新的cur_tick重新放置。  */
+static void thpool_timer_cascade_unsafe(thpool_timer_wheel *wheel_p, int level, int slot)
+{
+    thpool_timer *timer_p = wheel_p->slots[level][slot];
+    wheel_p->slots[level][slot] = nullptr;
+    wheel_p->occupied[level] &= ~(1ull << slot);
+    while (timer_p != nullptr) {
+        thpool_timer *next_p = timer_p->next;
+        wheel_p->num_armed--;
+        thpool_timer_insert_unsafe(wheel_p, timer_p);
+        timer_p = next_p;
+    }
+}
+
+/**
+ * 处理至多到now_tick的刻度，把到期的定时器摘下放入batch，返回数量。batch满时停在当前刻度，下次继续。
+ * 刻度前进到下层的一圈起点时，从高层到低层逐级下放：高层下放的定时器可能落入低层刚要下放的槽。
+ */
+static int thpool_timer_collect_unsafe(thpool_timer_wheel *wheel_p, uint64_t now_tick, thpool_timer **batch)
+{
+    int num = 0;
+    while (wheel_p->cur_tick <= now_tick && num < THPOOL_TIMER_BATCH) {
+        if (wheel_p->num_armed == 0) {
+            wheel_p->cur_tick = now_tick + 1;
+            break;
+        }
+        thpool_timer **head_p = &wheel_p->slots[0][wheel_p->cur_tick & (THPOOL_TIMER_SLOTS - 1)];
+        while (*head_p != nullptr && num < THPOOL_TIMER_BATCH) {
+            thpool_timer *timer_p = *head_p;
+            thpool_timer_unlink_unsafe(wheel_p, timer_p);
+            timer_p->state = THPOOL_TIMER_FIRING;
+            batch[num++] = timer_p;
+        }
+        if (*head_p != nullptr) {
+            break;
+        }
+
+        uint64_t tick = ++wheel_p->cur_tick;
+        int top = 0;
+        while (top < THPOOL_TIMER_LEVELS - 1 && (tick & ((1ull << (THPOOL_TIMER_LEVEL_BITS * (top + 1))) - 1)) == 0) {
+            top++;
+        }
+        for (int level = top; level >= 1; level--) {
+            thpool_timer_cascade_unsafe(wheel_p, level, (int)((tick >> (THPOOL_TIMER_LEVEL_BITS * level)) & (THPOOL_TIMER_SLOTS - 1)));
+        }
+    }
+    return num;
+}
+
+/* 返回槽位图中最低的非空槽。调用者须保证occupied非零。   */
+static inline int thpool_timer_lowest_slot(uint64_t occupied)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(occupied);
+#else
+    int slot = 0;
+    while (!(occupied & 1u)) {
+        occupied >>= 1;
+        slot++;
+    }
+    return slot;
+#endif
+}
+
+/**
+ * 下一个需要处理的刻度：第0层中最近的非空槽，若上层非空，则不晚于第0层转完这一圈的下放时刻。没有定时器时返回UINT64_MAX。
+ */
+static uint64_t thpool_timer_next_tick_unsafe(thpool_timer_wheel *wheel_p)
+{
+    if (wheel_p->num_armed == 0) {
+        return UINT64_MAX;
+    }
+    uint64_t cur = wheel_p->cur_tick;
+    int idx = (int)(cur & (THPOOL_TIMER_SLOTS - 1));
+    uint64_t next = UINT64_MAX;
+    uint64_t occupied = wheel_p->occupied[0];
+    if (occupied != 0) {
+        uint64_t rotated = (occupied >> idx) | (idx ? occupied << (THPOOL_TIMER_SLOTS - idx) : 0);
+        next = cur + (uint64_t)thpool_timer_lowest_slot(rotated);
+    }
+    for (int level = 1; level < THPOOL_TIMER_LEVELS; level++) {
+        if (wheel_p->occupied[level] != 0) {
+            uint64_t boundary = (cur | (THPOOL_TIMER_SLOTS - 1)) + 1;
+            next = (boundary < next) ? boundary : next;
+            break;
+        }
+    }
+    return next;
+}
+
+/**
+ * 到期任务的包装：执行用户的任务函数，然后周期定时器放回时间轮，一次性定时器结束。
+ * 周期定时器在这次执行结束后才重新计时，同一定时器的任务不会重叠执行；错过的周期被跳过而不是连续补执行。
+ * 周期定时器在排队期间已被取消时不再执行用户的任务函数。一次性定时器入队后无法取消，不必检查。
+ */
+static void thpool_timer_run(void *arg_p, threadpool_thread current_thrd)
+{
+    thpool_timer *timer_p = arg_p;
+    thpool_timer_wheel *wheel_p = &timer_p->thpool_p->timer_wheel;
+    bool cancelled = false;
+    if (timer_p->period_ticks != 0) {
+        pthread_mutex_lock(&wheel_p->mutex);
+        cancelled = (timer_p->state == THPOOL_TIMER_CANCELLED);
+        pthread_mutex_unlock(&wheel_p->mutex);
+    }
+    if (likely(!cancelled)) {
+        timer_p->function(timer_p->arg, current_thrd);
+    }
+
+    pthread_mutex_lock(&wheel_p->mutex);
+    if (timer_p->period_ticks != 0 && timer_p->state == THPOOL_TIMER_FIRING) {
+        uint64_t now_tick = thpool_timer_now_tick();
+        uint64_t next = timer_p->expire_tick + timer_p->period_ticks;
+        if (next <= now_tick) {
+            next += ((now_tick - next) / timer_p->period_ticks + 1) * timer_p->period_ticks;
+        }
+        timer_p->expire_tick = next;
+        timer_p->state = THPOOL_TIMER_ARMED;
+        thpool_timer_insert_unsafe(wheel_p, timer_p);
+        if (timer_p->expire_tick < wheel_p->wake_tick) {
+            pthread_cond_signal(&wheel_p->cond);
+        }
+    } else {
+        timer_p->state = THPOOL_TIMER_DONE;
+        if (!timer_p->user_ref) {
+            thpool_timer_free_unsafe(timer_p);
+        }
+    }
+    pthread_mutex_unlock(&wheel_p->mutex);
+}
+
+/**
+ * 定时器线程：推进时间轮，把到期的定时器以`thpool_add_work_batch`批量入队，一次加锁入队至多THPOOL_TIMER_BATCH个。
+ * 入队期间不持有时间轮的mutex。入队失败而线程池仍存活时（如内存不足），定时器放回下一个刻度重试。
+ */
+static void *thpool_timer_thread_do(void *thpool_p_arg)
+{
+    thpool *thpool_p = thpool_p_arg;
+    thpool_timer_wheel *wheel_p = &thpool_p->timer_wheel;
+    char name[16];
+    snprintf(name, sizeof(name), "%s-timer", thpool_p->thread_name_prefix);
+#if defined(__linux__)
+    prctl(PR_SET_NAME, name);
+#elif defined(__APPLE__) && defined(__MACH__)
+    pthread_setname_np(name);
+#elif defined(__FreeBSD__) || defined(__OpenBSD__)
+    pthread_set_name_np(pthread_self(), name);
+#endif
+
+    thpool_timer *batch[THPOOL_TIMER_BATCH];
+    pthread_mutex_lock(&wheel_p->mutex);
+    while (!wheel_p->stop) {
+        int num = thpool_timer_collect_unsafe(wheel_p, thpool_timer_now_tick(), batch);
+        if (num > 0) {
+            pthread_mutex_unlock(&wheel_p->mutex);
+            int pushed = thpool_add_work_batch_inner(thpool_p, thpool_timer_run, (void **)batch, num);
+            pushed = (pushed < 0) ? 0 : pushed;
+            pthread_mutex_lock(&wheel_p->mutex);
+            if (unlikely(pushed < num) && atomic_load(&thpool_p->threads_keepalive)) {
+                for (int i = pushed; i < num; i++) {
+                    if (batch[i]->state == THPOOL_TIMER_FIRING) {
+                        batch[i]->state = THPOOL_TIMER_ARMED;
+                        thpool_timer_insert_unsafe(wheel_p, batch[i]);
+                    } else {
+                        batch[i]->state = THPOOL_TIMER_DONE;
+                        if (!batch[i]->user_ref) {
+                            thpool_timer_free_unsafe(batch[i]);
+                        }
+                    }
+                }
+                /* 避免在持续失败时空转。    */
+                pthread_mutex_unlock(&wheel_p->mutex);
+                nanosleep(&(struct timespec) {0, (long)THPOOL_TIMER_TICK_NS}, nullptr);
+                pthread_mutex_lock(&wheel_p->mutex);
+            }
+            continue;
+        }
+
+        uint64_t next = thpool_timer_next_tick_unsafe(wheel_p);
+        wheel_p->wake_tick = next;
+        if (next == UINT64_MAX) {
+            pthread_cond_wait(&wheel_p->cond, &wheel_p->mutex);
+        } else {
+            struct timespec deadline = thpool_cond_deadline(next * THPOOL_TIMER_TICK_NS);
+            pthread_cond_timedwait(&wheel_p->cond, &wheel_p->mutex, &deadline);
+        }
+        wheel_p->wake_tick = 0;
+    }
+    pthread_mutex_unlock(&wheel_p->mutex);
+    return nullptr;
+}
+
+/**
+ * 到期时刻向上取整到刻度，不会提前执行。定时器线程在第一个定时器加入时启动。
+ * 加入的定时器早于定时器线程计划醒来的刻度时才唤醒它。
+ */
+static int thpool_add_work_timer_inner(thpool *thpool_p, uint64_t deadline_ns, uint64_t period_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, thpool_timer **timer_out)
+{
+    if (unlikely(function_p == nullptr)) {
+        thpool_log_error("thpool_add_work_at(): function_p is null pointer");
+        errno = EINVAL;
+        return -1;
+    }
+    thpool_timer *timer_p = malloc(sizeof(thpool_timer));
+    if (unlikely(timer_p == nullptr)) {
+        thpool_log_error("thpool_add_work_at(): Could not allocate memory for timer");
+        errno = ENOMEM;
+        return -1;
+    }
+    timer_p->thpool_p = thpool_p;
+    timer_p->expire_tick = deadline_ns / THPOOL_TIMER_TICK_NS + (deadline_ns % THPOOL_TIMER_TICK_NS != 0);
+    timer_p->period_ticks = period_ns / THPOOL_TIMER_TICK_NS + (period_ns % THPOOL_TIMER_TICK_NS != 0);
+    timer_p->function = function_p;
+    timer_p->arg = arg_p;
+    timer_p->state = THPOOL_TIMER_ARMED;
+    timer_p->user_ref = (timer_out != nullptr);
+
+    thpool_timer_wheel *wheel_p = &thpool_p->timer_wheel;
+    pthread_mutex_lock(&wheel_p->mutex);
+    if (unlikely(wheel_p->stop)) {
+        pthread_mutex_unlock(&wheel_p->mutex);
+        free(timer_p);
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(!wheel_p->thread_started)) {
+        int err = pthread_create(&wheel_p->thread, nullptr, thpool_timer_thread_do, thpool_p);
+        if (unlikely(err != 0)) {
+            pthread_mutex_unlock(&wheel_p->mutex);
+            thpool_log_error("thpool_add_work_at(): Could not create timer thread, err=%d", err);
+            free(timer_p);
+            errno = err;
+            return -1;
+        }
+        wheel_p->thread_started = true;
+    }
+    /* 时间轮为空时，直接把当前刻度推进到现在，不必由定时器线程逐刻度追赶。  */
+    if (wheel_p->num_armed == 0) {
+        uint64_t now_tick = thpool_timer_now_tick();
+        wheel_p->cur_tick = (wheel_p->cur_tick > now_tick) ? wheel_p->cur_tick : now_tick;
+    }
+    thpool_timer_insert_unsafe(wheel_p, timer_p);
+    timer_p->all_next = wheel_p->all;
+    if (wheel_p->all != nullptr) {
+        wheel_p->all->all_pprev = &timer_p->all_next;
+    }
+    wheel_p->all = timer_p;
+    timer_p->all_pprev = &wheel_p->all;
+    if (timer_p->expire_tick < wheel_p->wake_tick) {
+        pthread_cond_signal(&wheel_p->cond);
+    }
+    pthread_mutex_unlock(&wheel_p->mutex);
+
+    if (timer_out != nullptr) {
+        *timer_out = timer_p;
+    }
+    return 0;
+}
+
+/**
+ * 在时间轮中的定时器直接摘除，O(1)。一次性定时器已到期时无法撤回，返回EALREADY；
+ * 周期定时器已入队时标记为已取消，尚在排队的不再执行，正在执行的结束后不再放回。无论结果如何，都释放用户持有的句柄。
+ */
+static int thpool_timer_cancel_inner(thpool *thpool_p, thpool_timer *timer_p)
+{
+    if (unlikely(timer_p == nullptr) || unlikely(timer_p->thpool_p != thpool_p)) {
+        errno = EINVAL;
+        return -1;
+    }
+    thpool_timer_wheel *wheel_p = &thpool_p->timer_wheel;
+    int ret = 0;
+    pthread_mutex_lock(&wheel_p->mutex);
+    switch (timer_p->state) {
+    case THPOOL_TIMER_ARMED:
+        thpool_timer_unlink_unsafe(wheel_p, timer_p);
+        timer_p->state = THPOOL_TIMER_DONE;
+        break;
+    case THPOOL_TIMER_FIRING:
+        if (timer_p->period_ticks != 0) {
+            timer_p->state = THPOOL_TIMER_CANCELLED;
+        } else {
+            errno = EALREADY;
+            ret = -1;
+        }
+        break;
+    default:
+        errno = EALREADY;
+        ret = -1;
+        break;
+    }
+    timer_p->user_ref = false;
+    if (timer_p->state == THPOOL_TIMER_DONE) {
+        thpool_timer_free_unsafe(timer_p);
+    }
+    pthread_mutex_unlock(&wheel_p->mutex);
+    return ret;
+}
+
+unsigned long long thpool_clock_ns(void)
+{
+    return thpool_now_ns();
+}
+
+/* ============================= FIBER ============================== */
+
+static int thpool_fiber_poller_init(thpool_fiber_poller *poller_p, size_t stack_size)
+{
+    int err = pthread_mutex_init(&poller_p->mutex, nullptr);
+    if (unlikely(err != 0)) {
+        errno = err;
+        return -1;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    stack_size = (stack_size > 0) ? stack_size : THPOOL_FIBER_STACK_SIZE;
+    poller_p->stack_size = (stack_size + page - 1) / page * page;
+    poller_p->thread_started = false;
+    poller_p->stop = false;
+    poller_p->epoll_fd = -1;
+    poller_p->event_fd = -1;
+    poller_p->heap = nullptr;
+    poller_p->heap_len = 0;
+    poller_p->heap_cap = 0;
+    poller_p->free_list = nullptr;
+    poller_p->num_free = 0;
+    poller_p->all = nullptr;
+    atomic_init(&poller_p->num_live, 0);
+    return 0;
+}
+
+#ifdef THPOOL_HAS_FIBERS
+/**
+ * 协程的入口。`makecontext`只能传递int参数，指针拆成高低两半传入。
+ * 任务函数返回后切回工作线程，协程复用时从这里继续执行下一个任务函数。
+ */
+static void thpool_fiber_entry(unsigned int hi, unsigned int lo)
+{
+    thpool_fiber *fiber_p = (thpool_fiber *)(uintptr_t)(((uint64_t)hi << 32) | lo);
+    for (;;) {
+        fiber_p->function(fiber_p->arg, fiber_p->thread_p);
+        fiber_p->done = true;
+        swapcontext(&fiber_p->ctx, fiber_p->worker_ctx);
+    }
+}
+
+/**
+ * 取一个空闲协程，没有时新建。栈以`mmap`分配，最低处的一页设为不可访问，栈溢出时立即出错而不是改写相邻内存。
+ * 每个协程至多有一个恢复任务在队列中，因此有上限的线程池为每个协程放宽一个任务节点的上限。
+ */
+static thpool_fiber *thpool_fiber_alloc(thpool *thpool_p)
+{
+    thpool_fiber_poller *poller_p = &thpool_p->fibers;
+    pthread_mutex_lock(&poller_p->mutex);
+    thpool_fiber *fiber_p = poller_p->free_list;
+    if (fiber_p != nullptr) {
+        poller_p->free_list = fiber_p->next;
+        poller_p->num_free--;
+    }
+    pthread_mutex_unlock(&poller_p->mutex);
+
+    if (fiber_p == nullptr) {
+        fiber_p = malloc(sizeof(thpool_fiber));
+        if (unlikely(fiber_p == nullptr)) {
+            thpool_log_error("thpool_add_work_fiber(): Could not allocate memory for fiber");
+            errno = ENOMEM;
+            return nullptr;
+        }
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        fiber_p->stack_size = poller_p->stack_size + page;
+        fiber_p->stack = mmap(nullptr, fiber_p->stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (unlikely(fiber_p->stack == MAP_FAILED)) {
+            thpool_log_error("thpool_add_work_fiber(): Could not map fiber stack");
+            free(fiber_p);
+            errno = ENOMEM;
+            return nullptr;
+        }
+        /* 栈底的保护页。设置失败时栈溢出会静默破坏相邻内存，因此不使用这样的栈。   */
+        if (unlikely(mprotect(fiber_p->stack, page, PROT_NONE) != 0)) {
+            int err = errno;
+            thpool_log_error("thpool_add_work_fiber(): Could not protect the guard page of fiber stack");
+            munmap(fiber_p->stack, fiber_p->stack_size);
+            free(fiber_p);
+            errno = err;
+            return nullptr;
+        }
+        getcontext(&fiber_p->ctx);
+        fiber_p->ctx.uc_stack.ss_sp = (char *)fiber_p->stack + page;
+        fiber_p->ctx.uc_stack.ss_size = poller_p->stack_size;
+        fiber_p->ctx.uc_link = nullptr;
+        uint64_t bits = (uint64_t)(uintptr_t)fiber_p;
+        makecontext(&fiber_p->ctx, (void (*)(void))thpool_fiber_entry, 2, (unsigned int)(bits >> 32), (unsigned int)bits);
+        fiber_p->thpool_p = thpool_p;
+        fiber_p->heap_index = -1;
+        fiber_p->registered = false;
+
+        pthread_mutex_lock(&poller_p->mutex);
+        fiber_p->all_next = poller_p->all;
+        if (poller_p->all != nullptr) {
+            poller_p->all->all_pprev = &fiber_p->all_next;
+        }
+        poller_p->all = fiber_p;
+        fiber_p->all_pprev = &poller_p->all;
+        pthread_mutex_unlock(&poller_p->mutex);
+
+        pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+        if (thpool_p->jobpool.max_nodes) {
+            thpool_p->jobpool.max_nodes++;
+        }
+        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    }
+    fiber_p->done = false;
+    atomic_fetch_add(&poller_p->num_live, 1);
+    return fiber_p;
+}
+
+static void thpool_fiber_free(thpool_fiber *fiber_p)
+{
+    munmap(fiber_p->stack, fiber_p->stack_size);
+    free(fiber_p);
+}
+
+/**
+ * 存活协程数减一。`thpool_wait`在存活协程数不为0时等待threads_all_idle，而协程可能在工作线程之外结束
+ * （例如poller线程未能提交恢复任务），不会经过`thread_do`的通知，因此减到0时若有等待者，在同一把锁下广播。
+ * 与`thpool_wait`先登记等待者、再读取存活协程数的顺序构成一对，均为seq_cst序。
+ */
+static void thpool_fiber_live_dec(thpool *thpool_p)
+{
+    if (atomic_fetch_sub(&thpool_p->fibers.num_live, 1) == 1 && atomic_load(&thpool_p->num_idle_waiters) > 0) {
+        pthread_mutex_lock(&thpool_p->threads_all_idle_mutex);
+        pthread_cond_broadcast(&thpool_p->threads_all_idle);
+        pthread_mutex_unlock(&thpool_p->threads_all_idle_mutex);
+    }
+}
+
+/* 任务函数已返回或未能提交，协程放回空闲链表，缓存已满时归还系统。  */
+static void thpool_fiber_release(thpool *thpool_p, thpool_fiber *fiber_p)
+{
+    thpool_fiber_poller *poller_p = &thpool_p->fibers;
+    pthread_mutex_lock(&poller_p->mutex);
+    if (poller_p->num_free < THPOOL_FIBER_CACHE_SIZE) {
+        fiber_p->next = poller_p->free_list;
+        poller_p->free_list = fiber_p;
+        poller_p->num_free++;
+        fiber_p = nullptr;
+    } else {
+        *fiber_p->all_pprev = fiber_p->all_next;
+        if (fiber_p->all_next != nullptr) {
+            fiber_p->all_next->all_pprev = fiber_p->all_pprev;
+        }
+    }
+    pthread_mutex_unlock(&poller_p->mutex);
+
+    if (fiber_p != nullptr) {
+        thpool_fiber_free(fiber_p);
+        pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+        if (thpool_p->jobpool.max_nodes) {
+            thpool_p->jobpool.max_nodes--;
+        }
+        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    }
+    thpool_fiber_live_dec(thpool_p);
+}
+
+/* 截止时间堆的上浮与下沉，同时维护各协程的heap_index。调用者持有poller的mutex。   */
+static void thpool_fiber_heap_up_unsafe(thpool_fiber_poller *poller_p, int i)
+{
+    thpool_fiber **heap = poller_p->heap;
+    thpool_fiber *fiber_p = heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (heap[parent]->wait_deadline_ns <= fiber_p->wait_deadline_ns) {
+            break;
+        }
+        heap[i] = heap[parent];
+        heap[i]->heap_index = i;
+        i = parent;
+    }
+    heap[i] = fiber_p;
+    fiber_p->heap_index = i;
+}
+
+static void thpool_fiber_heap_down_unsafe(thpool_fiber_poller *poller_p, int i)
+{
+    thpool_fiber **heap = poller_p->heap;
+    thpool_fiber *fiber_p = heap[i];
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= poller_p->heap_len) {
+            break;
+        }
+        if (child + 1 < poller_p->heap_len && heap[child + 1]->wait_deadline_ns < heap[child]->wait_deadline_ns) {
+            child++;
+        }
+        if (fiber_p->wait_deadline_ns <= heap[child]->wait_deadline_ns) {
+            break;
+        }
+        heap[i] = heap[child];
+        heap[i]->heap_index = i;
+        i = child;
+    }
+    heap[i] = fiber_p;
+    fiber_p->heap_index = i;
+}
+
+static int thpool_fiber_heap_push_unsafe(thpool_fiber_poller *poller_p, thpool_fiber *fiber_p)
+{
+    if (unlikely(poller_p->heap_len == poller_p->heap_cap)) {
+        int cap = (poller_p->heap_cap > 0) ? poller_p->heap_cap * 2 : THPOOL_FIBER_EVENTS;
+        thpool_fiber **heap = realloc(poller_p->heap, (size_t)cap * sizeof(thpool_fiber *));
+        if (unlikely(heap == nullptr)) {
+            errno = ENOMEM;
+            return -1;
+        }
+        poller_p->heap = heap;
+        poller_p->heap_cap = cap;
+    }
+    poller_p->heap[poller_p->heap_len] = fiber_p;
+    thpool_fiber_heap_up_unsafe(poller_p, poller_p->heap_len++);
+    return 0;
+}
+
+static void thpool_fiber_heap_remove_unsafe(thpool_fiber_poller *poller_p, thpool_fiber *fiber_p)
+{
+    int i = fiber_p->heap_index;
+    thpool_fiber *last_p = poller_p->heap[--poller_p->heap_len];
+    fiber_p->heap_index = -1;
+    if (last_p != fiber_p) {
+        poller_p->heap[i] = last_p;
+        last_p->heap_index = i;
+        thpool_fiber_heap_up_unsafe(poller_p, i);
+        thpool_fiber_heap_down_unsafe(poller_p, last_p->heap_index);
+    }
+}
+
+/**
+ * 把协程的恢复任务放入共享链表的队尾。与执行域的服务任务相同，恢复任务不受`work_num_max`的约束：
+ * 提交方是poller线程或刚切出协程的工作线程，阻塞等待名额可能死锁；协程创建时已相应放宽了任务节点上限。
+ * 线程池已关闭或内存不足时返回false，协程不再恢复。
+ */
+static bool thpool_fiber_post(thpool *thpool_p, thpool_fiber *fiber_p)
+{
+    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+    job *newjob = nullptr;
+    if (likely(atomic_load(&thpool_p->threads_keepalive))) {
+        newjob = jobpool_alloc_unsafe(&thpool_p->jobpool, true);
+    }
+    if (unlikely(newjob == nullptr)) {
+        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+        thpool_fiber_live_dec(thpool_p);
+        if (atomic_load(&thpool_p->threads_keepalive)) {
+            thpool_log_error("thpool_yield_until(): Could not allocate memory for fiber resumption, the fiber is lost");
+        }
+        return false;
+    }
+    thpool_stats_update_peak(thpool_p, atomic_fetch_add(&thpool_p->num_jobs_queued, 1) + 1);
+    newjob->function = thpool_fiber_resume;
+    newjob->arg = fiber_p;
+    newjob->enqueue_ns = thpool_job_stamp(thpool_p);
+    jobqueue_push_unsafe(&thpool_p->jobqueue, newjob, THPOOL_PRIO_NORMAL);
+    bool kicked = true;
+    if (unlikely(thpool_p->executor != nullptr)) {
+        kicked = thpool_domain_kick_unsafe(thpool_p, 1);
+    }
+    if (atomic_load(&thpool_p->num_threads_parked) > 0) {
+        pthread_cond_signal(&thpool_p->get_job_unblock);
+    }
+    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    if (unlikely(!kicked)) {
+        thpool_domain_post_failed(thpool_p, "thpool_yield_until()");
+    }
+    thpool_stats_record_submit(thpool_p, thpool_current_thread(thpool_p), 1, 0);
+    return true;
+}
+
+/* 撤销协程的登记并恢复它。调用者持有poller的mutex，加锁顺序为先poller、后jobqueue_rwmutex。  */
+static void thpool_fiber_wake_unsafe(thpool *thpool_p, thpool_fiber *fiber_p, int result)
+{
+    thpool_fiber_poller *poller_p = &thpool_p->fibers;
+    if (fiber_p->wait_fd >= 0) {
+        epoll_ctl(poller_p->epoll_fd, EPOLL_CTL_DEL, fiber_p->wait_fd, nullptr);
+    }
+    if (fiber_p->heap_index >= 0) {
+        thpool_fiber_heap_remove_unsafe(poller_p, fiber_p);
+    }
+    fiber_p->registered = false;
+    fiber_p->result = result;
+    thpool_fiber_post(thpool_p, fiber_p);
+}
+
+/**
+ * poller线程：以epoll等待登记的文件描述符，超时取最早的截止时刻，然后恢复就绪与到期的协程。
+ * 只有poller线程撤销登记，因此取出的事件总是属于协程当前的登记。epoll的超时以毫秒计，向上取整，不会提前唤醒。
+ */
+static void *thpool_fiber_poller_do(void *thpool_p_arg)
+{
+    thpool *thpool_p = thpool_p_arg;
+    thpool_fiber_poller *poller_p = &thpool_p->fibers;
+#if defined(__linux__)
+    char name[16];
+    snprintf(name, sizeof(name), "%s-poll", thpool_p->thread_name_prefix);
+    prctl(PR_SET_NAME, name);
+#endif
+
+    struct epoll_event events[THPOOL_FIBER_EVENTS];
+    pthread_mutex_lock(&poller_p->mutex);
+    while (!poller_p->stop) {
+        int timeout_ms = -1;
+        if (poller_p->heap_len > 0) {
+            uint64_t now_ns = thpool_now_ns();
+            uint64_t deadline_ns = poller_p->heap[0]->wait_deadline_ns;
+            uint64_t wait_ms = (deadline_ns > now_ns) ? (deadline_ns - now_ns + 999999) / 1000000 : 0;
+            timeout_ms = (wait_ms < INT_MAX) ? (int)wait_ms : INT_MAX;
+        }
+        pthread_mutex_unlock(&poller_p->mutex);
+        int num = epoll_wait(poller_p->epoll_fd, events, THPOOL_FIBER_EVENTS, timeout_ms);
+        pthread_mutex_lock(&poller_p->mutex);
+
+        for (int i = 0; i < num; i++) {
+            thpool_fiber *fiber_p = events[i].data.ptr;
+            if (fiber_p == nullptr) {
+                uint64_t count;
+                while (read(poller_p->event_fd, &count, sizeof(count)) > 0) {}
+            } else if (fiber_p->registered) {
+                /* EPOLLIN等事件与poll的同名事件取值相同。  */
+                int revents = (int)(events[i].events & (EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLERR | EPOLLHUP));
+                thpool_fiber_wake_unsafe(thpool_p, fiber_p, revents);
+            }
+        }
+        uint64_t now_ns = thpool_now_ns();
+        while (poller_p->heap_len > 0 && poller_p->heap[0]->wait_deadline_ns <= now_ns) {
+            thpool_fiber_wake_unsafe(thpool_p, poller_p->heap[0], 0);
+        }
+    }
+    pthread_mutex_unlock(&poller_p->mutex);
+    return nullptr;
+}
+
+static void thpool_fiber_poller_kick(thpool_fiber_poller *poller_p)
+{
+    uint64_t one = 1;
+    /* 计数溢出时写入失败，但poller线程此时必然会被唤醒。   */
+    ssize_t ignored = write(poller_p->event_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+/* 创建epoll实例、唤醒用的eventfd与poller线程。调用者持有poller的mutex。  */
+static int thpool_fiber_poller_start_unsafe(thpool *thpool_p)
+{
+    thpool_fiber_poller *poller_p = &thpool_p->fibers;
+    int err;
+    poller_p->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (unlikely(poller_p->epoll_fd < 0)) {
+        return -1;
+    }
+    poller_p->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = nullptr};
+    if (unlikely(poller_p->event_fd < 0) || unlikely(epoll_ctl(poller_p->epoll_fd, EPOLL_CTL_ADD, poller_p->event_fd, &ev) != 0)) {
+        err = errno;
+        goto cleanup;
+    }
+    err = pthread_create(&poller_p->thread, nullptr, thpool_fiber_poller_do, thpool_p);
+    if (unlikely(err != 0)) {
+        goto cleanup;
+    }
+    poller_p->thread_started = true;
+    return 0;
+
+cleanup:
+    if (poller_p->event_fd >= 0) {
+        close(poller_p->event_fd);
+        poller_p->event_fd = -1;
+    }
+    close(poller_p->epoll_fd);
+    poller_p->epoll_fd = -1;
+    errno = err;
+    return -1;
+}
+
+/**
+ * 协程切出后由原工作线程调用，按`thpool_yield_until`填写的条件登记等待。
+ * 既不等待文件描述符也不限时的协程直接放回队尾；登记失败时以-1恢复协程，由`thpool_yield_until`返回错误。
+ * 解锁后本线程不再访问协程，poller线程可能已在其他工作线程上恢复了它。
+ */
+static void thpool_fiber_park(thpool *thpool_p, thpool_fiber *fiber_p)
+{
+    thpool_fiber_poller *poller_p = &thpool_p->fibers;
+    if (fiber_p->wait_fd < 0 && fiber_p->wait_deadline_ns == 0) {
+        fiber_p->result = 0;
+        thpool_fiber_post(thpool_p, fiber_p);
+        return;
+    }
+
+    int err = 0;
+    pthread_mutex_lock(&poller_p->mutex);
+    if (unlikely(poller_p->stop)) {
+        err = ECANCELED;
+    } else if (unlikely(!poller_p->thread_started) && thpool_fiber_poller_start_unsafe(thpool_p) != 0) {
+        err = errno;
+    } else if (fiber_p->wait_fd >= 0) {
+        struct epoll_event ev = {.events = (uint32_t)fiber_p->wait_events | EPOLLONESHOT, .data.ptr = fiber_p};
+        if (unlikely(epoll_ctl(poller_p->epoll_fd, EPOLL_CTL_ADD, fiber_p->wait_fd, &ev) != 0)) {
+            err = errno;
+        }
+    }
+    if (err == 0 && fiber_p->wait_deadline_ns != 0) {
+        if (unlikely(thpool_fiber_heap_push_unsafe(poller_p, fiber_p) != 0)) {
+            err = ENOMEM;
+            if (fiber_p->wait_fd >= 0) {
+                epoll_ctl(poller_p->epoll_fd, EPOLL_CTL_DEL, fiber_p->wait_fd, nullptr);
+            }
+        } else if (fiber_p->heap_index == 0) {
+            thpool_fiber_poller_kick(poller_p);
+        }
+    }
+    if (likely(err == 0)) {
+        fiber_p->registered = true;
+        pthread_mutex_unlock(&poller_p->mutex);
+        return;
+    }
+    pthread_mutex_unlock(&poller_p->mutex);
+
+    fiber_p->result = -1;
+    fiber_p->err = err;
+    thpool_fiber_post(thpool_p, fiber_p);
+}
+
+/**
+ * 恢复任务：在当前工作线程上切入协程，直到协程返回或在`thpool_yield_until`中切出。
+ * 协程切出后才登记等待，因此其他线程恢复它时，本线程已不再使用它的上下文。
+ */
+static void thpool_fiber_resume(void *arg_p, threadpool_thread current_thrd)
+{
+    thpool_fiber *fiber_p = arg_p;
+    struct thread *thread_p = current_thrd;
+    /* 协程内以`thpool_group_wait`等协助执行其他任务时，可能嵌套恢复另一个协程。    */
+    thpool_fiber *outer_p = thread_p->fiber;
+    ucontext_t worker_ctx;
+    fiber_p->thread_p = thread_p;
+    fiber_p->worker_ctx = &worker_ctx;
+    thread_p->fiber = fiber_p;
+    swapcontext(&worker_ctx, &fiber_p->ctx);
+    thread_p->fiber = outer_p;
+    if (fiber_p->done) {
+        /* 恢复任务的参数是协程本身，协程任务的参数在任务函数返回后才归还参数区。   */
+        void *arena_arg = thpool_arena_job_arg(fiber_p->thpool_p, fiber_p->function, fiber_p->arg);
+        if (arena_arg != nullptr) {
+            thpool_arena_put(&fiber_p->thpool_p->arena, arena_arg);
+        }
+        thpool_fiber_release(fiber_p->thpool_p, fiber_p);
+    } else {
+        thpool_fiber_park(fiber_p->thpool_p, fiber_p);
+    }
+}
+#endif
+
+/* 停止poller线程。仍在等待的协程不再恢复，不再计入`thpool_wait`等待的任务。 */
+static void thpool_fiber_poller_stop(thpool_fiber_poller *poller_p)
+{
+#ifdef THPOOL_HAS_FIBERS
+    pthread_mutex_lock(&poller_p->mutex);
+    poller_p->stop = true;
+    bool started = poller_p->thread_started;
+    if (started) {
+        thpool_fiber_poller_kick(poller_p);
+    }
+    pthread_mutex_unlock(&poller_p->mutex);
+    if (started) {
+        pthread_join(poller_p->thread, nullptr);
+    }
+
+    pthread_mutex_lock(&poller_p->mutex);
+    for (thpool_fiber *fiber_p = poller_p->all; fiber_p != nullptr; fiber_p = fiber_p->all_next) {
+        if (fiber_p->registered) {
+            fiber_p->registered = false;
+            atomic_fetch_sub(&poller_p->num_live, 1);
+        }
+    }
+    poller_p->heap_len = 0;
+    pthread_mutex_unlock(&poller_p->mutex);
+#else
+    (void)poller_p;
+#endif
+}
+
+/* 释放所有协程及其栈。此时工作线程均已退出，排队的恢复任务也已丢弃。  */
+static void thpool_fiber_poller_release(thpool_fiber_poller *poller_p)
+{
+#ifdef THPOOL_HAS_FIBERS
+    pthread_mutex_lock(&poller_p->mutex);
+    thpool_fiber *fiber_p = poller_p->all;
+    while (fiber_p != nullptr) {
+        thpool_fiber *next_p = fiber_p->all_next;
+        thpool_fiber_free(fiber_p);
+        fiber_p = next_p;
+    }
+    poller_p->all = nullptr;
+    poller_p->free_list = nullptr;
+    poller_p->num_free = 0;
+    free(poller_p->heap);
+    poller_p->heap = nullptr;
+    poller_p->heap_cap = 0;
+    if (poller_p->event_fd >= 0) {
+        close(poller_p->event_fd);
+        poller_p->event_fd = -1;
+    }
+    if (poller_p->epoll_fd >= 0) {
+        close(poller_p->epoll_fd);
+        poller_p->epoll_fd = -1;
+    }
+    pthread_mutex_unlock(&poller_p->mutex);
+#else
+    (void)poller_p;
+#endif
+}
+
+static void thpool_fiber_poller_destroy(thpool_fiber_poller *poller_p)
+{
+    pthread_mutex_destroy(&poller_p->mutex);
+}
+
+/* ============================= ARENA ============================== */
+
+/**
+ * 初始化任务参数区，size为0时不启用。Linux下以不可访问、不计入提交量的映射保留地址空间，多保留一块用于对齐后裁去首尾；
+ * 其他平台直接分配整个区域。失败时已初始化的部分均已清理。
+ */
+static int thpool_arena_init(thpool_arena *arena_p, size_t size, bool huge_pages)
+{
+    arena_p->base = nullptr;
+    arena_p->size = 0;
+    arena_p->huge_pages = huge_pages;
+    arena_p->free_list = nullptr;
+    atomic_init(&arena_p->num_committed, 0);
+    if (size == 0) {
+        return 0;
+    }
+    if (unlikely(size > SIZE_MAX / 2)) {
+        errno = EINVAL;
+        return -1;
+    }
+    size = (size + THPOOL_ARENA_CHUNK_SIZE - 1) & ~(THPOOL_ARENA_CHUNK_SIZE - 1);
+
+    int err = pthread_mutex_init(&arena_p->mutex, nullptr);
+    if (unlikely(err != 0)) {
+        errno = err;
+        return -1;
+    }
+    int n;
+    for (n = 0; n < THPOOL_STATS_STRIPES; n++) {
+        err = pthread_mutex_init(&arena_p->stripes[n].mutex, nullptr);
+        if (unlikely(err != 0)) {
+            goto cleanup_stripes;
+        }
+        arena_p->stripes[n].chunk = nullptr;
+    }
+
+#if defined(__linux__)
+    char *region = mmap(nullptr, size + THPOOL_ARENA_CHUNK_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (unlikely(region == MAP_FAILED)) {
+        err = ENOMEM;
+        goto cleanup_stripes;
+    }
+    char *base = (char *)(((uintptr_t)region + THPOOL_ARENA_CHUNK_SIZE - 1) & ~(uintptr_t)(THPOOL_ARENA_CHUNK_SIZE - 1));
+    if (base > region) {
+        munmap(region, (size_t)(base - region));
+    }
+    if (region + THPOOL_ARENA_CHUNK_SIZE > base) {
+        munmap(base + size, (size_t)(region + THPOOL_ARENA_CHUNK_SIZE - base));
+    }
+#else
+    char *base = aligned_alloc(THPOOL_ARENA_CHUNK_SIZE, size);
+    if (unlikely(base == nullptr)) {
+        err = ENOMEM;
+        goto cleanup_stripes;
+    }
+#endif
+    arena_p->base = base;
+    arena_p->size = size;
+    return 0;
+
+cleanup_stripes:
+    while (--n >= 0) {
+        pthread_mutex_destroy(&arena_p->stripes[n].mutex);
+    }
+    pthread_mutex_destroy(&arena_p->mutex);
+    errno = err;
+    return -1;
+}
+
+/* 归还整个区域。此时所有任务都已结束，所有块连同其中未释放的分配一并归还。  */
+static void thpool_arena_destroy(thpool_arena *arena_p)
+{
+    if (arena_p->base == nullptr) {
+        return;
+    }
+#if defined(__linux__)
+    munmap(arena_p->base, arena_p->size);
+#else
+    free(arena_p->base);
+#endif
+    for (int n = 0; n < THPOOL_STATS_STRIPES; n++) {
+        pthread_mutex_destroy(&arena_p->stripes[n].mutex);
+    }
+    pthread_mutex_destroy(&arena_p->mutex);
+    arena_p->base = nullptr;
+    arena_p->size = 0;
+}
+
+/**
+ * 为一个块提交物理内存，调用者持有参数区的mutex。要求大页时先尝试以`MAP_HUGETLB`覆盖映射，
+ * 系统没有空闲的大页时退回普通页并以`MADV_HUGEPAGE`请求透明大页。覆盖映射失败时原映射可能已被移除，因此普通页总是重新映射。
+ */
+static int thpool_arena_commit_unsafe(thpool_arena *arena_p, char *chunk)
+{
+#if defined(__linux__)
+#if defined(MAP_HUGETLB)
+    if (arena_p->huge_pages &&
+        mmap(chunk, THPOOL_ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0) != MAP_FAILED) {
+        return 0;
+    }
+#endif
+    if (unlikely(mmap(chunk, THPOOL_ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)) {
+        return -1;
+    }
+#if defined(MADV_HUGEPAGE)
+    if (arena_p->huge_pages) {
+        madvise(chunk, THPOOL_ARENA_CHUNK_SIZE, MADV_HUGEPAGE);
+    }
+#endif
+#else
+    (void)arena_p;
+    (void)chunk;
+#endif
+    return 0;
+}
+
+/* 取一个块作为当前块：优先复用空闲链表中的块，否则提交下一个块。区域用尽时返回空指针，errno为`ENOMEM`。 */
+static thpool_arena_chunk *thpool_arena_chunk_get(thpool_arena *arena_p)
+{
+    pthread_mutex_lock(&arena_p->mutex);
+    thpool_arena_chunk *chunk_p = arena_p->free_list;
+    if (chunk_p != nullptr) {
+        arena_p->free_list = chunk_p->next;
+    } else {
+        size_t num_committed = atomic_load_explicit(&arena_p->num_committed, memory_order_relaxed);
+        if (num_committed < arena_p->size / THPOOL_ARENA_CHUNK_SIZE) {
+            char *chunk = arena_p->base + num_committed * THPOOL_ARENA_CHUNK_SIZE;
+            if (likely(thpool_arena_commit_unsafe(arena_p, chunk) == 0)) {
+                chunk_p = (thpool_arena_chunk *)chunk;
+                atomic_store_explicit(&arena_p->num_committed, num_committed + 1, memory_order_release);
+            }
+        }
+    }
+    pthread_mutex_unlock(&arena_p->mutex);
+    if (unlikely(chunk_p == nullptr)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    atomic_store_explicit(&chunk_p->live, THPOOL_ARENA_CHUNK_BIAS, memory_order_relaxed);
+    chunk_p->used = sizeof(thpool_arena_chunk);
+    chunk_p->num_allocs = 0;
+    return chunk_p;
+}
+
+static void thpool_arena_recycle(thpool_arena *arena_p, thpool_arena_chunk *chunk_p)
+{
+    pthread_mutex_lock(&arena_p->mutex);
+    chunk_p->next = arena_p->free_list;
+    arena_p->free_list = chunk_p;
+    pthread_mutex_unlock(&arena_p->mutex);
+}
+
+/* 持有者放弃当前块，减去预计引用中未用掉的部分。块内的分配已全部释放时由本线程回收该块。    */
+static void thpool_arena_retire(thpool_arena *arena_p, thpool_arena_chunk *chunk_p)
+{
+    unsigned unused = THPOOL_ARENA_CHUNK_BIAS - chunk_p->num_allocs;
+    if (atomic_fetch_sub_explicit(&chunk_p->live, unused, memory_order_acq_rel) == unused) {
+        thpool_arena_recycle(arena_p, chunk_p);
+    }
+}
+
+/**
+ * 从持有者的当前块中切出size字节，size已按THPOOL_ARENA_ALIGN取整。当前块放不下时换一个块。
+ * 持有者为工作线程时无需加锁，为条带时由调用者持有条带的mutex。
+ */
+static void *thpool_arena_carve(thpool_arena *arena_p, thpool_arena_chunk **chunk_pp, size_t size)
+{
+    thpool_arena_chunk *chunk_p = *chunk_pp;
+    if (unlikely(chunk_p == nullptr) || unlikely(THPOOL_ARENA_CHUNK_SIZE - chunk_p->used < size)) {
+        if (chunk_p != nullptr) {
+            thpool_arena_retire(arena_p, chunk_p);
+        }
+        *chunk_pp = chunk_p = thpool_arena_chunk_get(arena_p);
+        if (unlikely(chunk_p == nullptr)) {
+            return nullptr;
+        }
+    }
+    void *ptr = (char *)chunk_p + chunk_p->used;
+    chunk_p->used += size;
+    chunk_p->num_allocs++;
+    return ptr;
+}
+
+/**
+ * ptr是否位于参数区中某个已提交块的分配范围内。未启用参数区时base为空指针、num_committed为0，总是返回false。
+ * 尚未提交的块仍为PROT_NONE，以其中的指针调用`thpool_arena_put`会在读取块头时出错，因此以已提交的范围为界而不是整个区域。
+ */
+static inline bool thpool_arena_contains(thpool_arena *arena_p, void *ptr)
+{
+    size_t committed = atomic_load_explicit(&arena_p->num_committed, memory_order_acquire) * THPOOL_ARENA_CHUNK_SIZE;
+    return (uintptr_t)ptr - (uintptr_t)arena_p->base < committed &&
+           ((uintptr_t)ptr & (THPOOL_ARENA_CHUNK_SIZE - 1)) >= sizeof(thpool_arena_chunk);
+}
+
+/* 释放一个分配。块内的分配全部释放且持有者已放弃该块时，由释放最后一个分配的线程回收该块。 */
+static inline void thpool_arena_put(thpool_arena *arena_p, void *ptr)
+{
+    thpool_arena_chunk *chunk_p = (thpool_arena_chunk *)((uintptr_t)ptr & ~(uintptr_t)(THPOOL_ARENA_CHUNK_SIZE - 1));
+    if (atomic_fetch_sub_explicit(&chunk_p->live, 1, memory_order_acq_rel) == 1) {
+        thpool_arena_recycle(arena_p, chunk_p);
+    }
+}
+
+/**
+ * 任务结束后应归还的参数区分配：任务的用户参数位于本线程池的参数区内时返回它，否则返回空指针。
+ * 完成句柄与任务组的任务解开包装，取载体中的用户参数；载体在任务执行时归还，因此须在执行前调用。
+ */
+static inline void *thpool_arena_job_arg(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (likely(thpool_p->arena.base == nullptr)) {
+        return nullptr;
+    }
+    if (function_p == thpool_handle_run || function_p == thpool_group_run) {
+        arg_p = ((struct job *)arg_p)->arg;
+    }
+    return thpool_arena_contains(&thpool_p->arena, arg_p) ? arg_p : nullptr;
+}
+
+/**
+ * 工作线程（包括执行域的线程视图）从自身的当前块分配，不加锁；外部线程从所属条带的当前块分配，同一条带的线程之间才会竞争。
+ */
+static void *thpool_job_alloc_inner(thpool *thpool_p, size_t size)
+{
+    thpool_arena *arena_p = &thpool_p->arena;
+    if (unlikely(arena_p->base == nullptr)) {
+        errno = ENOTSUP;
+        return nullptr;
+    }
+    if (unlikely(size == 0) || unlikely(size > THPOOL_ARENA_MAX_ALLOC)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    size = (size + THPOOL_ARENA_ALIGN - 1) & ~(size_t)(THPOOL_ARENA_ALIGN - 1);
+    void *ptr;
+    struct thread *current_thrd = thpool_current_thread(thpool_p);
+    if (current_thrd != nullptr) {
+        ptr = thpool_arena_carve(arena_p, &current_thrd->arena_chunk, size);
+    } else {
+        thpool_arena_stripe *stripe_p = &arena_p->stripes[thpool_producer_stripe_index()];
+        pthread_mutex_lock(&stripe_p->mutex);
+        ptr = thpool_arena_carve(arena_p, &stripe_p->chunk, size);
+        pthread_mutex_unlock(&stripe_p->mutex);
+    }
+    if (unlikely(ptr == nullptr)) {
+        thpool_log_error("thpool_job_alloc(): job argument arena of %zu bytes is exhausted", arena_p->size);
+    }
+    return ptr;
+}
+
+static int thpool_job_free_inner(thpool *thpool_p, void *ptr)
+{
+    if (unlikely(!thpool_arena_contains(&thpool_p->arena, ptr))) {
+        errno = EINVAL;
+        return -1;
+    }
+    thpool_arena_put(&thpool_p->arena, ptr);
+    return 0;
+}
+
+/* ============================ JOB RING ============================ */
+
+/* 容量向上取整到2的幂，以便用掩码取模。  */
+static int jobring_init(jobring *ring_p, int min_capacity)
+{
+    size_t capacity = 1;
+    while (capacity < (size_t)min_capacity) {
+        capacity <<= 1;
+    }
+    ring_p->cells = aligned_alloc(THPOOL_CACHE_LINE_SIZE, capacity * sizeof(jobring_cell));
+    if (unlikely(ring_p->cells == nullptr)) {
+        return -1;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&ring_p->cells[i].seq, i);
+    }
+    ring_p->mask = capacity - 1;
+    atomic_init(&ring_p->enqueue_pos, 0);
+    atomic_init(&ring_p->dequeue_pos, 0);
+    return 0;
+}
+
+static void jobring_destroy(jobring *ring_p)
+{
+    free(ring_p->cells);
+    ring_p->cells = nullptr;
+}
+
+/* Returns false if the ring is full. */
+static bool jobring_push(jobring *ring_p, void (*function_p)(void *, threadpool_thread), void *arg_p, uint64_t enqueue_ns)
+{
+    jobring_cell *cell;
+    size_t pos = atomic_load_explicit(&ring_p->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        cell = &ring_p->cells[pos & ring_p->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring_p->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&ring_p->enqueue_pos, memory_order_relaxed);
+        }
+    }
+    cell->function = function_p;
+    cell->arg = arg_p;
+    cell->enqueue_ns = enqueue_ns;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+/* Returns false if the ring is empty. */
+static bool jobring_pop(jobring *ring_p, struct job *job_out)
+{
+    jobring_cell *cell;
+    size_t pos = atomic_load_explicit(&ring_p->dequeue_pos, memory_order_relaxed);
+    for (;;) {
+        cell = &ring_p->cells[pos & ring_p->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring_p->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&ring_p->dequeue_pos, memory_order_relaxed);
+        }
+    }
+    job_out->function = cell->function;
+    job_out->arg = cell->arg;
+    job_out->enqueue_ns = cell->enqueue_ns;
+    atomic_store_explicit(&cell->seq, pos + ring_p->mask + 1, memory_order_release);
+    return true;
+}
+
+/* ======================= WORK-STEALING DEQUE ====================== */
+
+/* node为所属线程的NUMA节点，-1表示普通分配。    */
+static wsdeque *wsdeque_create(int node)
+{
+    wsdeque *deque_p = thpool_node_alloc(sizeof(wsdeque), node);
+    if (unlikely(deque_p == nullptr)) {
+        return nullptr;
+    }
+    atomic_init(&deque_p->top, 0);
+    atomic_init(&deque_p->bottom, 0);
+    for (int i = 0; i < THPOOL_DEQUE_CAPACITY; i++) {
+        atomic_init(&deque_p->buffer[i], nullptr);
+    }
+    return deque_p;
+}
+
+/* 仅释放双端队列本身。队列中残留的任务应当先由`thpool_shutdown`清理。 */
+static void wsdeque_destroy(wsdeque *deque_p, int node)
+{
+    thpool_node_free(deque_p, sizeof(wsdeque), node);
+}
+
+/**
+ * 仅可由持有者调用。窃取者只会增加top，因此持有者观察到的剩余空间只会变多，
+ * 检查通过后持有者的一次push必定成功。
+ */
+static inline bool wsdeque_has_room(wsdeque *deque_p)
+{
+    long b = atomic_load_explicit(&deque_p->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&deque_p->top, memory_order_acquire);
+    return b - t < THPOOL_DEQUE_CAPACITY;
+}
+
+/* Push a job at the bottom. Owner only, caller must have checked `wsdeque_has_room`. */
+static inline void wsdeque_push(wsdeque *deque_p, struct job *newjob_p)
+{
+    long b = atomic_load_explicit(&deque_p->bottom, memory_order_relaxed);
+    atomic_store_explicit(&deque_p->buffer[b & (THPOOL_DEQUE_CAPACITY - 1)], newjob_p, memory_order_relaxed);
+    /* 以release写入bottom，与原文的release栅栏加relaxed写入等价，且能被ThreadSanitizer识别。  */
+    atomic_store_explicit(&deque_p->bottom, b + 1, memory_order_release);
+}
+
+/* Take a job from the bottom (LIFO). Owner only. Returns null pointer if empty. */
+static struct job *wsdeque_take(wsdeque *deque_p)
+{
+    long b = atomic_load_explicit(&deque_p->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque_p->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&deque_p->top, memory_order_relaxed);
+    struct job *job_p = nullptr;
+
+    if (t <= b) {
+        job_p = atomic_load_explicit(&deque_p->buffer[b & (THPOOL_DEQUE_CAPACITY - 1)], memory_order_relaxed);
+        if (t == b) {
+            /* 只剩最后一个任务，与窃取者竞争。   */
+            if (!atomic_compare_exchange_strong_explicit(&deque_p->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+                job_p = nullptr;
+            }
+            atomic_store_explicit(&deque_p->bottom, b + 1, memory_order_relaxed);
+        }
+    } else {
+        atomic_store_explicit(&deque_p->bottom, b + 1, memory_order_relaxed);
+    }
+    return job_p;
+}
+
+/* Steal a job from the top (FIFO). Any thread. Returns null pointer if empty or lost the race. */
+static struct job *wsdeque_steal(wsdeque *deque_p)
+{
+    long t = atomic_load_explicit(&deque_p->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&deque_p->bottom, memory_order_acquire);
+
+    if (t < b) {
+        struct job *job_p = atomic_load_explicit(&deque_p->buffer[t & (THPOOL_DEQUE_CAPACITY - 1)], memory_order_relaxed);
+        if (!atomic_compare_exchange_strong_explicit(&deque_p->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            return nullptr;
+        }
+        return job_p;
+    }
+    return nullptr;
+}
+
+/* ========================== THREADPOOL ============================ */
+
+/**
+ * @brief Initializes a thread pool.
+ *
+ * Creates and initializes a thread pool with the specified configuration.
+ * This function blocks until all worker threads have been successfully created and are ready.
+ * It also handles the creation or binding of the concurrency passport based on the config.
+ *
+ * @param conf Pointer to a threadpool_config structure containing initialization options.
+ * Must not be null pointer. The memory pointed to by @p conf is only needed during the call to thpool_init.
+ * @return threadpool A handle to the created thread pool on success, or null pointer on error.
+ * Returns null pointer if memory allocation fails, thread creation fails, or passport binding/initialization fails.
+ */
+struct thpool *thpool_init(threadpool_config *conf)
+{
+    if (unlikely(conf == nullptr)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    int num_threads = (conf->num_threads < 0)?0:conf->num_threads;
+
+    /* Make new thread pool */
+    thpool *thpool_p;
+    thpool_p = aligned_alloc(THPOOL_CACHE_LINE_SIZE, sizeof(struct thpool));
+    if (unlikely(thpool_p == nullptr)) {
+        thpool_log_error("thpool_init(): Could not allocate memory for thread pool");
+        return nullptr;
+    }
+
+    /* 创建或使用用户提供的同步控制块。 */
+    /* Create or use user-provided concurrency control block (passport). */
+#ifdef THPOOL_ENABLE_DEBUG_CONC_API
+    if (conf->passport == nullptr){
+        thpool_p->passport_user_owned = false;
+        thpool_p->debug_conc_passport = thpool_debug_conc_passport_init();
+    } else {
+        thpool_p->passport_user_owned = true;
+        thpool_p->debug_conc_passport = conf->passport;
+    }
+
+    if (thpool_p->debug_conc_passport == nullptr) {
+        thpool_log_error("thpool_init(): Could not allocate memory for conc state block");
+        goto cleanup_pool;
+    }
+
+    /* 同步控制块绑定。 */
+    /* Bind passport to this thread pool. */
+    bool bind_success = false;
+    enum thpool_state expected = THPOOL_UNBIND;
+    while (!atomic_compare_exchange_weak(&thpool_p->debug_conc_passport->state, &expected, THPOOL_ALIVE)) {
+        if (likely(expected == THPOOL_UNBIND)) {
+            /* 应该是弱交换造成的伪错误，继续循环。 */
+            continue;
+        } else {
+            /* 其他情况理应是将一个已经被绑定过的passport重复绑定了，因此报告上一个绑定的线程池信息。   */
+            thpool_log_error("passport rebind! The old "THPOOL_PASSPORT_STATUS_REPORTER(thpool_p->debug_conc_passport, expected));
+            errno = EINVAL;
+            goto cleanup_passport;
+        }
+    }
+    THPOOL_PROBE3(state_change, thpool_p->debug_conc_passport, THPOOL_UNBIND, THPOOL_ALIVE);
+    thpool_p->debug_conc_passport->bind_pool = thpool_p;
+    snprintf(thpool_p->debug_conc_passport->name_copy, sizeof(thpool_p->debug_conc_passport->name_copy), "%s", conf->thread_name_prefix);
+    bind_success = true;
+#else
+    thpool_p->debug_conc_passport = thpool_debug_conc_passport_init_inner(THPOOL_ALIVE);
+    if (thpool_p->debug_conc_passport == nullptr) {
+        thpool_log_error("thpool_init(): Could not allocate memory for conc state block");
+        goto cleanup_pool;
+    }
+#endif
+
+    /* 配置继承。   */
+    /* Inherit configuration.   */
+    snprintf(thpool_p->thread_name_prefix, sizeof(thpool_p->thread_name_prefix), "%s", conf->thread_name_prefix);
+    thpool_p->thread_start_cb = conf->thread_start_cb;
+    thpool_p->thread_end_cb = conf->thread_end_cb;
+    thpool_p->callback_arg = conf->callback_arg;
+    thpool_p->callback_arg_destructor = conf->callback_arg_destructor;
+    thpool_p->threads_capacity = (conf->max_threads > num_threads) ? conf->max_threads : num_threads;
+    thpool_p->min_threads = (conf->min_threads > 1) ? conf->min_threads : 1;
+    thpool_p->idle_timeout_ms = (conf->idle_timeout_ms > 0) ? conf->idle_timeout_ms : 0;
+    thpool_p->scale_up_queue_depth = (conf->scale_up_queue_depth > 0) ? conf->scale_up_queue_depth : 0;
+    thpool_p->sched_mode = conf->sched_mode;
+    thpool_p->idle_policy = conf->idle_policy;
+    thpool_p->idle_spin_ns = (conf->idle_spin_ns > 0) ? conf->idle_spin_ns : THPOOL_DEFAULT_IDLE_SPIN_NS;
+    thpool_p->stats_timing = (conf->stats_timing != 0);
+    thpool_p->reject_policy = conf->reject_policy;
+    thpool_p->nested_inline_depth = (conf->nested_inline_depth > 0) ? conf->nested_inline_depth : 0;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t scratch_size = (conf->thread_scratch_size > 0) ? conf->thread_scratch_size : THPOOL_SCRATCH_SIZE;
+    thpool_p->scratch_size = (scratch_size + page - 1) / page * page;
+    thpool_p->pre_job_cb = conf->pre_job_cb;
+    thpool_p->post_job_cb = conf->post_job_cb;
+    thpool_p->job_timestamps = thpool_p->stats_timing || conf->pre_job_cb != nullptr || conf->post_job_cb != nullptr;
+    /**
+     * 执行域为执行线程池的每个线程位置准备一个线程视图，num_threads改为服务任务数上限。
+     * 调度模式、空闲缩减、自动扩大与延续槽位都属于实际的工作线程，对执行域不适用。
+     */
+    thpool_p->executor = conf->executor;
+    thpool_p->domain_weight = (conf->executor_weight > 0) ? conf->executor_weight : 1;
+    thpool_p->domain_max_servers = 0;
+    atomic_init(&thpool_p->num_domains, 0);
+    atomic_init(&thpool_p->domain_servers, 0);
+    atomic_init(&thpool_p->domain_serving, 0);
+    if (thpool_p->executor != nullptr) {
+        if (unlikely(thpool_p->executor->executor != nullptr)) {
+            thpool_log_error("thpool_init(): the executor is itself an executor domain");
+            errno = EINVAL;
+            goto cleanup_passport;
+        }
+        thpool_p->threads_capacity = thpool_p->executor->threads_capacity;
+        thpool_p->domain_max_servers = (num_threads > 0 && num_threads < thpool_p->threads_capacity) ? num_threads : thpool_p->threads_capacity;
+        num_threads = thpool_p->threads_capacity;
+        thpool_p->sched_mode = THPOOL_SCHED_SHARED_QUEUE;
+        thpool_p->idle_timeout_ms = 0;
+        thpool_p->scale_up_queue_depth = 0;
+        thpool_p->nested_inline_depth = 0;
+    }
+    if (unlikely(thpool_affinity_init(thpool_p, conf) == -1)) {
+        goto cleanup_passport;
+    }
+
+    /* 原子量初始化。   */
+    /* Initialize atomics.      */
+    atomic_init(&thpool_p->threads_keepalive, true);
+    atomic_init(&thpool_p->threads_active, true);
+    atomic_init(&thpool_p->num_threads, 0);
+    atomic_init(&thpool_p->num_threads_running, 0);
+    atomic_init(&thpool_p->num_threads_alive, 0);
+    atomic_init(&thpool_p->num_idle_waiters, 0);
+    atomic_init(&thpool_p->num_jobs_queued, 0);
+    for (int i = 0; i < THPOOL_DRAIN_STRIPES; i++) {
+        atomic_init(&thpool_p->drain_stripes[i].word, 0);
+    }
+    atomic_init(&thpool_p->drain_seq, 0);
+    atomic_init(&thpool_p->num_drainers, 0);
+    atomic_init(&thpool_p->num_threads_parked, 0);
+    atomic_init(&thpool_p->num_producers_blocked, 0);
+    atomic_init(&thpool_p->queue_len_peak, 0);
+    for (int i = 0; i < THPOOL_STATS_STRIPES; i++) {
+        producer_stats_init(&thpool_p->producer_stats[i]);
+    }
+    /**
+     * 如果用户对callback_arg传入了析构函数，则各线程默认均持有引用。此外线程池自己也持有引用。
+     * 由于之后随时可能启动新线程，线程池的引用持续到`thpool_shutdown`中所有线程退出为止。
+     */
+    if (thpool_p->callback_arg_destructor != nullptr) {
+        atomic_init(&thpool_p->callback_arg_refcount, num_threads + 1);
+    } else {
+        atomic_init(&thpool_p->callback_arg_refcount, 0);
+    }
+
+    /* 在任务队列创建前，先创建相关锁。 */
+    /* Job queue related locks and condition variables initialization. */
+    int err = pthread_mutex_init(&(thpool_p->jobqueue_rwmutex), nullptr);
+    if (unlikely(err != 0)) { // Check init result
+        thpool_log_error("thpool_init(): Could not initialize jobqueue_rwmutex");
+        errno = err;
+        goto cleanup_numa_nodes;
+    }
+    /* 创建任务队列。   */
+    /* Initialise the job queue */
+    threadpool_queue_backend backend = (thpool_p->executor != nullptr) ? THPOOL_QUEUE_LINKED_LIST : conf->queue_backend;
+    if (unlikely(jobqueue_init(&thpool_p->jobqueue, conf->work_num_max, backend, conf->prio_aging_threshold, conf->prio_work_num_max) == -1)) {
+        thpool_log_error("thpool_init(): Could not allocate memory for job queue");
+        goto cleanup_jobqueue_rwmutex;
+    }
+    thpool_p->num_affine_queued = 0;
+    /**
+     * 任务分配器初始化，节点按需分配。有上限时，节点数量不超过排队上限、每线程执行中的一个节点与每线程缓存之和。
+     */
+    jobpool_init(&thpool_p->jobpool, (conf->work_num_max > 0) ? conf->work_num_max + thpool_p->threads_capacity * (THPOOL_JOB_CACHE_SIZE + 1) : 0);
+
+    /* 任务队列条件量初始化。   */
+    err = pthread_cond_init(&thpool_p->get_job_unblock, nullptr);
+    if (unlikely(err != 0)) { // Check init result
+        thpool_log_error("thpool_init(): Could not initialize get_job_unblock");
+        errno = err;
+        goto cleanup_jobqueue;
+    }
+    /* put_job_unblock用于限时提交，Linux下以CLOCK_MONOTONIC计时。 */
+    err = thpool_cond_init_monotonic(&thpool_p->put_job_unblock);
+    if (unlikely(err != 0)) { // Check init result
+        thpool_log_error("thpool_init(): Could not initialize put_job_unblock");
+        errno = err;
+        goto cleanup_get_job_unblock;
+    }
+
+    /* TSD key 初始化。         */
+    err = pthread_key_create(&thpool_p->key, nullptr);
+    if (unlikely(err != 0)) {
+        thpool_log_error("thpool_init(): Could not initialize TSD key");
+        errno = err;
+        goto cleanup_put_job_unblock;
+    }
+
+    /* Make threads in pool */
+    thpool_p->threads = calloc(thpool_p->threads_capacity, sizeof(struct thread *));
+    if (unlikely(thpool_p->threads == nullptr)) {
+        thpool_log_error("thpool_init(): Could not allocate memory for threads");
+        goto cleanup_TSD_key;
+    }
+
+    /* 线程空闲锁与条件量初始化。 */
+    /* Thread idle lock and condition variable initialization. */
+    err = pthread_mutex_init(&(thpool_p->threads_all_idle_mutex), nullptr);
+    if (unlikely(err != 0)) { // Check init result
+        thpool_log_error("thpool_init(): Could not initialize threads_all_idle_mutex");
+        errno = err;
+        goto cleanup_threads_array;
+    }
+    err = pthread_cond_init(&thpool_p->threads_all_idle, nullptr);
+    if (unlikely(err != 0)) { // Check init result
+        thpool_log_error("thpool_init(): Could not initialize threads_all_idle");
+        errno = err;
+        goto cleanup_threads_all_idle_mutex;
+    }
+    err = pthread_mutex_init(&thpool_p->resize_mutex, nullptr);
+    if (unlikely(err != 0)) {
+        thpool_log_error("thpool_init(): Could not initialize resize_mutex");
+        errno = err;
+        goto cleanup_threads_all_idle_cond;
+    }
+    err = pthread_mutex_init(&thpool_p->drain_mutex, nullptr);
+    if (unlikely(err != 0)) {
+        thpool_log_error("thpool_init(): Could not initialize drain_mutex");
+        errno = err;
+        goto cleanup_resize_mutex;
+    }
+    if (unlikely(thpool_timer_wheel_init(&thpool_p->timer_wheel) != 0)) {
+        thpool_log_error("thpool_init(): Could not initialize timer wheel");
+        goto cleanup_drain_mutex;
+    }
+    if (unlikely(thpool_fiber_poller_init(&thpool_p->fibers, conf->fiber_stack_size) != 0)) {
+        thpool_log_error("thpool_init(): Could not initialize fiber poller");
+        goto cleanup_timer_wheel;
+    }
+    if (unlikely(thpool_arena_init(&thpool_p->arena, conf->arena_size, conf->arena_huge_pages != 0) != 0)) {
+        thpool_log_error("thpool_init(): Could not reserve %zu bytes for job argument arena", conf->arena_size);
+        goto cleanup_fiber_poller;
+    }
+
+    int n;
+    /* 执行域只创建线程视图，再挂到执行线程池上。 */
+    if (thpool_p->executor != nullptr) {
+        thpool *executor_p = thpool_p->executor;
+        for (n = 0; n < num_threads; n++) {
+            if (unlikely(thread_alloc(thpool_p, &thpool_p->threads[n], n) != 0)) {
+                goto cleanup_views;
+            }
+            atomic_store_explicit(&thpool_p->num_threads, n + 1, memory_order_release);
+        }
+        atomic_store(&thpool_p->num_threads_running, thpool_p->domain_max_servers);
+        pthread_mutex_lock(&executor_p->jobqueue_rwmutex);
+        if (unlikely(!atomic_load(&executor_p->threads_keepalive))) {
+            pthread_mutex_unlock(&executor_p->jobqueue_rwmutex);
+            thpool_log_error("thpool_init(): the executor is shutting down");
+            errno = ECANCELED;
+            goto cleanup_views;
+        }
+        if (executor_p->jobpool.max_nodes) {
+            executor_p->jobpool.max_nodes += num_threads;
+        }
+        atomic_fetch_add(&executor_p->num_domains, 1);
+        pthread_mutex_unlock(&executor_p->jobqueue_rwmutex);
+        return thpool_p;
+    }
+
+    /* Thread init */
+    /* 创建失败的线程不占用位置，保证已创建的位置连续，之后的扩大只需在末尾追加。 */
+    int created = 0;
+    for (n=0; n<num_threads; n++) {
+        int thread_init_err = thread_init(thpool_p, &thpool_p->threads[created], created);
+        thpool_log_debug("THPOOL_DEBUG: Created thread %d in pool", n);
+        if (unlikely(thread_init_err != 0)) {
+            thpool_log_error("init thread %d fail", n);
+            continue;
+        }
+        created++;
+        atomic_store_explicit(&thpool_p->num_threads, created, memory_order_release);
+    }
+    num_threads = created;
+    if (unlikely(num_threads <= 0)) {
+        goto cleanup_arena;
+    }
+    atomic_store(&thpool_p->num_threads_running, num_threads);
+
+    /* Wait for threads to initialize */
+    while (atomic_load(&thpool_p->num_threads_alive) != num_threads) {
+        /**
+         * 在创建与销毁等性能不那么敏感的地方，没有再添加条件变量。
+         * 如果为此添加一个条件变量和一个锁，仅仅为了创建和销毁的这一点小小的需求就要消耗88字节常驻内存，我有些无法接受。
+         * 其他地方的条件变量的检查都是需要多次使用的，唯独此处几乎仅需要检查一次，我实在不想为此实现cond和mutex的通知机制。
+         * 而相比原作者的自旋忙等待，采取了`nanosleep`等待的折中方案。
+         */
+        nanosleep(&(struct timespec) {0, 10000}, nullptr);
+    }
+
+    return thpool_p;
+
+cleanup_views:
+    for (n = atomic_load(&thpool_p->num_threads) - 1; n >= 0; n--) {
+        wsdeque_destroy(thpool_p->threads[n]->deque, thpool_p->threads[n]->numa_node);
+        thpool_node_free(thpool_p->threads[n], sizeof(struct thread), thpool_p->threads[n]->numa_node);
+    }
+cleanup_arena:
+    thpool_arena_destroy(&thpool_p->arena);
+cleanup_fiber_poller:
+    thpool_fiber_poller_destroy(&thpool_p->fibers);
+cleanup_timer_wheel:
+    thpool_timer_wheel_destroy(&thpool_p->timer_wheel);
+cleanup_drain_mutex:
+    pthread_mutex_destroy(&thpool_p->drain_mutex);
+cleanup_resize_mutex:
+    pthread_mutex_destroy(&thpool_p->resize_mutex);
+cleanup_threads_all_idle_cond:
+    pthread_cond_destroy(&thpool_p->threads_all_idle);
+cleanup_threads_all_idle_mutex:
+    pthread_mutex_destroy(&thpool_p->threads_all_idle_mutex);
+cleanup_threads_array:
+    free(thpool_p->threads);
+cleanup_TSD_key:
+    pthread_key_delete(thpool_p->key);
+cleanup_put_job_unblock:
+    pthread_cond_destroy(&thpool_p->put_job_unblock);
+cleanup_get_job_unblock:
+    pthread_cond_destroy(&thpool_p->get_job_unblock);
+cleanup_jobqueue:
+    /* 此处的锁逻辑上是无意义的，仅仅是为了遵循自己设计的API调用约定。    */
+    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+    jobqueue_destroy_unsafe(&thpool_p->jobqueue);
+    jobpool_destroy(&thpool_p->jobpool);
+    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+cleanup_jobqueue_rwmutex:
+    pthread_mutex_destroy(&(thpool_p->jobqueue_rwmutex));
+cleanup_numa_nodes:
+    free(thpool_p->numa_nodes);
+cleanup_passport:
+#ifdef THPOOL_ENABLE_DEBUG_CONC_API
+    if (bind_success) {
+        /* 如果最初绑定成功，passport状态块回退回THPOOL_UNBIND。    */
+        expected = THPOOL_ALIVE;
+        while (!atomic_compare_exchange_weak(&thpool_p->debug_conc_passport->state, &expected, THPOOL_UNBIND)) {
+            if (expected == THPOOL_ALIVE) {
+                /* 应该是弱交换造成的伪错误，继续循环。 */
+                continue;
+            } else {
+                /* 不明原因解绑失败，那没办法了，反正都要错误退出了。   */
+                thpool_log_error("passport unbind failed! The "THPOOL_PASSPORT_STATUS_REPORTER(thpool_p->debug_conc_passport, expected));
+                // Unbind failed from ALIVE state. What should happen? Passport is likely still bound.
+                // This indicates a serious error during initialization cleanup.
+                // Maybe just log and continue cleanup, leaving passport in potentially bad state?
+                // Or attempt to force the state? Forcing might hide errors. Log and continue is safer.
+                break;
+            }
+        }
+        THPOOL_PROBE3(state_change, thpool_p->debug_conc_passport, THPOOL_ALIVE, THPOOL_UNBIND);
+        thpool_p->debug_conc_passport->bind_pool = nullptr;
+    }
+    if (!thpool_p->passport_user_owned) {
+        /* 若passport非用户持有，无警告地简单清理掉passport对象。   */
+        free(thpool_p->debug_conc_passport);
+    }
+#else
+    free(thpool_p->debug_conc_passport);
+#endif
+cleanup_pool:
+    free(thpool_p);
+    return nullptr;
+}
+
+/* 将thpool的threads_keepalive设置为false，并等待所有线程与正在执行中的thpool_add_work执行完毕。    */
+static int thpool_shutdown_safe_inner(thpool *thpool_p, conc_state_block *passport)
+{
+    /* 禁止线程池内的线程本身执行`thpool_shutdown`。    */
+    if (thpool_is_current_thread_owner(thpool_p)) {
+        errno = EINVAL;
+        return -1;
+    }
+    enum thpool_state expected = THPOOL_ALIVE;
+    /* 若交换失败，则发生了重复调用，错误退出。 */
+    if (!atomic_compare_exchange_strong(&passport->state, &expected, THPOOL_SHUTTING_DOWN)) {
+        thpool_log_error("cannot shutdown! The "THPOOL_PASSPORT_STATUS_REPORTER(passport, expected));
+        errno = EINVAL;
+        return -1;
+    }
+    THPOOL_PROBE3(state_change, passport, THPOOL_ALIVE, THPOOL_SHUTTING_DOWN);
+    if (unlikely(atomic_load(&thpool_p->num_domains) > 0)) {
+        thpool_log_warn("thpool_shutdown(): %d executor domains are still attached, their jobs will no longer run", atomic_load(&thpool_p->num_domains));
+    }
+
+    /* End each thread 's infinite loop */
+    /* 在resize_mutex内关闭存活标记，正在进行的扩大完成后，不会再有新线程启动。 */
+    pthread_mutex_lock(&thpool_p->resize_mutex);
+    atomic_store(&thpool_p->threads_keepalive, false);
+    atomic_store(&thpool_p->threads_active, false);
+    pthread_mutex_unlock(&thpool_p->resize_mutex);
+
+    /* 大幅修正原作者基于二元信号做的不优雅摧毁逻辑，一次广播即可保证所有jobqueue的阻塞取消。   */
+    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+    pthread_cond_broadcast(&thpool_p->get_job_unblock);
+    pthread_cond_broadcast(&thpool_p->put_job_unblock);
+    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    /* 排队的任务将被丢弃而不再逐个减少计数，`thpool_drain`看到存活标记已关闭后返回。 */
+    atomic_fetch_add(&thpool_p->drain_seq, 1);
+    thpool_futex_wake(&thpool_p->drain_seq);
+
+    /* 定时器线程不再推进时间轮，尚未到期的定时器留待下面统一释放。  */
+    thpool_timer_wheel_stop(&thpool_p->timer_wheel);
+    /* 挂起的协程不再恢复，与尚未执行的任务一样被丢弃。   */
+    thpool_fiber_poller_stop(&thpool_p->fibers);
+
+    /* Poll remaining threads */
+    if (thpool_p->executor != nullptr) {
+        thpool_domain_stop(thpool_p);
+    }
+    while (atomic_load(&thpool_p->num_threads_alive) != 0) {
+        sleep(1);
+    }
+
+    /* 等待所有正在使用中的api退出。 */
+    while (thpool_passport_in_use(passport)) {
+        sleep(1);
+    }
+
+    /* 不会再有线程启动，解除线程池自身对`callback_arg`的引用。    */
+    if (thpool_p->callback_arg_destructor != nullptr) {
+        if (atomic_fetch_sub_explicit(&thpool_p->callback_arg_refcount, 1, memory_order_acq_rel) == 1) {
+            thpool_p->callback_arg_destructor(thpool_p->callback_arg);
+            thpool_log_debug("callback_arg destructed by thpool_shutdown.");
+        }
+    }
+
+    /* Job queue cleanup */
+    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+    jobqueue_destroy_unsafe(&thpool_p->jobqueue);
+    /* 所有线程已退出，此时可以安全地以持有者身份清空各双端队列与私有队列中的残留任务。节点随任务分配器统一释放。    */
+    int num_slots = atomic_load(&thpool_p->num_threads);
+    for (int n = 0; n < num_slots; n++) {
+        struct thread *thread_p = thpool_p->threads[n];
+        if (thread_p == nullptr) {
+            continue;
+        }
+        job *job_p;
+        while (thread_p->deque != nullptr && (job_p = wsdeque_take(thread_p->deque)) != nullptr) {
+            thpool_job_discard(job_p->function, job_p->arg);
+        }
+        while (thread_p->affine_len > 0) {
+            job_p = thread_affine_pull_unsafe(thpool_p, thread_p);
+            thpool_job_discard(job_p->function, job_p->arg);
+        }
+    }
+    atomic_store(&thpool_p->num_jobs_queued, 0);
+    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    /* 已入队的到期任务已随队列丢弃，此时释放所有定时器，包括用户尚未释放的句柄。    */
+    thpool_timer_wheel_release(&thpool_p->timer_wheel);
+    thpool_fiber_poller_release(&thpool_p->fibers);
+
+    expected = THPOOL_SHUTTING_DOWN;
+    /* 若交换失败，不明原因，可能是弱交换的固有问题，继续等待   */
+    while (!atomic_compare_exchange_weak(&passport->state, &expected, THPOOL_SHUTDOWN)) {
+        if (expected == THPOOL_SHUTTING_DOWN) {
+            /* 应该是弱交换造成的伪错误，继续循环。 */
+            continue;
+        } else {
+            /* 其他情况理论不可达，abort。  */
+            thpool_log_fatal("shutdown but status panic! The "THPOOL_PASSPORT_STATUS_REPORTER(passport, expected));
+            abort();
+        }
+    }
+    THPOOL_PROBE3(state_change, passport, THPOOL_SHUTTING_DOWN, THPOOL_SHUTDOWN);
+    /* 工作线程均已退出，它们留在异步日志缓冲中的记录此时全部写出。    */
+    thpool_log_flush();
+    return 0;
+}
+
+/* Destroy the threadpool */
+static int thpool_destroy_safe_inner(thpool *thpool_p, conc_state_block *passport)
+{
+    /* 禁止线程池内的线程本身执行`thpool_destroy`。    */
+    if (thpool_is_current_thread_owner(thpool_p)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    enum thpool_state expected = THPOOL_SHUTDOWN;
+    /* 若交换失败，情况可能有多种，分别讨论。   */
+    while (!atomic_compare_exchange_weak(&passport->state, &expected, THPOOL_DESTROYING)) {
+        /* 根据不同情形决定不同应对 */
+        switch (expected) {
+        case THPOOL_ALIVE:
+            //还没有开始shutdown，尝试运行shutdown，并警告用户尽量先shutdown。
+#ifdef THPOOL_ENABLE_DEBUG_CONC_API
+            thpool_log_warn("threadpool %p:%s has not shutdown yet, `thpool_shutdown` first is recommanded. Try auto shutdown...", passport->bind_pool, passport->name_copy);
+#else
+            thpool_log_warn("threadpool has not shutdown yet, `thpool_shutdown` first is recommanded. Try auto shutdown...");
+#endif
+            thpool_shutdown_safe_inner(thpool_p, passport);
+            /* 不论结果如何，先continue根据新的expected再看。*/
+            break;
+        case THPOOL_SHUTTING_DOWN:
+#ifdef THPOOL_ENABLE_DEBUG_CONC_API
+            thpool_log_warn("threadpool %p:%s is shutting down, waiting ...", passport->bind_pool, passport->name_copy);
+#else
+            thpool_log_warn("threadpool is shutting down, waiting ...");
+#endif
+            sleep(1);
+            break;
+        case THPOOL_SHUTDOWN:
+            /* 假失败，重试。   */
+            break;
+        default:
+            thpool_log_error("cannot destroy! The "THPOOL_PASSPORT_STATUS_REPORTER(passport, expected));
+            errno = EINVAL;
+            return -1;
+        }
+        continue;
+    }
+    THPOOL_PROBE3(state_change, passport, THPOOL_SHUTDOWN, THPOOL_DESTROYING);
+#ifdef THPOOL_ENABLE_DEBUG_CONC_API
+    bool passport_user_owned = thpool_p->passport_user_owned;
+#endif
+
+    /* Deallocs */
+    int n;
+    int num_slots = atomic_load(&thpool_p->num_threads);
+    for (n=0; n < num_slots; n++) {
+        thread_destroy(thpool_p->threads[n]);
+    }
+    free(thpool_p->threads);
+    free(thpool_p->numa_nodes);
+    /* 完成句柄位于任务节点中，随任务分配器一同释放，之后再使用它们即为释放后使用。  */
+    int num_handles = atomic_load(&thpool_p->jobpool.num_detached);
+    if (unlikely(num_handles > 0)) {
+        thpool_log_warn("thpool_destroy(): %d completion handles were not released", num_handles);
+    }
+    jobpool_destroy(&thpool_p->jobpool);
+
+    pthread_mutex_destroy(&thpool_p->threads_all_idle_mutex);
+    pthread_cond_destroy(&thpool_p->threads_all_idle);
+    pthread_mutex_destroy(&thpool_p->resize_mutex);
+    pthread_mutex_destroy(&thpool_p->drain_mutex);
+    thpool_timer_wheel_destroy(&thpool_p->timer_wheel);
+    thpool_fiber_poller_destroy(&thpool_p->fibers);
+    thpool_arena_destroy(&thpool_p->arena);
+    pthread_mutex_destroy(&(thpool_p->jobqueue_rwmutex));
+    pthread_cond_destroy(&thpool_p->get_job_unblock);
+    pthread_cond_destroy(&thpool_p->put_job_unblock);
+    pthread_key_delete(thpool_p->key);
+
+    free(thpool_p);
+    expected = THPOOL_DESTROYING;
+    /* 若交换失败，不明原因，可能是弱交换的固有问题，继续等待   */
+    while (!atomic_compare_exchange_weak(&passport->state, &expected, THPOOL_DESTROYED)) {
+        if (expected == THPOOL_DESTROYING) {
+            /* 应该是弱交换造成的伪错误，继续循环。 */
+            continue;
+        } else {
+            /* 理论不可达的情况，abort  */
+            thpool_log_fatal("destroyed but status panic! The "THPOOL_PASSPORT_STATUS_REPORTER(passport, expected));
+            abort();
+        }
+    }
+    THPOOL_PROBE3(state_change, passport, THPOOL_DESTROYING, THPOOL_DESTROYED);
+#ifdef THPOOL_ENABLE_DEBUG_CONC_API
+    /* 若passport非用户持有，无警告地简单清理掉passport对象。   */
+    if (!passport_user_owned) {
+        free(passport);
+    }
+#else
+    free(passport);
+#endif
+    return 0;
+}
+
+/**
+ * 为即将入队的任务预留一个名额。无上限时直接计数。
+ * 有上限时以CAS预留，保证共享队列与各双端队列中的任务总数不会超过`work_num_max`。
+ * 返回false表示队列已满。
+ */
+static inline bool thpool_reserve_job_slot(thpool *thpool_p)
+{
+    int max_len = thpool_p->jobqueue.max_len;
+    if (!max_len) {
+        thpool_stats_update_peak(thpool_p, atomic_fetch_add(&thpool_p->num_jobs_queued, 1) + 1);
+        return true;
+    }
+    int queued = atomic_load(&thpool_p->num_jobs_queued);
+    do {
+        if (queued >= max_len) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&thpool_p->num_jobs_queued, &queued, queued + 1));
+    thpool_stats_update_peak(thpool_p, queued + 1);
+    return true;
+}
+
+/* 批量预留至多num个名额，返回实际预留的数量。返回0表示队列已满。   */
+static int thpool_reserve_job_slots(thpool *thpool_p, int num)
+{
+    int max_len = thpool_p->jobqueue.max_len;
+    if (!max_len) {
+        thpool_stats_update_peak(thpool_p, atomic_fetch_add(&thpool_p->num_jobs_queued, num) + num);
+        return num;
+    }
+    int queued = atomic_load(&thpool_p->num_jobs_queued);
+    int reserved;
+    do {
+        if (queued >= max_len) {
+            return 0;
+        }
+        reserved = (max_len - queued < num) ? max_len - queued : num;
+    } while (!atomic_compare_exchange_weak(&thpool_p->num_jobs_queued, &queued, queued + reserved));
+    thpool_stats_update_peak(thpool_p, queued + reserved);
+    return reserved;
+}
+
+/**
+ * 任务出队后释放其名额。若有生产者因队列已满而阻塞，唤醒其中一个。
+ * @param locked 调用者是否已持有jobqueue_rwmutex。
+ */
+static void thpool_release_job_slot(thpool *thpool_p, bool locked)
+{
+    atomic_fetch_sub(&thpool_p->num_jobs_queued, 1);
+    if ((thpool_p->jobqueue.max_len || thpool_p->jobqueue.level_limited) && atomic_load(&thpool_p->num_producers_blocked) > 0) {
+        /**
+         * 原先只在任务总数从满变为满-1时广播，因为被唤醒的put_job持锁时并无优先权，只发一个信号会让其他put_job错过。
+         * 现在每释放一个名额，只要仍有生产者阻塞就发送一个信号，每个名额对应一次唤醒，不再需要广播造成惊群。
+         * 已被唤醒、尚未重新持锁的生产者仍计入阻塞数，但它已不在等待队列中，新的信号会落到其他阻塞者身上。
+         * 不持锁的调用者（双端队列、环形缓冲区出队）也必须在锁内发信号，否则可能与检查条件后、尚未进入等待的put_job错过。
+         * 例外是设置了优先级级别的单独上限：阻塞者等待的可能是不同级别，单个信号可能落到条件仍不满足的阻塞者身上，此时仍需广播。
+         */
+        if (!locked) {
+            pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+        }
+        if (unlikely(thpool_p->jobqueue.level_limited)) {
+            pthread_cond_broadcast(&thpool_p->put_job_unblock);
+        } else {
+            pthread_cond_signal(&thpool_p->put_job_unblock);
+        }
+        if (!locked) {
+            pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+        }
+    }
+}
+
+/**
+ * 不持锁的入队方预留名额后调用，重新确认线程池仍处于活跃状态。
+ * `thpool_wait`在锁内先关闭活跃标记、后读取任务总数，与这里先预留名额、后读取活跃标记的顺序相对，
+ * 两者都是顺序一致的原子操作，因此要么`thpool_wait`看到名额而继续等待，要么本线程看到不活跃。
+ * 后一种情况释放名额并返回false，由调用者改走持锁路径阻塞至`thpool_reactivate`。
+ * 释放的名额可能正是`thpool_wait`看到的那一个，因此按工作线程结束任务时的条件唤醒等待者。
+ */
+static bool thpool_recheck_active(thpool *thpool_p)
+{
+    if (likely(atomic_load(&thpool_p->threads_active))) {
+        return true;
+    }
+    thpool_release_job_slot(thpool_p, false);
+    if (atomic_load(&thpool_p->num_idle_waiters) > 0 && atomic_load(&thpool_p->num_jobs_queued) == 0) {
+        pthread_mutex_lock(&thpool_p->threads_all_idle_mutex);
+        pthread_cond_broadcast(&thpool_p->threads_all_idle);
+        pthread_mutex_unlock(&thpool_p->threads_all_idle_mutex);
+    }
+    return false;
+}
+
+/**
+ * 在锁内等待并预留至多num个名额，返回实际预留的数量。返回0表示未能预留，errno为`ECANCELED`（线程池已shutdown）、
+ * `EAGAIN`（timeout_ns为0且需要等待）或`ETIMEDOUT`（等待超时）。timeout_ns为负数表示不限时。
+ * 在不活跃状态，阻塞。此外，若开启队列最大长度且队列已满，或者prio级别设置了单独上限且已满，阻塞。
+ * prio为负数表示任务不进入链表的优先级子队列（例如环形缓冲区），不受级别上限约束。
+ *
+ * 进入等待前先登记阻塞数，再重新尝试预留，与`thpool_release_job_slot`先释放名额、后读取阻塞数的顺序相对。
+ * 两者都是顺序一致的原子操作，因此要么本线程重新预留成功，要么释放方看到登记，并在锁内发送信号。
+ * 本线程从检查到进入等待全程持锁，信号不会丢失。活跃状态与存活状态的变化都在锁内广播，无需登记。
+ */
+static int thpool_wait_job_slots_unsafe(thpool *thpool_p, int num, int prio, long timeout_ns)
+{
+    int reserved = 0;
+    struct timespec deadline;
+    if (timeout_ns > 0) {
+        deadline = thpool_cond_deadline(thpool_now_ns() + (uint64_t)timeout_ns);
+    }
+    while (atomic_load(&thpool_p->threads_keepalive)) {
+        bool threads_active = atomic_load(&thpool_p->threads_active);
+        /* 级别的任务数只在锁内变化，检查一次即可。   */
+        int room = jobqueue_level_room_unsafe(&thpool_p->jobqueue, prio, num);
+        if (likely(threads_active) && room > 0 && (reserved = thpool_reserve_job_slots(thpool_p, room)) != 0) {
+            break;
+        }
+        atomic_fetch_add(&thpool_p->num_producers_blocked, 1);
+        if (likely(threads_active) && room > 0 && (reserved = thpool_reserve_job_slots(thpool_p, room)) != 0) {
+            atomic_fetch_sub(&thpool_p->num_producers_blocked, 1);
+            break;
+        }
+        if (timeout_ns == 0) {
+            atomic_fetch_sub(&thpool_p->num_producers_blocked, 1);
+            errno = EAGAIN;
+            return 0;
+        }
+        /* 
+        * 小心use after free风险！如果不能确保所有thpool_put_job执行完成后才销毁，这里无法保证thpool_p仍然存在！
+        * 解决方案：将thpool_destroy拆分成thpool_shutdown和thpool_destroy。thpool_shutdown令所有线程终止，但不销毁资源。
+        * thpool_destroy仅销毁资源，必须确保在所有对该thpool执行相关操作的线程全部终止运行，才允许调用，且必须在thpool_shutdown之后调用。
+        */
+        uint64_t block_start_ns = thpool_stats_timestamp(thpool_p);
+        int err = 0;
+        THPOOL_PROBE2(producer_block, thpool_p, atomic_load_explicit(&thpool_p->num_jobs_queued, memory_order_relaxed));
+        if (timeout_ns > 0) {
+            /* put_job_unblock在Linux下以CLOCK_MONOTONIC计时，不受系统时间调整影响，参见`thpool_cond_init_monotonic`。 */
+            err = pthread_cond_timedwait(&thpool_p->put_job_unblock, &thpool_p->jobqueue_rwmutex, &deadline);
+        } else {
+            pthread_cond_wait(&thpool_p->put_job_unblock, &thpool_p->jobqueue_rwmutex);
+        }
+        THPOOL_PROBE2(producer_unblock, thpool_p, err);
+        atomic_fetch_sub(&thpool_p->num_producers_blocked, 1);
+        if (thpool_p->stats_timing) {
+            producer_stats *stats_p = thpool_producer_stats(thpool_p, thpool_current_thread(thpool_p));
+            atomic_fetch_add_explicit(&stats_p->blocked_ns, thpool_now_ns() - block_start_ns, memory_order_relaxed);
+        }
+        if (err == ETIMEDOUT) {
+            /* 超时后再尝试一次。超时返回时仍可能已消耗了一次信号，放弃前须转给其他阻塞者，否则其名额可能无人认领。   */
+            if (likely(atomic_load(&thpool_p->threads_active)) && (room = jobqueue_level_room_unsafe(&thpool_p->jobqueue, prio, num)) > 0 &&
+                (reserved = thpool_reserve_job_slots(thpool_p, room)) != 0) {
+                break;
+            }
+            if (atomic_load(&thpool_p->threads_keepalive)) {
+                if (atomic_load(&thpool_p->num_producers_blocked) > 0) {
+                    pthread_cond_signal(&thpool_p->put_job_unblock);
+                }
+                errno = ETIMEDOUT;
+                return 0;
+            }
+        }
+    }
+    if (reserved == 0) {
+        errno = ECANCELED;
+    }
+    return reserved;
+}
+
+/**
+ * `thpool_put_job`、`thpool_put_job_affine`与`thpool_put_job_deadline`的公共前半部分：加锁，阻塞至预留到一个名额，
+ * 再分配任务节点并填入任务函数、参数与入队时间戳。成功时返回节点，此时仍持有jobqueue_rwmutex，由调用者入队后解锁。
+ * 失败时已归还名额并解锁，在锁外写日志后返回空指针，errno见`thpool_wait_job_slots_unsafe`，内存不足时为`ENOMEM`。
+ * 任务节点在预留名额后才分配，阻塞中的生产者不占用节点，节点数量因此受`work_num_max`约束。
+ * @param thread_p 调用者所在的工作线程，可为空指针。非空时优先使用该线程缓存的节点。
+ * @param prio     级别上限所针对的优先级，负数表示任务不进入链表的优先级子队列。
+ * @param caller   日志中的调用者名称。
+ */
+static job *thpool_put_job_begin(thpool *thpool_p, struct thread *thread_p, int prio, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ns, const char *caller)
+{
+    /* 日志一律放在临界区之外，开启调试日志时也不延长持锁时间。    */
+    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+
+    /* 阻塞至预留到名额。但若阻塞期间线程池shutdown，退出。    */
+    //在锁内仅需关心一次keealive情况。后续即使再遭遇thpool的销毁，在锁内也可以保护此流程安全。
+    if (thpool_wait_job_slots_unsafe(thpool_p, 1, prio, timeout_ns) == 0) {
+        int err = errno;
+        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+        thpool_log_debug("%s: no job slot, errno = %d", caller, err);
+        errno = err;
+        return nullptr;
+    }
+
+    job *newjob;
+    if (thread_p != nullptr && thread_p->job_cache != nullptr) {
+        newjob = thread_p->job_cache;
+        thread_p->job_cache = newjob->prev;
+        thread_p->job_cache_len--;
+    } else {
+        newjob = jobpool_alloc_unsafe(&thpool_p->jobpool, true);
+        if (unlikely(newjob == nullptr)) {
+            thpool_release_job_slot(thpool_p, true);
+            pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+            thpool_log_error("%s: Could not allocate memory for job slab", caller);
+            errno = ENOMEM;
+            return nullptr;
+        }
+    }
+    newjob->function = function_p;
+    newjob->arg = arg_p;
+    newjob->enqueue_ns = thpool_job_stamp(thpool_p);
+    return newjob;
+}
+
+/**
+ * 有一个返回值，通知结果是成功还是失败。0为成功，-1为失败。失败一般是因为已经thpool正在shutdown。
+ * 任务节点在预留名额后才分配，阻塞中的生产者不占用节点，节点数量因此受`work_num_max`约束。
+ * @param thread_p 调用者所在的工作线程，可为空指针。非空时优先使用该线程缓存的节点。
+ * @param prio     任务进入的优先级子队列。
+ * @param timeout_ns 等待名额的时限，见`thpool_wait_job_slots_unsafe`。
+ */
+static int thpool_put_job(thpool *thpool_p, struct thread *thread_p, threadpool_priority prio, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ns)
+{
+    job *newjob = thpool_put_job_begin(thpool_p, thread_p, prio, function_p, arg_p, timeout_ns, "thpool_put_job");
+    if (unlikely(newjob == nullptr)) {
+        return -1;
+    }
+    jobqueue_push_unsafe(&thpool_p->jobqueue, newjob, prio);
+    bool kicked = true;
+    if (unlikely(thpool_p->executor != nullptr)) {
+        kicked = thpool_domain_kick_unsafe(thpool_p, 1);
+    }
+
+    /**
+     * 若有工作线程休眠，唤醒其中一个。休眠线程数在锁内增减，此处读取是准确的。
+     * 原先只在任务从0变为1时广播：被唤醒的get_job持锁时并无优先权，只发一个信号会让其他get_job错过。
+     * 现在每个任务入队都检查一次，一个任务对应一次唤醒，既不会遗漏，也不会惊群。
+     */
+    if (atomic_load(&thpool_p->num_threads_parked) > 0) {
+        pthread_cond_signal(&thpool_p->get_job_unblock);
+    }
+
+    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    if (unlikely(!kicked)) {
+        thpool_domain_post_failed(thpool_p, "thpool_put_job");
+    }
+    
+    return 0;
+}
+
+/**
+ * 放入截止时间堆，阻塞语义与时限与`thpool_put_job`一致。截止时间任务总是进入共享链表所在的锁内队列，不受级别上限约束。
+ */
+static int thpool_put_job_deadline(thpool *thpool_p, struct thread *thread_p, uint64_t deadline_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, void (*on_expire)(void *, threadpool_thread))
+{
+    job *newjob = thpool_put_job_begin(thpool_p, thread_p, -1, function_p, arg_p, -1, "thpool_put_job_deadline");
+    if (unlikely(newjob == nullptr)) {
+        return -1;
+    }
+    if (unlikely(jobqueue_push_deadline_unsafe(&thpool_p->jobqueue, newjob, deadline_ns, on_expire) == -1)) {
+        thpool_drain_leave(thpool_p, newjob->enqueue_ns);
+        jobpool_free_unsafe(&thpool_p->jobpool, newjob);
+        thpool_release_job_slot(thpool_p, true);
+        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+        errno = ENOMEM;
+        return -1;
+    }
+    bool kicked = true;
+    if (unlikely(thpool_p->executor != nullptr)) {
+        kicked = thpool_domain_kick_unsafe(thpool_p, 1);
+    }
+    if (atomic_load(&thpool_p->num_threads_parked) > 0) {
+        pthread_cond_signal(&thpool_p->get_job_unblock);
+    }
+    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    if (unlikely(!kicked)) {
+        thpool_domain_post_failed(thpool_p, "thpool_put_job_deadline");
+    }
+    return 0;
+}
+
+/**
+ * 工作窃取模式下，由工作线程将任务放入自身的双端队列，不经过jobqueue_rwmutex。
+ * 双端队列已满、任务总数已达上限或线程池不活跃时，退回到`thpool_put_job`，沿用其阻塞语义与时限。
+ */
+static int thpool_put_job_local(thpool *thpool_p, struct thread *thread_p, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ns)
+{
+    if (unlikely(!atomic_load(&thpool_p->threads_keepalive))) {
+        errno = ECANCELED;
+        return -1;
+    }
+    if (unlikely(!atomic_load(&thpool_p->threads_active)) || !wsdeque_has_room(thread_p->deque) || !thpool_reserve_job_slot(thpool_p) ||
+        unlikely(!thpool_recheck_active(thpool_p))) {
+        return thpool_put_job(thpool_p, thread_p, THPOOL_PRIO_NORMAL, function_p, arg_p, timeout_ns);
+    }
+
+    job *newjob = thread_alloc_job(thpool_p, thread_p);
+    if (unlikely(newjob == nullptr)) {
+        thpool_release_job_slot(thpool_p, false);
+        errno = ENOMEM;
+        return -1;
+    }
+    newjob->function = function_p;
+    newjob->arg = arg_p;
+    newjob->enqueue_ns = thpool_job_stamp(thpool_p);
+    wsdeque_push(thread_p->deque, newjob);
+    thpool_notify_job_added(thpool_p);
+    return 0;
+}
+
+/**
+ * 不持锁的入队方（双端队列、环形缓冲区）在任务入队后调用，必要时唤醒休眠的工作线程。
+ *
+ * 先预留名额（计数自增）再读取休眠线程数，与`thpool_get_job`中先登记休眠再读取计数的顺序相对，
+ * 两者都是顺序一致的原子操作，因此至少有一方能观察到另一方：要么休眠方看到计数非零不进入休眠，
+ * 要么入队方看到有线程休眠，并在锁内发送信号。休眠方从检查到进入等待全程持锁，信号不会丢失。
+ * 由于每次入队都会检查，这里发送单个信号即可。
+ */
+static inline void thpool_notify_job_added(thpool *thpool_p)
+{
+    if (atomic_load(&thpool_p->num_threads_parked) > 0) {
+        pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+        pthread_cond_signal(&thpool_p->get_job_unblock);
+        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    }
+}
+
+/**
+ * 将工作线程内部提交的任务放入该线程的延续槽位。槽位已被占用、连续执行的延续任务已达上限，
+ * 或线程池不活跃、正在关闭时返回false，由调用者照常入队。
+ * 延续任务不经过队列，不占用排队名额，在设置本线程busy标志后即对`thpool_wait`可见：
+ * 本线程将在当前任务返回后执行它，期间不会清除busy标志。
+ */
+static inline bool thpool_put_job_cont(thpool *thpool_p, struct thread *thread_p, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (thread_p->cont_pending || thread_p->cont_depth >= thpool_p->nested_inline_depth ||
+        unlikely(!atomic_load(&thpool_p->threads_active)) || unlikely(!atomic_load(&thpool_p->threads_keepalive))) {
+        return false;
+    }
+    thread_p->cont_job.function = function_p;
+    thread_p->cont_job.arg = arg_p;
+    thread_p->cont_job.enqueue_ns = thpool_job_stamp(thpool_p);
+    thread_p->cont_pending = true;
+    /* 线程开始回调中提交时，本线程尚未处于工作状态。   */
+    atomic_store_explicit(&thread_p->busy, true, memory_order_relaxed);
+    return true;
+}
+
+/**
+ * 线程是否还能接收私有任务。THREAD_EXITING在锁内、私有队列为空时才会进入，
+ * 因此持锁看到状态早于THREAD_EXITING时放入的任务，一定会在线程退出前执行。
+ */
+static inline bool thread_accepts_affine(struct thread *thread_p)
+{
+    return atomic_load(&thread_p->run_state) < THREAD_EXITING;
+}
+
+/* 放入线程的私有队列。调用者须持锁，并已为任务预留名额。   */
+static void thread_affine_push_unsafe(thpool *thpool_p, struct thread *thread_p, struct job *newjob)
+{
+    newjob->prev = nullptr;
+    if (thread_p->affine_len == 0) {
+        thread_p->affine_front = newjob;
+    } else {
+        thread_p->affine_rear->prev = newjob;
+    }
+    thread_p->affine_rear = newjob;
+    thread_p->affine_len++;
+    thpool_p->num_affine_queued++;
+}
+
+/* 取出线程私有队列中最早的任务。调用者须持锁，并保证私有队列非空。   */
+static struct job *thread_affine_pull_unsafe(thpool *thpool_p, struct thread *thread_p)
+{
+    job *job_p = thread_p->affine_front;
+    thread_p->affine_front = job_p->prev;
+    if (--thread_p->affine_len == 0) {
+        thread_p->affine_rear = nullptr;
+    }
+    thpool_p->num_affine_queued--;
+    return job_p;
+}
+
+/**
+ * 放入target_p的私有队列，阻塞语义与时限与`thpool_put_job`一致。私有任务不进入优先级子队列，不受级别上限约束。
+ * 预留名额期间目标线程可能已经退出，此时任务退回共享链表的普通级别。
+ * 私有队列没有单独的条件变量，目标线程可能休眠时只能广播get_job_unblock，其他被唤醒的线程发现没有可取的任务后重新休眠。
+ */
+static int thpool_put_job_affine(thpool *thpool_p, struct thread *thread_p, struct thread *target_p, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ns)
+{
+    job *newjob = thpool_put_job_begin(thpool_p, thread_p, -1, function_p, arg_p, timeout_ns, "thpool_put_job_affine");
+    if (unlikely(newjob == nullptr)) {
+        return -1;
+    }
+    if (likely(thread_accepts_affine(target_p))) {
+        thread_affine_push_unsafe(thpool_p, target_p, newjob);
+        if (atomic_load(&thpool_p->num_threads_parked) > 0) {
+            pthread_cond_broadcast(&thpool_p->get_job_unblock);
+        }
+    } else {
+        jobqueue_push_unsafe(&thpool_p->jobqueue, newjob, THPOOL_PRIO_NORMAL);
+        if (atomic_load(&thpool_p->num_threads_parked) > 0) {
+            pthread_cond_signal(&thpool_p->get_job_unblock);
+        }
+    }
+    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    return 0;
+}
+
+/**
+ * 环形缓冲区后端的入队。快速路径既不分配内存也不加锁，仅在名额已满或线程池不活跃时，
+ * 在锁内阻塞于put_job_unblock，语义与时限与`thpool_put_job`一致。
+ */
+static int thpool_put_job_ring(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ns)
+{
+    if (unlikely(!atomic_load(&thpool_p->threads_active)) || !thpool_reserve_job_slot(thpool_p) || unlikely(!thpool_recheck_active(thpool_p))) {
+        pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+        int reserved = thpool_wait_job_slots_unsafe(thpool_p, 1, -1, timeout_ns);
+        int err = errno;
+        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+        if (reserved == 0) {
+            errno = err;
+            return -1;
+        }
+    }
+
+    /* 预留名额后检查存活，与`thpool_shutdown`先关闭存活标记、后清空队列的顺序相对。  */
+    if (unlikely(!atomic_load(&thpool_p->threads_keepalive))) {
+        thpool_release_job_slot(thpool_p, false);
+        errno = ECANCELED;
+        return -1;
+    }
+
+    /**
+     * 名额保证了环形缓冲区中的任务总数不超过容量，但Vyukov算法中，某个已认领槽位、尚未写回序号的慢消费者
+     * 仍会令对应槽位暂时不可写。这一窗口极短，让出CPU重试即可。
+     */
+    uint64_t enqueue_ns = thpool_job_stamp(thpool_p);
+    while (!jobring_push(thpool_p->jobqueue.ring, function_p, arg_p, enqueue_ns)) {
+        sched_yield();
+    }
+    thpool_notify_job_added(thpool_p);
+    return 0;
+}
+
+/**
+ * 从共享链表中丢弃一个任务，其节点改写为新任务，放到普通级别的队尾，新任务继承其名额。
+ * 从最低的非空优先级中取最早的任务；若普通级别已达单独上限，改为从普通级别选取，保证新任务能放入。
+ * low_only为真时，只在选中的是`THPOOL_PRIO_LOW`或普通级别已满时丢弃。成功返回0并经victim_out交出被丢弃的任务。
+ */
+static int thpool_drop_listed_job(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p, bool low_only, job *victim_out)
+{
+    jobqueue *jobqueue_p = &thpool_p->jobqueue;
+    int ret = -1;
+    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+    /* 截止时间任务过期后自行丢弃，不作为被丢弃的对象。 */
+    if (jobqueue_p->level_mask != 0) {
+        bool normal_full = (jobqueue_level_room_unsafe(jobqueue_p, THPOOL_PRIO_NORMAL, 1) == 0);
+        int level = normal_full ? THPOOL_PRIO_NORMAL : jobqueue_lowest_level(jobqueue_p->level_mask);
+        if (!low_only || normal_full || level == THPOOL_PRIO_LOW) {
+            job *job_p = jobqueue_pull_level_unsafe(jobqueue_p, level);
+            victim_out->function = job_p->function;
+            victim_out->arg = job_p->arg;
+            victim_out->enqueue_ns = job_p->enqueue_ns;
+            job_p->function = function_p;
+            job_p->arg = arg_p;
+            job_p->enqueue_ns = thpool_job_stamp(thpool_p);
+            jobqueue_push_unsafe(jobqueue_p, job_p, THPOOL_PRIO_NORMAL);
+            ret = 0;
+        }
+    }
+    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    return ret;
+}
+
+/* 在锁外完成被丢弃的任务，其参数区中的参数随之归还。   */
+static void thpool_drop_victim(thpool *thpool_p, struct job *victim_p)
+{
+    void *arena_arg = thpool_arena_job_arg(thpool_p, victim_p->function, victim_p->arg);
+    thpool_drain_leave(thpool_p, victim_p->enqueue_ns);
+    thpool_job_discard(victim_p->function, victim_p->arg);
+    if (arena_arg != nullptr) {
+        thpool_arena_put(&thpool_p->arena, arena_arg);
+    }
+}
+
+/**
+ * `THPOOL_REJECT_DROP_OLDEST`：丢弃一个排队中的任务，新任务继承其名额，因此无需重新预留。
+ * 依次尝试共享链表中的低优先级任务、环形缓冲区、各双端队列与共享链表中的其余任务，每个队列内丢弃最早的任务。
+ * 丢弃操作放入链表的新任务比双端队列中已有的任务新，因此双端队列先于链表中的普通任务，避免反复丢弃刚放入的任务。
+ * 被丢弃的任务在锁外以取消状态完成。没有可丢弃的任务时返回-1，errno为`EAGAIN`。
+ */
+static int thpool_put_job_drop_oldest(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    jobqueue *jobqueue_p = &thpool_p->jobqueue;
+    job victim;
+    if (unlikely(!atomic_load(&thpool_p->threads_keepalive))) {
+        errno = ECANCELED;
+        return -1;
+    }
+
+    if (thpool_drop_listed_job(thpool_p, function_p, arg_p, true, &victim) == 0) {
+        thpool_drop_victim(thpool_p, &victim);
+        return 0;
+    }
+
+    /* 环形缓冲区取出一个任务后，至少空出一个槽位，写入仅可能因慢消费者短暂重试。   */
+    if (jobqueue_p->ring != nullptr && jobring_pop(jobqueue_p->ring, &victim)) {
+        uint64_t enqueue_ns = thpool_job_stamp(thpool_p);
+        while (!jobring_push(jobqueue_p->ring, function_p, arg_p, enqueue_ns)) {
+            sched_yield();
+        }
+        thpool_notify_job_added(thpool_p);
+        thpool_drop_victim(thpool_p, &victim);
+        return 0;
+    }
+
+    /* 以窃取者身份从双端队列中取出最早的任务，其节点改写为新任务后放入共享链表。  */
+    if (thpool_p->sched_mode == THPOOL_SCHED_WORK_STEALING) {
+        int num_threads = atomic_load_explicit(&thpool_p->num_threads, memory_order_acquire);
+        for (int n = 0; n < num_threads; n++) {
+            struct thread *thread_p = thpool_p->threads[n];
+            job *job_p;
+            if (thread_p == nullptr || (job_p = wsdeque_steal(thread_p->deque)) == nullptr) {
+                continue;
+            }
+            victim.function = job_p->function;
+            victim.arg = job_p->arg;
+            victim.enqueue_ns = job_p->enqueue_ns;
+            job_p->function = function_p;
+            job_p->arg = arg_p;
+            job_p->enqueue_ns = thpool_job_stamp(thpool_p);
+            pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+            jobqueue_push_unsafe(jobqueue_p, job_p, THPOOL_PRIO_NORMAL);
+            if (atomic_load(&thpool_p->num_threads_parked) > 0) {
+                pthread_cond_signal(&thpool_p->get_job_unblock);
+            }
+            pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+            thpool_drop_victim(thpool_p, &victim);
+            return 0;
+        }
+    }
+
+    if (thpool_drop_listed_job(thpool_p, function_p, arg_p, false, &victim) == 0) {
+        thpool_drop_victim(thpool_p, &victim);
+        return 0;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+/**
+ * 任务执行完毕后回收其节点：优先放入本线程缓存，缓存已满时归还到分配器。
+ * 从环形缓冲区取出的任务暂存于线程元数据中，无需回收。
+ */
+static inline void thread_release_job(struct thread *thread_p, struct job *job_p)
+{
+    if (job_p == &thread_p->ring_job || job_p == &thread_p->cont_job) {
+        return;
+    }
+    if (thread_p->job_cache_len < THPOOL_JOB_CACHE_SIZE) {
+        job_p->prev = thread_p->job_cache;
+        thread_p->job_cache = job_p;
+        thread_p->job_cache_len++;
+    } else {
+        jobpool_return(&thread_p->thpool_p->jobpool, job_p);
+    }
+}
+
+/**
+ * @brief Interval at which a work-stealing worker checks the shared queue before its own deque.
+ *
+ * 工作线程持续生产本地任务时，共享队列中外部提交的任务可能一直得不到调度。
+ * 因此每隔若干次取任务，优先检查一次共享队列。
+ */
+#define THPOOL_INJECTION_CHECK_INTERVAL 61
+
+/**
+ * 不持锁地尝试获取任务。工作窃取模式下，先按LIFO取自身双端队列，再按FIFO窃取其他线程的双端队列；
+ * 环形缓冲区后端下，从环形缓冲区出队。
+ * 取得的任务仍占有名额，由调用者在计入工作线程数后释放。
+ */
+static struct job *thpool_try_get_job_local(thpool *thpool_p, struct thread *thread_p)
+{
+    struct job *job_p;
+
+    /**
+     * 共享链表中有高于普通优先级的任务时，放弃无锁路径，由持锁路径按优先级出队。
+     * 不活跃状态下同样放弃，与持锁路径一样不取任务，由调用者在锁内休眠至`thpool_reactivate`。
+     */
+    if (atomic_load_explicit(&thpool_p->jobqueue.len_urgent, memory_order_relaxed) > 0 ||
+        unlikely(!atomic_load(&thpool_p->threads_active))) {
+        return nullptr;
+    }
+
+    bool ring = (thpool_p->jobqueue.backend == THPOOL_QUEUE_RING);
+
+    if (thread_p->deque == nullptr) {
+        /* 非工作窃取模式下，只有环形缓冲区可以不持锁地获取。  */
+        if (ring && jobring_pop(thpool_p->jobqueue.ring, &thread_p->ring_job)) {
+            return &thread_p->ring_job;
+        }
+        return nullptr;
+    }
+
+    if (unlikely(++thread_p->sched_tick % THPOOL_INJECTION_CHECK_INTERVAL == 0)) {
+        if (ring) {
+            if (jobring_pop(thpool_p->jobqueue.ring, &thread_p->ring_job)) {
+                return &thread_p->ring_job;
+            }
+        } else {
+            /* 返回空指针，令调用者先进入持锁路径检查共享队列。   */
+            return nullptr;
+        }
+    }
+
+    job_p = wsdeque_take(thread_p->deque);
+    if (job_p != nullptr) {
+        return job_p;
+    }
+
+    /* 环形缓冲区作为注入队列时，不需要加锁，先于窃取检查。 */
+    if (ring && jobring_pop(thpool_p->jobqueue.ring, &thread_p->ring_job)) {
+        return &thread_p->ring_job;
+    }
+
+    /**
+     * 任务总数为零时无需轮询。这同时保证了只有在`thpool_init`返回、有任务提交以后才会读取threads数组，
+     * 避免与`thpool_init`中仍在写入的threads数组发生数据竞争。
+     */
+    if (atomic_load(&thpool_p->num_jobs_queued) == 0) {
+        return nullptr;
+    }
+
+    /* 从伪随机位置开始轮询其他线程，避免所有窃取者争抢同一个目标。  */
+    int num_threads = atomic_load_explicit(&thpool_p->num_threads, memory_order_acquire);
+    thread_p->steal_seed ^= thread_p->steal_seed << 13;
+    thread_p->steal_seed ^= thread_p->steal_seed >> 17;
+    thread_p->steal_seed ^= thread_p->steal_seed << 5;
+    int start = (int)(thread_p->steal_seed % (unsigned)num_threads);
+    /* 跨多个NUMA节点放置时分两轮，先窃取同一节点上的线程，再窃取其他节点上的线程。  */
+    bool local_first = (thpool_p->num_numa_nodes > 1);
+    for (int pass = local_first ? 0 : 1; pass < 2; pass++) {
+        for (int i = 0; i < num_threads; i++) {
+            struct thread *victim = thpool_p->threads[(start + i) % num_threads];
+            if (victim == nullptr || victim == thread_p) {
+                continue;
+            }
+            if (local_first && (victim->numa_node == thread_p->numa_node) != (pass == 0)) {
+                continue;
+            }
+            job_p = wsdeque_steal(victim->deque);
+            if (job_p != nullptr) {
+                return job_p;
+            }
+        }
+    }
+    return nullptr;
+}
+
+/* 自旋等待时的CPU让步指令，降低自旋对同一物理核上其他超线程的干扰。   */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define thpool_cpu_relax() __builtin_ia32_pause()
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+#define thpool_cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define thpool_cpu_relax() sched_yield()
+#endif
+
+/* 自适应空闲策略的最短自旋时长，避免自旋时长缩减到零后再也无法观察到任务的到达间隔。 */
+#define THPOOL_MIN_IDLE_SPIN_NS     1000L
+
+static inline long thpool_elapsed_ns(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+}
+
+/**
+ * 休眠前按空闲策略自旋，观察排队任务总数。返回true表示自旋期间有任务入队。
+ * 自旋中的线程不计入休眠线程数，入队方不会为其发送信号，从而省去唤醒与上下文切换。
+ */
+static bool thpool_spin_for_job(thpool *thpool_p, struct thread *thread_p)
+{
+    long budget;
+    switch (thpool_p->idle_policy) {
+    case THPOOL_IDLE_SPIN:
+            budget = thpool_p->idle_spin_ns;
+            break;
+    case THPOOL_IDLE_ADAPTIVE:
+            budget = thread_p->spin_budget_ns;
+            break;
+    default:
+            return false;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool found = false;
+    for (unsigned i = 1; ; i++) {
+        if (atomic_load_explicit(&thpool_p->num_jobs_queued, memory_order_relaxed) > 0) {
+            found = true;
+            break;
+        }
+        if (unlikely(!atomic_load_explicit(&thpool_p->threads_keepalive, memory_order_relaxed))) {
+            break;
+        }
+        thpool_cpu_relax();
+        /* 读取时钟的开销远大于一次让步，每64次才检查一次是否超时。 */
+        if (i % 64 == 0 && thpool_elapsed_ns(&start) >= budget) {
+            break;
+        }
+    }
+
+    if (thpool_p->idle_policy == THPOOL_IDLE_ADAPTIVE) {
+        if (found) {
+            budget *= 2;
+            thread_p->spin_budget_ns = (budget < thpool_p->idle_spin_ns) ? budget : thpool_p->idle_spin_ns;
+        } else {
+            budget /= 2;
+            thread_p->spin_budget_ns = (budget > THPOOL_MIN_IDLE_SPIN_NS) ? budget : THPOOL_MIN_IDLE_SPIN_NS;
+        }
+    }
+    return found;
+}
+
+/**
+ * 获取任务，必要时阻塞。返回任务时已设置本线程的busy标志。
+ * 标记先于名额释放，名额释放是seq_cst序的读改写，`thpool_wait`只要看到队列为空，就一定能看到该线程处于工作状态，
+ * 因此标记本身使用relaxed序即可。
+ * 线程被要求退出时，先取完自身双端队列与私有队列中的任务，再进入THREAD_EXITING并返回空指针。
+ */
+static struct job *thpool_get_job(thpool *thpool_p, struct thread *thread_p)
+{
+    /* 存在不持锁入队的队列时，共享链表为空不代表没有任务。  */
+    bool lock_free = (thpool_p->sched_mode == THPOOL_SCHED_WORK_STEALING || thpool_p->jobqueue.backend == THPOOL_QUEUE_RING);
+    struct job *ret;
+
+    for (;;) {
+        if (unlikely(atomic_load_explicit(&thread_p->run_state, memory_order_relaxed) == THREAD_RETIRING)) {
+            /* 只有本线程能向自身双端队列添加任务，取空后其中不会再出现新任务。  */
+            if (thread_p->deque != nullptr && (ret = wsdeque_take(thread_p->deque)) != nullptr) {
+                atomic_store_explicit(&thread_p->busy, true, memory_order_relaxed);
+                thpool_release_job_slot(thpool_p, false);
+                return ret;
+            }
+            /**
+             * 私有队列在锁内检查，并在同一临界区内进入THREAD_EXITING。生产者在锁内确认目标线程尚未退出才放入私有任务，
+             * 因此私有队列取空后不会再出现新任务。CAS失败说明`thpool_resize`撤回了退出要求，继续工作。
+             */
+            pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+            if (thread_p->affine_len > 0) {
+                ret = thread_affine_pull_unsafe(thpool_p, thread_p);
+                atomic_store_explicit(&thread_p->busy, true, memory_order_relaxed);
+                thpool_release_job_slot(thpool_p, true);
+                pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+                return ret;
+            }
+            enum thread_run_state expected = THREAD_RETIRING;
+            bool exiting = atomic_compare_exchange_strong(&thread_p->run_state, &expected, THREAD_EXITING);
+            pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+            if (exiting) {
+                errno = ECANCELED;
+                return nullptr;
+            }
+        }
+
+        if (lock_free) {
+            ret = thpool_try_get_job_local(thpool_p, thread_p);
+            if (ret != nullptr) {
+                atomic_store_explicit(&thread_p->busy, true, memory_order_relaxed);
+                thpool_release_job_slot(thpool_p, false);
+                return ret;
+            }
+        }
+
+        /* 没有排队任务时，按空闲策略先自旋再进入持锁路径休眠。自旋期间有任务入队，且可以不持锁获取时，直接重试。   */
+        if (atomic_load(&thpool_p->num_jobs_queued) == 0 && thpool_spin_for_job(thpool_p, thread_p) && lock_free) {
+            continue;
+        }
+
+        pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+        bool thpool_alive = atomic_load(&thpool_p->threads_keepalive);
+        bool retry = false;
+        bool idle_expired = false;
+
+        /**
+         * 在不活跃状态，阻塞。此外，若队列空，阻塞。但若阻塞期间线程池摧毁，退出。 
+         * 目前对于活跃状态的检查是冗余的，因为只有`thpool_wait`会修改active状态，而此时队列一定为空。
+         * 但考虑到可扩展性，保留对`threads_active`的阻塞检查。
+         */
+        while (thpool_alive && ((thpool_p->jobqueue.len == 0 && thread_p->affine_len == 0) || unlikely(!atomic_load(&thpool_p->threads_active)))) {
+            /* `thpool_resize`在锁内广播唤醒被要求退出的线程，回到循环开头处理。  */
+            if (unlikely(atomic_load_explicit(&thread_p->run_state, memory_order_relaxed) == THREAD_RETIRING)) {
+                retry = true;
+                break;
+            }
+            atomic_fetch_add(&thpool_p->num_threads_parked, 1);
+            /**
+             * 工作窃取模式或环形缓冲区后端下，共享链表为空不代表没有任务，先登记休眠再检查任务总数。
+             * 除去其他线程的私有任务后总数非零，说明双端队列或环形缓冲区中仍有任务，放弃休眠，回到无锁路径获取。
+             */
+            if (lock_free && atomic_load(&thpool_p->num_jobs_queued) > thpool_p->num_affine_queued && likely(atomic_load(&thpool_p->threads_active))) {
+                atomic_fetch_sub(&thpool_p->num_threads_parked, 1);
+                retry = true;
+                break;
+            }
+            /* 开启空闲自动缩减且线程数多于下限时，限时休眠，超时后尝试退出。   */
+            if (thpool_p->idle_timeout_ms > 0 && atomic_load_explicit(&thpool_p->num_threads_running, memory_order_relaxed) > thpool_p->min_threads) {
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_sec += thpool_p->idle_timeout_ms / 1000;
+                deadline.tv_nsec += (thpool_p->idle_timeout_ms % 1000) * 1000000L;
+                if (deadline.tv_nsec >= 1000000000L) {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000L;
+                }
+                THPOOL_PROBE2(worker_park, thpool_p, thread_p->id);
+                idle_expired = (pthread_cond_timedwait(&thpool_p->get_job_unblock, &thpool_p->jobqueue_rwmutex, &deadline) == ETIMEDOUT);
+            } else {
+                THPOOL_PROBE2(worker_park, thpool_p, thread_p->id);
+                pthread_cond_wait(&thpool_p->get_job_unblock, &thpool_p->jobqueue_rwmutex);
+            }
+            THPOOL_PROBE2(worker_unpark, thpool_p, thread_p->id);
+            atomic_fetch_sub(&thpool_p->num_threads_parked, 1);
+            thpool_alive = atomic_load(&thpool_p->threads_keepalive);
+            if (idle_expired) {
+                /* 超时的同时可能恰好有任务入队，仍然空闲时才退出。 */
+                idle_expired = ((thpool_p->jobqueue.len == 0 && thread_p->affine_len == 0) || unlikely(!atomic_load(&thpool_p->threads_active)));
+                break;
+            }
+        }
+
+        if (retry) {
+            pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+            continue;
+        }
+
+        if (idle_expired && thpool_alive) {
+            /* 加锁顺序为先resize_mutex后jobqueue_rwmutex，须先解锁。  */
+            pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+            thpool_retire_idle_thread(thpool_p, thread_p);
+            continue;
+        }
+
+        if (!thpool_alive) {
+            pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+            errno = ECANCELED;
+            return nullptr;
+        }
+
+        /* 私有任务只有本线程能执行，先于共享链表取出。   */
+        ret = (thread_p->affine_len > 0) ? thread_affine_pull_unsafe(thpool_p, thread_p) : jobqueue_pull_unsafe(&thpool_p->jobqueue);
+        atomic_store_explicit(&thread_p->busy, true, memory_order_relaxed);
+        thpool_release_job_slot(thpool_p, true);
+
+        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+
+        return ret;
+    }
+}
+
+/**
+ * 不阻塞地取一个任务，供已在执行任务的工作线程协助执行使用。
+ * 调用者已设置busy标志，这里只释放排队名额。没有可取的任务时返回空指针。
+ */
+static struct job *thpool_try_get_job(thpool *thpool_p, struct thread *thread_p)
+{
+    /* 延续任务可能正是任务组等待的成员，先执行它。 */
+    if (thread_p->cont_pending) {
+        thread_p->cont_pending = false;
+        return &thread_p->cont_job;
+    }
+    struct job *ret = thpool_try_get_job_local(thpool_p, thread_p);
+    if (ret != nullptr) {
+        thpool_release_job_slot(thpool_p, false);
+        return ret;
+    }
+    if (atomic_load(&thpool_p->num_jobs_queued) == 0) {
+        return nullptr;
+    }
+    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+    /* 私有任务同样要协助执行，否则等待中的任务组若包含本线程的私有任务，将永远等不到它完成。 */
+    if (thread_p->affine_len > 0 && likely(atomic_load(&thpool_p->threads_active))) {
+        ret = thread_affine_pull_unsafe(thpool_p, thread_p);
+        thpool_release_job_slot(thpool_p, true);
+    } else if (thpool_p->jobqueue.len > 0 && likely(atomic_load(&thpool_p->threads_active))) {
+        ret = jobqueue_pull_unsafe(&thpool_p->jobqueue);
+        thpool_release_job_slot(thpool_p, true);
+    }
+    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    return ret;
+}
+
+/* ============================= RESIZE ============================= */
+
+/* 等待刚启动的线程开始运行。与`thpool_init`一样，不为此添加条件变量，以nanosleep折中等待。  */
+static inline void thread_wait_started(struct thread *thread_p)
+{
+    while (atomic_load(&thread_p->run_state) == THREAD_STARTING) {
+        nanosleep(&(struct timespec) {0, 10000}, nullptr);
+    }
+}
+
+/**
+ * 将运行中的线程数调整为num。缩小时从编号最大的位置开始要求线程退出，立即返回；
+ * 扩大时从编号最小的位置开始，撤回尚未生效的退出要求，或重新启动已退出的线程，位置不足时在末尾追加新线程，
+ * 并等待启动的线程开始运行后返回。
+ * 启动失败时保留已启动的线程，返回-1。调用者须持有resize_mutex，并已确认线程池存活。
+ */
+static int thpool_resize_unsafe(thpool *thpool_p, int num)
+{
+    int running = atomic_load(&thpool_p->num_threads_running);
+    int num_slots = atomic_load(&thpool_p->num_threads);
+
+    if (num < running) {
+        for (int i = num_slots - 1; i >= 0 && running > num; i--) {
+            enum thread_run_state expected = THREAD_RUNNING;
+            if (atomic_compare_exchange_strong(&thpool_p->threads[i]->run_state, &expected, THREAD_RETIRING)) {
+                running--;
+            }
+        }
+        atomic_store(&thpool_p->num_threads_running, running);
+        /* 唤醒所有休眠的线程，被要求退出的线程醒来后退出，其他线程重新休眠。  */
+        pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+        pthread_cond_broadcast(&thpool_p->get_job_unblock);
+        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+        return 0;
+    }
+
+    struct thread *current_thrd = thpool_current_thread(thpool_p);
+    int err = 0;
+    for (int i = 0; i < thpool_p->threads_capacity && running < num; i++) {
+        if (i >= num_slots) {
+            /* 与`thpool_init`相同，为新线程预先计入引用，`thread_init`失败时自行解除。  */
+            if (thpool_p->callback_arg_destructor != nullptr) {
+                atomic_fetch_add_explicit(&thpool_p->callback_arg_refcount, 1, memory_order_acq_rel);
+            }
+            if (unlikely(thread_init(thpool_p, &thpool_p->threads[i], i) != 0)) {
+                err = errno;
+                break;
+            }
+            num_slots = i + 1;
+            atomic_store_explicit(&thpool_p->num_threads, num_slots, memory_order_release);
+            thread_wait_started(thpool_p->threads[i]);
+            running++;
+            continue;
+        }
+
+        struct thread *thread_p = thpool_p->threads[i];
+        enum thread_run_state expected = THREAD_RETIRING;
+        /* 尚未离开任务循环的线程，撤回退出要求即可。    */
+        if (atomic_compare_exchange_strong(&thread_p->run_state, &expected, THREAD_RUNNING)) {
+            running++;
+            continue;
+        }
+        /* 正在执行`thread_end_cb`的线程很快会退出，等待后重新启动。调用者自己正在退出时，跳过自身避免死锁。 */
+        if (expected == THREAD_EXITING && thread_p != current_thrd) {
+            while ((expected = atomic_load(&thread_p->run_state)) == THREAD_EXITING) {
+                nanosleep(&(struct timespec) {0, 10000}, nullptr);
+            }
+        }
+        if (expected == THREAD_RETIRED) {
+            if (unlikely(thread_revive(thpool_p, thread_p) != 0)) {
+                err = errno;
+                break;
+            }
+            thread_wait_started(thread_p);
+            running++;
+        }
+    }
+    atomic_store(&thpool_p->num_threads_running, running);
+    if (unlikely(running < num)) {
+        errno = err ? err : EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 空闲超时的线程尝试退出。多个线程同时超时时在resize_mutex内逐个确认，保证运行中的线程数不少于下限。
+ * 不阻塞等待resize_mutex，拿不到锁时放弃，下次超时再试。
+ */
+static void thpool_retire_idle_thread(thpool *thpool_p, struct thread *thread_p)
+{
+    if (pthread_mutex_trylock(&thpool_p->resize_mutex) != 0) {
+        return;
+    }
+    int running = atomic_load(&thpool_p->num_threads_running);
+    enum thread_run_state expected = THREAD_RUNNING;
+    if (running > thpool_p->min_threads && atomic_compare_exchange_strong(&thread_p->run_state, &expected, THREAD_RETIRING)) {
+        atomic_store(&thpool_p->num_threads_running, running - 1);
+        thpool_log_debug("thread %d retires after idle timeout, %d threads running", thread_p->id, running - 1);
+    }
+    pthread_mutex_unlock(&thpool_p->resize_mutex);
+}
+
+/**
+ * 添加任务后调用。排队任务数超过`scale_up_queue_depth`且线程数未达上限时，由本生产者再启动一个线程。
+ * 不阻塞等待resize_mutex，已有其他线程在调整线程数时直接返回。
+ */
+static inline void thpool_autoscale_grow(thpool *thpool_p)
+{
+    int depth = thpool_p->scale_up_queue_depth;
+    if (likely(depth == 0) || atomic_load_explicit(&thpool_p->num_jobs_queued, memory_order_relaxed) <= depth ||
+        atomic_load_explicit(&thpool_p->num_threads_running, memory_order_relaxed) >= thpool_p->threads_capacity) {
+        return;
+    }
+    if (pthread_mutex_trylock(&thpool_p->resize_mutex) != 0) {
+        return;
+    }
+    int running = atomic_load(&thpool_p->num_threads_running);
+    if (likely(atomic_load(&thpool_p->threads_keepalive)) && running < thpool_p->threads_capacity) {
+        if (thpool_resize_unsafe(thpool_p, running + 1) == 0) {
+            thpool_log_debug("queue depth above %d, grew to %d threads", depth, running + 1);
+        }
+    }
+    pthread_mutex_unlock(&thpool_p->resize_mutex);
+}
+
+/* ============================= DOMAIN ============================= */
+
+/**
+ * 执行域：设置了`executor`的线程池。它有自己的任务队列、排队上限、通行证与`thpool_wait`语义，但不创建线程，
+ * 而是向执行线程池提交服务任务`thpool_domain_serve`，由执行线程池的工作线程从本队列中取任务执行。
+ * 服务任务每轮至多执行domain_weight个任务，队列中仍有任务时把自己放回执行线程池共享链表的队尾，
+ * 各执行域的服务任务与执行线程池自身的任务在链表中轮转，因此排队的执行域按权重分享工作线程。
+ * 同时存在的服务任务数不超过domain_max_servers，即同时为本执行域工作的线程数上限。
+ * 加锁顺序为先执行域、后执行线程池的jobqueue_rwmutex。
+ */
+
+/**
+ * 把执行域的服务任务放入执行线程池共享链表的队尾。服务任务不受执行线程池`work_num_max`的约束：
+ * 提交方可能正是执行线程池的工作线程，阻塞等待名额可能死锁；其数量不超过各执行域的服务任务上限之和，
+ * 挂上执行域时已相应放宽了执行线程池的任务节点上限。执行线程池已关闭或内存不足时返回false。
+ * 调用者持有执行域的jobqueue_rwmutex，这里不记录日志，由调用者释放该锁后调用`thpool_domain_post_failed`。
+ */
+static bool thpool_domain_post(thpool *thpool_p)
+{
+    thpool *executor_p = thpool_p->executor;
+    pthread_mutex_lock(&executor_p->jobqueue_rwmutex);
+    job *newjob = nullptr;
+    if (likely(atomic_load(&executor_p->threads_keepalive))) {
+        newjob = jobpool_alloc_unsafe(&executor_p->jobpool, true);
+    }
+    if (unlikely(newjob == nullptr)) {
+        pthread_mutex_unlock(&executor_p->jobqueue_rwmutex);
+        return false;
+    }
+    thpool_stats_update_peak(executor_p, atomic_fetch_add(&executor_p->num_jobs_queued, 1) + 1);
+    newjob->function = thpool_domain_serve;
+    newjob->arg = thpool_p;
+    newjob->enqueue_ns = thpool_job_stamp(executor_p);
+    jobqueue_push_unsafe(&executor_p->jobqueue, newjob, THPOOL_PRIO_NORMAL);
+    if (atomic_load(&executor_p->num_threads_parked) > 0) {
+        pthread_cond_signal(&executor_p->get_job_unblock);
+    }
+    pthread_mutex_unlock(&executor_p->jobqueue_rwmutex);
+    thpool_stats_record_submit(executor_p, thpool_current_thread(executor_p), 1, 0);
+    return true;
+}
+
+/**
+ * 执行域新入队了num个任务后调用，在上限内为它们补充服务任务。调用者持有执行域的jobqueue_rwmutex。
+ * 服务任务是否结束也在该锁内决定，因此入队的任务总有服务任务负责。执行线程池已关闭时任务留在队列中。
+ * 提交服务任务失败时返回false，调用者释放jobqueue_rwmutex后调用`thpool_domain_post_failed`。
+ */
+static bool thpool_domain_kick_unsafe(thpool *thpool_p, int num)
+{
+    for (; num > 0 && atomic_load_explicit(&thpool_p->domain_servers, memory_order_relaxed) < thpool_p->domain_max_servers; num--) {
+        atomic_fetch_add(&thpool_p->domain_servers, 1);
+        if (unlikely(!thpool_domain_post(thpool_p))) {
+            atomic_fetch_sub(&thpool_p->domain_servers, 1);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* 提交服务任务失败后，在释放执行域的jobqueue_rwmutex之后记录日志。执行线程池已关闭时失败是预期的，不记录。   */
+static void thpool_domain_post_failed(thpool *thpool_p, const char *caller)
+{
+    if (atomic_load(&thpool_p->executor->threads_keepalive)) {
+        thpool_log_error("%s: Could not allocate memory for domain service job", caller);
+    }
+}
+
+/**
+ * 服务任务，在执行线程池的工作线程上运行。以该工作线程位置上的线程视图执行本执行域的任务，
+ * 任务函数与回调看到的线程句柄、线程上下文与统计都属于线程视图。执行期间TSD指向线程视图，
+ * 任务内部的提交、等待与禁止调用的检查因此与普通工作线程一致。工作线程第一次为本执行域服务时执行开始回调。
+ */
+static void thpool_domain_serve(void *arg_p, threadpool_thread current_thrd)
+{
+    thpool *thpool_p = arg_p;
+    /* 此时本服务任务仍计入domain_servers，执行域不会被销毁。  */
+    atomic_fetch_add(&thpool_p->domain_serving, 1);
+    struct thread *thread_p = thpool_p->threads[current_thrd->id];
+    /* `thpool_group_wait`协助执行时，同一工作线程可能嵌套执行本执行域的另一个服务任务。    */
+    void *outer_p = pthread_getspecific(thpool_p->key);
+    pthread_setspecific(thpool_p->key, thread_p);
+    bool outermost = (thread_p->domain_depth++ == 0);
+
+    /* 服务任务结束前`thpool_shutdown`不会读取线程视图的状态，这里无需与之同步。   */
+    if (unlikely(atomic_load_explicit(&thread_p->run_state, memory_order_relaxed) == THREAD_STARTING) &&
+        likely(atomic_load(&thpool_p->threads_keepalive))) {
+        atomic_fetch_add(&thpool_p->num_threads_alive, 1);
+        atomic_store(&thread_p->run_state, THREAD_RUNNING);
+        if (thpool_p->thread_start_cb) {
+            thpool_p->thread_start_cb(thpool_p->callback_arg, thread_p);
+        }
+    }
+
+    int served = 0;
+    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+    while (served < thpool_p->domain_weight && thpool_p->jobqueue.len > 0 && likely(atomic_load(&thpool_p->threads_keepalive))) {
+        /* 与`thpool_get_job`相同，先设置busy标志再释放名额。    */
+        job *job_p = jobqueue_pull_unsafe(&thpool_p->jobqueue);
+        atomic_store_explicit(&thread_p->busy, true, memory_order_relaxed);
+        thpool_release_job_slot(thpool_p, true);
+        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+        THPOOL_PROBE3(job_dequeue, thpool_p, thread_p->id, atomic_load_explicit(&thpool_p->num_jobs_queued, memory_order_relaxed));
+        /* 线程视图两轮服务之间的时间属于执行线程池，不计为空闲时间。    */
+        thread_run_job(thread_p, job_p, true);
+        served++;
+        pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+    }
+    /* 仍有任务时放回队尾，让出工作线程。`thpool_resize`降低上限后，多出的服务任务直接结束。  */
+    bool requeue = thpool_p->jobqueue.len > 0 && likely(atomic_load(&thpool_p->threads_keepalive)) &&
+                   atomic_load_explicit(&thpool_p->domain_servers, memory_order_relaxed) <= thpool_p->domain_max_servers;
+    bool post_failed = requeue && unlikely(!thpool_domain_post(thpool_p));
+    if (!requeue || post_failed) {
+        atomic_fetch_sub(&thpool_p->domain_servers, 1);
+        /* 执行域没有自己的工作线程，get_job_unblock只有`thpool_domain_stop`等待。  */
+        if (unlikely(!atomic_load(&thpool_p->threads_keepalive))) {
+            pthread_cond_broadcast(&thpool_p->get_job_unblock);
+        }
+    }
+    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    if (unlikely(post_failed)) {
+        thpool_domain_post_failed(thpool_p, "thpool_domain_serve()");
+    }
+
+    thread_p->domain_depth--;
+    pthread_setspecific(thpool_p->key, outer_p);
+    /* 与`thread_do`相同，清除busy标志后再读取等待者数量。  */
+    if (outermost) {
+        atomic_store(&thread_p->busy, false);
+        if (unlikely(atomic_load(&thpool_p->num_idle_waiters) > 0) && atomic_load(&thpool_p->num_jobs_queued) == 0) {
+            pthread_mutex_lock(&thpool_p->threads_all_idle_mutex);
+            pthread_cond_broadcast(&thpool_p->threads_all_idle);
+            pthread_mutex_unlock(&thpool_p->threads_all_idle_mutex);
+        }
+    }
+    /* 对执行域的最后一次访问，此后执行域可能已被销毁。  */
+    atomic_fetch_sub(&thpool_p->domain_serving, 1);
+}
+
+/* 在为执行域服务过的工作线程上执行结束回调，此后线程视图不再使用。    */
+static void thpool_domain_end(void *arg_p, threadpool_thread current_thrd)
+{
+    struct thread *thread_p = arg_p;
+    thpool *thpool_p = thread_p->thpool_p;
+    (void)current_thrd;
+    void *outer_p = pthread_getspecific(thpool_p->key);
+    pthread_setspecific(thpool_p->key, thread_p);
+    if (thpool_p->thread_end_cb) {
+        thpool_p->thread_end_cb(thread_p);
+    }
+    pthread_setspecific(thpool_p->key, outer_p);
+    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+    atomic_store(&thread_p->run_state, THREAD_RETIRED);
+    atomic_fetch_sub(&thpool_p->num_threads_alive, 1);
+    pthread_cond_broadcast(&thpool_p->get_job_unblock);
+    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+}
+
+/**
+ * 把线程视图的结束回调放入执行线程池第thread_id个工作线程的私有队列。与服务任务相同，不受`work_num_max`的约束，
+ * 挂上执行域时已为每个线程视图放宽了任务节点上限。执行线程池不活跃时不入队：入队后`thpool_wait`会等待它，
+ * 而入队前已进入的不活跃状态不会解除。该位置的工作线程已退出、执行线程池已关闭、不活跃或内存不足时返回false，
+ * 结束回调只属于为线程视图服务过的工作线程，不退回共享队列。
+ */
+static bool thpool_domain_post_end(thpool *executor_p, int thread_id, struct thread *view_p)
+{
+    struct thread *target_p = nullptr;
+    if (thread_id < atomic_load_explicit(&executor_p->num_threads, memory_order_acquire)) {
+        target_p = executor_p->threads[thread_id];
+    }
+    if (target_p == nullptr) {
+        return false;
+    }
+    pthread_mutex_lock(&executor_p->jobqueue_rwmutex);
+    job *newjob = nullptr;
+    if (likely(atomic_load(&executor_p->threads_keepalive)) && likely(atomic_load(&executor_p->threads_active)) &&
+        thread_accepts_affine(target_p)) {
+        newjob = jobpool_alloc_unsafe(&executor_p->jobpool, true);
+    }
+    if (unlikely(newjob == nullptr)) {
+        pthread_mutex_unlock(&executor_p->jobqueue_rwmutex);
+        return false;
+    }
+    thpool_stats_update_peak(executor_p, atomic_fetch_add(&executor_p->num_jobs_queued, 1) + 1);
+    newjob->function = thpool_domain_end;
+    newjob->arg = view_p;
+    newjob->enqueue_ns = thpool_job_stamp(executor_p);
+    thread_affine_push_unsafe(executor_p, target_p, newjob);
+    if (atomic_load(&executor_p->num_threads_parked) > 0) {
+        pthread_cond_broadcast(&executor_p->get_job_unblock);
+    }
+    pthread_mutex_unlock(&executor_p->jobqueue_rwmutex);
+    return true;
+}
+
+/**
+ * 执行域关闭后，取回仍在执行线程池共享链表中排队的本执行域服务任务，返回取回的数量。
+ * 存活标记已关闭，服务任务不再执行执行域的任务，只减少服务任务计数。调用者是执行线程池的工作线程时在调用者上执行，
+ * 否则直接丢弃，二者效果相同。只在执行线程池不活跃、排队的服务任务不会被取走，或调用者本身就是执行线程池的工作线程、
+ * 其他工作线程可能都在等待它时使用。
+ */
+static int thpool_domain_reclaim(thpool *thpool_p, struct thread *current_thrd)
+{
+    thpool *executor_p = thpool_p->executor;
+    jobqueue *jobqueue_p = &executor_p->jobqueue;
+    job *removed_p = nullptr;
+    pthread_mutex_lock(&executor_p->jobqueue_rwmutex);
+    int removed = job_list_remove_unsafe(&jobqueue_p->front[THPOOL_PRIO_NORMAL], &jobqueue_p->rear[THPOOL_PRIO_NORMAL],
+                                         thpool_domain_serve, thpool_p, &removed_p);
+    if (removed > 0) {
+        jobqueue_p->level_len[THPOOL_PRIO_NORMAL] -= removed;
+        jobqueue_p->len -= removed;
+        if (jobqueue_p->level_len[THPOOL_PRIO_NORMAL] == 0) {
+            jobqueue_p->level_mask &= ~(1u << THPOOL_PRIO_NORMAL);
+        }
+        for (int i = 0; i < removed; i++) {
+            thpool_release_job_slot(executor_p, true);
+        }
+    }
+    while (removed_p != nullptr) {
+        job *next_p = removed_p->prev;
+        jobpool_free_unsafe(&executor_p->jobpool, removed_p);
+        removed_p = next_p;
+    }
+    pthread_mutex_unlock(&executor_p->jobqueue_rwmutex);
+
+    for (int i = 0; i < removed; i++) {
+        if (current_thrd != nullptr) {
+            thpool_domain_serve(thpool_p, current_thrd);
+        } else {
+            atomic_fetch_sub(&thpool_p->domain_servers, 1);
+        }
+    }
+    return removed;
+}
+
+/**
+ * 代替`thpool_shutdown`中等待工作线程退出的部分：等待所有服务任务结束，再在每个为本执行域服务过的工作线程上执行结束回调，
+ * 最后从执行线程池上摘下本执行域。
+ *
+ * 执行线程池不活跃时，排队的服务任务不会被取走；调用者是执行线程池的工作线程时（例如执行线程池只有这一个线程），
+ * 排队的服务任务只能由它执行。这两种情况下不再等待，以`thpool_domain_reclaim`取回它们。
+ * 结束回调所在的工作线程正是调用者，或执行线程池已关闭、不活跃时，在调用者上直接执行结束回调；
+ * 该位置的工作线程已经退出时跳过结束回调，它不会在其他工作线程上执行。
+ * 丢弃服务任务的`thpool_job_discard`不持有执行域的锁，服务任务退出domain_serving时也不发信号，
+ * 等待以1毫秒为限，错过信号时仍会重新检查。
+ */
+static void thpool_domain_stop(thpool *thpool_p)
+{
+    thpool *executor_p = thpool_p->executor;
+    struct thread *current_thrd = thpool_current_thread(executor_p);
+    while (atomic_load(&thpool_p->domain_servers) > 0 || atomic_load(&thpool_p->domain_serving) > 0) {
+        if (atomic_load(&thpool_p->domain_servers) > 0 &&
+            (current_thrd != nullptr || unlikely(!atomic_load(&executor_p->threads_active))) &&
+            thpool_domain_reclaim(thpool_p, current_thrd) > 0) {
+            continue;
+        }
+        pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+        if (atomic_load(&thpool_p->domain_servers) > 0 || atomic_load(&thpool_p->domain_serving) > 0) {
+            struct timespec deadline = thpool_cond_deadline(thpool_now_ns() + 1000000u);
+            pthread_cond_timedwait(&thpool_p->get_job_unblock, &thpool_p->jobqueue_rwmutex, &deadline);
+        }
+        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    }
+
+    for (int n = 0; n < thpool_p->threads_capacity; n++) {
+        struct thread *thread_p = thpool_p->threads[n];
+        if (atomic_load(&thread_p->run_state) != THREAD_RUNNING) {
+            continue;
+        }
+        if (thpool_p->thread_end_cb == nullptr || (current_thrd != nullptr && current_thrd->id == n)) {
+            thpool_domain_end(thread_p, current_thrd);
+            continue;
+        }
+        if (thpool_domain_post_end(executor_p, n, thread_p)) {
+            continue;
+        }
+        /* 执行线程池已关闭或不活跃时，它的工作线程不再执行私有任务，改在调用者上执行。 */
+        struct thread *worker_p = (n < atomic_load_explicit(&executor_p->num_threads, memory_order_acquire)) ? executor_p->threads[n] : nullptr;
+        if (worker_p != nullptr && thread_accepts_affine(worker_p)) {
+            thpool_domain_end(thread_p, current_thrd);
+        } else {
+            atomic_store(&thread_p->run_state, THREAD_RETIRED);
+            atomic_fetch_sub(&thpool_p->num_threads_alive, 1);
+        }
+    }
+    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+    while (atomic_load(&thpool_p->num_threads_alive) != 0) {
+        struct timespec deadline = thpool_cond_deadline(thpool_now_ns() + 1000000u);
+        pthread_cond_timedwait(&thpool_p->get_job_unblock, &thpool_p->jobqueue_rwmutex, &deadline);
+    }
+    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+
+    pthread_mutex_lock(&executor_p->jobqueue_rwmutex);
+    if (executor_p->jobpool.max_nodes) {
+        executor_p->jobpool.max_nodes -= thpool_p->threads_capacity;
+    }
+    pthread_mutex_unlock(&executor_p->jobqueue_rwmutex);
+    atomic_fetch_sub(&executor_p->num_domains, 1);
+}
+
+/* 执行域的`thpool_resize`调整服务任务上限，提高上限后立即为排队的任务补充服务任务。调用者持有resize_mutex。  */
+static int thpool_domain_resize_unsafe(thpool *thpool_p, int num)
+{
+    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+    thpool_p->domain_max_servers = num;
+    atomic_store(&thpool_p->num_threads_running, num);
+    bool kicked = thpool_domain_kick_unsafe(thpool_p, thpool_p->jobqueue.len);
+    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    if (unlikely(!kicked)) {
+        thpool_domain_post_failed(thpool_p, "thpool_resize()");
+    }
+    return 0;
+}
+
+static inline bool thpool_is_current_thread_owner(thpool *thpool_p)
+{
+    return pthread_getspecific(thpool_p->key) != nullptr;
+}
+
+/* 返回当前线程在本线程池中的线程元数据，若当前线程不属于本线程池，返回空指针。    */
+static inline struct thread *thpool_current_thread(thpool *thpool_p)
+{
+    return pthread_getspecific(thpool_p->key);
+}
+
+/* Add work to the thread pool */
+static int thpool_add_work_inner(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    return thpool_add_work_timed_inner(thpool_p, function_p, arg_p, -1);
+}
+
+/**
+ * 限时添加任务，timeout_ns的含义见`thpool_wait_job_slots_unsafe`。
+ * 不限时的调用与原先的`thpool_add_work`相同；限时的调用在等待失败（EAGAIN或ETIMEDOUT）后按拒绝策略处理。
+ * 统计上，调用者执行与丢弃最早任务都计为一次拒绝：后者新任务入队、旧任务出队，提交数不变，
+ * 因此`thpool_wait`返回后完成数仍等于提交数。
+ */
+static int thpool_add_work_timed_inner(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ns)
+{
+    /**
+     * 环形缓冲区后端直接保存任务函数与参数，无需分配任务节点。
+     * 工作窃取模式下，工作线程内部提交的任务仍优先放入自身的双端队列。
+     */
+    struct thread *current_thrd = thpool_current_thread(thpool_p);
+    /* 完成句柄的等待方不协助执行，任务内提交并等待句柄时延续任务将永远得不到执行，因此句柄任务照常入队。  */
+    if (thpool_p->nested_inline_depth > 0 && current_thrd != nullptr && function_p != thpool_handle_run &&
+        thpool_put_job_cont(thpool_p, current_thrd, function_p, arg_p)) {
+        thpool_stats_record_submit(thpool_p, current_thrd, 1, 0);
+        return 0;
+    }
+    bool work_stealing = (thpool_p->sched_mode == THPOOL_SCHED_WORK_STEALING);
+    int ret;
+    if (thpool_p->jobqueue.backend == THPOOL_QUEUE_RING && !(work_stealing && current_thrd != nullptr)) {
+        ret = thpool_put_job_ring(thpool_p, function_p, arg_p, timeout_ns);
+    } else if (work_stealing && current_thrd != nullptr) {
+        /* add job to queue */
+        /* 工作窃取模式下，工作线程内部提交的任务放入自身的双端队列。任务节点由入队函数在预留名额后从任务分配器取得。 */
+        ret = thpool_put_job_local(thpool_p, current_thrd, function_p, arg_p, timeout_ns);
+    } else {
+        ret = thpool_put_job(thpool_p, current_thrd, THPOOL_PRIO_NORMAL, function_p, arg_p, timeout_ns);
+    }
+    if (ret == 0) {
+        thpool_stats_record_submit(thpool_p, current_thrd, 1, 0);
+        thpool_autoscale_grow(thpool_p);
+        return 0;
+    }
+    thpool_stats_record_submit(thpool_p, current_thrd, 0, 1);
+    if (errno != EAGAIN && errno != ETIMEDOUT) {
+        return -1;
+    }
+    switch (thpool_p->reject_policy) {
+    case THPOOL_REJECT_CALLER_RUNS:
+        {
+            void *arena_arg = thpool_arena_job_arg(thpool_p, function_p, arg_p);
+            function_p(arg_p, current_thrd);
+            if (arena_arg != nullptr) {
+                thpool_arena_put(&thpool_p->arena, arena_arg);
+            }
+            return 0;
+        }
+    case THPOOL_REJECT_DROP_OLDEST:
+        {
+            int err = errno;
+            if (thpool_put_job_drop_oldest(thpool_p, function_p, arg_p) == 0) {
+                return 0;
+            }
+            if (errno == EAGAIN) {
+                errno = err;
+            }
+            return -1;
+        }
+    default:
+        return -1;
+    }
+}
+
+/**
+ * 按优先级添加任务。普通优先级与`thpool_add_work`完全相同。
+ * 其他优先级的任务总是进入共享链表的对应子队列，不进入双端队列或环形缓冲区，以保证按优先级出队。
+ */
+static int thpool_add_work_prio_inner(thpool *thpool_p, threadpool_priority prio, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely((unsigned)prio >= THPOOL_PRIO_LEVELS)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (prio == THPOOL_PRIO_NORMAL) {
+        return thpool_add_work_inner(thpool_p, function_p, arg_p);
+    }
+    struct thread *current_thrd = thpool_current_thread(thpool_p);
+    int ret = thpool_put_job(thpool_p, current_thrd, prio, function_p, arg_p, -1);
+    thpool_stats_record_submit(thpool_p, current_thrd, ret == 0, ret != 0);
+    if (ret == 0) {
+        thpool_autoscale_grow(thpool_p);
+    }
+    return ret;
+}
+
+/**
+ * 添加协程任务。协程从空闲链表中取得或新建，恢复任务与普通任务一样排队，受`work_num_max`约束。
+ * 提交失败时协程立即放回空闲链表，errno保持提交失败的原因。
+ */
+static int thpool_add_work_fiber_inner(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+#ifdef THPOOL_HAS_FIBERS
+    if (unlikely(function_p == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    thpool_fiber *fiber_p = thpool_fiber_alloc(thpool_p);
+    if (unlikely(fiber_p == nullptr)) {
+        return -1;
+    }
+    fiber_p->function = function_p;
+    fiber_p->arg = arg_p;
+    int ret = thpool_add_work_inner(thpool_p, thpool_fiber_resume, fiber_p);
+    if (unlikely(ret != 0)) {
+        int err = errno;
+        thpool_fiber_release(thpool_p, fiber_p);
+        errno = err;
+    }
+    return ret;
+#else
+    (void)thpool_p;
+    (void)function_p;
+    (void)arg_p;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+static int thpool_add_work_deadline_inner(thpool *thpool_p, unsigned long long deadline_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, void (*on_expire)(void *, threadpool_thread))
+{
+    struct thread *current_thrd = thpool_current_thread(thpool_p);
+    int ret = thpool_put_job_deadline(thpool_p, current_thrd, deadline_ns, function_p, arg_p, on_expire);
+    thpool_stats_record_submit(thpool_p, current_thrd, ret == 0, ret != 0);
+    if (ret == 0) {
+        thpool_autoscale_grow(thpool_p);
+    }
+    return ret;
+}
+
+/**
+ * 添加由指定线程执行的任务。thread_id为负数时与`thpool_add_work`相同。
+ * 目标线程尚未创建、已退出或正在退出时，任务退回共享队列，而不是等待该线程重新启动。
+ */
+static int thpool_add_work_to_inner(thpool *thpool_p, int thread_id, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (thread_id < 0) {
+        return thpool_add_work_inner(thpool_p, function_p, arg_p);
+    }
+    if (unlikely(thread_id >= thpool_p->threads_capacity)) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* 执行域的线程视图不对应固定的线程，指定线程的任务与普通任务相同。    */
+    if (thpool_p->executor != nullptr) {
+        return thpool_add_work_inner(thpool_p, function_p, arg_p);
+    }
+    /* 位置编号即下标，以acquire序读取位置数之后，其下标之内的线程元数据总是有效的。   */
+    struct thread *target_p = nullptr;
+    if (thread_id < atomic_load_explicit(&thpool_p->num_threads, memory_order_acquire)) {
+        target_p = thpool_p->threads[thread_id];
+    }
+    if (target_p == nullptr || !thread_accepts_affine(target_p)) {
+        return thpool_add_work_inner(thpool_p, function_p, arg_p);
+    }
+    struct thread *current_thrd = thpool_current_thread(thpool_p);
+    int ret = thpool_put_job_affine(thpool_p, current_thrd, target_p, function_p, arg_p, -1);
+    thpool_stats_record_submit(thpool_p, current_thrd, ret == 0, ret != 0);
+    if (ret == 0) {
+        thpool_autoscale_grow(thpool_p);
+    }
+    return ret;
+}
+
+/**
+ * 按键添加任务。键经过混合后对线程位置数取模，落在不再运行的位置上时向后寻找第一个运行中的线程，
+ * 因此线程数不变时同一个键总是映射到同一个线程。没有运行中的线程时退回共享队列。
+ */
+static int thpool_add_work_keyed_inner(thpool *thpool_p, unsigned long long key, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    /* splitmix64的终结函数，避免连续的键落在相邻的线程上。  */
+    uint64_t h = (uint64_t)key;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    h ^= h >> 31;
+
+    int num_slots = atomic_load_explicit(&thpool_p->num_threads, memory_order_acquire);
+    if (unlikely(num_slots == 0)) {
+        return thpool_add_work_inner(thpool_p, function_p, arg_p);
+    }
+    int start = (int)(h % (uint64_t)num_slots);
+    for (int i = 0; i < num_slots; i++) {
+        int id = (start + i) % num_slots;
+        struct thread *thread_p = thpool_p->threads[id];
+        if (thread_p != nullptr && atomic_load(&thread_p->run_state) <= THREAD_RUNNING) {
+            return thpool_add_work_to_inner(thpool_p, id, function_p, arg_p);
+        }
+    }
+    return thpool_add_work_inner(thpool_p, function_p, arg_p);
+}
+
+/**
+ * 批量添加任务。每次加锁尽可能多地预留名额，从任务分配器取得节点并链入队列，
+ * 再按本次入队数量与休眠线程数的较小值逐个唤醒，避免广播造成的惊群。
+ * 返回实际入队的任务数。一个任务都未能入队时返回-1。
+ */
+static int thpool_add_work_batch_inner(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void **args_p, int num)
+{
+    if (unlikely(num < 0) || unlikely(num > 0 && args_p == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (num == 0) {
+        return 0;
+    }
+
+    /**
+     * 环形缓冲区后端的入队本就不加锁、不分配内存；工作窃取模式下工作线程提交的任务放入自身的双端队列，同样不加锁。
+     * 这两种情况逐个提交即可。
+     */
+    if (thpool_p->jobqueue.backend == THPOOL_QUEUE_RING ||
+        (thpool_p->sched_mode == THPOOL_SCHED_WORK_STEALING && thpool_current_thread(thpool_p) != nullptr)) {
+        for (int i = 0; i < num; i++) {
+            if (unlikely(thpool_add_work_inner(thpool_p, function_p, args_p[i]) != 0)) {
+                /* 失败的任务已由`thpool_add_work_inner`计入，其余未尝试的任务同样视为被拒绝。  */
+                thpool_stats_record_submit(thpool_p, thpool_current_thread(thpool_p), 0, num - i - 1);
+                return i ? i : -1;
+            }
+        }
+        return num;
+    }
+
+    int accepted = 0;
+    bool out_of_memory = false;
+    bool kicked = true;
+    uint64_t enqueue_ns = thpool_stats_timestamp(thpool_p);
+    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+    while (accepted < num && !out_of_memory) {
+        /* 阻塞条件与`thpool_put_job`一致，但每次尽可能多地预留名额。  */
+        int reserved = thpool_wait_job_slots_unsafe(thpool_p, num - accepted, THPOOL_PRIO_NORMAL, -1);
+        if (reserved == 0) {
+            break;
+        }
+
+        int pushed = 0;
+        for (; pushed < reserved; pushed++) {
+            job *newjob = jobpool_alloc_unsafe(&thpool_p->jobpool, true);
+            if (unlikely(newjob == nullptr)) {
+                out_of_memory = true;
+                break;
+            }
+            newjob->function = function_p;
+            newjob->arg = args_p[accepted + pushed];
+            newjob->enqueue_ns = enqueue_ns | thpool_drain_enter(thpool_p);
+            jobqueue_push_unsafe(&thpool_p->jobqueue, newjob, THPOOL_PRIO_NORMAL);
+        }
+        /* 归还未用上的名额。   */
+        for (int i = pushed; i < reserved; i++) {
+            thpool_release_job_slot(thpool_p, true);
+        }
+        reserved = pushed;
+        accepted += reserved;
+        if (unlikely(thpool_p->executor != nullptr)) {
+            kicked &= thpool_domain_kick_unsafe(thpool_p, reserved);
+        }
+
+        /**
+         * 休眠线程数在锁内增减，此处读取是准确的。已被唤醒但尚未重新持锁的线程仍计入其中，
+         * 此时多发送的信号不会唤醒任何线程，而这些线程醒来后会继续取任务，不会有任务被遗漏。
+         */
+        int parked = atomic_load(&thpool_p->num_threads_parked);
+        for (int i = (reserved < parked) ? reserved : parked; i > 0; i--) {
+            pthread_cond_signal(&thpool_p->get_job_unblock);
+        }
+    }
+    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    thpool_stats_record_submit(thpool_p, thpool_current_thread(thpool_p), accepted, num - accepted);
+    if (accepted > 0) {
+        thpool_autoscale_grow(thpool_p);
+    }
+
+    if (unlikely(out_of_memory)) {
+        thpool_log_error("thpool_add_work_batch(): Could not allocate memory for job slab");
+    }
+    if (unlikely(!kicked)) {
+        thpool_domain_post_failed(thpool_p, "thpool_add_work_batch()");
+    }
+    if (accepted < num) {
+        errno = out_of_memory ? ENOMEM : ECANCELED;
+        if (accepted == 0) {
+            return -1;
+        }
+    }
+    return accepted;
+}
+
+/* Wait until all jobs have finished */
+/**
+ * 从任务分配器取一个节点作为完成句柄，再以`thpool_handle_run`为任务函数、句柄为参数，按`thpool_add_work`的路径提交。
+ * 句柄节点本身不入队，因此适用于所有调度模式与队列后端。
+ */
+static int thpool_submit_inner(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p, struct job **handle_out)
+{
+    if (unlikely(handle_out == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct thread *current_thrd = thpool_current_thread(thpool_p);
+    job *handle_p;
+    if (current_thrd != nullptr) {
+        handle_p = thread_alloc_job(thpool_p, current_thrd);
+    } else {
+        pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+        handle_p = jobpool_alloc_unsafe(&thpool_p->jobpool, true);
+        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+        if (unlikely(handle_p == nullptr)) {
+            thpool_log_error("thpool_submit(): Could not allocate memory for job slab");
+        }
+    }
+    if (unlikely(handle_p == nullptr)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    atomic_fetch_add_explicit(&thpool_p->jobpool.num_detached, 1, memory_order_relaxed);
+    handle_p->owner = thpool_p;
+    handle_p->function = function_p;
+    handle_p->arg = arg_p;
+    atomic_init(&handle_p->handle.state, THPOOL_HANDLE_PENDING);
+    atomic_init(&handle_p->handle.refs, 2);
+
+    if (unlikely(thpool_add_work_inner(thpool_p, thpool_handle_run, handle_p) != 0)) {
+        int err = errno;
+        atomic_fetch_sub_explicit(&thpool_p->jobpool.num_detached, 1, memory_order_relaxed);
+        jobpool_return(&thpool_p->jobpool, handle_p);
+        errno = err;
+        return -1;
+    }
+    *handle_out = handle_p;
+    return 0;
+}
+
+static int thpool_wait_inner(thpool *thpool_p)
+{
+    /* 禁止线程池内的线程本身执行`thpool_wait`。    */
+    if (thpool_is_current_thread_owner(thpool_p)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /**
+     * 原作者此处用了一个很优雅的while，但是因此这里对thpool_p->jobqueue.len的读取放在了一个可能发生数据竞争的位置。
+     * 考虑到thpool_wait此处需要读的次数非常少，因此没有必要考虑其他锁或者高效方案，在这里使用互斥锁判定即可。
+     * 宁可丑陋一些，也不能接受潜在的数据竞争问题。
+     * 但此处使用了两个锁，因此必须小心死锁的情形，所幸threads_all_idle其他使用的地方均不需要考虑jobqueue_rwmutex。
+     */
+    THPOOL_PROBE1(wait_enter, thpool_p);
+    pthread_mutex_lock(&thpool_p->threads_all_idle_mutex);
+    /* 先登记等待者再读取busy标志，工作线程据此决定是否发送threads_all_idle，参见`thread_do`。  */
+    atomic_fetch_add(&thpool_p->num_idle_waiters, 1);
+    for (;;) {
+        pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+        /* 以所有队列的任务总数为准，工作窃取模式下共享队列为空不代表双端队列中没有任务。   */
+        /**
+         * 先关闭活跃标记再读取任务总数，与不持锁的入队方先预留名额、再重新检查活跃标记的顺序相对，参见`thpool_recheck_active`。
+         * 仍有任务时恢复原先的活跃标记。期间持锁，持锁路径上的生产者与工作线程观察不到这一短暂的不活跃状态。
+         */
+        bool was_active = atomic_exchange(&thpool_p->threads_active, false);
+        int jobqueuelen = atomic_load(&thpool_p->num_jobs_queued);
+        int working_threads = thpool_count_busy_threads(thpool_p);
+        /* 挂起的协程任务既不在队列中也不占用线程，但尚未完成。 */
+        if (jobqueuelen || working_threads != 0 || atomic_load(&thpool_p->fibers.num_live) != 0) {
+            atomic_store(&thpool_p->threads_active, was_active);
+            pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+            pthread_cond_wait(&thpool_p->threads_all_idle, &thpool_p->threads_all_idle_mutex);
+        } else {
+            pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+            thpool_log_debug("thpool_wait_inner: jobs queued = %d, num_threads_working = %d", jobqueuelen, working_threads);
+            break;
+        }
+    }
+    atomic_fetch_sub(&thpool_p->num_idle_waiters, 1);
+    pthread_mutex_unlock(&thpool_p->threads_all_idle_mutex);
+    THPOOL_PROBE1(wait_exit, thpool_p);
+    return 0;
+}
+
+/* 解除thpool_put_job的阻塞 */
+static int thpool_reactivate_inner(thpool *thpool_p)
+{
+    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
+    atomic_store(&thpool_p->threads_active, true);
+    pthread_cond_broadcast(&thpool_p->get_job_unblock);
+    pthread_cond_broadcast(&thpool_p->put_job_unblock);
+    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+    thpool_log_debug("thpool_reactivate_inner: threads_active set to true");
+    return 0;
+}
+
+/**
+ * 逐个读取各线程的busy标志求和。位置只增不减，以acquire序读取num_threads之后，其下标之内的线程元数据总是有效的。
+ */
+static int thpool_count_busy_threads(thpool *thpool_p)
+{
+    int num_slots = atomic_load_explicit(&thpool_p->num_threads, memory_order_acquire);
+    int busy = 0;
+    for (int i = 0; i < num_slots; i++) {
+        struct thread *thread_p = thpool_p->threads[i];
+        if (thread_p != nullptr && atomic_load(&thread_p->busy)) {
+            busy++;
+        }
+    }
+    return busy;
+}
+
+static int thpool_num_threads_working_inner(thpool *thpool_p)
+{
+    return thpool_count_busy_threads(thpool_p);
+}
+
+static int thpool_num_threads_inner(thpool *thpool_p)
+{
+    return atomic_load(&thpool_p->num_threads_running);
+}
+
+static int thpool_resize_inner(thpool *thpool_p, int num)
+{
+    if (unlikely(num < 1 || num > thpool_p->threads_capacity)) {
+        errno = EINVAL;
+        return -1;
+    }
+    int ret;
+    pthread_mutex_lock(&thpool_p->resize_mutex);
+    /* 与`thpool_shutdown`在resize_mutex内关闭存活标记相对，shutdown开始后不再启动线程。   */
+    if (unlikely(!atomic_load(&thpool_p->threads_keepalive))) {
+        errno = ECANCELED;
+        ret = -1;
+    } else if (thpool_p->executor != nullptr) {
+        ret = thpool_domain_resize_unsafe(thpool_p, num);
+    } else {
+        ret = thpool_resize_unsafe(thpool_p, num);
+    }
+    pthread_mutex_unlock(&thpool_p->resize_mutex);
+    return ret;
+}
+
+static int thpool_job_slab_high_water_inner(thpool *thpool_p)
+{
+    return atomic_load(&thpool_p->jobpool.num_nodes);
+}
+
+static inline void producer_stats_sum(threadpool_stats *out, producer_stats *stats_p)
+{
+    out->jobs_submitted += atomic_load_explicit(&stats_p->jobs_submitted, memory_order_relaxed);
+    out->jobs_rejected += atomic_load_explicit(&stats_p->jobs_rejected, memory_order_relaxed);
+    out->producer_blocked_ns += atomic_load_explicit(&stats_p->blocked_ns, memory_order_relaxed);
+}
+
+/**
+ * 汇总各条带与各工作线程的计数器，不持有jobqueue_rwmutex。
+ * 提交数在任务入队后才计入，因此任务执行期间，快照中的完成数可能暂时超过提交数。
+ */
+static int thpool_get_stats_inner(thpool *thpool_p, threadpool_stats *out)
+{
+    if (unlikely(out == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    threadpool_thread_stats *threads_out = out->threads;
+    int threads_capacity = (threads_out == nullptr) ? 0 : out->threads_capacity;
+    memset(out, 0, sizeof(*out));
+    out->threads = threads_out;
+    out->threads_capacity = threads_capacity;
+
+    int num_slots = atomic_load_explicit(&thpool_p->num_threads, memory_order_acquire);
+    for (int i = 0; i < num_slots; i++) {
+        struct thread *thread_p = thpool_p->threads[i];
+        if (thread_p == nullptr) {
+            continue;
+        }
+        worker_stats *stats_p = &thread_p->stats;
+        unsigned long long completed = atomic_load_explicit(&stats_p->jobs_completed, memory_order_relaxed);
+        out->jobs_completed += completed;
+        for (int b = 0; b < THPOOL_STATS_HIST_BUCKETS; b++) {
+            out->queue_wait_hist[b] += atomic_load_explicit(&stats_p->queue_wait_hist[b], memory_order_relaxed);
+            out->run_time_hist[b] += atomic_load_explicit(&stats_p->run_time_hist[b], memory_order_relaxed);
+        }
+        if (out->num_threads < threads_capacity) {
+            threadpool_thread_stats *thread_out = &threads_out[out->num_threads];
+            thread_out->id = thread_p->id;
+            thread_out->jobs_completed = completed;
+            thread_out->busy_ns = atomic_load_explicit(&stats_p->busy_ns, memory_order_relaxed);
+            thread_out->idle_ns = atomic_load_explicit(&stats_p->idle_ns, memory_order_relaxed);
+        }
+        out->num_threads++;
+    }
+    for (int i = 0; i < num_slots; i++) {
+        if (thpool_p->threads[i] != nullptr) {
+            producer_stats_sum(out, &thpool_p->threads[i]->stats.produced);
+        }
+    }
+    for (int i = 0; i < THPOOL_STATS_STRIPES; i++) {
+        producer_stats_sum(out, &thpool_p->producer_stats[i]);
+    }
+    out->jobs_expired = atomic_load_explicit(&thpool_p->jobqueue.num_expired, memory_order_relaxed);
+    out->queue_len = atomic_load(&thpool_p->num_jobs_queued);
+    out->queue_len_peak = atomic_load_explicit(&thpool_p->queue_len_peak, memory_order_relaxed);
+    return 0;
+}
+
+/**
+ * 本线程使用的通行证分片编号，首次调用时按轮转分配，0表示尚未分配。线程数不超过分片数时，各线程的分片互不相同。
+ */
+static _Thread_local unsigned thpool_passport_shard_id;
+static atomic_uint thpool_passport_shard_next;
+
+/**
+ * api进入时在本线程的分片上登记使用，返回该分片的计数，退出时交给`thpool_passport_leave`。
+ * 登记与随后读取state都是顺序一致的原子操作，与`thpool_shutdown_safe_inner`先切换state、后检查各分片的顺序相对：
+ * 要么本次调用看到非ALIVE状态而不访问线程池，要么shutdown看到本分片的登记并等待其退出，因此不会发生uaf。
+ */
+static inline atomic_int *thpool_passport_enter(conc_state_block *passport)
+{
+    unsigned id = thpool_passport_shard_id;
+    if (unlikely(id == 0)) {
+        id = atomic_fetch_add_explicit(&thpool_passport_shard_next, 1, memory_order_relaxed) % THPOOL_PASSPORT_SHARDS + 1;
+        thpool_passport_shard_id = id;
+    }
+    atomic_int *num_api_use = &passport->use[id - 1].num_api_use;
+    atomic_fetch_add(num_api_use, 1);
+    return num_api_use;
+}
+
+static inline void thpool_passport_leave(atomic_int *num_api_use)
+{
+    atomic_fetch_sub(num_api_use, 1);
+}
+
+/**
+ * 是否仍有api在使用通行证。逐个读取分片不是原子快照，但在state切换后调用时已足够：
+ * 看到ALIVE的调用在退出前一直保持其分片非零，之后才进入的调用看到非ALIVE状态，立即退出。
+ */
+static bool thpool_passport_in_use(conc_state_block *passport)
+{
+    for (int i = 0; i < THPOOL_PASSPORT_SHARDS; i++) {
+        if (atomic_load(&passport->use[i].num_api_use) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#define DEFINE_THPOOL_EASY_API_SAFE_INNER(API) \
+static inline int thpool_##API##_safe_inner(thpool *thpool_p, conc_state_block *passport) \
+{ \
+    int ret; \
+    atomic_int *num_api_use = thpool_passport_enter(passport); \
+    enum thpool_state state = atomic_load(&passport->state); \
+    if (likely(state == THPOOL_ALIVE)) { \
+        ret = thpool_##API##_inner(thpool_p); \
+    } else { \
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state)); \
+        errno = EINVAL; \
+        ret = -1; \
+    } \
+    thpool_passport_leave(num_api_use); \
+    return ret; \
+}
+
+DEFINE_THPOOL_EASY_API_SAFE_INNER(wait)
+DEFINE_THPOOL_EASY_API_SAFE_INNER(drain)
+DEFINE_THPOOL_EASY_API_SAFE_INNER(reactivate)
+DEFINE_THPOOL_EASY_API_SAFE_INNER(num_threads_working)
+DEFINE_THPOOL_EASY_API_SAFE_INNER(num_threads)
+DEFINE_THPOOL_EASY_API_SAFE_INNER(job_slab_high_water)
+
+static inline int thpool_add_work_safe_inner(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_add_work_inner(thpool_p, function_p, arg_p);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline int thpool_add_work_batch_safe_inner(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void **args_p, int num)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_add_work_batch_inner(thpool_p, function_p, args_p, num);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline int thpool_resize_safe_inner(thpool *thpool_p, conc_state_block *passport, int num)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_resize_inner(thpool_p, num);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline int thpool_get_stats_safe_inner(thpool *thpool_p, conc_state_block *passport, threadpool_stats *out)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_get_stats_inner(thpool_p, out);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline void *thpool_job_alloc_safe_inner(thpool *thpool_p, conc_state_block *passport, size_t size)
+{
+    void *ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_job_alloc_inner(thpool_p, size);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = nullptr;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline int thpool_job_free_safe_inner(thpool *thpool_p, conc_state_block *passport, void *ptr)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_job_free_inner(thpool_p, ptr);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline int thpool_add_work_prio_safe_inner(thpool *thpool_p, conc_state_block *passport, threadpool_priority prio, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_add_work_prio_inner(thpool_p, prio, function_p, arg_p);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline int thpool_add_work_fiber_safe_inner(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_add_work_fiber_inner(thpool_p, function_p, arg_p);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline int thpool_add_work_deadline_safe_inner(thpool *thpool_p, conc_state_block *passport, unsigned long long deadline_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, void (*on_expire)(void *, threadpool_thread))
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_add_work_deadline_inner(thpool_p, deadline_ns, function_p, arg_p, on_expire);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline int thpool_add_work_timed_safe_inner(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ns)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_add_work_timed_inner(thpool_p, function_p, arg_p, timeout_ns);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline int thpool_add_work_to_safe_inner(thpool *thpool_p, conc_state_block *passport, int thread_id, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_add_work_to_inner(thpool_p, thread_id, function_p, arg_p);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline int thpool_add_work_keyed_safe_inner(thpool *thpool_p, conc_state_block *passport, unsigned long long key, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_add_work_keyed_inner(thpool_p, key, function_p, arg_p);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+/* 毫秒时限换算为纳秒，负数无效，过大的值截断为long能表示的最大值。 */
+static inline long thpool_timeout_ms_to_ns(long timeout_ms)
+{
+    return (timeout_ms > LONG_MAX / 1000000L) ? LONG_MAX : timeout_ms * 1000000L;
+}
+
+static inline int thpool_submit_safe_inner(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p, struct job **handle_out)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_submit_inner(thpool_p, function_p, arg_p, handle_out);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline struct thpool_group *thpool_group_create_safe_inner(thpool *thpool_p, conc_state_block *passport)
+{
+    struct thpool_group *ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_group_create_inner(thpool_p);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = nullptr;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline int thpool_group_add_work_safe_inner(struct thpool_group *group_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_group_add_work_inner(group_p, function_p, arg_p);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline int thpool_parallel_for_safe_inner(thpool *thpool_p, conc_state_block *passport, size_t begin, size_t end, size_t grain, void (*function_p)(size_t, size_t, void *, threadpool_thread), void *arg_p)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_parallel_for_inner(thpool_p, begin, end, grain, function_p, arg_p);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline struct thpool_graph *thpool_graph_create_safe_inner(thpool *thpool_p, conc_state_block *passport)
+{
+    struct thpool_graph *ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_graph_create_inner(thpool_p);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = nullptr;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline int thpool_graph_run_safe_inner(struct thpool_graph *graph_p, conc_state_block *passport)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_graph_run_inner(graph_p);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+static inline int thpool_add_work_timer_safe_inner(thpool *thpool_p, conc_state_block *passport, uint64_t deadline_ns, uint64_t period_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, thpool_timer **timer_out)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_add_work_timer_inner(thpool_p, deadline_ns, period_ns, function_p, arg_p, timer_out);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
+    }
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+/* 先检查状态再访问定时器：线程池离开ALIVE状态后，定时器可能已被`thpool_shutdown`释放。 */
+static inline int thpool_timer_cancel_safe_inner(thpool *thpool_p, conc_state_block *passport, thpool_timer *timer_p)
+{
+    int ret;
+    atomic_int *num_api_use = thpool_passport_enter(passport);
+    enum thpool_state state = atomic_load(&passport->state);
+    if (likely(state == THPOOL_ALIVE)) {
+        ret = thpool_timer_cancel_inner(thpool_p, timer_p);
+    } else {
+        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+        errno = EINVAL;
+        ret = -1;
     }
-#else
-    free(passport);
-#endif
-    return 0;
+    thpool_passport_leave(num_api_use);
+    return ret;
+}
+
+/* ============================= DRAIN ============================== */
+
+/* 在调用线程所属条带的当前纪元计数上加一，返回记录在enqueue_ns中的纪元位与条带位。  */
+static inline uint64_t thpool_drain_enter(thpool *thpool_p)
+{
+    unsigned stripe = thpool_producer_stripe_index() & (THPOOL_DRAIN_STRIPES - 1);
+    atomic_ullong *word_p = &thpool_p->drain_stripes[stripe].word;
+    unsigned long long word = atomic_load_explicit(word_p, memory_order_relaxed);
+    unsigned long long tag;
+    do {
+        tag = word & THPOOL_DRAIN_TAG;
+    } while (!atomic_compare_exchange_weak(word_p, &word, word + (tag ? (1ull << 32) : 1ull)));
+    return tag | ((uint64_t)stripe << THPOOL_DRAIN_STRIPE_SHIFT);
 }
 
-/* 有一个返回值，通知结果是成功还是失败。0为成功，-1为失败。失败一般是因为已经thpool正在shutdown。  */
-static int thpool_put_job(thpool *thpool_p, struct job *newjob)
+/**
+ * 任务完成或被丢弃后，在其入队时的条带与纪元计数上减一。某一条带旧纪元的计数归零且有`thpool_drain`等待时唤醒它，
+ * 由它重新汇总各条带。与`thpool_drain`先登记等待、再读取计数的顺序构成一对，两者都使用seq_cst序。
+ * 当前纪元的计数归零时多发送的唤醒是无害的。
+ */
+static inline void thpool_drain_leave(thpool *thpool_p, uint64_t stamp)
 {
-    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
-    thpool_log_debug("thpool_put_job: Entering, jobqueue.len = %d", thpool_p->jobqueue.len);
+    int shift = (stamp & THPOOL_DRAIN_TAG) ? 32 : 0;
+    unsigned stripe = (unsigned)(stamp >> THPOOL_DRAIN_STRIPE_SHIFT) & (THPOOL_DRAIN_STRIPES - 1);
+    unsigned long long word = atomic_fetch_sub(&thpool_p->drain_stripes[stripe].word, 1ull << shift);
+    if (unlikely(((word >> shift) & THPOOL_DRAIN_COUNT_MASK) == 1) && atomic_load(&thpool_p->num_drainers) > 0) {
+        atomic_fetch_add(&thpool_p->drain_seq, 1);
+        thpool_futex_wake(&thpool_p->drain_seq);
+    }
+}
 
-    bool thpool_alive = atomic_load(&thpool_p->threads_keepalive);
-    bool threads_active = atomic_load(&thpool_p->threads_active);
+/* 新入队任务的enqueue_ns：入队时刻与排空纪元。 */
+static inline uint64_t thpool_job_stamp(thpool *thpool_p)
+{
+    return thpool_stats_timestamp(thpool_p) | thpool_drain_enter(thpool_p);
+}
 
-    /* 在不活跃状态，阻塞。此外，若开启队列最大长度且队列已满，阻塞。但若阻塞期间线程池shutdown，退出。 */
-    while (thpool_alive && (!threads_active || (thpool_p->jobqueue.max_len && thpool_p->jobqueue.len >= thpool_p->jobqueue.max_len))) {
-        thpool_log_debug("thpool_put_job: Blocking, threads_active = %d, jobqueue.len = %d", threads_active, thpool_p->jobqueue.len);
-        pthread_cond_wait(&thpool_p->put_job_unblock, &thpool_p->jobqueue_rwmutex);
-        /* 
-        * 小心use after free风险！如果不能确保所有thpool_put_job执行完成后才销毁，这里无法保证thpool_p仍然存在！
-        * 解决方案：将thpool_destroy拆分成thpool_shutdown和thpool_destroy。thpool_shutdown令所有线程终止，但不销毁资源。
-        * thpool_destroy仅销毁资源，必须确保在所有对该thpool执行相关操作的线程全部终止运行，才允许调用，且必须在thpool_shutdown之后调用。
-        */
-        thpool_alive = atomic_load(&thpool_p->threads_keepalive);
-        threads_active = atomic_load(&thpool_p->threads_active);
-        thpool_log_debug("thpool_put_job: Woke up");
+/* 汇总各条带中指定纪元尚未完成的任务数。    */
+static unsigned long long thpool_drain_pending(thpool *thpool_p, int shift)
+{
+    unsigned long long pending = 0;
+    for (int i = 0; i < THPOOL_DRAIN_STRIPES; i++) {
+        pending += (atomic_load(&thpool_p->drain_stripes[i].word) >> shift) & THPOOL_DRAIN_COUNT_MASK;
     }
+    return pending;
+}
 
-    //在锁内仅需关心一次keealive情况。后续即使再遭遇thpool的销毁，在锁内也可以保护此流程安全。
-    if (!thpool_alive) {
-        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
-        errno = ECANCELED;
+/**
+ * 逐个条带翻转纪元后等待旧纪元的计数归零。各条带由drain_mutex保证纪元一致，翻转某一条带前经它入队的任务都计入旧纪元。
+ * 调用之前入队的任务都计入旧纪元，之后入队的任务计入新纪元，不会被等待，生产者与工作线程也不受影响。
+ * 多个`thpool_drain`依次进行：上一次返回时它等待的纪元计数已归零，该纪元再次成为当前纪元时从零开始计数，
+ * 旧纪元里不会残留更早的任务。
+ */
+static int thpool_drain_inner(thpool *thpool_p)
+{
+    /* 禁止线程池内的线程本身执行`thpool_drain`，其当前任务在完成前一直计入旧纪元。   */
+    if (thpool_is_current_thread_owner(thpool_p)) {
+        errno = EINVAL;
         return -1;
     }
 
-    jobqueue_push_unsafe(&thpool_p->jobqueue, newjob);
-
-    /* 如果此次行为将job从0变为1，发送一个信号告诉jobqueue非空。    */
-    if (thpool_p->jobqueue.len == 1) {
-        /* 注意，等待信号量的线程，在收到信号量后，在持有锁时并无优先权，仅仅只是重新放到了竞争锁的一个队列而已。
-        * 这意味着，如果多个get_job任务阻塞时，有多个put_job发生，第一个收到信号的get_job不保证一定比其他put_job优先执行。
-        * 于是，其他get_job就始终错过了信号。为此，这里需要用广播信号。
-        */
-        pthread_cond_broadcast(&thpool_p->get_job_unblock);
+    int ret = 0;
+    THPOOL_PROBE1(drain_enter, thpool_p);
+    pthread_mutex_lock(&thpool_p->drain_mutex);
+    unsigned long long word = 0;
+    for (int i = 0; i < THPOOL_DRAIN_STRIPES; i++) {
+        word = atomic_fetch_xor(&thpool_p->drain_stripes[i].word, THPOOL_DRAIN_TAG);
+    }
+    int shift = (word & THPOOL_DRAIN_TAG) ? 32 : 0;
+    atomic_fetch_add(&thpool_p->num_drainers, 1);
+    for (;;) {
+        unsigned seq = atomic_load(&thpool_p->drain_seq);
+        if (thpool_drain_pending(thpool_p, shift) == 0) {
+            break;
+        }
+        if (unlikely(!atomic_load(&thpool_p->threads_keepalive))) {
+            errno = ECANCELED;
+            ret = -1;
+            break;
+        }
+        thpool_futex_wait(&thpool_p->drain_seq, seq, 0);
     }
+    atomic_fetch_sub(&thpool_p->num_drainers, 1);
+    pthread_mutex_unlock(&thpool_p->drain_mutex);
+    THPOOL_PROBE1(drain_exit, thpool_p);
+    return ret;
+}
 
-    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
-    
-    return 0;
+/* ============================== API =============================== */
+
+#define DEFINE_THPOOL_EASY_API(API) \
+int thpool_##API(thpool *thpool_p) \
+{ \
+    if (unlikely(thpool_p == nullptr)) { \
+        errno = EINVAL; \
+        return -1; \
+    } \
+    return thpool_##API##_safe_inner(thpool_p, thpool_p->debug_conc_passport); \
 }
 
-static struct job *thpool_get_job(thpool *thpool_p)
-{
-    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
-    bool thpool_alive = atomic_load(&thpool_p->threads_keepalive);
-    struct job *ret;
+DEFINE_THPOOL_EASY_API(wait)
+DEFINE_THPOOL_EASY_API(drain)
+DEFINE_THPOOL_EASY_API(reactivate)
+DEFINE_THPOOL_EASY_API(shutdown)
+DEFINE_THPOOL_EASY_API(destroy)
+DEFINE_THPOOL_EASY_API(num_threads_working)
+DEFINE_THPOOL_EASY_API(num_threads)
+DEFINE_THPOOL_EASY_API(job_slab_high_water)
 
-    /**
-     * 在不活跃状态，阻塞。此外，若队列空，阻塞。但若阻塞期间线程池摧毁，退出。 
-     * 目前对于活跃状态的检查是冗余的，因为只有`thpool_wait`会修改active状态，而此时队列一定为空。
-     * 但考虑到可扩展性，保留对`threads_active`的阻塞检查。
-     */
-    while (thpool_alive && (thpool_p->jobqueue.len == 0 || unlikely(!atomic_load(&thpool_p->threads_active)))) {
-        pthread_cond_wait(&thpool_p->get_job_unblock, &thpool_p->jobqueue_rwmutex);
-        thpool_alive = atomic_load(&thpool_p->threads_keepalive);
-    }
 
-    if (!thpool_alive) {
-        pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
-        errno = ECANCELED;
-        return nullptr;
+int thpool_add_work(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return -1;
     }
+    return thpool_add_work_safe_inner(thpool_p, thpool_p->debug_conc_passport, function_p, arg_p);
+}
 
-    ret = jobqueue_pull_unsafe(&thpool_p->jobqueue);
+int thpool_add_work_prio(thpool *thpool_p, threadpool_priority prio, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_prio_safe_inner(thpool_p, thpool_p->debug_conc_passport, prio, function_p, arg_p);
+}
 
-    /* 如果jobqueue设置了上限，且此次行为将job队列从满变为满-1，发送一个信号告诉jobqueue非满。    */
-    if (thpool_p->jobqueue.max_len && (thpool_p->jobqueue.len == thpool_p->jobqueue.max_len - 1)) {
-        /**
-         * 注意，等待信号量的线程，在收到信号量后，在持有锁时并无优先权，仅仅只是重新放到了竞争锁的一个队列而已。
-         * 这意味着，如果多个put_job任务阻塞时，有多个get_job发生，第一个收到信号的put_job不保证一定比其他get_job优先执行。
-         * 于是，其他put_job就始终错过了信号。为此，这里需要用广播信号。
-         */
-        pthread_cond_broadcast(&thpool_p->put_job_unblock);
+int thpool_add_work_fiber(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return -1;
     }
+    return thpool_add_work_fiber_safe_inner(thpool_p, thpool_p->debug_conc_passport, function_p, arg_p);
+}
 
-    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
+int thpool_add_work_deadline(thpool *thpool_p, unsigned long long deadline_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, void (*on_expire)(void *, threadpool_thread))
+{
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_deadline_safe_inner(thpool_p, thpool_p->debug_conc_passport, deadline_ns, function_p, arg_p, on_expire);
+}
 
-    return ret;
+int thpool_try_add_work(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_timed_safe_inner(thpool_p, thpool_p->debug_conc_passport, function_p, arg_p, 0);
 }
 
-static inline bool thpool_is_current_thread_owner(thpool *thpool_p)
+int thpool_add_work_timed(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ms)
 {
-    return pthread_getspecific(thpool_p->key) == thpool_p;
+    if (unlikely(thpool_p == nullptr) || unlikely(timeout_ms < 0)){
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_timed_safe_inner(thpool_p, thpool_p->debug_conc_passport, function_p, arg_p, thpool_timeout_ms_to_ns(timeout_ms));
 }
 
-/* Add work to the thread pool */
-static int thpool_add_work_inner(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p)
+int thpool_add_work_to(thpool *thpool_p, int thread_id, void (*function_p)(void *, threadpool_thread), void *arg_p)
 {
-    job *newjob;
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_to_safe_inner(thpool_p, thpool_p->debug_conc_passport, thread_id, function_p, arg_p);
+}
 
-    newjob=malloc(sizeof(struct job));
-    if (unlikely(newjob == nullptr)) {
-        thpool_log_error("thpool_add_work(): Could not allocate memory for new job");
+int thpool_add_work_keyed(thpool *thpool_p, unsigned long long key, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
         return -1;
     }
+    return thpool_add_work_keyed_safe_inner(thpool_p, thpool_p->debug_conc_passport, key, function_p, arg_p);
+}
 
-    /* add function and argument */
-    newjob->function=function_p;
-    newjob->arg=arg_p;
+int thpool_add_work_batch(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void **args_p, int num)
+{
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_batch_safe_inner(thpool_p, thpool_p->debug_conc_passport, function_p, args_p, num);
+}
 
-    /* add job to queue */
-    int ret = thpool_put_job(thpool_p, newjob);
+int thpool_submit(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p, struct job **handle_out)
+{
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_submit_safe_inner(thpool_p, thpool_p->debug_conc_passport, function_p, arg_p, handle_out);
+}
 
-    return ret;
+struct thpool_group *thpool_group_create(thpool *thpool_p)
+{
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return nullptr;
+    }
+    return thpool_group_create_safe_inner(thpool_p, thpool_p->debug_conc_passport);
 }
 
-/* Wait until all jobs have finished */
-static int thpool_wait_inner(thpool *thpool_p)
+int thpool_group_add_work(struct thpool_group *group_p, void (*function_p)(void *, threadpool_thread), void *arg_p)
 {
-    /* 禁止线程池内的线程本身执行`thpool_wait`。    */
-    if (thpool_is_current_thread_owner(thpool_p)) {
+    if (unlikely(group_p == nullptr)){
         errno = EINVAL;
         return -1;
     }
+    return thpool_group_add_work_safe_inner(group_p, group_p->thpool_p->debug_conc_passport, function_p, arg_p);
+}
 
-    /**
-     * 原作者此处用了一个很优雅的while，但是因此这里对thpool_p->jobqueue.len的读取放在了一个可能发生数据竞争的位置。
-     * 考虑到thpool_wait此处需要读的次数非常少，因此没有必要考虑其他锁或者高效方案，在这里使用互斥锁判定即可。
-     * 宁可丑陋一些，也不能接受潜在的数据竞争问题。
-     * 但此处使用了两个锁，因此必须小心死锁的情形，所幸threads_all_idle其他使用的地方均不需要考虑jobqueue_rwmutex。
-     */
-    pthread_mutex_lock(&thpool_p->threads_all_idle_mutex);
-    for (;;) {
-        pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
-        int jobqueuelen = thpool_p->jobqueue.len;
-        int working_threads = atomic_load(&thpool_p->num_threads_working);
-        if (jobqueuelen || working_threads != 0) {
-            pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
-            pthread_cond_wait(&thpool_p->threads_all_idle, &thpool_p->threads_all_idle_mutex);
-        } else {
-            atomic_store(&thpool_p->threads_active, false);
-            thpool_log_debug("thpool_wait_inner: jobqueue.len = %d, num_threads_working = %d", jobqueuelen, working_threads);
-            pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
-            break;
-        }
+int thpool_parallel_for(thpool *thpool_p, size_t begin, size_t end, size_t grain, void (*function_p)(size_t, size_t, void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return -1;
     }
-    pthread_mutex_unlock(&thpool_p->threads_all_idle_mutex);
-    return 0;
+    return thpool_parallel_for_safe_inner(thpool_p, thpool_p->debug_conc_passport, begin, end, grain, function_p, arg_p);
 }
 
-/* 解除thpool_put_job的阻塞 */
-static int thpool_reactivate_inner(thpool *thpool_p)
+struct thpool_graph *thpool_graph_create(thpool *thpool_p)
 {
-    pthread_mutex_lock(&thpool_p->jobqueue_rwmutex);
-    atomic_store(&thpool_p->threads_active, true);
-    thpool_log_debug("thpool_reactivate_inner: threads_active successfully set to %d", atomic_load(&thpool_p->threads_active));
-    pthread_cond_broadcast(&thpool_p->get_job_unblock);
-    pthread_cond_broadcast(&thpool_p->put_job_unblock);
-    pthread_mutex_unlock(&thpool_p->jobqueue_rwmutex);
-    return 0;
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return nullptr;
+    }
+    return thpool_graph_create_safe_inner(thpool_p, thpool_p->debug_conc_passport);
 }
 
-static int thpool_num_threads_working_inner(thpool *thpool_p)
+int thpool_graph_run(struct thpool_graph *graph_p)
 {
-    return atomic_load(&thpool_p->num_threads_working);
+    if (unlikely(graph_p == nullptr)){
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_graph_run_safe_inner(graph_p, graph_p->group.thpool_p->debug_conc_passport);
 }
 
-#define DEFINE_THPOOL_EASY_API_SAFE_INNER(API) \
-static inline int thpool_##API##_safe_inner(thpool *thpool_p, conc_state_block *passport) \
-{ \
-    int ret; \
-    atomic_fetch_add(&passport->num_api_use, 1); \
-    enum thpool_state state = atomic_load(&passport->state); \
-    if (likely(state == THPOOL_ALIVE)) { \
-        ret = thpool_##API##_inner(thpool_p); \
-    } else { \
-        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state)); \
-        errno = EINVAL; \
-        ret = -1; \
-    } \
-    atomic_fetch_sub(&passport->num_api_use, 1); \
-    return ret; \
+int thpool_add_work_at(thpool *thpool_p, unsigned long long deadline_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, thpool_timer **timer_out)
+{
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_timer_safe_inner(thpool_p, thpool_p->debug_conc_passport, deadline_ns, 0, function_p, arg_p, timer_out);
 }
 
-DEFINE_THPOOL_EASY_API_SAFE_INNER(wait)
-DEFINE_THPOOL_EASY_API_SAFE_INNER(reactivate)
-DEFINE_THPOOL_EASY_API_SAFE_INNER(num_threads_working)
-
-static inline int thpool_add_work_safe_inner(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p)
+int thpool_add_work_every(thpool *thpool_p, unsigned long long first_deadline_ns, unsigned long long period_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, thpool_timer **timer_out)
 {
-    int ret;
-    atomic_fetch_add(&passport->num_api_use, 1);
-    enum thpool_state state = atomic_load(&passport->state);
-    if (likely(state == THPOOL_ALIVE)) {
-        ret = thpool_add_work_inner(thpool_p, function_p, arg_p);
-    } else {
-        thpool_log_error("use thpool api in bad state! The" THPOOL_PASSPORT_STATUS_REPORTER(passport, state));
+    if (unlikely(thpool_p == nullptr) || unlikely(period_ns == 0)){
         errno = EINVAL;
-        ret = -1;
+        return -1;
     }
-    atomic_fetch_sub(&passport->num_api_use, 1);
-    return ret;
+    return thpool_add_work_timer_safe_inner(thpool_p, thpool_p->debug_conc_passport, first_deadline_ns, period_ns, function_p, arg_p, timer_out);
 }
 
-/* ============================== API =============================== */
+int thpool_timer_cancel(thpool *thpool_p, thpool_timer *timer_p)
+{
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_timer_cancel_safe_inner(thpool_p, thpool_p->debug_conc_passport, timer_p);
+}
 
-#define DEFINE_THPOOL_EASY_API(API) \
-int thpool_##API(thpool *thpool_p) \
-{ \
-    if (unlikely(thpool_p == nullptr)) { \
-        errno = EINVAL; \
-        return -1; \
-    } \
-    return thpool_##API##_safe_inner(thpool_p, thpool_p->debug_conc_passport); \
+int thpool_resize(thpool *thpool_p, int num)
+{
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_resize_safe_inner(thpool_p, thpool_p->debug_conc_passport, num);
 }
 
-DEFINE_THPOOL_EASY_API(wait)
-DEFINE_THPOOL_EASY_API(reactivate)
-DEFINE_THPOOL_EASY_API(shutdown)
-DEFINE_THPOOL_EASY_API(destroy)
-DEFINE_THPOOL_EASY_API(num_threads_working)
+int thpool_get_stats(thpool *thpool_p, threadpool_stats *out)
+{
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_get_stats_safe_inner(thpool_p, thpool_p->debug_conc_passport, out);
+}
 
+void *thpool_job_alloc(thpool *thpool_p, size_t size)
+{
+    if (unlikely(thpool_p == nullptr)){
+        errno = EINVAL;
+        return nullptr;
+    }
+    return thpool_job_alloc_safe_inner(thpool_p, thpool_p->debug_conc_passport, size);
+}
 
-int thpool_add_work(thpool *thpool_p, void (*function_p)(void *, threadpool_thread), void *arg_p)
+int thpool_job_free(thpool *thpool_p, void *ptr)
 {
     if (unlikely(thpool_p == nullptr)){
         errno = EINVAL;
         return -1;
     }
-    return thpool_add_work_safe_inner(thpool_p, thpool_p->debug_conc_passport, function_p, arg_p);
+    return thpool_job_free_safe_inner(thpool_p, thpool_p->debug_conc_passport, ptr);
+}
+
+/* `thpool_stats_bucket`的逆运算。  */
+unsigned long long thpool_stats_bucket_lower_ns(int bucket)
+{
+    if (bucket < 0 || bucket >= THPOOL_STATS_HIST_BUCKETS) {
+        return 0;
+    }
+    if (bucket < THPOOL_STATS_HIST_SUB) {
+        return (unsigned long long)bucket;
+    }
+    int e = bucket / THPOOL_STATS_HIST_SUB + THPOOL_STATS_HIST_SUB_BITS - 1;
+    unsigned long long sub = (unsigned long long)(bucket % THPOOL_STATS_HIST_SUB);
+    return (THPOOL_STATS_HIST_SUB + sub) << (e - THPOOL_STATS_HIST_SUB_BITS);
 }
 
 /* ===================== DEBUG CONC PASSPORT ======================== */
@@ -1263,12 +7853,14 @@ conc_state_block *thpool_debug_conc_passport_init()
 
 conc_state_block *thpool_debug_conc_passport_init_inner(enum thpool_state state)
 {
-    conc_state_block *passport = malloc(sizeof(conc_state_block));
+    conc_state_block *passport = aligned_alloc(THPOOL_CACHE_LINE_SIZE, sizeof(conc_state_block));
     if (unlikely(passport == nullptr)) {
         thpool_log_error("Could not allocate memory for debug concurrency passport");
         return nullptr;
     }
-    atomic_init(&passport->num_api_use, 0);
+    for (int i = 0; i < THPOOL_PASSPORT_SHARDS; i++) {
+        atomic_init(&passport->use[i].num_api_use, 0);
+    }
     atomic_init(&passport->state, state);
 #ifdef THPOOL_ENABLE_DEBUG_CONC_API 
     memset(passport->name_copy, 0, sizeof(passport->name_copy));
@@ -1312,10 +7904,13 @@ int thpool_##API##_debug_conc(thpool *thpool_p, conc_state_block *passport) \
 }
 
 DEFINE_THPOOL_EASY_DEBUG_CONC_API(wait)
+DEFINE_THPOOL_EASY_DEBUG_CONC_API(drain)
 DEFINE_THPOOL_EASY_DEBUG_CONC_API(reactivate)
 DEFINE_THPOOL_EASY_DEBUG_CONC_API(shutdown)
 DEFINE_THPOOL_EASY_DEBUG_CONC_API(destroy)
 DEFINE_THPOOL_EASY_DEBUG_CONC_API(num_threads_working)
+DEFINE_THPOOL_EASY_DEBUG_CONC_API(num_threads)
+DEFINE_THPOOL_EASY_DEBUG_CONC_API(job_slab_high_water)
 
 int thpool_add_work_debug_conc(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p)
 {
@@ -1331,4 +7926,298 @@ int thpool_add_work_debug_conc(thpool *thpool_p, conc_state_block *passport, voi
     return thpool_add_work_safe_inner(thpool_p, passport, function_p, arg_p);
 }
 
+int thpool_add_work_prio_debug_conc(thpool *thpool_p, conc_state_block *passport, threadpool_priority prio, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_prio_safe_inner(thpool_p, passport, prio, function_p, arg_p);
+}
+
+int thpool_add_work_fiber_debug_conc(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_fiber_safe_inner(thpool_p, passport, function_p, arg_p);
+}
+
+int thpool_add_work_deadline_debug_conc(thpool *thpool_p, conc_state_block *passport, unsigned long long deadline_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, void (*on_expire)(void *, threadpool_thread))
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_deadline_safe_inner(thpool_p, passport, deadline_ns, function_p, arg_p, on_expire);
+}
+
+int thpool_try_add_work_debug_conc(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_timed_safe_inner(thpool_p, passport, function_p, arg_p, 0);
+}
+
+int thpool_add_work_timed_debug_conc(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ms)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr) || unlikely(timeout_ms < 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_timed_safe_inner(thpool_p, passport, function_p, arg_p, thpool_timeout_ms_to_ns(timeout_ms));
+}
+
+int thpool_add_work_to_debug_conc(thpool *thpool_p, conc_state_block *passport, int thread_id, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_to_safe_inner(thpool_p, passport, thread_id, function_p, arg_p);
+}
+
+int thpool_add_work_keyed_debug_conc(thpool *thpool_p, conc_state_block *passport, unsigned long long key, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_keyed_safe_inner(thpool_p, passport, key, function_p, arg_p);
+}
+
+int thpool_add_work_batch_debug_conc(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void **args_p, int num)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_batch_safe_inner(thpool_p, passport, function_p, args_p, num);
+}
+
+int thpool_submit_debug_conc(thpool *thpool_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p, struct job **handle_out)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_submit_safe_inner(thpool_p, passport, function_p, arg_p, handle_out);
+}
+
+int thpool_add_work_at_debug_conc(thpool *thpool_p, conc_state_block *passport, unsigned long long deadline_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, thpool_timer **timer_out)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_timer_safe_inner(thpool_p, passport, deadline_ns, 0, function_p, arg_p, timer_out);
+}
+
+int thpool_add_work_every_debug_conc(thpool *thpool_p, conc_state_block *passport, unsigned long long first_deadline_ns, unsigned long long period_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, thpool_timer **timer_out)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr) || unlikely(period_ns == 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_add_work_timer_safe_inner(thpool_p, passport, first_deadline_ns, period_ns, function_p, arg_p, timer_out);
+}
+
+int thpool_timer_cancel_debug_conc(thpool *thpool_p, conc_state_block *passport, thpool_timer *timer_p)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_timer_cancel_safe_inner(thpool_p, passport, timer_p);
+}
+
+struct thpool_graph *thpool_graph_create_debug_conc(thpool *thpool_p, conc_state_block *passport)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return nullptr;
+    }
+    return thpool_graph_create_safe_inner(thpool_p, passport);
+}
+
+int thpool_graph_run_debug_conc(struct thpool_graph *graph_p, conc_state_block *passport)
+{
+    if (unlikely(graph_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != graph_p->group.thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_graph_run_safe_inner(graph_p, passport);
+}
+
+int thpool_parallel_for_debug_conc(thpool *thpool_p, conc_state_block *passport, size_t begin, size_t end, size_t grain, void (*function_p)(size_t, size_t, void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_parallel_for_safe_inner(thpool_p, passport, begin, end, grain, function_p, arg_p);
+}
+
+struct thpool_group *thpool_group_create_debug_conc(thpool *thpool_p, conc_state_block *passport)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return nullptr;
+    }
+    return thpool_group_create_safe_inner(thpool_p, passport);
+}
+
+int thpool_group_add_work_debug_conc(struct thpool_group *group_p, conc_state_block *passport, void (*function_p)(void *, threadpool_thread), void *arg_p)
+{
+    if (unlikely(group_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != group_p->thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_group_add_work_safe_inner(group_p, passport, function_p, arg_p);
+}
+
+int thpool_resize_debug_conc(thpool *thpool_p, conc_state_block *passport, int num)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_resize_safe_inner(thpool_p, passport, num);
+}
+
+int thpool_get_stats_debug_conc(thpool *thpool_p, conc_state_block *passport, threadpool_stats *out)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_get_stats_safe_inner(thpool_p, passport, out);
+}
+
+void *thpool_job_alloc_debug_conc(thpool *thpool_p, conc_state_block *passport, size_t size)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return nullptr;
+    }
+    return thpool_job_alloc_safe_inner(thpool_p, passport, size);
+}
+
+int thpool_job_free_debug_conc(thpool *thpool_p, conc_state_block *passport, void *ptr)
+{
+    if (unlikely(thpool_p == nullptr) || unlikely(passport == nullptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (unlikely(passport->bind_pool != thpool_p)) {
+        thpool_log_error("passport bind thpool %p:%s, match failed!", passport->bind_pool, passport->name_copy);
+        errno = EINVAL;
+        return -1;
+    }
+    return thpool_job_free_safe_inner(thpool_p, passport, ptr);
+}
+
 #endif
\ No newline at end of file
@@ -21,6 +21,8 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -50,6 +52,38 @@ typedef struct thpool *threadpool;
  */
 typedef struct thread *threadpool_thread;
 
+/**
+ * @brief An opaque completion handle for a job added by @ref thpool_submit.
+ *
+ * The handle lives in a job node of the thread pool's own allocator, so it must be released
+ * with @ref thpool_handle_release before @ref thpool_destroy. Users should not access its internal members directly.
+ *
+ * `thpool_submit`添加的任务的不透明完成句柄。句柄位于线程池自身分配器的任务节点中，
+ * 因此必须在`thpool_destroy`之前以`thpool_handle_release`释放。使用者不应直接访问其内部成员。
+ */
+typedef struct job *threadpool_handle;
+
+/**
+ * @brief An opaque handle for a task group, see @ref thpool_group_create.
+ *
+ * 任务组的不透明句柄，参见`thpool_group_create`。使用者不应直接访问其内部成员。
+ */
+typedef struct thpool_group *threadpool_group;
+
+/**
+ * @brief An opaque handle for a task graph, see @ref thpool_graph_create.
+ *
+ * 任务图的不透明句柄，参见`thpool_graph_create`。使用者不应直接访问其内部成员。
+ */
+typedef struct thpool_graph *threadpool_graph;
+
+/**
+ * @brief An opaque handle for a delayed or periodic job, see @ref thpool_add_work_at.
+ *
+ * 延时或周期任务的不透明句柄，参见`thpool_add_work_at`。使用者不应直接访问其内部成员。
+ */
+typedef struct thpool_timer *threadpool_timer;
+
 #ifdef THPOOL_ENABLE_DEBUG_CONC_API
 /**
  * @brief An opaque handle for the debug concurrency passport.
@@ -93,9 +127,268 @@ typedef struct thread *threadpool_thread;
  * 如果遵循这个约定，调试并发API可以帮助检测在线程池池生命周期中不正确的时机进行的API调用，
  * 根据通行证状态记录警告或错误，潜在地阻止池对象本身在释放后被使用。
  */
-typedef conc_state_block *thpool_debug_conc_passport;
+typedef struct conc_state_block *thpool_debug_conc_passport;
 #endif
 
+/**
+ * @brief Job scheduling modes of the thread pool.
+ *
+ * Selects how jobs are distributed to worker threads.
+ *
+ * 线程池的任务调度模式，决定任务如何分发到各个工作线程。
+ */
+typedef enum threadpool_sched_mode {
+    /**
+     * All jobs go through the single shared job queue. This is the default mode.
+     * 所有任务都经由唯一的共享任务队列分发。这是默认模式。
+     */
+    THPOOL_SCHED_SHARED_QUEUE = 0,
+    /**
+     * Each worker thread owns a Chase-Lev work-stealing deque.
+     * Jobs submitted from inside a worker thread are pushed to its own deque, and the worker pops
+     * its own deque in LIFO order. An idle worker takes jobs from the shared queue, and then steals
+     * from other workers' deques in FIFO order. Jobs submitted by external threads still go through
+     * the shared queue, which acts as the injection queue.
+     *
+     * 每个工作线程持有一个Chase-Lev工作窃取双端队列。
+     * 工作线程内部提交的任务放入自身的双端队列，并按LIFO顺序从自身队列取出；
+     * 空闲的工作线程先从共享队列获取任务，再按FIFO顺序从其他线程的双端队列窃取任务。
+     * 外部线程提交的任务仍经由共享队列，此时共享队列作为注入队列使用。
+     */
+    THPOOL_SCHED_WORK_STEALING,
+} threadpool_sched_mode;
+
+/**
+ * @brief Backend implementations of the shared job queue.
+ *
+ * 共享任务队列的后端实现。
+ */
+typedef enum threadpool_queue_backend {
+    /**
+     * Mutex-protected linked list, one node per job taken from the pool's job node allocator. This is the default backend.
+     * 互斥锁保护的链表，每个任务占用一个从线程池任务节点分配器取得的节点。这是默认后端。
+     */
+    THPOOL_QUEUE_LINKED_LIST = 0,
+    /**
+     * Preallocated lock-free bounded MPMC ring buffer storing the task function and argument inline.
+     * Only available for bounded pools (`work_num_max > 0`); otherwise the linked list backend is used.
+     * Adding work neither allocates memory nor takes the queue mutex unless the queue is full.
+     *
+     * 预分配的无锁有界多生产者多消费者环形缓冲区，直接在槽位内保存任务函数与参数。
+     * 仅适用于有上限的线程池（`work_num_max > 0`），否则仍使用链表后端。
+     * 除非队列已满，添加任务既不分配内存，也不获取队列互斥锁。
+     */
+    THPOOL_QUEUE_RING,
+} threadpool_queue_backend;
+
+/**
+ * @brief What an idle worker thread does before it parks.
+ *
+ * 空闲工作线程在休眠前的等待策略。
+ */
+typedef enum threadpool_idle_policy {
+    /**
+     * Park on the condition variable immediately when there is no job. Never burns CPU while idle.
+     * This is the default policy.
+     * 没有任务时立即在条件变量上休眠，空闲时不占用CPU。这是默认策略。
+     */
+    THPOOL_IDLE_PARK = 0,
+    /**
+     * Spin for up to `idle_spin_ns` nanoseconds watching the queued job count before parking.
+     * A job arriving within that window is picked up without a futex wake and a context switch.
+     * 休眠前先自旋至多`idle_spin_ns`纳秒并观察排队任务数，在此期间到达的任务无需唤醒与上下文切换即可被取走。
+     */
+    THPOOL_IDLE_SPIN,
+    /**
+     * Like @ref THPOOL_IDLE_SPIN, but each worker adapts its own spin budget to the observed
+     * inter-arrival time: the budget doubles (up to `idle_spin_ns`) when a job arrives while spinning,
+     * and halves when the worker has to park anyway.
+     * 与`THPOOL_IDLE_SPIN`类似，但每个工作线程按观察到的任务到达间隔调整自旋时长：
+     * 自旋期间等到任务时加倍（不超过`idle_spin_ns`），最终仍需休眠时减半。
+     */
+    THPOOL_IDLE_ADAPTIVE,
+} threadpool_idle_policy;
+
+/**
+ * @brief Placement of worker threads on CPUs, see @ref threadpool_config::affinity.
+ *
+ * Only supported on Linux. On other systems any value other than @ref THPOOL_AFFINITY_NONE
+ * logs a warning and is ignored.
+ *
+ * 工作线程在CPU上的放置方式。仅在Linux上支持，在其他系统上除`THPOOL_AFFINITY_NONE`外的值会记录警告并被忽略。
+ */
+typedef enum threadpool_affinity {
+    /**
+     * Threads are created with default attributes and scheduled freely by the kernel. This is the default.
+     * 以默认属性创建线程，由内核自由调度。这是默认值。
+     */
+    THPOOL_AFFINITY_NONE = 0,
+    /**
+     * Every worker may run on any CPU of the set, and the kernel balances them within it.
+     * 所有工作线程都限制在该CPU集合内运行，由内核在集合内均衡。
+     */
+    THPOOL_AFFINITY_CPUSET,
+    /**
+     * Each worker is pinned to a single CPU of the set, assigned round-robin by thread id.
+     * 每个工作线程固定在集合中的一个CPU上，按线程编号轮流分配。
+     */
+    THPOOL_AFFINITY_PER_CPU,
+    /**
+     * Workers are spread round-robin by thread id over the NUMA nodes that have CPUs in the set,
+     * and each may run on any CPU of its node within the set. The metadata of each thread,
+     * including its statistics and work-stealing deque, is allocated on its node, and in
+     * @ref THPOOL_SCHED_WORK_STEALING mode an idle worker steals from workers on its own node first.
+     * If the NUMA topology cannot be read, this behaves like @ref THPOOL_AFFINITY_CPUSET.
+     *
+     * 工作线程按线程编号轮流分布到集合中有CPU的各个NUMA节点上，每个线程可以在本节点位于集合内的任意CPU上运行。
+     * 每个线程的元数据（包括统计计数与工作窃取双端队列）分配在其所在节点上，
+     * 在`THPOOL_SCHED_WORK_STEALING`模式下，空闲的工作线程优先窃取同一节点上的线程。
+     * 若无法读取NUMA拓扑，其行为与`THPOOL_AFFINITY_CPUSET`相同。
+     */
+    THPOOL_AFFINITY_NUMA_SPREAD,
+} threadpool_affinity;
+
+/**
+ * @brief What @ref thpool_try_add_work and @ref thpool_add_work_timed do with a job they cannot queue.
+ *
+ * The policy applies only when the queue stays full (or the pool inactive) past the deadline of
+ * those two calls. `thpool_add_work` and the other submission functions keep blocking.
+ *
+ * `thpool_try_add_work`与`thpool_add_work_timed`无法放入任务时的处理方式。
+ * 仅在这两个函数的时限内队列一直已满（或线程池一直不活跃）时生效，`thpool_add_work`等其他提交函数仍然阻塞。
+ */
+typedef enum threadpool_reject_policy {
+    /**
+     * The call fails and sets `errno` to `EAGAIN` or `ETIMEDOUT`.
+     * 调用失败，并将`errno`设置为`EAGAIN`或`ETIMEDOUT`。
+     */
+    THPOOL_REJECT_FAIL = 0,
+    /**
+     * The job runs on the calling thread before the call returns 0. `current_thrd` is the
+     * caller's thread handle if the caller is a worker of this pool, or null otherwise.
+     * 任务在调用线程上执行，随后调用返回0。若调用者是本线程池的工作线程，`current_thrd`为其线程句柄，否则为空指针。
+     */
+    THPOOL_REJECT_CALLER_RUNS,
+    /**
+     * A queued job is discarded without running and the new job takes its place. Jobs of
+     * @ref THPOOL_PRIO_LOW go first, then jobs of the ring buffer or the work-stealing deques,
+     * then the remaining jobs of the shared linked list from the lowest priority up; within a queue
+     * the oldest job goes first. Handles and groups of the discarded job complete as cancelled,
+     * as if @ref thpool_shutdown had discarded it. If nothing is queued (for example the pool
+     * is inactive with an empty queue), the call fails as with @ref THPOOL_REJECT_FAIL.
+     *
+     * 丢弃一个排队中的任务（不执行），由新任务取代其位置。依次选取`THPOOL_PRIO_LOW`的任务、
+     * 环形缓冲区或工作窃取双端队列中的任务、共享链表中其余级别从低到高的任务，同一队列内最早的任务先被丢弃。
+     * 被丢弃任务的句柄与任务组如同被`thpool_shutdown`丢弃一样以取消状态完成。
+     * 若没有排队的任务（例如线程池不活跃且队列为空），调用按`THPOOL_REJECT_FAIL`的方式失败。
+     */
+    THPOOL_REJECT_DROP_OLDEST,
+} threadpool_reject_policy;
+
+/**
+ * @brief Priority levels of jobs, see @ref thpool_add_work_prio.
+ *
+ * A smaller value means a higher priority. Jobs added by @ref thpool_add_work use @ref THPOOL_PRIO_NORMAL.
+ *
+ * 任务的优先级，数值越小优先级越高。`thpool_add_work`添加的任务为`THPOOL_PRIO_NORMAL`。
+ */
+typedef enum threadpool_priority {
+    THPOOL_PRIO_CRITICAL = 0,   /* latency-critical work. 延迟敏感的任务。 */
+    THPOOL_PRIO_HIGH,
+    THPOOL_PRIO_NORMAL,         /* default priority. 默认优先级。  */
+    THPOOL_PRIO_LOW,            /* background work. 后台任务。  */
+    THPOOL_PRIO_LEVELS,         /* number of priority levels, not a valid priority. 优先级数量，不是有效的优先级。  */
+} threadpool_priority;
+
+/**
+ * @brief Number of buckets in each latency histogram of @ref threadpool_stats.
+ *
+ * Histograms are log-linear: values below 4ns get one bucket each, and every power of two
+ * above is split into 4 equal sub-buckets, so a bucket spans at most 25% of its lower bound.
+ * The last bucket (starting at about 7.5s) also collects every larger value.
+ * Use @ref thpool_stats_bucket_lower_ns to get the range of a bucket.
+ *
+ * 延迟直方图的桶数。直方图为对数线性分布：小于4纳秒的值每个值一个桶，此后每个2的幂区间均分为4个子桶，
+ * 因此每个桶的宽度不超过其下界的25%。最后一个桶（约7.5秒起）同时收纳所有更大的值。
+ * 使用`thpool_stats_bucket_lower_ns`获取桶的范围。
+ */
+#define THPOOL_STATS_HIST_BUCKETS   128
+
+/**
+ * @brief Per-worker part of a statistics snapshot, see @ref thpool_get_stats.
+ *
+ * 统计快照中每个工作线程的部分。
+ */
+typedef struct threadpool_thread_stats {
+    int     id;                                 /* thread id, see @ref thpool_thread_get_id. 线程编号。 */
+    unsigned long long  jobs_completed;         /* jobs finished by this thread. 本线程完成的任务数。  */
+    /* time spent running jobs, only collected with `stats_timing`. 执行任务的时间，仅在开启`stats_timing`时统计。  */
+    unsigned long long  busy_ns;
+    /* time spent waiting for jobs (spinning or parked), only collected with `stats_timing`. 等待任务（自旋或休眠）的时间。  */
+    unsigned long long  idle_ns;
+} threadpool_thread_stats;
+
+/**
+ * @brief A snapshot of thread pool statistics, filled by @ref thpool_get_stats.
+ *
+ * Counters are kept per thread and summed when the snapshot is taken, without taking the job queue lock.
+ * The snapshot is therefore not atomic as a whole: while jobs are running, sums may be slightly behind each other
+ * (a job is counted as submitted only after it is queued, so `jobs_completed` may briefly exceed `jobs_submitted`).
+ * Once @ref thpool_wait returns and no other thread is adding work, `jobs_completed` equals `jobs_submitted`.
+ * Timing fields and histograms stay zero unless `stats_timing` is set in @ref threadpool_config.
+ *
+ * 线程池统计快照。计数器按线程分散保存，仅在获取快照时汇总，获取时不持有任务队列锁。
+ * 因此快照整体并非原子的：任务执行期间，各项合计之间可能略有先后（任务入队后才计入提交数，因此完成数可能暂时超过提交数）。
+ * `thpool_wait`返回且没有其他线程添加任务时，`jobs_completed`等于`jobs_submitted`。
+ * 除非在`threadpool_config`中设置了`stats_timing`，计时字段与直方图始终为0。
+ */
+typedef struct threadpool_stats {
+    unsigned long long  jobs_submitted;         /* jobs accepted into the queue. 成功入队的任务数。  */
+    unsigned long long  jobs_completed;         /* jobs finished by workers. 已执行完毕的任务数。  */
+    /* jobs refused because the pool was shutting down, out of memory or by the reject policy. 因线程池关闭、内存不足或拒绝策略而被拒绝的任务数。  */
+    unsigned long long  jobs_rejected;
+    /* jobs of `thpool_add_work_deadline` that ran their expire callback instead. 过期而改为执行过期回调的截止时间任务数。  */
+    unsigned long long  jobs_expired;
+    int     queue_len;                          /* jobs currently queued. 当前排队的任务数。 */
+    int     queue_len_peak;                     /* highest number of jobs queued at once. 排队任务数的历史峰值。 */
+    /* total time producers spent blocked on a full queue. 生产者因队列已满而阻塞的总时间。  */
+    unsigned long long  producer_blocked_ns;
+    /* time from submission to the start of execution. 任务从提交到开始执行的等待时间。  */
+    unsigned long long  queue_wait_hist[THPOOL_STATS_HIST_BUCKETS];
+    /* time spent executing each job. 每个任务的执行时间。  */
+    unsigned long long  run_time_hist[THPOOL_STATS_HIST_BUCKETS];
+    /* number of worker thread slots, including retired threads whose counters are kept. 工作线程位置数，包括保留计数器的已退出线程。    */
+    int     num_threads;
+    /**
+     * Filled by the caller before the call: an array of `threads_capacity` elements that receives
+     * per-thread statistics, or null pointer if not needed. At most `min(num_threads, threads_capacity)`
+     * elements are written.
+     * 由调用者在调用前填写：接收每线程统计的数组及其元素数`threads_capacity`，不需要时为空指针。
+     * 至多写入`min(num_threads, threads_capacity)`个元素。
+     */
+    threadpool_thread_stats *threads;
+    int     threads_capacity;
+} threadpool_stats;
+
+/**
+ * @brief A job as seen by @ref threadpool_config.pre_job_cb and @ref threadpool_config.post_job_cb.
+ *
+ * Timestamps are `CLOCK_MONOTONIC` nanoseconds, the same clock as the timing part of @ref threadpool_stats.
+ * For jobs added by @ref thpool_submit or @ref thpool_group_add_work, `function` and `arg` are the ones the user passed,
+ * not the internal wrapper that is actually queued.
+ *
+ * 任务钩子看到的任务信息。时刻为`CLOCK_MONOTONIC`纳秒，与`threadpool_stats`计时部分使用同一时钟。
+ * 对于`thpool_submit`与`thpool_group_add_work`添加的任务，`function`与`arg`为用户传入的值，而非实际入队的内部包装函数。
+ */
+typedef struct threadpool_job_info {
+    void    (*function)(void *, threadpool_thread);    /* task function. 任务函数。    */
+    void    *arg;                                       /* task argument. 任务参数。    */
+    unsigned long long  enqueue_ns;                     /* time the job was queued. 入队时刻。  */
+    unsigned long long  start_ns;                       /* time the worker took the job, just before `pre_job_cb`. 开始执行时刻，紧接`pre_job_cb`之前。   */
+    /* time the task function returned, just before `post_job_cb`; 0 in `pre_job_cb`. 任务函数返回时刻，紧接`post_job_cb`之前；在`pre_job_cb`中为0。    */
+    unsigned long long  end_ns;
+} threadpool_job_info;
+
 /**
  * @brief Configuration structure for initializing the thread pool.
  *
@@ -124,6 +417,49 @@ typedef struct threadpool_config {
      * 必须是正整数。如果提供非正值（0 或负数），`thpool_init` 将失败并返回空指针。
      */
     int     num_threads;
+    /**
+     * @brief Upper bound of the number of worker threads, for @ref thpool_resize and auto-scaling.
+     *
+     * Slots for this many threads are reserved at initialization. If smaller than @ref num_threads
+     * (including 0), it is taken as @ref num_threads, i.e. the pool can shrink and grow back but not beyond its initial size.
+     *
+     * 工作线程数量的上限，供`thpool_resize`与自动伸缩使用。初始化时即预留这么多线程的位置。
+     * 若小于`num_threads`（包括0），视为`num_threads`，即线程池可以缩小再恢复，但不能超过初始大小。
+     */
+    int     max_threads;
+    /**
+     * @brief Lower bound of the number of worker threads kept by idle auto-scaling, see @ref idle_timeout_ms.
+     *
+     * Values below 1 are taken as 1. Only affects auto-scaling; @ref thpool_resize may go down to 1 thread.
+     *
+     * 空闲自动缩减保留的最少工作线程数，参见`idle_timeout_ms`。小于1时视为1。
+     * 只影响自动伸缩，`thpool_resize`可以缩减到1个线程。
+     */
+    int     min_threads;
+    /**
+     * @brief Idle time after which a parked worker retires itself, in milliseconds.
+     *
+     * If greater than 0, a worker that has waited this long without getting a job exits
+     * (running @ref thread_end_cb) as long as more than @ref min_threads threads are running.
+     * If 0 or negative, workers never retire on their own.
+     *
+     * 休眠中的工作线程自行退出的空闲时长，单位为毫秒。若大于0，一个等待了这么久仍未取得任务的工作线程，
+     * 在运行中的线程多于`min_threads`时退出（并执行`thread_end_cb`）。若为0或负数，工作线程不会自行退出。
+     */
+    long    idle_timeout_ms;
+    /**
+     * @brief Queue depth that triggers starting another worker, up to @ref max_threads.
+     *
+     * If greater than 0, adding work while more than this many jobs are queued starts one more
+     * worker thread (running @ref thread_start_cb) unless @ref max_threads are already running.
+     * The thread is started by the producer that observed the depth, so that call takes longer.
+     * If 0 or negative, the pool only grows through @ref thpool_resize.
+     *
+     * 触发启动新工作线程的排队任务数，不超过`max_threads`。若大于0，添加任务时若排队任务多于该值，
+     * 且运行中的线程尚未达到`max_threads`，则再启动一个工作线程（并执行`thread_start_cb`）。
+     * 新线程由观察到该排队数的生产者启动，因此这次调用耗时更长。若为0或负数，线程池只通过`thpool_resize`扩大。
+     */
+    int     scale_up_queue_depth;
     /**
      * @brief Maximum number of jobs allowed in the queue.
      *
@@ -136,6 +472,227 @@ typedef struct threadpool_config {
      * 如果为0或负数，则任务队列大小无限制（仅受内存限制）。
      */
     int     work_num_max;
+    /**
+     * @brief Job scheduling mode, see @ref threadpool_sched_mode.
+     *
+     * Defaults to @ref THPOOL_SCHED_SHARED_QUEUE when zero-initialized.
+     * In any mode, @ref work_num_max limits the total number of queued jobs across all queues,
+     * and @ref thpool_wait waits for all queues to drain.
+     *
+     * 任务调度模式，参见`threadpool_sched_mode`。零初始化时默认为`THPOOL_SCHED_SHARED_QUEUE`。
+     * 不论何种模式，`work_num_max`限制的都是所有队列中排队任务的总数，`thpool_wait`也会等待所有队列排空。
+     */
+    threadpool_sched_mode   sched_mode;
+    /**
+     * @brief Backend of the shared job queue, see @ref threadpool_queue_backend.
+     *
+     * Defaults to @ref THPOOL_QUEUE_LINKED_LIST when zero-initialized.
+     * @ref THPOOL_QUEUE_RING requires a positive @ref work_num_max and falls back to the linked list otherwise.
+     *
+     * 共享任务队列的后端，参见`threadpool_queue_backend`。零初始化时默认为`THPOOL_QUEUE_LINKED_LIST`。
+     * `THPOOL_QUEUE_RING`要求`work_num_max`为正数，否则退回链表后端。
+     */
+    threadpool_queue_backend    queue_backend;
+    /**
+     * @brief Idle strategy of worker threads, see @ref threadpool_idle_policy.
+     *
+     * Defaults to @ref THPOOL_IDLE_PARK (never spin) when zero-initialized.
+     *
+     * 工作线程的空闲策略，参见`threadpool_idle_policy`。零初始化时默认为`THPOOL_IDLE_PARK`，即从不自旋。
+     */
+    threadpool_idle_policy  idle_policy;
+    /**
+     * @brief Spin budget in nanoseconds for @ref THPOOL_IDLE_SPIN, upper bound for @ref THPOOL_IDLE_ADAPTIVE.
+     *
+     * If 0 or negative, 50000 (50 microseconds) is used. Ignored by @ref THPOOL_IDLE_PARK.
+     *
+     * `THPOOL_IDLE_SPIN`的自旋时长（纳秒），`THPOOL_IDLE_ADAPTIVE`的自旋时长上限。
+     * 为0或负数时使用50000（50微秒）。`THPOOL_IDLE_PARK`忽略该值。
+     */
+    long    idle_spin_ns;
+    /**
+     * @brief Aging threshold that keeps lower priorities from starving.
+     *
+     * If greater than 0, a non-empty priority level that has been skipped this many times in favour
+     * of higher levels is served once before them. The deadline tier of @ref thpool_add_work_deadline
+     * ages like a level between @ref THPOOL_PRIO_HIGH and @ref THPOOL_PRIO_NORMAL. If 0 or negative,
+     * jobs are always taken strictly by priority.
+     *
+     * 防止低优先级饿死的老化阈值。若大于0，非空的级别每因更高优先级被跳过一次计数加一，
+     * 达到该次数后优先出队一次。`thpool_add_work_deadline`的截止时间级别作为`THPOOL_PRIO_HIGH`与`THPOOL_PRIO_NORMAL`之间的级别参与老化。
+     * 若为0或负数，总是严格按优先级出队。
+     */
+    int     prio_aging_threshold;
+    /**
+     * @brief Optional per-priority limits on the number of queued jobs, indexed by @ref threadpool_priority.
+     *
+     * A positive entry limits the jobs queued at that level; adding work at a full level blocks
+     * like a full queue. 0 or negative means only @ref work_num_max applies, which always stays
+     * the pool-wide cap. Setting any per-level limit makes freed slots wake all blocked producers
+     * instead of one.
+     *
+     * 可选的各优先级排队任务数上限，以`threadpool_priority`为下标。正数限制该级别的排队任务数，
+     * 向已满的级别添加任务会像队列已满一样阻塞。0或负数表示只受`work_num_max`约束，`work_num_max`始终是线程池整体的上限。
+     * 设置了任一级别的上限后，释放名额时会唤醒所有阻塞的生产者，而不是一个。
+     */
+    int     prio_work_num_max[THPOOL_PRIO_LEVELS];
+    /**
+     * @brief Nonzero to collect the timing part of @ref threadpool_stats.
+     *
+     * Job counts and queue lengths are always collected. Queue-wait and run-time histograms,
+     * per-thread busy/idle time and producer blocked time need two or three clock reads per job,
+     * so they are only collected if this is nonzero.
+     *
+     * 非零时收集`threadpool_stats`中的计时部分。任务计数与队列长度总是收集；
+     * 排队等待与执行时间直方图、每线程忙闲时间与生产者阻塞时间每个任务需要读取两到三次时钟，因此仅在该值非零时收集。
+     */
+    int     stats_timing;
+    /**
+     * @brief Placement of worker threads, see @ref threadpool_affinity.
+     *
+     * Defaults to @ref THPOOL_AFFINITY_NONE when zero-initialized.
+     *
+     * 工作线程的放置方式，参见`threadpool_affinity`。零初始化时默认为`THPOOL_AFFINITY_NONE`。
+     */
+    threadpool_affinity     affinity;
+    /**
+     * @brief Optional CPU set used by @ref affinity, as an array of @ref affinity_num_cpus CPU numbers.
+     *
+     * If null or empty, the CPUs the calling process may run on are used. CPUs the process may not
+     * run on are dropped; `thpool_init` fails with `EINVAL` if a number is negative or too large,
+     * or no CPU is left. The array is only read during `thpool_init`.
+     *
+     * 供`affinity`使用的可选CPU集合，为`affinity_num_cpus`个CPU编号组成的数组。
+     * 若为空指针或为空，使用调用进程允许运行的CPU。进程不允许运行的CPU会被剔除；
+     * 若有编号为负或过大，或剔除后没有剩余CPU，`thpool_init`失败并设置`EINVAL`。该数组仅在`thpool_init`期间读取。
+     */
+    const int   *affinity_cpus;
+    int     affinity_num_cpus;      /* length of @ref affinity_cpus. `affinity_cpus`的长度。  */
+    /**
+     * @brief What @ref thpool_try_add_work and @ref thpool_add_work_timed do when the queue is full,
+     * see @ref threadpool_reject_policy.
+     *
+     * Defaults to @ref THPOOL_REJECT_FAIL when zero-initialized.
+     *
+     * `thpool_try_add_work`与`thpool_add_work_timed`在队列已满时的处理方式，参见`threadpool_reject_policy`。
+     * 零初始化时默认为`THPOOL_REJECT_FAIL`。
+     */
+    threadpool_reject_policy    reject_policy;
+    /**
+     * @brief Run jobs that a worker submits to its own pool on that worker, right after the current job.
+     *
+     * 0 (the default when zero-initialized) or a negative value disables this. Otherwise, when a job
+     * running on a worker of this pool calls @ref thpool_add_work, @ref thpool_try_add_work or
+     * @ref thpool_add_work_timed on the same pool, the follow-up job is kept in a per-worker continuation
+     * slot instead of the queue, and the worker runs it as soon as the current job returns, ahead of
+     * every queued job, without taking the queue lock or waking another thread. The slot holds one job:
+     * further submissions of the same job go through the queue as usual, and so do submissions once the
+     * worker has run `nested_inline_depth` continuations in a row, so a chain of follow-ups cannot keep
+     * the worker from the queue. Continuations run after the submitting job returns, never inside it,
+     * so stack usage does not grow with the chain. A job must not block waiting for its own continuation
+     * (other than through @ref thpool_group_wait, which runs it); jobs added by @ref thpool_submit always
+     * go through the queue, since handle waits do not run jobs.
+     *
+     * 工作线程向所属线程池提交的任务，在该线程上紧接当前任务执行。零初始化时为0，0或负数表示关闭。
+     * 开启后，本线程池工作线程上执行的任务对同一线程池调用`thpool_add_work`、`thpool_try_add_work`或`thpool_add_work_timed`时，
+     * 后续任务保存在该线程的延续槽位而不进入队列，当前任务返回后该线程立即执行它，先于所有排队任务，既不获取队列锁也不唤醒其他线程。
+     * 槽位只能保存一个任务：同一任务的后续提交照常进入队列；线程连续执行了`nested_inline_depth`个延续任务后，提交同样照常进入队列，
+     * 因此连续的后续任务不会让该线程一直无法处理队列。延续任务在提交它的任务返回之后执行，而不是在其内部执行，栈的使用不会随链条增长。
+     * 任务不能阻塞等待自身的延续任务（`thpool_group_wait`除外，它会执行该任务）；等待句柄时不会执行任务，因此`thpool_submit`添加的任务总是进入队列。
+     */
+    int     nested_inline_depth;
+    /**
+     * @brief Run this pool's jobs on the workers of another pool instead of creating threads.
+     *
+     * A null pointer (the default when zero-initialized) creates a normal pool. Otherwise the new pool
+     * is an executor domain: a logical pool with its own queue, `work_num_max` bound, reject policy,
+     * passport, @ref thpool_wait, groups, handles, timers and statistics, whose jobs run on the threads
+     * of `executor`. The domain keeps at most `num_threads` service jobs (0 or a value above the executor's
+     * capacity means the executor's capacity) queued on or running in the executor, so `num_threads` caps
+     * how many executor workers serve the domain at once, and @ref thpool_resize on the domain changes this
+     * cap. A service job runs up to @ref executor_weight jobs of the domain, then goes back to the tail of
+     * the executor's shared queue while the domain has more work, so domains and the executor's own jobs
+     * take turns and busy domains share the workers in proportion to their weights. Service jobs do not
+     * count against the executor's `work_num_max`.
+     *
+     * Thread handles seen by the domain's jobs and callbacks are per-worker views of the domain: their id
+     * is the executor worker's id, and their thread context and statistics belong to the domain.
+     * `thread_start_cb` runs on a worker the first time it serves the domain, `thread_end_cb` runs on that
+     * worker during @ref thpool_shutdown of the domain. If that worker has exited since (after @ref thpool_resize
+     * or idle retirement), its `thread_end_cb` is skipped; if the executor is inactive or shut down, it runs on
+     * the thread calling @ref thpool_shutdown. `sched_mode`, `queue_backend`, `max_threads`,
+     * `min_threads`, `idle_timeout_ms`, `scale_up_queue_depth`, `affinity` and `nested_inline_depth` are
+     * ignored, @ref thpool_add_work_to and @ref thpool_add_work_keyed behave like @ref thpool_add_work.
+     * A domain must be shut down and destroyed before its executor. The domain's jobs stall while the
+     * executor is inactive after @ref thpool_wait on the executor, which also waits for queued service jobs.
+     * @ref thpool_shutdown of the domain does not wait for an inactive executor, and may be called from one of
+     * the executor's workers.
+     * An executor domain cannot be used as an executor.
+     *
+     * 在另一个线程池的工作线程上执行本线程池的任务，而不创建线程。零初始化时为空指针，即普通线程池。
+     * 否则新线程池是一个执行域：它是逻辑上的线程池，有自己的队列、`work_num_max`上限、拒绝策略、同步控制块、`thpool_wait`、任务组、句柄、定时任务与统计，
+     * 任务则在`executor`的线程上执行。执行域在执行线程池中排队或执行的服务任务至多`num_threads`个（0或超过执行线程池容量时取其容量），
+     * 因此`num_threads`限制同时为执行域工作的线程数，对执行域调用`thpool_resize`会修改这一上限。
+     * 每个服务任务至多执行`executor_weight`个执行域的任务，执行域仍有任务时回到执行线程池共享队列的队尾，
+     * 因此各执行域与执行线程池自身的任务轮流执行，繁忙的执行域按权重分享工作线程。服务任务不受执行线程池`work_num_max`的约束。
+     *
+     * 执行域的任务与回调看到的线程句柄是执行域在各工作线程上的视图：编号为执行线程池工作线程的编号，线程上下文与统计属于执行域。
+     * 工作线程第一次为执行域服务时执行`thread_start_cb`，执行域`thpool_shutdown`时在该工作线程上执行`thread_end_cb`。
+     * 该工作线程此后已经退出时（`thpool_resize`或空闲退出）跳过它的`thread_end_cb`；执行线程池不活跃或已关闭时，在调用`thpool_shutdown`的线程上执行。
+     * 忽略`sched_mode`、`queue_backend`、`max_threads`、`min_threads`、`idle_timeout_ms`、`scale_up_queue_depth`、`affinity`与`nested_inline_depth`，
+     * `thpool_add_work_to`与`thpool_add_work_keyed`与`thpool_add_work`相同。执行域必须先于执行线程池关闭并销毁。
+     * 对执行线程池调用`thpool_wait`后，执行线程池未重新激活前执行域的任务不会执行；该等待也会等待排队的服务任务。
+     * 执行域的`thpool_shutdown`不会等待不活跃的执行线程池，也可以在执行线程池的工作线程上调用。执行域不能作为执行线程池。
+     */
+    threadpool  executor;
+    /**
+     * @brief Number of jobs an executor domain runs per turn on a worker. 0 (the default when zero-initialized) means 1.
+     *
+     * Ignored unless @ref executor is set. See @ref executor.
+     *
+     * 执行域在工作线程上每轮执行的任务数。零初始化时为0，表示1。仅在设置了`executor`时有效，见`executor`。
+     */
+    int     executor_weight;
+    /**
+     * @brief Stack size in bytes of the fibers of @ref thpool_add_work_fiber. 0 (the default when zero-initialized) means 64 KiB.
+     *
+     * Rounded up to the page size. Each fiber stack is mapped with an extra inaccessible guard page below it,
+     * so a stack overflow faults instead of corrupting memory. Pages are only committed when touched.
+     *
+     * `thpool_add_work_fiber`协程的栈大小，单位字节。零初始化时为0，表示64 KiB。向上取整到页大小。
+     * 每个协程栈下方另映射一个不可访问的保护页，栈溢出时立即出错而不是改写内存。页面只在被访问时才实际分配。
+     */
+    size_t  fiber_stack_size;
+    /**
+     * @brief Bytes of address space reserved for @ref thpool_job_alloc. 0 (the default when zero-initialized) disables the arena.
+     *
+     * Rounded up to 2 MiB chunks. The whole range is reserved by @ref thpool_init, a chunk only gets memory the first time it is
+     * used and is then recycled until @ref thpool_destroy, so the arena never grows beyond this size. Each worker and each of the
+     * few stripes of outside threads keeps a current chunk, so allow at least one chunk for each of them.
+     *
+     * 为`thpool_job_alloc`保留的地址空间字节数。零初始化时为0，表示不启用任务参数区。按2 MiB的块向上取整。
+     * `thpool_init`一次保留整个区域，块在首次使用时才分配内存，此后循环使用到`thpool_destroy`，因此参数区不会超过该大小。
+     * 每个工作线程与外部线程的每个条带各持有一个当前块，因此至少为它们各留出一个块。
+     */
+    size_t  arena_size;
+    /**
+     * @brief Back the chunks of the job argument arena with huge pages. 0 (the default when zero-initialized) uses normal pages.
+     *
+     * On Linux each 2 MiB chunk is first mapped with `MAP_HUGETLB`; if no huge page is free it falls back to normal pages
+     * with `MADV_HUGEPAGE`, so transparent huge pages can still back it. Ignored on other systems.
+     *
+     * 以大页支撑任务参数区的块。零初始化时为0，使用普通页。Linux下每个2 MiB的块先以`MAP_HUGETLB`映射；
+     * 没有空闲的大页时退回普通页并设置`MADV_HUGEPAGE`，仍可由透明大页支撑。其他系统下忽略。
+     */
+    int     arena_huge_pages;
+    /**
+     * @brief Bytes of per-worker scratch memory of @ref thpool_thread_scratch. 0 (the default when zero-initialized) means 64 KiB.
+     *
+     * Rounded up to the page size. A worker maps its scratch region the first time it asks for it.
+     *
+     * `thpool_thread_scratch`每个工作线程临时内存的字节数。零初始化时为0，表示64 KiB。向上取整到页大小。工作线程第一次使用时才分配。
+     */
+    size_t  thread_scratch_size;
     /**
      * @brief Callback function executed when a thread starts.
      *
@@ -163,6 +720,41 @@ typedef struct threadpool_config {
      * 用户可以使用当前线程句柄访问线程特定数据和线程元数据。
      */
     void    (*thread_end_cb)(threadpool_thread);
+    /**
+     * @brief Callback function executed by a worker right before each job.
+     *
+     * Together with @ref post_job_cb this allows per-job tracing and profiling without wrapping
+     * every task function. Both callbacks run on the worker thread that runs the job, including jobs
+     * it runs while helping in @ref thpool_group_wait. The job node records its enqueue time whenever
+     * a job callback is set, so no extra allocation is made. If both callbacks are null pointer,
+     * the clock is not read for them and the job loop only tests one flag.
+     *
+     * 每个任务执行前由工作线程调用的回调。与`post_job_cb`一起，无需包装每个任务函数即可按任务追踪与剖析。
+     * 两个回调都在执行任务的工作线程上调用，包括在`thpool_group_wait`中协助执行的任务。
+     * 设置了任一任务回调时，任务节点记录入队时刻，不会额外分配内存。两者均为空指针时不为它们读取时钟，执行循环只检查一个标志。
+     *
+     * @param info              The job, see @ref threadpool_job_info. Valid only during the call.
+     * 任务信息，仅在调用期间有效。
+     * @param current_thrd      Current thread handle.
+     * 当前线程句柄。
+     */
+    void    (*pre_job_cb)(const threadpool_job_info *info, threadpool_thread current_thrd);
+    /**
+     * @brief Callback function executed by a worker right after each job returns.
+     *
+     * Receives the same @ref threadpool_job_info as @ref pre_job_cb, with `end_ns` filled in.
+     * For a job added by @ref thpool_submit the handle is already completed, and the job's `arg`
+     * may no longer be valid if the waiter has freed it.
+     *
+     * 每个任务返回后由工作线程调用的回调，收到与`pre_job_cb`相同的任务信息并填入`end_ns`。
+     * 对于`thpool_submit`添加的任务，此时句柄已完成，若等待方已释放任务参数，`arg`可能已失效。
+     *
+     * @param info              The job, see @ref threadpool_job_info. Valid only during the call.
+     * 任务信息，仅在调用期间有效。
+     * @param current_thrd      Current thread handle.
+     * 当前线程句柄。
+     */
+    void    (*post_job_cb)(const threadpool_job_info *info, threadpool_thread current_thrd);
     /**
      * @brief Shared argument passed to thread start callbacks.
      *
@@ -177,7 +769,9 @@ typedef struct threadpool_config {
      *
      * @note If a `callback_arg_destructor` is provided, the lifetime of the data
      * pointed to is managed by a reference count . Each worker thread and the thread pool
-     * initialization initially hold a reference. References are released when the
+     * itself hold a reference. Threads started later by @ref thpool_resize or auto-scaling take
+     * a reference too, so the pool keeps its own reference until @ref thpool_shutdown has stopped all threads.
+     * Thread references are released when the
      * thread metadata is destroyed (during the `thpool_destroy` process) or when
      * `thpool_thread_unref_callback_arg` is called from within a thread callback.
      * The destructor is called when the last reference is released. If no destructor
@@ -185,7 +779,8 @@ typedef struct threadpool_config {
      * the pointed-to data.
      * 
      * 如果提供了`callback_arg_destructor`，则指向的数据的生命周期由引用计数管理。
-     * 每个工作线程和线程池初始化最初都持有一个引用。当线程元数据被销毁
+     * 每个工作线程和线程池本身都持有一个引用。之后由`thpool_resize`或自动伸缩启动的线程同样持有引用，
+     * 因此线程池自身的引用保持到`thpool_shutdown`停止所有线程为止。当线程元数据被销毁
      * （`thpool_destroy`过程中），或线程回调内部调用`thpool_thread_unref_callback_arg`时，
      * 引用会被释放。当最后一个引用被释放时，会调用析构函数。
      * 如果没有主动干预，`callback_arg`的生存期与线程池本身一样长。
@@ -253,7 +848,7 @@ typedef struct threadpool_config {
      * 如果提供通行证，则用户对其生命周期负责。
      * 通行证的生命周期**必须**严格长于相关线程池的生命周期，并且覆盖使用该通行证的所有API调用。
      */
-    thpool_debug_conc_passport  *passport;
+    thpool_debug_conc_passport  passport;
 #endif
 } threadpool_config;
 
@@ -453,6 +1048,32 @@ int thpool_destroy(threadpool);
  */
 int thpool_wait(threadpool);
 
+/**
+ * @brief Waits until every job queued before the call has finished, without stopping producers.
+ *
+ * A quiescence barrier: jobs queued before the call, wherever they wait or run, have finished
+ * (or were dropped by `reject_policy`) when it returns. Jobs queued during or after the call are not waited for,
+ * and unlike @ref thpool_wait the pool stays active, so producers and workers carry on meanwhile.
+ * Every job is counted when it enters a queue: a timer job when it fires, a fiber job each time it is
+ * resumed, and a fiber parked in @ref thpool_yield_until is not waited for. Concurrent calls run one after another.
+ * Returns early with `errno` set to `ECANCELED` if the pool shuts down meanwhile.
+ * The cost on the job path is one atomic operation at submission and one at completion, on a counter
+ * striped by producer thread so producers do not contend on one cache line; only this call sums the stripes.
+ *
+ * 等待调用之前入队的所有任务完成，而不阻塞生产者。这是一个静默屏障：返回时，调用之前入队的任务无论在哪里排队或执行，
+ * 都已经完成（或已被`reject_policy`丢弃）。调用期间与之后入队的任务不会被等待。与`thpool_wait`不同，线程池保持活跃，
+ * 其间生产者与工作线程照常工作。任务在进入队列时计数：定时任务在到期时，协程任务在每次恢复时，
+ * 在`thpool_yield_until`中挂起的协程不会被等待。并发的调用依次进行。等待期间线程池关闭时提前返回，`errno`为`ECANCELED`。
+ * 任务路径上的开销是提交与完成时各一次原子操作，计数按生产者线程分条带，生产者之间不争用同一缓存行，只有本函数汇总各条带。
+ *
+ * @param threadpool The thread pool to drain. Must not be null pointer.
+ * 要排空的线程池。不能为空指针。
+ * @return int     0 on success, -1 on error (e.g., thpool_p is null pointer, pool is not in ALIVE state when called,
+ * called from within a thread pool worker thread, or the pool shut down meanwhile).
+ * 成功时返回0，错误时返回-1（例如`thpool_p`为空指针，调用时线程池不在`ALIVE`状态，从线程池工作线程内部调用，或等待期间线程池已关闭）。
+ */
+int thpool_drain(threadpool);
+
 /**
  * @brief Reactivates the thread pool.
  *
@@ -479,6 +1100,105 @@ int thpool_reactivate(threadpool);
  */
 int thpool_num_threads_working(threadpool);
 
+/**
+ * @brief Gets the current number of worker threads, i.e. the target set by @ref thpool_resize or auto-scaling.
+ * 获取当前的工作线程数量，即`thpool_resize`或自动伸缩设定的目标。
+ *
+ * Threads asked to retire are no longer counted, even while they finish their current job.
+ * 已被要求退出的线程不再计入，即使它们仍在完成当前任务。
+ *
+ * @param threadpool The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @return int     The number of worker threads (>= 1), or -1 on error (e.g., thpool_p is null pointer, or pool is not in ALIVE state when called).
+ * 工作线程数量（>= 1），或错误时返回-1（例如，`thpool_p`为空指针，或调用时线程池不在`ALIVE`状态）。
+ */
+int thpool_num_threads(threadpool);
+
+/**
+ * @brief Grows or shrinks the number of worker threads at runtime.
+ * 在运行时增加或减少工作线程数量。
+ *
+ * Growing starts new threads, or restarts retired ones, and returns once they are running;
+ * each of them runs `thread_start_cb` and takes a reference to `callback_arg` like the initial threads.
+ * Shrinking asks the highest-numbered threads to retire and returns immediately: a retiring thread
+ * finishes its current job and (in work-stealing mode) its own deque, runs `thread_end_cb` and exits.
+ * Job nodes, deques and statistics of retired threads are kept until @ref thpool_destroy,
+ * so thread ids stay in `[0, max_threads)`.
+ *
+ * 扩大时启动新线程或重新启动已退出的线程，并在它们开始运行后返回；这些线程与初始线程一样执行`thread_start_cb`，
+ * 并持有`callback_arg`的引用。缩小时要求编号最大的线程退出并立即返回：退出中的线程完成当前任务
+ * 以及（工作窃取模式下）自身双端队列中的任务后，执行`thread_end_cb`并退出。
+ * 已退出线程的任务节点、双端队列与统计数据保留到`thpool_destroy`，因此线程编号始终在`[0, max_threads)`内。
+ *
+ * @note Must not be called from `thread_end_cb`.
+ * 不得在`thread_end_cb`中调用。
+ *
+ * @param threadpool The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param num_threads The new number of worker threads, in `[1, max_threads]`.
+ * 新的工作线程数量，范围为`[1, max_threads]`。
+ * @return int     0 on success, -1 on error (e.g., `num_threads` out of range sets `EINVAL`,
+ * or a thread could not be started, in which case the threads started so far are kept).
+ * 成功时返回0，错误时返回-1（例如`num_threads`越界时设置`EINVAL`；或线程启动失败，此时保留已启动的线程）。
+ */
+int thpool_resize(threadpool, int num_threads);
+
+/**
+ * @brief Gets the high-water mark of the job node slab allocator.
+ * 获取任务节点slab分配器的高水位线。
+ *
+ * Job nodes are carved from pool-owned slabs and recycled between workers and producers
+ * instead of being allocated per job; they are only returned to the system by @ref thpool_destroy.
+ * The number of nodes carved so far is therefore the peak footprint of the job queue.
+ * If `work_num_max` is set, it is bounded by
+ * `work_num_max + num_threads * (THPOOL_JOB_CACHE_SIZE + 1)` (the per-thread cache size is 32).
+ *
+ * 任务节点从线程池持有的slab中分配，并在工作线程与生产者之间循环使用，不再每个任务分配一次，
+ * 直到`thpool_destroy`才归还系统。因此，已分配的节点数量即为任务队列内存占用的峰值。
+ * 若设置了`work_num_max`，该值不超过`work_num_max + num_threads * (THPOOL_JOB_CACHE_SIZE + 1)`（每线程缓存大小为32）。
+ *
+ * @param threadpool The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @return int     The number of job nodes allocated by the slab allocator (>= 0), or -1 on error (e.g., thpool_p is null pointer, or pool is not in ALIVE state when called).
+ * slab分配器已分配的任务节点数量（>= 0），或错误时返回-1（例如，`thpool_p`为空指针，或调用时线程池不在`ALIVE`状态）。
+ */
+int thpool_job_slab_high_water(threadpool);
+
+/**
+ * @brief Takes a statistics snapshot of the thread pool.
+ * 获取线程池的统计快照。
+ *
+ * Counters are recorded per thread in cache-line padded blocks and only summed here,
+ * so recording them adds no contention and taking a snapshot does not take the job queue lock.
+ * Set `out->threads` and `out->threads_capacity` before the call to also receive per-thread statistics.
+ *
+ * 计数器按线程记录在按缓存行填充的块中，仅在此处汇总，因此记录时不引入竞争，获取快照时也不持有任务队列锁。
+ * 若需要每线程统计，在调用前设置`out->threads`与`out->threads_capacity`。
+ *
+ * @param threadpool The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param out  The snapshot to fill. Must not be null pointer.
+ * 要填写的快照。不能为空指针。
+ * @return int     0 on success, -1 on error (e.g., null pointer arguments, or pool is not in ALIVE state when called).
+ * 成功时返回0，错误时返回-1（例如参数为空指针，或调用时线程池不在`ALIVE`状态）。
+ */
+int thpool_get_stats(threadpool, threadpool_stats *out);
+
+/**
+ * @brief Gets the lower bound of a histogram bucket of @ref threadpool_stats, in nanoseconds.
+ * 获取`threadpool_stats`直方图中某个桶的下界，单位为纳秒。
+ *
+ * Bucket `i` covers `[thpool_stats_bucket_lower_ns(i), thpool_stats_bucket_lower_ns(i + 1))`,
+ * except the last bucket, which has no upper bound.
+ * 第`i`个桶覆盖`[thpool_stats_bucket_lower_ns(i), thpool_stats_bucket_lower_ns(i + 1))`，最后一个桶没有上界。
+ *
+ * @param bucket Bucket index in `[0, THPOOL_STATS_HIST_BUCKETS)`.
+ * 桶的下标，范围为`[0, THPOOL_STATS_HIST_BUCKETS)`。
+ * @return unsigned long long  The lower bound in nanoseconds, or 0 if `bucket` is out of range.
+ * 以纳秒为单位的下界。`bucket`越界时返回0。
+ */
+unsigned long long thpool_stats_bucket_lower_ns(int bucket);
+
 /**
  * @brief Add work to the job queue.
  *
@@ -575,29 +1295,671 @@ int thpool_num_threads_working(threadpool);
 int thpool_add_work(threadpool, void (*function_p)(void *, threadpool_thread), void *arg_p);
 
 /**
- * @brief Gets the ID of the current thread pool thread.
- *
- * This function is intended to be called from within a worker thread's
- * @ref thread_start_cb, @ref thread_end_cb, or a task function.
- * It retrieves the thread's internal ID from its thread metadata.
- * 
- * 获取当前线程池线程的 ID。
- * 
- * 它从线程元数据中检索线程的内部ID。
- *
- * @param current_thrd  Current thread handle,
- * as passed to the callback or task function.
- * 当前线程句柄，线程池将它作为参数传递给回调或任务函数中以获取。不能为null pointer。
- * @return int The internal ID of the calling thread pool thread.
- * 返回调用线程池线程的内部ID，如果`current_thrd`为空指针则返回-1。
+ * @brief Add work to the job queue with a priority.
+ *
+ * Like @ref thpool_add_work, but the job is queued at the given priority level. Workers always take
+ * the job from the highest non-empty level in O(1), subject to the optional aging rule
+ * (`prio_aging_threshold`). Jobs of the same level run in FIFO order.
+ * @ref THPOOL_PRIO_NORMAL behaves exactly like @ref thpool_add_work. Other levels always go through
+ * the shared linked list, even in work-stealing mode or with the ring buffer backend;
+ * while jobs above @ref THPOOL_PRIO_NORMAL are queued there, workers check it before their deques
+ * and the ring buffer. The aging rule only applies among the levels of the shared linked list.
+ *
+ * 按优先级添加任务。与`thpool_add_work`类似，但任务进入指定优先级的队列。工作线程总是以O(1)的代价从最高的非空级别取任务，
+ * 同时遵循可选的老化规则（`prio_aging_threshold`），同一级别内按FIFO顺序执行。
+ * `THPOOL_PRIO_NORMAL`与`thpool_add_work`完全相同。其他级别的任务即使在工作窃取模式或环形缓冲区后端下也总是进入共享链表；
+ * 共享链表中存在高于普通优先级的任务时，工作线程先于自身双端队列与环形缓冲区检查它。老化规则仅作用于共享链表的各级别之间。
+ *
+ * @param pool         The thread pool handle.
+ * @param prio         Priority level of the job, see @ref threadpool_priority.
+ * 任务的优先级，参见`threadpool_priority`。
+ * @param function_p   Pointer to the task function. Must not be null pointer.
+ * @param arg_p        The argument for the task function.
+ *
+ * @return int         0 on success, -1 otherwise (e.g., invalid priority, or thread pool is being destroyed).
+ * 成功时返回0，否则返回-1（例如优先级无效，或线程池正在销毁）。
  */
-int thpool_thread_get_id(threadpool_thread current_thrd);
+int thpool_add_work_prio(threadpool, threadpool_priority prio, void (*function_p)(void *, threadpool_thread), void *arg_p);
 
 /**
- * @brief Gets the name of the current thread pool thread.
- *
- * This function is intended to be called from within a worker thread's
- * @ref thread_start_cb, @ref thread_end_cb, or a task function.
+ * @brief Add work that is only worth running before a deadline.
+ *
+ * Jobs with a deadline wait in a 4-ary min-heap of the shared queue and run earliest deadline first.
+ * As a tier they come after @ref THPOOL_PRIO_CRITICAL and @ref THPOOL_PRIO_HIGH and before
+ * @ref THPOOL_PRIO_NORMAL. The aging rule (`prio_aging_threshold`) treats the tier like a level, so a
+ * steady stream of higher-priority jobs does not starve it and it does not starve the lower levels.
+ * Like the levels above @ref THPOOL_PRIO_NORMAL, they go through the shared linked list even in
+ * work-stealing mode or with the ring buffer backend, and are not limited by `prio_work_num_max`.
+ * When a worker takes a job whose deadline has passed, it runs `on_expire` with the same argument
+ * instead of the task function, so an overloaded pool spends little time on work nobody waits for.
+ * The expired job still counts as completed; `jobs_expired` in @ref threadpool_stats counts them.
+ * Blocks while the queue is full, like @ref thpool_add_work.
+ *
+ * 添加只在截止时刻之前才值得执行的任务。截止时间任务在共享队列的4叉最小堆中等待，按截止时刻最早者优先执行。
+ * 作为一个级别，它们排在`THPOOL_PRIO_CRITICAL`与`THPOOL_PRIO_HIGH`之后、`THPOOL_PRIO_NORMAL`之前。老化规则（`prio_aging_threshold`）将其视为一个级别，持续的高优先级任务不会让它饿死，它也不会让更低的级别饿死。
+ * 与高于普通优先级的任务一样，即使在工作窃取模式或环形缓冲区后端下也进入共享链表所在的队列，不受`prio_work_num_max`约束。
+ * 工作线程取出已过截止时刻的任务时，以相同参数执行`on_expire`而不是任务函数，过载的线程池因此不会把时间花在无人等待的任务上。
+ * 过期的任务仍计为已完成，`threadpool_stats`的`jobs_expired`记录其数量。队列已满时与`thpool_add_work`一样阻塞。
+ *
+ * @param pool         The thread pool handle.
+ * @param deadline_ns  The deadline on the clock of @ref thpool_clock_ns.
+ * 以`thpool_clock_ns`的时钟表示的截止时刻。
+ * @param function_p   Pointer to the task function. Must not be null pointer.
+ * @param arg_p        The argument for the task function and for `on_expire`.
+ * 任务函数与`on_expire`的参数。
+ * @param on_expire    Run instead of `function_p` if the job is taken after its deadline, e.g. to fail the request
+ * or release `arg_p`. Should be cheap. Null pointer drops the expired job.
+ * 任务在截止时刻之后才被取出时代替`function_p`执行，例如向请求方返回失败或释放`arg_p`，应当廉价。为空指针时直接丢弃过期的任务。
+ *
+ * @return int         0 on success, -1 otherwise (e.g., out of memory, or thread pool is being destroyed).
+ * 成功时返回0，否则返回-1（例如内存不足，或线程池正在销毁）。
+ */
+int thpool_add_work_deadline(threadpool, unsigned long long deadline_ns, void (*function_p)(void *, threadpool_thread), void *arg_p,
+                             void (*on_expire)(void *, threadpool_thread));
+
+/**
+ * @brief Add a job that runs on its own stack and can yield its worker with @ref thpool_yield_until.
+ *
+ * The job runs as a stackful fiber. When it calls @ref thpool_yield_until, the worker switches back to
+ * the queue and runs other jobs while the fiber waits for its file descriptor or deadline; a poller thread
+ * of the pool then queues the fiber again at the tail of the shared queue, and whichever worker takes it
+ * resumes it, so many waiting jobs share few threads. The first submission waits for a slot of
+ * `work_num_max` like @ref thpool_add_work, resumptions do not. @ref thpool_wait also waits for parked fibers.
+ * Fibers still parked at @ref thpool_shutdown are never resumed; their stacks are unmapped and anything
+ * on them is lost. The stack size is `fiber_stack_size` with a guard page below it; fibers are cached and
+ * reused. The task function may run on a different worker after each yield. Only available on Linux with
+ * glibc, elsewhere returns -1 with `errno` set to `ENOTSUP`.
+ *
+ * 添加在独立栈上运行、并可用`thpool_yield_until`让出工作线程的任务。任务以有栈协程运行，
+ * 调用`thpool_yield_until`时工作线程切回队列执行其他任务，协程则等待其文件描述符或截止时刻；
+ * 条件满足后，线程池的poller线程把协程重新放到共享队列的队尾，由取到它的工作线程恢复，因此大量等待中的任务共享少量线程。
+ * 首次提交与`thpool_add_work`一样等待`work_num_max`的名额，恢复不受约束。`thpool_wait`也等待挂起的协程。
+ * `thpool_shutdown`时仍挂起的协程不再恢复，其栈被释放，栈上的一切随之丢失。栈大小为`fiber_stack_size`，下方有一个保护页；协程会被缓存复用。
+ * 每次让出后任务函数都可能在另一个工作线程上继续执行。仅在Linux与glibc下可用，其他平台返回-1并设置`errno`为`ENOTSUP`。
+ *
+ * @param pool         The thread pool handle.
+ * @param function_p   Pointer to the task function. Must not be null pointer.
+ * 指向任务函数的指针。不能为空指针。
+ * @param arg_p        The argument for the task function.
+ *
+ * @return int         0 on success, -1 otherwise (e.g., out of memory, fibers not supported, or thread pool is being destroyed).
+ * 成功时返回0，否则返回-1（例如内存不足，平台不支持协程，或线程池正在销毁）。
+ */
+int thpool_add_work_fiber(threadpool, void (*function_p)(void *, threadpool_thread), void *arg_p);
+
+/**
+ * @brief Allocate the argument of one job from the job argument arena of the pool.
+ *
+ * Replaces the `malloc` before @ref thpool_add_work and the `free` at the end of the task function: the memory is
+ * released automatically once the job whose argument it is has finished on a worker of this pool (or was run by the
+ * caller or dropped by the reject policy). Workers carve from a chunk of their own without locking or atomics, outside
+ * threads from a chunk of their stripe; chunks are 2 MiB aligned and optionally huge-page backed (`arena_size`,
+ * `arena_huge_pages`). Pass the returned pointer, or a pointer into the block, as the argument of exactly one job of the
+ * same pool, through @ref thpool_add_work and its variants, @ref thpool_submit, @ref thpool_group_add_work or
+ * @ref thpool_add_work_fiber (released when the fiber returns). Memory passed to timers, @ref thpool_parallel_for or
+ * graph nodes, or not submitted at all, must be released with @ref thpool_job_free. Jobs discarded by
+ * @ref thpool_shutdown do not release theirs; the whole arena is returned by @ref thpool_destroy. A chunk is reused
+ * only once every block in it is released, so a long-lived block keeps its chunk.
+ *
+ * 从线程池的任务参数区分配一个任务的参数。取代`thpool_add_work`之前的`malloc`与任务函数末尾的`free`：
+ * 以它为参数的任务在本线程池的工作线程上结束（或由调用者执行、被拒绝策略丢弃）后，内存自动释放。
+ * 工作线程从自身持有的块中切分，不加锁也不做原子操作，外部线程从所属条带的块中切分；块按2 MiB对齐，可选以大页支撑（`arena_size`、`arena_huge_pages`）。
+ * 返回的指针或指向该块内部的指针只能作为同一线程池中恰好一个任务的参数，通过`thpool_add_work`及其变体、`thpool_submit`、
+ * `thpool_group_add_work`或`thpool_add_work_fiber`（协程返回时释放）提交。交给定时任务、`thpool_parallel_for`或任务图节点的内存，
+ * 以及未提交的内存，须以`thpool_job_free`释放。被`thpool_shutdown`丢弃的任务不释放其参数，整个参数区由`thpool_destroy`归还。
+ * 块中的分配全部释放后块才会复用，长期存活的分配会占住所在的块。
+ *
+ * @param pool         The thread pool handle.
+ * @param size         Bytes to allocate, at most 64 KiB. The block is 16-byte aligned.
+ * 分配的字节数，至多64 KiB。分配按16字节对齐。
+ *
+ * @return void*       The block, or null pointer with `errno` set: `ENOTSUP` if the pool has no arena, `EINVAL` for a size of
+ * 0 or above 64 KiB, `ENOMEM` if the arena is exhausted.
+ * 分配的内存，或空指针并设置`errno`：线程池未启用参数区时为`ENOTSUP`，大小为0或超过64 KiB时为`EINVAL`，参数区用尽时为`ENOMEM`。
+ */
+void *thpool_job_alloc(threadpool, size_t size);
+
+/**
+ * @brief Release a block of @ref thpool_job_alloc that is not released automatically.
+ *
+ * For a block whose submission failed, or one passed to a timer, @ref thpool_parallel_for or a graph.
+ * May be called from any thread. A block must be released exactly once, either here or by its job.
+ * The call fails once @ref thpool_shutdown has started; the memory is returned by @ref thpool_destroy then.
+ *
+ * 释放不会自动释放的`thpool_job_alloc`分配，例如提交失败的分配，或交给定时任务、`thpool_parallel_for`与任务图的分配。
+ * 可以在任意线程调用。每个分配只能释放一次，由本函数或由其任务释放。`thpool_shutdown`开始后调用失败，内存随`thpool_destroy`归还。
+ *
+ * @param pool         The thread pool handle.
+ * @param ptr          The block, or a pointer into it.
+ * 分配的内存，或指向其内部的指针。
+ *
+ * @return int         0 on success, -1 otherwise, errno is `EINVAL` if `ptr` is not in the arena of the pool.
+ * 成功时返回0，否则返回-1，`ptr`不在该线程池的参数区内时errno为`EINVAL`。
+ */
+int thpool_job_free(threadpool, void *ptr);
+
+/**
+ * @brief Add work to the job queue without blocking.
+ *
+ * Like @ref thpool_add_work, but if the job cannot be queued at once because the queue is full
+ * (`work_num_max`, or the `prio_work_num_max` of @ref THPOOL_PRIO_NORMAL) or the pool is inactive,
+ * the job is handled by the `reject_policy` of the pool (see @ref threadpool_reject_policy)
+ * instead of blocking.
+ *
+ * 非阻塞地添加任务。与`thpool_add_work`类似，但若因队列已满（`work_num_max`，或`THPOOL_PRIO_NORMAL`的`prio_work_num_max`）
+ * 或线程池不活跃而无法立即入队，不阻塞，而是按线程池的`reject_policy`处理（参见`threadpool_reject_policy`）。
+ *
+ * @param pool         The thread pool handle.
+ * @param function_p   Pointer to the task function. Must not be null pointer.
+ * @param arg_p        The argument for the task function.
+ *
+ * @return int         0 if the job was queued, or run or queued by the reject policy. -1 otherwise,
+ * errno is `EAGAIN` if the job was rejected, `ECANCELED` if the pool is shutting down.
+ * 任务已入队，或按拒绝策略被执行或入队时返回0。否则返回-1，任务被拒绝时errno为`EAGAIN`，线程池正在关闭时为`ECANCELED`。
+ */
+int thpool_try_add_work(threadpool, void (*function_p)(void *, threadpool_thread), void *arg_p);
+
+/**
+ * @brief Add work to the job queue, blocking at most `timeout_ms` milliseconds.
+ *
+ * Like @ref thpool_try_add_work, but waits up to `timeout_ms` for room in the queue (or for the pool
+ * to be reactivated) before applying the reject policy. The deadline is measured on `CLOCK_MONOTONIC`.
+ * A `timeout_ms` of 0 behaves like @ref thpool_try_add_work.
+ *
+ * 限时添加任务。与`thpool_try_add_work`类似，但在按拒绝策略处理之前，至多等待`timeout_ms`毫秒，直到队列有空位（或线程池重新激活）。
+ * 时限以`CLOCK_MONOTONIC`计算。`timeout_ms`为0时与`thpool_try_add_work`相同。
+ *
+ * @param pool         The thread pool handle.
+ * @param function_p   Pointer to the task function. Must not be null pointer.
+ * @param arg_p        The argument for the task function.
+ * @param timeout_ms   Longest time to block in milliseconds. Must not be negative.
+ * 最长阻塞时间，单位为毫秒。不能为负数。
+ *
+ * @return int         0 if the job was queued, or run or queued by the reject policy. -1 otherwise,
+ * errno is `ETIMEDOUT` if the job was rejected after the timeout, `ECANCELED` if the pool was shut down
+ * while blocking, `EINVAL` for a negative timeout.
+ * 任务已入队，或按拒绝策略被执行或入队时返回0。否则返回-1，超时后任务被拒绝时errno为`ETIMEDOUT`，
+ * 阻塞期间线程池被关闭时为`ECANCELED`，时限为负数时为`EINVAL`。
+ */
+int thpool_add_work_timed(threadpool, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ms);
+
+/**
+ * @brief Add work that runs on one specific worker thread.
+ *
+ * The job goes to the private queue of the worker whose id (see @ref thpool_thread_get_id) is `thread_id`.
+ * Other workers never take or steal it, so jobs can rely on state the worker keeps in its
+ * `thread_ctx_slot` (an open transaction, prepared statements, warm caches). Jobs sent to the same
+ * worker run in FIFO order, before the jobs it would take from the shared queue.
+ * A negative `thread_id` means no affinity and behaves like @ref thpool_add_work. If the worker has not
+ * been started, has exited or is exiting (after @ref thpool_resize or an idle timeout), the job falls
+ * back to the shared queue. Private jobs count towards `work_num_max` and are waited for by
+ * @ref thpool_wait; they are not subject to `prio_work_num_max`. Blocks like @ref thpool_add_work.
+ *
+ * 添加由指定工作线程执行的任务。任务进入编号（参见`thpool_thread_get_id`）为`thread_id`的工作线程的私有队列，
+ * 其他线程不会取走或窃取它，因此任务可以依赖该线程保存在`thread_ctx_slot`中的状态（未提交的事务、预编译语句、缓存等）。
+ * 发往同一线程的任务按FIFO顺序执行，并先于该线程从共享队列取得的任务。
+ * `thread_id`为负数表示不指定线程，与`thpool_add_work`相同。目标线程尚未启动、已退出或正在退出
+ * （`thpool_resize`或空闲超时之后）时，任务退回共享队列。私有任务计入`work_num_max`，`thpool_wait`也会等待它们，
+ * 但不受`prio_work_num_max`约束。阻塞语义与`thpool_add_work`相同。
+ *
+ * @param pool         The thread pool handle.
+ * @param thread_id    Id of the worker to run the job, or negative for any worker.
+ * 执行任务的工作线程编号，负数表示任意线程。
+ * @param function_p   Pointer to the task function. Must not be null pointer.
+ * @param arg_p        The argument for the task function.
+ *
+ * @return int         0 on success, -1 otherwise, errno is `EINVAL` if `thread_id` is not below `max_threads`,
+ * `ECANCELED` if the pool is shutting down.
+ * 成功时返回0，否则返回-1，`thread_id`不小于`max_threads`时errno为`EINVAL`，线程池正在关闭时为`ECANCELED`。
+ */
+int thpool_add_work_to(threadpool, int thread_id, void (*function_p)(void *, threadpool_thread), void *arg_p);
+
+/**
+ * @brief Add work that runs on the worker thread a key maps to.
+ *
+ * Like @ref thpool_add_work_to, with the worker chosen by hashing `key` over the worker slots.
+ * While the number of threads does not change, the same key always maps to the same worker,
+ * so all jobs of one session or connection run on one thread. A key that maps to a worker which is
+ * no longer running moves on to the next running worker. Resizing the pool may remap keys.
+ *
+ * 添加由键所映射的工作线程执行的任务。与`thpool_add_work_to`类似，工作线程由`key`的哈希值在线程位置上选取。
+ * 线程数不变时，同一个键总是映射到同一个工作线程，因此同一会话或连接的所有任务都在同一线程上执行。
+ * 键映射到的线程已不再运行时，顺延到下一个运行中的线程。调整线程池大小可能改变键的映射。
+ *
+ * @param pool         The thread pool handle.
+ * @param key          Key of the job, e.g. a session or connection id. 任务的键，例如会话或连接编号。
+ * @param function_p   Pointer to the task function. Must not be null pointer.
+ * @param arg_p        The argument for the task function.
+ *
+ * @return int         0 on success, -1 otherwise (e.g., thread pool is being destroyed).
+ * 成功时返回0，否则返回-1（例如线程池正在销毁）。
+ */
+int thpool_add_work_keyed(threadpool, unsigned long long key, void (*function_p)(void *, threadpool_thread), void *arg_p);
+
+/**
+ * @brief Add a batch of jobs sharing one task function to the job queue.
+ *
+ * Equivalent to calling @ref thpool_add_work once for each element of `args_p`, but
+ * all job nodes are allocated up front and linked into the job queue under a single
+ * lock acquisition, and only as many idle workers as there are new jobs are woken up.
+ * If the queue is bounded (`work_num_max > 0`), as many jobs as fit are queued at a time,
+ * and the call blocks until the rest can be queued.
+ *
+ * 批量添加共用同一任务函数的任务。效果等同于对`args_p`的每个元素调用一次`thpool_add_work`，
+ * 但所有任务节点会预先一次性分配，并在一次加锁内链入任务队列，且只唤醒与新任务数量相当的空闲线程。
+ * 若队列有上限，每次尽可能多地入队，其余任务阻塞至可以入队为止。
+ *
+ * @param pool        The thread pool handle.
+ * @param function_p  Pointer to the task function shared by all jobs. Must not be null pointer.
+ * 所有任务共用的任务函数。不能为空指针。
+ * @param args_p      Array of `num` task arguments, one job per element.
+ * 包含`num`个任务参数的数组，每个元素对应一个任务。
+ * @param num         Number of jobs to add. Must not be negative.
+ * 要添加的任务数。不能为负数。
+ *
+ * @return int        The number of jobs added, which is `num` on success. If the thread pool
+ * is shut down while blocking (errno `ECANCELED`) or memory runs out, the jobs already queued
+ * stay queued and their count is returned; the remaining arguments were not submitted.
+ * -1 if no job could be added or the arguments are invalid.
+ * 返回实际添加的任务数，成功时等于`num`。若阻塞期间线程池被关闭（errno为`ECANCELED`）或内存不足，
+ * 已入队的任务保持入队，返回其数量，其余参数未被提交。一个任务都未能添加或参数无效时返回-1。
+ *
+ * @note The same lifetime rules as @ref thpool_add_work apply to every argument.
+ * 每个参数的生命周期要求与`thpool_add_work`相同。
+ */
+int thpool_add_work_batch(threadpool, void (*function_p)(void *, threadpool_thread), void **args_p, int num);
+
+/**
+ * @brief Add work to the job queue and get a completion handle for it.
+ *
+ * Like @ref thpool_add_work, but also returns a handle that @ref thpool_handle_wait,
+ * @ref thpool_handle_try, @ref thpool_handle_wait_any and @ref thpool_handle_wait_all can wait on.
+ * The handle is taken from the pool's job node allocator rather than `malloc`. The worker completes it
+ * with one atomic exchange after the task function returns, and only makes a wake-up system call if
+ * somebody is waiting. Everything the task function wrote is visible to whoever sees the handle complete.
+ * If @ref thpool_shutdown discards the job before it runs, the handle completes as cancelled.
+ *
+ * 添加任务，并取得该任务的完成句柄。与`thpool_add_work`类似，但同时返回一个句柄，
+ * 可以用`thpool_handle_wait`、`thpool_handle_try`、`thpool_handle_wait_any`与`thpool_handle_wait_all`等待。
+ * 句柄从线程池的任务节点分配器取得，而非`malloc`。任务函数返回后，工作线程以一次原子交换完成句柄，
+ * 只有在有人等待时才进行唤醒的系统调用。观察到句柄完成的一方，可以看到任务函数写入的所有内容。
+ * 若任务在执行前被`thpool_shutdown`丢弃，句柄以取消状态完成。
+ *
+ * @param pool         The thread pool handle.
+ * @param function_p   Pointer to the task function. Must not be null pointer.
+ * @param arg_p        The argument for the task function.
+ * @param handle_out   Receives the completion handle on success. Must not be null pointer.
+ * 成功时接收完成句柄。不能为空指针。
+ *
+ * @return int         0 on success, -1 otherwise. On failure no handle is returned and the job was not added.
+ * 成功时返回0，否则返回-1。失败时不返回句柄，任务也未被添加。
+ *
+ * @note Every handle must be released exactly once with @ref thpool_handle_release, and all handles
+ * must be released before @ref thpool_destroy. Waiting from inside a worker thread may deadlock
+ * if no other worker can run the job.
+ * 每个句柄必须以`thpool_handle_release`恰好释放一次，且所有句柄须在`thpool_destroy`之前释放。
+ * 在工作线程内部等待时，若没有其他工作线程能够执行该任务，可能死锁。
+ */
+int thpool_submit(threadpool, void (*function_p)(void *, threadpool_thread), void *arg_p, threadpool_handle *handle_out);
+
+/**
+ * @brief Checks whether the job of a handle has finished, without blocking.
+ *
+ * 不阻塞地检查句柄对应的任务是否已完成。
+ *
+ * @param handle  A handle returned by @ref thpool_submit and not yet released.
+ * `thpool_submit`返回且尚未释放的句柄。
+ * @return int    1 if the job has run, 0 if it has not finished yet,
+ * -1 with errno `ECANCELED` if it was discarded by @ref thpool_shutdown, or `EINVAL` for a null pointer handle.
+ * 任务已执行返回1，尚未完成返回0；任务被`thpool_shutdown`丢弃时返回-1且errno为`ECANCELED`，句柄为空指针时errno为`EINVAL`。
+ */
+int thpool_handle_try(threadpool_handle handle);
+
+/**
+ * @brief Blocks until the job of a handle has finished.
+ *
+ * 阻塞直到句柄对应的任务完成。
+ *
+ * @param handle  A handle returned by @ref thpool_submit and not yet released.
+ * `thpool_submit`返回且尚未释放的句柄。
+ * @return int    0 if the job has run, -1 with errno `ECANCELED` if it was discarded by @ref thpool_shutdown,
+ * or `EINVAL` for a null pointer handle.
+ * 任务已执行返回0；任务被`thpool_shutdown`丢弃时返回-1且errno为`ECANCELED`，句柄为空指针时errno为`EINVAL`。
+ */
+int thpool_handle_wait(threadpool_handle handle);
+
+/**
+ * @brief Blocks until at least one of the handles has finished.
+ *
+ * The handles may belong to different thread pools.
+ *
+ * 阻塞直到至少一个句柄对应的任务完成。这些句柄可以属于不同的线程池。
+ *
+ * @param handles  Array of `num` handles returned by @ref thpool_submit and not yet released.
+ * 包含`num`个`thpool_submit`返回且尚未释放的句柄的数组。
+ * @param num      Number of handles. Must be positive.
+ * 句柄数量。必须为正数。
+ * @return int     Index of a finished handle (run or cancelled, check it with @ref thpool_handle_try),
+ * or -1 with errno `EINVAL` if the arguments are invalid.
+ * 一个已完成（已执行或已取消，可用`thpool_handle_try`区分）句柄的下标；参数无效时返回-1且errno为`EINVAL`。
+ */
+int thpool_handle_wait_any(threadpool_handle *handles, int num);
+
+/**
+ * @brief Blocks until all of the handles have finished.
+ *
+ * 阻塞直到所有句柄对应的任务完成。
+ *
+ * @param handles  Array of `num` handles returned by @ref thpool_submit and not yet released.
+ * 包含`num`个`thpool_submit`返回且尚未释放的句柄的数组。
+ * @param num      Number of handles. Must not be negative.
+ * 句柄数量。不能为负数。
+ * @return int     0 if every job has run, -1 with errno `ECANCELED` if any was discarded by
+ * @ref thpool_shutdown (after all have finished), or `EINVAL` if the arguments are invalid.
+ * 所有任务均已执行返回0；任一任务被`thpool_shutdown`丢弃时（在全部完成后）返回-1且errno为`ECANCELED`，参数无效时errno为`EINVAL`。
+ */
+int thpool_handle_wait_all(threadpool_handle *handles, int num);
+
+/**
+ * @brief Releases a completion handle.
+ *
+ * May be called before the job has finished, in which case the job still runs and its node
+ * is recycled afterwards. The handle must not be used after this call.
+ *
+ * 释放完成句柄。可以在任务完成前调用，此时任务照常执行，执行后回收其节点。调用后不得再使用该句柄。
+ *
+ * @param handle  A handle returned by @ref thpool_submit. Null pointer is ignored.
+ * `thpool_submit`返回的句柄。空指针将被忽略。
+ */
+void thpool_handle_release(threadpool_handle handle);
+
+/**
+ * @brief Creates a task group on a thread pool.
+ *
+ * A task group counts the jobs added through @ref thpool_group_add_work that have not finished yet,
+ * so that @ref thpool_group_wait can wait for just those jobs while the rest of the pool keeps working.
+ * Unlike @ref thpool_wait, it does not deactivate the pool, and it may be called from worker threads.
+ * Several groups can be in use on one pool at the same time, and a group can be reused after each wait.
+ *
+ * 在线程池上创建任务组。任务组统计经由`thpool_group_add_work`添加且尚未完成的任务，
+ * `thpool_group_wait`只等待这些任务，线程池的其他任务照常执行。与`thpool_wait`不同，它不会使线程池进入不活跃状态，
+ * 也可以在工作线程内调用。一个线程池上可以同时使用多个任务组，每次等待之后任务组可以继续使用。
+ *
+ * @param pool  The thread pool handle.
+ * @return threadpool_group  A handle to the new group, or null pointer on error.
+ * 新任务组的句柄，错误时返回空指针。
+ *
+ * @note The group must be destroyed with @ref thpool_group_destroy before the thread pool is destroyed.
+ * 任务组须在线程池销毁之前以`thpool_group_destroy`销毁。
+ */
+threadpool_group thpool_group_create(threadpool);
+
+/**
+ * @brief Adds work to the job queue as part of a task group.
+ *
+ * Like @ref thpool_add_work, with the same blocking behaviour on a full queue, but the job is
+ * counted by the group until its task function returns.
+ *
+ * 作为任务组的一部分添加任务。与`thpool_add_work`相同，队列已满时同样阻塞，但任务在其任务函数返回之前都被任务组计数。
+ *
+ * @param group        The task group handle.
+ * @param function_p   Pointer to the task function. Must not be null pointer.
+ * @param arg_p        The argument for the task function.
+ * @return int         0 on success, -1 otherwise. On failure the job is neither added nor counted.
+ * 成功时返回0，否则返回-1。失败时任务既未添加也未计数。
+ */
+int thpool_group_add_work(threadpool_group group, void (*function_p)(void *, threadpool_thread), void *arg_p);
+
+/**
+ * @brief Blocks until every job added to the group so far has finished.
+ *
+ * Called from a worker thread of the group's pool, it runs queued jobs of the pool (of any group or none)
+ * while it waits, so waiting from inside a job does not tie up the worker or deadlock a small pool.
+ * Called from any other thread, it sleeps until the group count drops to zero. Everything written by the
+ * group's jobs is visible after it returns.
+ *
+ * 阻塞直到此前添加到任务组的所有任务完成。在任务组所属线程池的工作线程内调用时，等待期间协助执行线程池中排队的任务
+ * （不论属于哪个任务组），因此在任务内部等待不会空占工作线程，也不会令线程数较少的线程池死锁。
+ * 在其他线程中调用时，休眠直到任务组计数归零。返回后可以看到任务组中各任务写入的所有内容。
+ *
+ * @param group  The task group handle.
+ * @return int   0 on success. -1 with errno `ECANCELED` if some job of the group was discarded by
+ * @ref thpool_shutdown, or if the calling worker was asked to stop by the shutdown; `EINVAL` for a null pointer handle.
+ * 成功时返回0。若任务组中有任务被`thpool_shutdown`丢弃，或调用的工作线程因shutdown被要求停止，返回-1且errno为`ECANCELED`；
+ * 句柄为空指针时errno为`EINVAL`。
+ */
+int thpool_group_wait(threadpool_group group);
+
+/**
+ * @brief Destroys a task group.
+ *
+ * 销毁任务组。
+ *
+ * @param group  The task group handle.
+ * @return int   0 on success, -1 with errno `EBUSY` if the group still has unfinished jobs,
+ * or `EINVAL` for a null pointer handle.
+ * 成功时返回0；任务组仍有未完成的任务时返回-1且errno为`EBUSY`，句柄为空指针时errno为`EINVAL`。
+ */
+int thpool_group_destroy(threadpool_group group);
+
+/**
+ * @brief Runs a function over the range [begin, end) on the thread pool and blocks until it is done.
+ *
+ * The range is cut into chunks of @p grain items and a handful of jobs, about one per worker thread,
+ * grab the chunks from a shared atomic cursor. Only one small allocation is made per call, however many
+ * chunks there are. Completion is tracked by a task group, so, like @ref thpool_group_wait, the call may be
+ * made from a worker thread, which then runs the chunks itself while waiting.
+ *
+ * 在线程池上对区间[begin, end)执行函数，阻塞直到完成。区间按每块`grain`个元素切分，
+ * 约每个工作线程一个的任务从共享的原子游标领取各块。不论分多少块，每次调用只进行一次小的内存分配。
+ * 完成情况以任务组跟踪，因此与`thpool_group_wait`一样可以在工作线程内调用，此时它在等待期间亲自执行各块。
+ *
+ * @param pool        The thread pool handle.
+ * @param begin       The first index of the range.
+ * @param end         One past the last index of the range. An empty range returns 0 at once.
+ * 区间末尾的下一个下标。区间为空时立即返回0。
+ * @param grain       The number of items per chunk, or 0 to choose it automatically (about 8 chunks per worker thread).
+ * 每块的元素数，为0时自动选择（每个工作线程约8块）。
+ * @param function_p  Called with [range_begin, range_end) for each chunk. Must not be null pointer.
+ * 对每块以[range_begin, range_end)调用。不能为空指针。
+ * @param arg_p       The argument passed to every call of @p function_p.
+ * 传给每次`function_p`调用的参数。
+ * @return int        0 on success, -1 otherwise. errno is `ECANCELED` if @ref thpool_shutdown stopped the range
+ * before every chunk ran.
+ * 成功时返回0，否则返回-1。若`thpool_shutdown`使部分块未能执行，errno为`ECANCELED`。
+ *
+ * @note Calling it while holding anything the chunks need is a deadlock, as with any blocking wait.
+ * 与任何阻塞等待一样，持有各块所需的资源时调用会死锁。
+ */
+int thpool_parallel_for(threadpool, size_t begin, size_t end, size_t grain, void (*function_p)(size_t range_begin, size_t range_end, void *arg, threadpool_thread current_thrd), void *arg_p);
+
+/**
+ * @brief Returns the current time of the clock used by timed jobs, in nanoseconds.
+ *
+ * This is `CLOCK_MONOTONIC`. Deadlines of @ref thpool_add_work_at and @ref thpool_add_work_every are on this clock.
+ *
+ * 返回定时任务所用时钟的当前时间，单位为纳秒。该时钟为`CLOCK_MONOTONIC`，
+ * `thpool_add_work_at`与`thpool_add_work_every`的到期时刻都以它为准。
+ */
+unsigned long long thpool_clock_ns(void);
+
+/**
+ * @brief Adds work to the job queue once a deadline has passed.
+ *
+ * The job waits in a hierarchical timing wheel with 1 ms ticks, serviced by a single timer thread that the pool
+ * starts on the first timed job. No worker sleeps for it. Expired jobs are pushed into the job queue in batches,
+ * so they queue behind work already there. A job never runs before its deadline, but may run later when
+ * the pool is busy.
+ *
+ * 在到期时刻之后把任务加入队列。任务在刻度为1毫秒的分层时间轮中等待，由线程池在第一个定时任务加入时启动的
+ * 单个定时器线程推进，不占用任何工作线程。到期的任务批量加入任务队列，排在已有任务之后。
+ * 任务不会早于到期时刻执行，但线程池繁忙时可能晚于到期时刻。
+ *
+ * @param pool         The thread pool handle.
+ * @param deadline_ns  The deadline on the clock of @ref thpool_clock_ns. A past deadline queues the job on the next tick.
+ * 以`thpool_clock_ns`的时钟表示的到期时刻。已经过去的时刻在下一个刻度入队。
+ * @param function_p   Pointer to the task function. Must not be null pointer.
+ * @param arg_p        The argument for the task function.
+ * @param timer_out    If not null pointer, receives a handle for @ref thpool_timer_cancel. The caller then
+ * owns the handle and must release it with @ref thpool_timer_cancel, even after the job has run, unless the pool is shut down first.
+ * 非空指针时接收用于`thpool_timer_cancel`的句柄。调用者随即持有该句柄，即使任务已经执行，也须以`thpool_timer_cancel`释放，
+ * 除非线程池先被shutdown。
+ * @return int         0 on success, -1 otherwise.
+ * 成功时返回0，否则返回-1。
+ */
+int thpool_add_work_at(threadpool, unsigned long long deadline_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, threadpool_timer *timer_out);
+
+/**
+ * @brief Adds work to the job queue periodically.
+ *
+ * Like @ref thpool_add_work_at, but after each run the job is armed again one period after its previous
+ * deadline. Runs of one periodic job never overlap, and periods missed while it was running or queued
+ * are skipped rather than run back to back. It keeps running until cancelled or until the pool is shut down.
+ *
+ * 周期性地把任务加入队列。与`thpool_add_work_at`类似，但每次执行结束后，以上一次到期时刻加一个周期重新计时。
+ * 同一个周期任务的执行不会重叠，执行或排队期间错过的周期被跳过，而不是连续补执行。该任务持续执行，直到被取消或线程池shutdown。
+ *
+ * @param pool               The thread pool handle.
+ * @param first_deadline_ns  The first deadline on the clock of @ref thpool_clock_ns.
+ * 以`thpool_clock_ns`的时钟表示的第一次到期时刻。
+ * @param period_ns          The period, rounded up to whole ticks (1 ms). Must not be 0.
+ * 周期，向上取整到整数个刻度（1毫秒）。不能为0。
+ * @param function_p         Pointer to the task function. Must not be null pointer.
+ * @param arg_p              The argument for the task function.
+ * @param timer_out          If not null pointer, receives a handle for @ref thpool_timer_cancel, see @ref thpool_add_work_at.
+ * 非空指针时接收用于`thpool_timer_cancel`的句柄，参见`thpool_add_work_at`。
+ * @return int               0 on success, -1 otherwise.
+ * 成功时返回0，否则返回-1。
+ */
+int thpool_add_work_every(threadpool, unsigned long long first_deadline_ns, unsigned long long period_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, threadpool_timer *timer_out);
+
+/**
+ * @brief Cancels a delayed or periodic job and releases its handle.
+ *
+ * A job still waiting in the wheel is unlinked in O(1). A periodic job that is already queued is skipped when it is
+ * dequeued; one that is running finishes that run. Either way it is not armed again.
+ * The handle is released in every case and must not be used afterwards.
+ * After @ref thpool_shutdown all timers are gone and this call fails with `EINVAL` without touching the handle.
+ *
+ * 取消延时或周期任务并释放其句柄。仍在时间轮中等待的任务以O(1)摘除；已在排队的周期任务出队时跳过，
+ * 正在执行的周期任务执行完这一次，此后都不再计时。
+ * 无论结果如何句柄都被释放，之后不得再使用。`thpool_shutdown`之后所有定时器都已释放，此调用以`EINVAL`失败且不会访问句柄。
+ *
+ * @param pool    The thread pool handle that the job was added to.
+ * 任务所属的线程池句柄。
+ * @param timer   The handle from @ref thpool_add_work_at or @ref thpool_add_work_every.
+ * @return int    0 if the job will not run again because of this call, -1 with errno `EALREADY` if a one-shot job
+ * had already expired (it runs, or has run, anyway), or `EINVAL` on bad arguments or a pool not in `ALIVE` state.
+ * 若此调用使任务不会再执行，返回0；一次性任务已经到期时（它仍会或已经执行）返回-1且errno为`EALREADY`；
+ * 参数无效或线程池不在`ALIVE`状态时errno为`EINVAL`。
+ */
+int thpool_timer_cancel(threadpool, threadpool_timer timer);
+
+/**
+ * @brief Creates an empty task graph on a thread pool.
+ *
+ * A task graph holds jobs (nodes) and ordering constraints (edges) between them. @ref thpool_graph_run
+ * queues every node as soon as all of its predecessors have finished, instead of waiting for a whole
+ * layer, so a long-running node only delays the nodes that depend on it. The graph can be run many times.
+ *
+ * 在线程池上创建空的任务图。任务图包含任务（节点）及其间的先后约束（边）。`thpool_graph_run`在节点的所有前驱完成后
+ * 立即将其入队，而不是等待一整层完成，因此耗时较长的节点只会推迟依赖它的节点。任务图可以多次执行。
+ *
+ * @param pool  The thread pool handle.
+ * @return threadpool_graph  A handle to the new graph, or null pointer on error.
+ * 新任务图的句柄，错误时返回空指针。
+ *
+ * @note The graph must be destroyed with @ref thpool_graph_destroy before the thread pool is destroyed.
+ * 任务图须在线程池销毁之前以`thpool_graph_destroy`销毁。
+ */
+threadpool_graph thpool_graph_create(threadpool);
+
+/**
+ * @brief Adds a node to a task graph.
+ *
+ * 向任务图添加节点。
+ *
+ * @param graph       The task graph handle.
+ * @param function_p  Pointer to the task function of the node. Must not be null pointer.
+ * 节点的任务函数指针。不能为空指针。
+ * @param arg_p       The argument for the task function.
+ * 任务函数的参数。
+ * @return int        The id of the new node (0, 1, 2, ... in order of addition), or -1 on error.
+ * errno is `EBUSY` while the graph is running.
+ * 新节点的编号（按添加顺序为0, 1, 2, ...），错误时返回-1。任务图执行期间errno为`EBUSY`。
+ */
+int thpool_graph_add_node(threadpool_graph graph, void (*function_p)(void *, threadpool_thread), void *arg_p);
+
+/**
+ * @brief Adds an edge to a task graph: node @p to will not start before node @p from has finished.
+ *
+ * Everything written by @p from is visible to @p to. Cycles are reported by @ref thpool_graph_run.
+ *
+ * 向任务图添加边：节点`to`在节点`from`完成之前不会开始。`from`写入的所有内容对`to`可见。环由`thpool_graph_run`报告。
+ *
+ * @param graph  The task graph handle.
+ * @param from   The id of the predecessor node.
+ * 前驱节点的编号。
+ * @param to     The id of the successor node. Must differ from @p from.
+ * 后继节点的编号。必须不同于`from`。
+ * @return int   0 on success, -1 otherwise. errno is `EINVAL` for a bad node id, or `EBUSY` while the graph is running.
+ * 成功时返回0，否则返回-1。节点编号无效时errno为`EINVAL`，任务图执行期间为`EBUSY`。
+ */
+int thpool_graph_add_edge(threadpool_graph graph, int from, int to);
+
+/**
+ * @brief Runs every node of a task graph once, respecting its edges, and blocks until all have finished.
+ *
+ * Nodes without predecessors are queued first. When a node finishes, the worker queues the successors it made
+ * ready and runs the first of them itself, while its inputs are still in cache. Like @ref thpool_group_wait,
+ * it may be called from a worker thread, which then runs queued jobs while waiting.
+ *
+ * 执行任务图的每个节点一次，遵守各边的约束，阻塞直到全部完成。没有前驱的节点首先入队。节点完成时，
+ * 工作线程将其变为就绪的后继入队，并亲自执行其中第一个，此时其输入仍在缓存中。
+ * 与`thpool_group_wait`一样可以在工作线程内调用，此时等待期间执行排队的任务。
+ *
+ * @param graph  The task graph handle.
+ * @return int   0 on success, -1 otherwise. errno is `EINVAL` if the graph has a cycle, `EBUSY` if it is already running,
+ * or `ECANCELED` if @ref thpool_shutdown discarded some of its nodes.
+ * 成功时返回0，否则返回-1。任务图有环时errno为`EINVAL`，已在执行时为`EBUSY`，有节点被`thpool_shutdown`丢弃时为`ECANCELED`。
+ */
+int thpool_graph_run(threadpool_graph graph);
+
+/**
+ * @brief Destroys a task graph.
+ *
+ * 销毁任务图。
+ *
+ * @param graph  The task graph handle.
+ * @return int   0 on success, -1 with errno `EBUSY` if the graph is running, or `EINVAL` for a null pointer handle.
+ * 成功时返回0；任务图正在执行时返回-1且errno为`EBUSY`，句柄为空指针时errno为`EINVAL`。
+ */
+int thpool_graph_destroy(threadpool_graph graph);
+
+/**
+ * @brief Gets the ID of the current thread pool thread.
+ *
+ * This function is intended to be called from within a worker thread's
+ * @ref thread_start_cb, @ref thread_end_cb, or a task function.
+ * It retrieves the thread's internal ID from its thread metadata.
+ * 
+ * 获取当前线程池线程的 ID。
+ * 
+ * 它从线程元数据中检索线程的内部ID。
+ *
+ * @param current_thrd  Current thread handle,
+ * as passed to the callback or task function.
+ * 当前线程句柄，线程池将它作为参数传递给回调或任务函数中以获取。不能为null pointer。
+ * @return int The internal ID of the calling thread pool thread.
+ * 返回调用线程池线程的内部ID，如果`current_thrd`为空指针则返回-1。
+ */
+int thpool_thread_get_id(threadpool_thread current_thrd);
+
+/**
+ * @brief Gets the name of the current thread pool thread.
+ *
+ * This function is intended to be called from within a worker thread's
+ * @ref thread_start_cb, @ref thread_end_cb, or a task function.
  * It retrieves the thread's name from its thread metadata.
  * 
  * 获取当前线程池线程的名称。
@@ -694,10 +2056,10 @@ void thpool_thread_unset_context(threadpool_thread current_thrd);
  * 如果用户这么做，则不得再在同一线程内使用回调参数，否则可能导致UAF。
  *
  * When the reference count for the `callback_arg` drops to zero across all
- * threads and the thread pool initialization process, the provided
+ * threads and the thread pool itself (whose reference is released by `thpool_shutdown`), the provided
  * `callback_arg_destructor` will be called.
  * 
- * 当`callback_arg`的引用计数在所有线程和线程池初始化过程中降至零时，
+ * 当`callback_arg`的引用计数在所有线程和线程池本身（其引用由`thpool_shutdown`释放）中降至零时，
  * 将调用用户提供的`callback_arg_destructor`。
  *
  * Calling this function multiple times from the same thread, or calling it
@@ -710,6 +2072,62 @@ void thpool_thread_unset_context(threadpool_thread current_thrd);
  */
 void thpool_thread_unref_callback_arg(threadpool_thread current_thrd);
 
+/**
+ * @brief Suspend the current fiber job until a file descriptor is ready or a deadline passes.
+ *
+ * Must be called from a job of @ref thpool_add_work_fiber. The worker goes on with other jobs meanwhile.
+ * The fiber is resumed when `fd` reports one of `events` (as for `poll`) or when `deadline_ns` passes,
+ * whichever comes first. A negative `fd` or zero `events` waits for the deadline only; a zero `deadline_ns`
+ * waits without a time limit; with neither, the fiber just goes to the tail of the shared queue.
+ * The fiber may be resumed on another worker: `*current_thrd` is updated to that worker's handle, and
+ * thread-local storage, including values cached from it, must not be relied on across the call.
+ * The same `fd` must not be waited on by two fibers at once.
+ *
+ * 挂起当前的协程任务，直到文件描述符就绪或截止时刻已过。只能在`thpool_add_work_fiber`的任务中调用，其间工作线程继续执行其他任务。
+ * `fd`报告`events`中的任一事件（与`poll`相同）或超过`deadline_ns`时，以先发生者恢复协程。
+ * `fd`为负数或`events`为0时只等待截止时刻；`deadline_ns`为0时不限时；两者都没有时，协程只是回到共享队列的队尾。
+ * 协程可能在另一个工作线程上恢复：`*current_thrd`会更新为该线程的句柄，不能在调用前后依赖线程局部存储，包括从中缓存的值。
+ * 同一个`fd`不能同时被两个协程等待。
+ *
+ * @param current_thrd Pointer to the current thread handle, updated on return. Must not be null pointer.
+ * 指向当前线程句柄的指针，返回时更新。不能为空指针。
+ * @param fd           File descriptor to wait on, or negative.
+ * 等待的文件描述符，或负数。
+ * @param events       `POLLIN`, `POLLOUT`, `POLLPRI` or a combination.
+ * `POLLIN`、`POLLOUT`、`POLLPRI`或其组合。
+ * @param deadline_ns  The deadline on the clock of @ref thpool_clock_ns, or 0.
+ * 以`thpool_clock_ns`的时钟表示的截止时刻，或0。
+ *
+ * @return int         The ready events of `fd` (which may include `POLLERR` and `POLLHUP`), 0 if the deadline passed
+ * or nothing was waited for, -1 with `errno` set otherwise: `EINVAL` outside a fiber job, `ECANCELED` if the pool is
+ * shutting down, `ENOTSUP` without fiber support, or the error of registering `fd`.
+ * `fd`就绪的事件（可能包括`POLLERR`与`POLLHUP`）；截止时刻已过或未等待任何条件时返回0；否则返回-1并设置`errno`：
+ * 不在协程任务中时为`EINVAL`，线程池正在关闭时为`ECANCELED`，不支持协程时为`ENOTSUP`，或登记`fd`时的错误。
+ */
+int thpool_yield_until(threadpool_thread *current_thrd, int fd, short events, unsigned long long deadline_ns);
+
+/**
+ * @brief Bump-allocate temporary memory private to the current worker.
+ *
+ * Each worker owns a scratch region of `thread_scratch_size` bytes on its NUMA node. Allocations only move an offset,
+ * and everything allocated during a job is released when that job returns, so nothing needs to be freed. Jobs run
+ * nested in the same worker (e.g. while helping in @ref thpool_group_wait) release only their own allocations.
+ * The memory is valid until the current job returns; in a fiber job it is also lost at @ref thpool_yield_until.
+ *
+ * 从当前工作线程私有的临时内存中按偏移分配。每个工作线程在其NUMA节点上持有`thread_scratch_size`字节的临时内存，
+ * 分配只移动偏移，任务期间分配的一切在该任务返回时释放，因此无需释放。在同一线程内嵌套执行的任务（例如在`thpool_group_wait`中协助执行）只释放自己的分配。
+ * 内存在当前任务返回前有效；协程任务调用`thpool_yield_until`后同样失效。
+ *
+ * @param current_thrd Current thread handle (@ref threadpool_thread). Must not be null pointer.
+ * 当前线程句柄。不能为空指针。
+ * @param size         Bytes to allocate. The block is 16-byte aligned.
+ * 分配的字节数。分配按16字节对齐。
+ *
+ * @return void*       The memory, or null pointer with `errno` set to `ENOMEM` if the region is exhausted, `EINVAL` for a size of 0.
+ * 分配的内存，或空指针：临时内存不足时errno为`ENOMEM`，大小为0时为`EINVAL`。
+ */
+void *thpool_thread_scratch(threadpool_thread current_thrd, size_t size);
+
 #ifdef THPOOL_ENABLE_DEBUG_CONC_API
 /**
  * @brief Initializes a debug concurrency passport.
@@ -778,6 +2196,429 @@ void thpool_debug_conc_passport_destroy(thpool_debug_conc_passport);
  */
 int thpool_add_work_debug_conc(threadpool, thpool_debug_conc_passport, void (*function_p)(void *, threadpool_thread), void *arg_p);
 
+/**
+ * @brief Adds work with a priority using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_add_work_prio but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证按优先级添加任务以进行诊断。
+ * 此函数类似于`thpool_add_work_prio`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @param prio       Priority level of the job.
+ * 任务的优先级。
+ * @param function_p Pointer to the task function. Must not be null pointer.
+ * 指向任务函数的指针。不能为空指针。
+ * @param arg_p      The argument for the task function.
+ * 任务函数的参数。
+ * @return int       0 on success, -1 otherwise (e.g., invalid priority, null pointer handles, passport mismatch, or pool not in ALIVE state).
+ * 成功时返回0，否则返回-1（例如优先级无效，句柄为空指针，通行证不匹配，或线程池不在`ALIVE`状态）。
+ */
+int thpool_add_work_prio_debug_conc(threadpool, thpool_debug_conc_passport, threadpool_priority prio, void (*function_p)(void *, threadpool_thread), void *arg_p);
+
+/**
+ * @brief Adds work with a deadline using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_add_work_deadline but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证添加截止时间任务以进行诊断。
+ * 此函数类似于`thpool_add_work_deadline`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @param deadline_ns The deadline on the clock of @ref thpool_clock_ns.
+ * 以`thpool_clock_ns`的时钟表示的截止时刻。
+ * @param function_p Pointer to the task function. Must not be null pointer.
+ * 指向任务函数的指针。不能为空指针。
+ * @param arg_p      The argument for the task function and for `on_expire`.
+ * 任务函数与`on_expire`的参数。
+ * @param on_expire  Run instead of `function_p` if the job is taken after its deadline, or null pointer to drop it.
+ * 任务过期时代替`function_p`执行，为空指针时直接丢弃。
+ * @return int       0 on success, -1 otherwise (e.g., null pointer handles, passport mismatch, or pool not in ALIVE state).
+ * 成功时返回0，否则返回-1（例如句柄为空指针，通行证不匹配，或线程池不在`ALIVE`状态）。
+ */
+int thpool_add_work_deadline_debug_conc(threadpool, thpool_debug_conc_passport, unsigned long long deadline_ns, void (*function_p)(void *, threadpool_thread), void *arg_p,
+                                        void (*on_expire)(void *, threadpool_thread));
+
+/**
+ * @brief Adds a fiber job using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_add_work_fiber but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证添加协程任务以进行诊断。
+ * 此函数类似于`thpool_add_work_fiber`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @param function_p Pointer to the task function. Must not be null pointer.
+ * 指向任务函数的指针。不能为空指针。
+ * @param arg_p      The argument for the task function.
+ * 任务函数的参数。
+ * @return int       0 on success, -1 otherwise (e.g., null pointer handles, passport mismatch, or pool not in ALIVE state).
+ * 成功时返回0，否则返回-1（例如句柄为空指针，通行证不匹配，或线程池不在`ALIVE`状态）。
+ */
+int thpool_add_work_fiber_debug_conc(threadpool, thpool_debug_conc_passport, void (*function_p)(void *, threadpool_thread), void *arg_p);
+
+/**
+ * @brief Allocates a job argument using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_job_alloc but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证分配任务参数以进行诊断。
+ * 此函数类似于`thpool_job_alloc`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @param size       Bytes to allocate, at most 64 KiB.
+ * 分配的字节数，至多64 KiB。
+ * @return void*     The block, or null pointer on error (e.g., null pointer handles, passport mismatch, or pool not in ALIVE state).
+ * 分配的内存，错误时返回空指针（例如句柄为空指针，通行证不匹配，或线程池不在`ALIVE`状态）。
+ */
+void *thpool_job_alloc_debug_conc(threadpool, thpool_debug_conc_passport, size_t size);
+
+/**
+ * @brief Releases a job argument using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_job_free but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证释放任务参数以进行诊断。
+ * 此函数类似于`thpool_job_free`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @param ptr        The block, or a pointer into it.
+ * 分配的内存，或指向其内部的指针。
+ * @return int       0 on success, -1 otherwise (e.g., null pointer handles, passport mismatch, or pool not in ALIVE state).
+ * 成功时返回0，否则返回-1（例如句柄为空指针，通行证不匹配，或线程池不在`ALIVE`状态）。
+ */
+int thpool_job_free_debug_conc(threadpool, thpool_debug_conc_passport, void *ptr);
+
+/**
+ * @brief Adds work without blocking using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_try_add_work but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证非阻塞地添加任务以进行诊断。
+ * 此函数类似于`thpool_try_add_work`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @param function_p Pointer to the task function. Must not be null pointer.
+ * 指向任务函数的指针。不能为空指针。
+ * @param arg_p      The argument for the task function.
+ * 任务函数的参数。
+ * @return int       0 on success, -1 otherwise (see @ref thpool_try_add_work; also on null pointer handles, passport mismatch, or pool not in ALIVE state).
+ * 成功时返回0，否则返回-1（参见`thpool_try_add_work`；句柄为空指针，通行证不匹配，或线程池不在`ALIVE`状态时同样返回-1）。
+ */
+int thpool_try_add_work_debug_conc(threadpool, thpool_debug_conc_passport, void (*function_p)(void *, threadpool_thread), void *arg_p);
+
+/**
+ * @brief Adds work with a timeout using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_add_work_timed but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证限时添加任务以进行诊断。
+ * 此函数类似于`thpool_add_work_timed`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @param function_p Pointer to the task function. Must not be null pointer.
+ * 指向任务函数的指针。不能为空指针。
+ * @param arg_p      The argument for the task function.
+ * 任务函数的参数。
+ * @param timeout_ms Longest time to block in milliseconds. Must not be negative.
+ * 最长阻塞时间，单位为毫秒。不能为负数。
+ * @return int       0 on success, -1 otherwise (see @ref thpool_add_work_timed; also on null pointer handles, passport mismatch, or pool not in ALIVE state).
+ * 成功时返回0，否则返回-1（参见`thpool_add_work_timed`；句柄为空指针，通行证不匹配，或线程池不在`ALIVE`状态时同样返回-1）。
+ */
+int thpool_add_work_timed_debug_conc(threadpool, thpool_debug_conc_passport, void (*function_p)(void *, threadpool_thread), void *arg_p, long timeout_ms);
+
+/**
+ * @brief Adds work for a specific worker thread using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_add_work_to but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证添加由指定工作线程执行的任务以进行诊断。
+ * 此函数类似于`thpool_add_work_to`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @param thread_id  Id of the worker to run the job, or negative for any worker.
+ * 执行任务的工作线程编号，负数表示任意线程。
+ * @param function_p Pointer to the task function. Must not be null pointer.
+ * 指向任务函数的指针。不能为空指针。
+ * @param arg_p      The argument for the task function.
+ * 任务函数的参数。
+ * @return int       0 on success, -1 otherwise (see @ref thpool_add_work_to; also on null pointer handles, passport mismatch, or pool not in ALIVE state).
+ * 成功时返回0，否则返回-1（参见`thpool_add_work_to`；句柄为空指针，通行证不匹配，或线程池不在`ALIVE`状态时同样返回-1）。
+ */
+int thpool_add_work_to_debug_conc(threadpool, thpool_debug_conc_passport, int thread_id, void (*function_p)(void *, threadpool_thread), void *arg_p);
+
+/**
+ * @brief Adds keyed work using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_add_work_keyed but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证按键添加任务以进行诊断。
+ * 此函数类似于`thpool_add_work_keyed`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @param key        Key of the job. 任务的键。
+ * @param function_p Pointer to the task function. Must not be null pointer.
+ * 指向任务函数的指针。不能为空指针。
+ * @param arg_p      The argument for the task function.
+ * 任务函数的参数。
+ * @return int       0 on success, -1 otherwise (see @ref thpool_add_work_keyed; also on null pointer handles, passport mismatch, or pool not in ALIVE state).
+ * 成功时返回0，否则返回-1（参见`thpool_add_work_keyed`；句柄为空指针，通行证不匹配，或线程池不在`ALIVE`状态时同样返回-1）。
+ */
+int thpool_add_work_keyed_debug_conc(threadpool, thpool_debug_conc_passport, unsigned long long key, void (*function_p)(void *, threadpool_thread), void *arg_p);
+
+/**
+ * @brief Adds a batch of jobs to the job queue using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_add_work_batch but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证批量添加任务以进行诊断。
+ * 此函数类似于`thpool_add_work_batch`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @param function_p Pointer to the task function shared by all jobs. Must not be null pointer.
+ * 所有任务共用的任务函数。不能为空指针。
+ * @param args_p     Array of `num` task arguments.
+ * 包含`num`个任务参数的数组。
+ * @param num        Number of jobs to add.
+ * 要添加的任务数。
+ * @return int       The number of jobs added, or -1 (see @ref thpool_add_work_batch; also on passport mismatch or pool not in ALIVE state).
+ * 返回实际添加的任务数，或-1（参见`thpool_add_work_batch`；通行证不匹配或线程池不在`ALIVE`状态时同样返回-1）。
+ */
+int thpool_add_work_batch_debug_conc(threadpool, thpool_debug_conc_passport, void (*function_p)(void *, threadpool_thread), void **args_p, int num);
+
+/**
+ * @brief Adds work and gets its completion handle using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_submit but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证添加任务并取得完成句柄以进行诊断。
+ * 此函数类似于`thpool_submit`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @param function_p Pointer to the task function. Must not be null pointer.
+ * 指向任务函数的指针。不能为空指针。
+ * @param arg_p      The argument for the task function.
+ * 任务函数的参数。
+ * @param handle_out Receives the completion handle on success. Must not be null pointer.
+ * 成功时接收完成句柄。不能为空指针。
+ * @return int       0 on success, -1 otherwise (e.g., null pointer handles, passport mismatch, or pool not in ALIVE state).
+ * 成功时返回0，否则返回-1（例如句柄为空指针，通行证不匹配，或线程池不在`ALIVE`状态）。
+ */
+int thpool_submit_debug_conc(threadpool, thpool_debug_conc_passport, void (*function_p)(void *, threadpool_thread), void *arg_p, threadpool_handle *handle_out);
+
+/**
+ * @brief Creates a task group using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_group_create but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证创建任务组以进行诊断。
+ * 此函数类似于`thpool_group_create`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @return threadpool_group  A handle to the new group, or null pointer on error.
+ * 新任务组的句柄，错误时返回空指针。
+ */
+threadpool_group thpool_group_create_debug_conc(threadpool, thpool_debug_conc_passport);
+
+/**
+ * @brief Runs a parallel for using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_parallel_for but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证执行并行for以进行诊断。
+ * 此函数类似于`thpool_parallel_for`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @return int       0 on success, -1 otherwise (e.g., null pointer handles, passport mismatch, or pool not in ALIVE state).
+ * 成功时返回0，否则返回-1（例如句柄为空指针，通行证不匹配，或线程池不在`ALIVE`状态）。
+ */
+int thpool_parallel_for_debug_conc(threadpool, thpool_debug_conc_passport, size_t begin, size_t end, size_t grain, void (*function_p)(size_t, size_t, void *, threadpool_thread), void *arg_p);
+
+/**
+ * @brief Creates a task graph using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_graph_create but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证创建任务图以进行诊断。
+ * 此函数类似于`thpool_graph_create`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @return threadpool_graph  A handle to the new graph, or null pointer on error.
+ * 新任务图的句柄，错误时返回空指针。
+ */
+threadpool_graph thpool_graph_create_debug_conc(threadpool, thpool_debug_conc_passport);
+
+/**
+ * @brief Adds delayed work using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_add_work_at but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证添加延时任务以进行诊断。
+ * 此函数类似于`thpool_add_work_at`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @return int       0 on success, -1 otherwise (e.g., null pointer handles, passport mismatch, or pool not in ALIVE state).
+ * 成功时返回0，否则返回-1（例如句柄为空指针，通行证不匹配，或线程池不在`ALIVE`状态）。
+ */
+int thpool_add_work_at_debug_conc(threadpool, thpool_debug_conc_passport, unsigned long long deadline_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, threadpool_timer *timer_out);
+
+/**
+ * @brief Adds periodic work using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_add_work_every but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证添加周期任务以进行诊断。
+ * 此函数类似于`thpool_add_work_every`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @return int       0 on success, -1 otherwise (e.g., null pointer handles, passport mismatch, or pool not in ALIVE state).
+ * 成功时返回0，否则返回-1（例如句柄为空指针，通行证不匹配，或线程池不在`ALIVE`状态）。
+ */
+int thpool_add_work_every_debug_conc(threadpool, thpool_debug_conc_passport, unsigned long long first_deadline_ns, unsigned long long period_ns, void (*function_p)(void *, threadpool_thread), void *arg_p, threadpool_timer *timer_out);
+
+/**
+ * @brief Cancels a timed job using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_timer_cancel but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse. The passport is checked before the handle is touched, so a handle
+ * outliving its pool's shutdown is reported instead of being accessed.
+ *
+ * 使用用户提供的通行证取消定时任务以进行诊断。
+ * 此函数类似于`thpool_timer_cancel`，但要求调用者提供关联的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ * 通行证在访问句柄之前检查，线程池shutdown之后残留的句柄会被报告而不会被访问。
+ *
+ * @param thpool_p   The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @return int       See @ref thpool_timer_cancel.
+ * 参见`thpool_timer_cancel`。
+ */
+int thpool_timer_cancel_debug_conc(threadpool, thpool_debug_conc_passport, threadpool_timer timer);
+
+/**
+ * @brief Runs a task graph using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_graph_run but requires the caller
+ * to provide the concurrency passport bound to the graph's thread pool. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证执行任务图以进行诊断。
+ * 此函数类似于`thpool_graph_run`，但要求调用者提供任务图所属线程池绑定的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param graph      The task graph handle. Must not be null pointer.
+ * 任务图句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to the graph's thread pool and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到任务图所属的线程池且不能为空指针。
+ * @return int       0 on success, -1 otherwise (e.g., null pointer handles, passport mismatch, or pool not in ALIVE state).
+ * 成功时返回0，否则返回-1（例如句柄为空指针，通行证不匹配，或线程池不在`ALIVE`状态）。
+ */
+int thpool_graph_run_debug_conc(threadpool_graph graph, thpool_debug_conc_passport);
+
+/**
+ * @brief Adds work to a task group using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_group_add_work but requires the caller
+ * to provide the concurrency passport bound to the group's thread pool. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证向任务组添加任务以进行诊断。
+ * 此函数类似于`thpool_group_add_work`，但要求调用者提供任务组所属线程池绑定的并发通行证，以**调试和诊断**生命周期相关的API误用。
+ *
+ * @param group      The task group handle. Must not be null pointer.
+ * 任务组句柄。不能为空指针。
+ * @param passport   The user-provided concurrency passport. Must be bound to the group's thread pool and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到任务组所属的线程池且不能为空指针。
+ * @param function_p Pointer to the task function. Must not be null pointer.
+ * 指向任务函数的指针。不能为空指针。
+ * @param arg_p      The argument for the task function.
+ * 任务函数的参数。
+ * @return int       0 on success, -1 otherwise (e.g., null pointer handles, passport mismatch, or pool not in ALIVE state).
+ * 成功时返回0，否则返回-1（例如句柄为空指针，通行证不匹配，或线程池不在`ALIVE`状态）。
+ */
+int thpool_group_add_work_debug_conc(threadpool_group group, thpool_debug_conc_passport, void (*function_p)(void *, threadpool_thread), void *arg_p);
+
 /**
  * @brief Waits for all queued jobs to finish using a user-provided passport for diagnosis.
  *
@@ -799,6 +2640,26 @@ int thpool_add_work_debug_conc(threadpool, thpool_debug_conc_passport, void (*fu
  */
 int thpool_wait_debug_conc(threadpool, thpool_debug_conc_passport);
 
+/**
+ * @brief Waits for the jobs queued before the call using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_drain but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证等待调用之前入队的任务完成以进行诊断。
+ * 此函数类似于`thpool_drain`，但要求调用者提供关联的并发通行证，以启用**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p The thread pool to drain. Must not be null pointer.
+ * 要排空的线程池句柄。不能为空指针。
+ * @param passport The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @return int     0 on success, -1 on error (e.g., null pointer handles, passport mismatch, pool not in ALIVE state when called,
+ * or called from within a thread pool worker thread).
+ * 成功时返回0，否则返回-1（例如句柄为空指针，通行证不匹配，线程池不在`ALIVE`状态，或从线程池内部调用）。
+ */
+int thpool_drain_debug_conc(threadpool, thpool_debug_conc_passport);
+
 /**
  * @brief Reactivates the thread pool using a user-provided passport for diagnosis.
  *
@@ -839,6 +2700,86 @@ int thpool_reactivate_debug_conc(threadpool, thpool_debug_conc_passport);
  */
 int thpool_num_threads_working_debug_conc(threadpool, thpool_debug_conc_passport);
 
+/**
+ * @brief Gets the current number of worker threads using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_num_threads but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证获取当前的工作线程数量以进行诊断。
+ * 此函数类似于`thpool_num_threads`，但要求调用者提供关联的并发通行证，以启用**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @return int     The number of worker threads (>= 1), or -1 on error.
+ * 工作线程数量（>= 1），或错误时返回-1。
+ */
+int thpool_num_threads_debug_conc(threadpool, thpool_debug_conc_passport);
+
+/**
+ * @brief Grows or shrinks the number of worker threads using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_resize but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证调整工作线程数量以进行诊断。
+ * 此函数类似于`thpool_resize`，但要求调用者提供关联的并发通行证，以启用**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @param num_threads The new number of worker threads, in `[1, max_threads]`.
+ * 新的工作线程数量，范围为`[1, max_threads]`。
+ * @return int     0 on success, -1 on error.
+ * 成功时返回0，错误时返回-1。
+ */
+int thpool_resize_debug_conc(threadpool, thpool_debug_conc_passport, int num_threads);
+
+/**
+ * @brief Gets the high-water mark of the job node slab allocator using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_job_slab_high_water but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证获取任务节点slab分配器的高水位线以进行诊断。
+ * 此函数类似于`thpool_job_slab_high_water`，但要求调用者提供关联的并发通行证，以启用**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @return int     The number of job nodes allocated by the slab allocator (>= 0), or -1 on error.
+ * slab分配器已分配的任务节点数量（>= 0），或错误时返回-1。
+ */
+int thpool_job_slab_high_water_debug_conc(threadpool, thpool_debug_conc_passport);
+
+/**
+ * @brief Takes a statistics snapshot of the thread pool using a user-provided passport for diagnosis.
+ *
+ * This function is similar to @ref thpool_get_stats but requires the caller
+ * to provide the associated concurrency passport. Enables **debugging and diagnosing**
+ * lifecycle-related API misuse.
+ *
+ * 使用用户提供的通行证获取线程池的统计快照以进行诊断。
+ * 此函数类似于`thpool_get_stats`，但要求调用者提供关联的并发通行证，以启用**调试和诊断**生命周期相关的API误用。
+ *
+ * @param thpool_p The thread pool handle. Must not be null pointer.
+ * 线程池句柄。不能为空指针。
+ * @param passport The user-provided concurrency passport. Must be bound to thpool_p and not be null pointer.
+ * 用户提供的并发通行证。必须绑定到`thpool_p`且不能为空指针。
+ * @param out  The snapshot to fill. Must not be null pointer.
+ * 要填写的快照。不能为空指针。
+ * @return int     0 on success, -1 on error.
+ * 成功时返回0，错误时返回-1。
+ */
+int thpool_get_stats_debug_conc(threadpool, thpool_debug_conc_passport, threadpool_stats *out);
+
 /**
  * @brief Initiates the shutdown process using a user-provided passport for diagnosis.
  *
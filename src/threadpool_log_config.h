@@ -5,6 +5,28 @@
 
 #include "utils/log.h"
 
+/**
+ * 编译期日志级别。低于THPOOL_LOG_LEVEL的宏展开为不求值参数的空语句，既不读取参数，也不进入日志库的锁。
+ * 可在编译选项中指定，例如`-DTHPOOL_LOG_LEVEL=THPOOL_LOG_LEVEL_WARN`；未指定时，定义了NDEBUG的发布构建
+ * 默认为INFO，其余构建保留所有级别。运行期仍可用`log_set_level`在编译期保留的级别中再次过滤。
+ * Compile-time log level. Macros below THPOOL_LOG_LEVEL expand to statements that never evaluate their arguments.
+ */
+#define THPOOL_LOG_LEVEL_TRACE  0
+#define THPOOL_LOG_LEVEL_DEBUG  1
+#define THPOOL_LOG_LEVEL_INFO   2
+#define THPOOL_LOG_LEVEL_WARN   3
+#define THPOOL_LOG_LEVEL_ERROR  4
+#define THPOOL_LOG_LEVEL_FATAL  5
+#define THPOOL_LOG_LEVEL_NONE   6
+
+#ifndef THPOOL_LOG_LEVEL
+#ifdef NDEBUG
+#define THPOOL_LOG_LEVEL THPOOL_LOG_LEVEL_INFO
+#else
+#define THPOOL_LOG_LEVEL THPOOL_LOG_LEVEL_TRACE
+#endif
+#endif
+
 #define PP_THIRD_ARG(a, b, c, ...) c
 #define VA_OPT_SUPPORTED_I(...) PP_THIRD_ARG(__VA_OPT__(,), true, false, )
 #define VA_OPT_SUPPORTED VA_OPT_SUPPORTED_I(x)
@@ -29,4 +51,31 @@
 #define thpool_log_debug    log_debug
 #endif
 
+/* `thpool_shutdown`在所有线程退出后调用，写出异步模式（`log_async_start`）下尚未输出的记录。   */
+#define thpool_log_flush()          log_async_flush()
+
+/* 被裁剪的级别仍经过一次类型检查，避免仅在日志中使用的变量产生未使用警告，随后被编译器整体删除。   */
+#define THPOOL_LOG_DISCARD(...)     do { if (0) { log_log(LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__); } } while (0)
+
+#if THPOOL_LOG_LEVEL > THPOOL_LOG_LEVEL_DEBUG
+#undef  thpool_log_debug
+#define thpool_log_debug(...)       THPOOL_LOG_DISCARD(__VA_ARGS__)
+#endif
+#if THPOOL_LOG_LEVEL > THPOOL_LOG_LEVEL_INFO
+#undef  thpool_log_info
+#define thpool_log_info(...)        THPOOL_LOG_DISCARD(__VA_ARGS__)
+#endif
+#if THPOOL_LOG_LEVEL > THPOOL_LOG_LEVEL_WARN
+#undef  thpool_log_warn
+#define thpool_log_warn(...)        THPOOL_LOG_DISCARD(__VA_ARGS__)
+#endif
+#if THPOOL_LOG_LEVEL > THPOOL_LOG_LEVEL_ERROR
+#undef  thpool_log_error
+#define thpool_log_error(...)       THPOOL_LOG_DISCARD(__VA_ARGS__)
+#endif
+#if THPOOL_LOG_LEVEL > THPOOL_LOG_LEVEL_FATAL
+#undef  thpool_log_fatal
+#define thpool_log_fatal(...)       THPOOL_LOG_DISCARD(__VA_ARGS__)
+#endif
+
 #endif
\ No newline at end of file
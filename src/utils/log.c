@@ -21,6 +21,10 @@
  */
 
  #include "log.h"
+ #include <stdlib.h>
+ #include <string.h>
+ #include <pthread.h>
+ #include <stdatomic.h>
 
  #define MAX_CALLBACKS 32
  
@@ -39,6 +43,41 @@
  } L;
  
  
+ /* Async mode: each thread formats into its own single-producer ring, and
+  * one flusher thread drains all rings to the outputs above in batches. */
+ typedef struct {
+   time_t time;
+   const char *file;
+   int line;
+   int level;
+   char msg[LOG_ASYNC_MSG_MAX];
+ } Record;
+ 
+ typedef struct Ring {
+   _Alignas(64) atomic_size_t head;  /* written by the owner thread */
+   _Alignas(64) atomic_size_t tail;  /* written by the drainer */
+   atomic_ullong dropped;
+   unsigned long long dropped_reported;
+   atomic_bool dead;                 /* owner thread has exited */
+   struct Ring *next;
+   Record records[LOG_ASYNC_RING_SIZE];
+ } Ring;
+ 
+ static struct {
+   atomic_bool running;
+   atomic_bool stop;
+   bool key_created;
+   pthread_key_t key;
+   pthread_t thread;
+   pthread_mutex_t mutex;            /* serializes drains and start/stop */
+   pthread_cond_t cond;
+   _Atomic(Ring *) rings;
+   atomic_ullong dropped;
+ } A = { .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+ 
+ static _Thread_local Ring *tls_ring;
+ 
+ 
  static const char *level_strings[] = {
    "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"
  };
@@ -137,6 +176,255 @@
  }
  
  
+ /* Sends one event to stderr and every callback. Caller holds the user lock. */
+ static void dispatch(log_Event *ev, va_list ap) {
+   if (!L.quiet && ev->level >= L.level) {
+     init_event(ev, stderr);
+     va_copy(ev->ap, ap);
+     stdout_callback(ev);
+     va_end(ev->ap);
+   }
+ 
+   for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
+     Callback *cb = &L.callbacks[i];
+     if (ev->level >= cb->level) {
+       init_event(ev, cb->udata);
+       va_copy(ev->ap, ap);
+       cb->fn(ev);
+       va_end(ev->ap);
+     }
+   }
+ }
+ 
+ 
+ static void emit(log_Event *ev, const char *fmt, ...) {
+   va_list ap;
+   ev->fmt = fmt;
+   va_start(ap, fmt);
+   dispatch(ev, ap);
+   va_end(ap);
+ }
+ 
+ 
+ static bool level_enabled(int level) {
+   bool enabled = false;
+   lock();
+   if (!L.quiet && level >= L.level) { enabled = true; }
+   for (int i = 0; !enabled && i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
+     if (level >= L.callbacks[i].level) { enabled = true; }
+   }
+   unlock();
+   return enabled;
+ }
+ 
+ 
+ static size_t drain(void);
+
+
+ /* Runs in the exiting thread. A later log from another destructor of the
+  * same thread gets a fresh ring instead of touching this one. With no
+  * flusher left to unlink it, the ring is drained and freed here. */
+ static void ring_destructor(void *arg) {
+   Ring *r = arg;
+   tls_ring = NULL;
+   atomic_store_explicit(&r->dead, true, memory_order_release);
+   atomic_thread_fence(memory_order_seq_cst);
+   if (!atomic_load(&A.running)) {
+     pthread_mutex_lock(&A.mutex);
+     drain();
+     pthread_mutex_unlock(&A.mutex);
+   }
+ }
+ 
+ 
+ static Ring *get_ring(void) {
+   Ring *r = tls_ring;
+   if (r) { return r; }
+   r = aligned_alloc(64, sizeof(Ring));
+   if (!r) { return NULL; }
+   atomic_init(&r->head, 0);
+   atomic_init(&r->tail, 0);
+   atomic_init(&r->dropped, 0);
+   r->dropped_reported = 0;
+   atomic_init(&r->dead, false);
+   r->next = atomic_load(&A.rings);
+   while (!atomic_compare_exchange_weak(&A.rings, &r->next, r)) {}
+   tls_ring = r;
+   pthread_setspecific(A.key, r);
+   return r;
+ }
+ 
+ 
+ /* Unlinks a dead, drained ring. Only drainers (under A.mutex) unlink, while
+  * new rings are only pushed at the head, so a non-head link is stable. */
+ static void unlink_ring(Ring *r, Ring *prev) {
+   if (prev) {
+     prev->next = r->next;
+   } else {
+     Ring *expected = r;
+     if (!atomic_compare_exchange_strong(&A.rings, &expected, r->next)) {
+       for (prev = expected; prev->next != r; prev = prev->next) {}
+       prev->next = r->next;
+     }
+   }
+   free(r);
+ }
+ 
+ 
+ /* Drains every ring. Caller holds A.mutex. Returns the number of records. */
+ static size_t drain(void) {
+   size_t total = 0;
+   Ring *prev = NULL;
+   Ring *r = atomic_load(&A.rings);
+   lock();
+   while (r) {
+     Ring *next = r->next;
+     bool dead = atomic_load_explicit(&r->dead, memory_order_acquire);
+     size_t start = atomic_load_explicit(&r->tail, memory_order_relaxed);
+     size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+     size_t tail = start;
+     for (; tail != head; tail++) {
+       Record *rec = &r->records[tail % LOG_ASYNC_RING_SIZE];
+       struct tm tm;
+       log_Event ev = {
+         .file  = rec->file,
+         .line  = rec->line,
+         .level = rec->level,
+         .time  = localtime_r(&rec->time, &tm),
+       };
+       emit(&ev, "%s", rec->msg);
+     }
+     atomic_store_explicit(&r->tail, tail, memory_order_release);
+     total += tail - start;
+ 
+     unsigned long long dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+     if (dropped != r->dropped_reported) {
+       time_t t = time(NULL);
+       struct tm tm;
+       log_Event ev = { .file = __FILE__, .line = __LINE__, .level = LOG_WARN, .time = localtime_r(&t, &tm) };
+       emit(&ev, "log: %llu records dropped, ring full", dropped - r->dropped_reported);
+       atomic_fetch_add_explicit(&A.dropped, dropped - r->dropped_reported, memory_order_relaxed);
+       r->dropped_reported = dropped;
+     }
+ 
+     if (dead) {
+       unlink_ring(r, prev);
+     } else {
+       prev = r;
+     }
+     r = next;
+   }
+   unlock();
+   return total;
+ }
+ 
+ 
+ static void *flusher(void *arg) {
+   (void)arg;
+   pthread_mutex_lock(&A.mutex);
+   while (!atomic_load(&A.stop)) {
+     drain();
+     struct timespec deadline;
+     clock_gettime(CLOCK_REALTIME, &deadline);
+     deadline.tv_nsec += LOG_ASYNC_FLUSH_MS * 1000000L;
+     deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+     deadline.tv_nsec %= 1000000000L;
+     pthread_cond_timedwait(&A.cond, &A.mutex, &deadline);
+   }
+   drain();
+   pthread_mutex_unlock(&A.mutex);
+   return NULL;
+ }
+ 
+ 
+ int log_async_start(void) {
+   int ret = 0;
+   pthread_mutex_lock(&A.mutex);
+   if (atomic_load(&A.running)) {
+     pthread_mutex_unlock(&A.mutex);
+     return 0;
+   }
+   if (!A.key_created) {
+     if (pthread_key_create(&A.key, ring_destructor) != 0) {
+       pthread_mutex_unlock(&A.mutex);
+       return -1;
+     }
+     A.key_created = true;
+   }
+   atomic_store(&A.stop, false);
+   if (pthread_create(&A.thread, NULL, flusher, NULL) != 0) {
+     ret = -1;
+   } else {
+     atomic_store(&A.running, true);
+   }
+   pthread_mutex_unlock(&A.mutex);
+   return ret;
+ }
+ 
+ 
+ void log_async_stop(void) {
+   pthread_mutex_lock(&A.mutex);
+   if (!atomic_load(&A.running)) {
+     pthread_mutex_unlock(&A.mutex);
+     return;
+   }
+   atomic_store(&A.running, false);
+   atomic_store(&A.stop, true);
+   pthread_cond_signal(&A.cond);
+   pthread_mutex_unlock(&A.mutex);
+   pthread_join(A.thread, NULL);
+   /* Catch records pushed by threads that saw running just before it was
+    * cleared, and free the rings of threads that have exited meanwhile. */
+   atomic_thread_fence(memory_order_seq_cst);
+   log_async_flush();
+ }
+ 
+ 
+ void log_async_flush(void) {
+   pthread_mutex_lock(&A.mutex);
+   drain();
+   pthread_mutex_unlock(&A.mutex);
+ }
+ 
+ 
+ unsigned long long log_async_dropped(void) {
+   pthread_mutex_lock(&A.mutex);
+   unsigned long long dropped = atomic_load(&A.dropped);
+   for (Ring *r = atomic_load(&A.rings); r; r = r->next) {
+     dropped += atomic_load(&r->dropped) - r->dropped_reported;
+   }
+   pthread_mutex_unlock(&A.mutex);
+   return dropped;
+ }
+ 
+ 
+ /* Formats into the calling thread's ring. Returns false to fall back to a
+  * synchronous write (out of memory). A full ring drops the record. */
+ static bool log_async(int level, const char *file, int line, const char *fmt, va_list ap) {
+   Ring *r = get_ring();
+   if (!r) { return false; }
+   size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+   size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+   if (head - tail >= LOG_ASYNC_RING_SIZE) {
+     atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+     return true;
+   }
+   Record *rec = &r->records[head % LOG_ASYNC_RING_SIZE];
+   rec->time = time(NULL);
+   rec->file = file;
+   rec->line = line;
+   rec->level = level;
+   vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+   atomic_store_explicit(&r->head, head + 1, memory_order_release);
+   /* Wake the flusher early once the ring is half full. Signalling without the
+    * mutex may be missed, which only delays the drain to the next period. */
+   if (head + 1 - tail == LOG_ASYNC_RING_SIZE / 2) {
+     pthread_cond_signal(&A.cond);
+   }
+   return true;
+ }
+ 
+ 
  void log_log(int level, const char *file, int line, const char *fmt, ...) {
    log_Event ev = {
      .fmt   = fmt,
@@ -144,26 +432,25 @@
      .line  = line,
      .level = level,
    };
- 
-   lock();
- 
-   if (!L.quiet && level >= L.level) {
-     init_event(&ev, stderr);
-     va_start(ev.ap, fmt);
-     stdout_callback(&ev);
-     va_end(ev.ap);
-   }
- 
-   for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
-     Callback *cb = &L.callbacks[i];
-     if (level >= cb->level) {
-       init_event(&ev, cb->udata);
-       va_start(ev.ap, fmt);
-       cb->fn(&ev);
-       va_end(ev.ap);
+   va_list ap;
+ 
+   if (atomic_load_explicit(&A.running, memory_order_relaxed)) {
+     if (!level_enabled(level)) { return; }
+     va_start(ap, fmt);
+     bool queued = log_async(level, file, line, fmt, ap);
+     va_end(ap);
+     if (queued) {
+       /* Fatal records are written out before the caller aborts. A record
+        * pushed after log_async_stop's final drain is drained here. */
+       atomic_thread_fence(memory_order_seq_cst);
+       if (level >= LOG_FATAL || !atomic_load(&A.running)) { log_async_flush(); }
+       return;
      }
    }
  
+   va_start(ap, fmt);
+   lock();
+   dispatch(&ev, ap);
    unlock();
- }
- 
\ No newline at end of file
+   va_end(ap);
+ }
\ No newline at end of file
@@ -15,6 +15,17 @@
  
  #define LOG_VERSION "0.1.0"
  
+ /* Async mode limits: message length, records per thread, flush period. */
+ #ifndef LOG_ASYNC_MSG_MAX
+ #define LOG_ASYNC_MSG_MAX 256
+ #endif
+ #ifndef LOG_ASYNC_RING_SIZE
+ #define LOG_ASYNC_RING_SIZE 128
+ #endif
+ #ifndef LOG_ASYNC_FLUSH_MS
+ #define LOG_ASYNC_FLUSH_MS 10
+ #endif
+ 
  typedef struct {
    va_list ap;
    const char *fmt;
@@ -46,5 +57,15 @@
  
  void log_log(int level, const char *file, int line, const char *fmt, ...);
  
+ /* Async mode. log_log checks the level under the lock, formats into a
+  * per-thread ring outside it, and a flusher thread writes the records to the
+  * outputs in batches. A full ring drops the record; log_async_dropped counts
+  * them. FATAL records are flushed before log_log returns. log_async_stop
+  * drains and goes back to synchronous writes. */
+ int log_async_start(void);
+ void log_async_stop(void);
+ void log_async_flush(void);
+ unsigned long long log_async_dropped(void);
+ 
  #endif
  
\ No newline at end of file
@@ -9,4 +9,31 @@ for _, file in ipairs(os.files("examples/*.c")) do
     set_group("threadpool_examples")
     add_includedirs("src")
     add_syslinks("pthread")
-end
\ No newline at end of file
+end
+for _, file in ipairs(os.files("bench/*.c")) do
+    local name = path.basename(file)
+    target(name)
+    set_kind("binary")
+    set_rules("mode.release")
+    add_defines("NDEBUG")
+    if name == "thpool_bench_debug_conc" then
+        add_defines("THPOOL_ENABLE_DEBUG_CONC_API")
+    end
+    add_files("src/threadpool.c")
+    add_files("src/utils/log.c")
+    add_files("bench/" .. name .. ".c")
+    set_group("threadpool_bench")
+    add_includedirs("src", "bench")
+    add_syslinks("pthread")
+end
+-- The false-sharing benchmark is built a second time with the cache-line regions removed, to compare the layouts.
+target("thpool_bench_false_sharing_packed")
+    set_kind("binary")
+    set_rules("mode.release")
+    add_defines("NDEBUG", "THPOOL_PACKED_LAYOUT")
+    add_files("src/threadpool.c")
+    add_files("src/utils/log.c")
+    add_files("bench/thpool_bench_false_sharing.c")
+    set_group("threadpool_bench")
+    add_includedirs("src", "bench")
+    add_syslinks("pthread")